@@ -0,0 +1,758 @@
+/***************************************************************************
+                        audiohash.c  -  description
+                           -------------------
+  Hashes and durations of the audio in a file, ignoring its tags
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Tag editors rewrite the metadata of a file but leave the coded
+ * audio alone, so hashing only the coded audio gives a key that
+ * survives retagging and is the same for copies of a track that are
+ * tagged differently.  Each container is handled as follows:
+ *
+ *  - ID3v2 tags at the start, and ID3v1, APEv2 and Lyrics3v2 tags at
+ *    the end, are skipped for every format (MP3 has nothing else).
+ *  - FLAC: the metadata blocks after "fLaC" are skipped.
+ *  - Ogg: only the packet data of the pages after the header packets
+ *    (including the comment packet) is hashed; the page headers
+ *    aren't, since the page sequence numbers and CRCs change when the
+ *    comment packet grows by a page.
+ *  - MP4: only the contents of the mdat boxes are hashed.
+ *  - WAV and AIFF: only the data and SSND chunks are hashed.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "audiohash.h"
+
+/* Read and hash files in chunks of this many bytes */
+#define HASH_CHUNK (64 * 1024)
+
+/* An Ogg granule position meaning no packet ends on the page */
+#define OGG_NO_GRANULE G_GUINT64_CONSTANT (0xffffffffffffffff)
+
+typedef struct
+{
+  GChecksum *checksum;
+  guchar    *chunk;   /* HASH_CHUNK bytes to read into */
+  goffset    length;  /* How much has been hashed */
+} Hasher;
+
+
+static gboolean
+read_at (gint fd, goffset offset, guchar *buf, gsize len)
+{
+  while (len > 0)
+    {
+      gssize n = pread (fd, buf, len, offset);
+
+      if (n <= 0)
+	return FALSE;
+      buf += n;
+      len -= n;
+      offset += n;
+    }
+
+  return TRUE;
+}
+
+static guint32
+read_be32 (const guchar *p)
+{
+  return ((guint32) p[0] << 24) | ((guint32) p[1] << 16)
+    | ((guint32) p[2] << 8) | (guint32) p[3];
+}
+
+static guint32
+read_le32 (const guchar *p)
+{
+  return ((guint32) p[3] << 24) | ((guint32) p[2] << 16)
+    | ((guint32) p[1] << 8) | (guint32) p[0];
+}
+
+static guint64
+read_le64 (const guchar *p)
+{
+  return ((guint64) read_le32 (p + 4) << 32) | read_le32 (p);
+}
+
+static guint64
+read_be64 (const guchar *p)
+{
+  return ((guint64) read_be32 (p) << 32) | read_be32 (p + 4);
+}
+
+static gboolean
+hash_range (Hasher *hasher, gint fd, goffset start, goffset end)
+{
+  while (start < end)
+    {
+      gsize len = (gsize) MIN (end - start, HASH_CHUNK);
+
+      if (!read_at (fd, start, hasher->chunk, len))
+	return FALSE;
+      g_checksum_update (hasher->checksum, hasher->chunk, len);
+      hasher->length += len;
+      start += len;
+    }
+
+  return TRUE;
+}
+
+
+/* Move start past any ID3v2 tags */
+static goffset
+skip_leading_tags (gint fd, goffset start, goffset end)
+{
+  guchar buf[10];
+
+  while (end - start >= 10  &&  read_at (fd, start, buf, 10)
+	 &&  memcmp (buf, "ID3", 3) == 0)
+    {
+      goffset size = ((buf[6] & 0x7f) << 21) | ((buf[7] & 0x7f) << 14)
+	| ((buf[8] & 0x7f) << 7) | (buf[9] & 0x7f);
+
+      size += 10;
+      if (buf[5] & 0x10)  /* Footer present */
+	size += 10;
+      start = MIN (start + size, end);
+    }
+
+  return start;
+}
+
+/* Move end before any ID3v1, APEv2 and Lyrics3v2 tags */
+static goffset
+skip_trailing_tags (gint fd, goffset start, goffset end)
+{
+  guchar buf[32];
+  goffset size;
+
+  for (;;)
+    {
+      if (end - start >= 128  &&  read_at (fd, end - 128, buf, 3)
+	  &&  memcmp (buf, "TAG", 3) == 0)
+	{
+	  end -= 128;
+	  continue;
+	}
+
+      if (end - start >= 32  &&  read_at (fd, end - 32, buf, 32)
+	  &&  memcmp (buf, "APETAGEX", 8) == 0)
+	{
+	  /* The size counts the footer but not the header */
+	  size = read_le32 (buf + 12);
+	  if (read_le32 (buf + 20) & 0x80000000)
+	    size += 32;
+	  if (size <= end - start)
+	    {
+	      end -= size;
+	      continue;
+	    }
+	}
+
+      if (end - start >= 15  &&  read_at (fd, end - 15, buf, 15)
+	  &&  memcmp (buf + 6, "LYRICS200", 9) == 0)
+	{
+	  buf[6] = '\0';
+	  size = g_ascii_strtoll ((gchar *) buf, NULL, 10) + 15;
+	  if (size > 15  &&  size <= end - start)
+	    {
+	      end -= size;
+	      continue;
+	    }
+	}
+
+      return end;
+    }
+}
+
+
+static gboolean
+hash_flac (Hasher *hasher, gint fd, goffset start, goffset end)
+{
+  guchar buf[4];
+  gboolean last = FALSE;
+
+  start += 4;  /* "fLaC" */
+  while (!last)
+    {
+      if (!read_at (fd, start, buf, 4))
+	return FALSE;
+      last = (buf[0] & 0x80) != 0;
+      start += 4 + ((buf[1] << 16) | (buf[2] << 8) | buf[3]);
+    }
+
+  return hash_range (hasher, fd, start, end);
+}
+
+
+/* The header packets of an Ogg stream end on pages with granule
+ * position 0, and audio packets end on pages with a positive one.
+ * A page on which no packet ends could belong to either, so those
+ * are held back until we know.
+ */
+static gboolean
+hash_ogg (Hasher *hasher, gint fd, goffset start, goffset end)
+{
+  GArray *pending;
+  guchar header[27], segments[255];
+  gboolean res = TRUE;
+  guint i;
+
+  pending = g_array_new (FALSE, FALSE, sizeof (goffset));
+
+  while (res  &&  end - start >= 27)
+    {
+      goffset payload, len = 0;
+      guint64 granule;
+
+      if (!read_at (fd, start, header, 27)  ||  memcmp (header, "OggS", 4) != 0
+	  ||  !read_at (fd, start + 27, segments, header[26]))
+	break;
+
+      for (i = 0; i < header[26]; ++i)
+	len += segments[i];
+      payload = start + 27 + header[26];
+      granule = read_le64 (header + 6);
+
+      if (granule == OGG_NO_GRANULE)
+	{
+	  g_array_append_val (pending, payload);
+	  g_array_append_val (pending, len);
+	}
+      else
+	{
+	  /* The pending pages were part of whatever this page ends */
+	  for (i = 0; res  &&  granule != 0  &&  i < pending->len; i += 2)
+	    res = hash_range (hasher, fd, g_array_index (pending, goffset, i),
+			      g_array_index (pending, goffset, i)
+			      + g_array_index (pending, goffset, i + 1));
+	  g_array_set_size (pending, 0);
+
+	  if (res  &&  granule != 0)
+	    res = hash_range (hasher, fd, payload, MIN (payload + len, end));
+	}
+
+      start = payload + len;
+    }
+
+  /* A truncated last packet is still audio */
+  for (i = 0; res  &&  i < pending->len; i += 2)
+    res = hash_range (hasher, fd, g_array_index (pending, goffset, i),
+		      MIN (g_array_index (pending, goffset, i)
+			   + g_array_index (pending, goffset, i + 1), end));
+
+  g_array_free (pending, TRUE);
+  return res;
+}
+
+
+static gboolean
+hash_mp4 (Hasher *hasher, gint fd, goffset start, goffset end)
+{
+  guchar box[16];
+  gboolean found = FALSE;
+
+  while (end - start >= 8  &&  read_at (fd, start, box, 8))
+    {
+      goffset size = read_be32 (box), header = 8;
+
+      if (size == 1)  /* 64-bit size follows */
+	{
+	  if (!read_at (fd, start + 8, box + 8, 8))
+	    return FALSE;
+	  size = ((goffset) read_be32 (box + 8) << 32) | read_be32 (box + 12);
+	  header = 16;
+	}
+      else if (size == 0)  /* Box runs to the end of the file */
+	size = end - start;
+
+      if (size < header)
+	break;
+
+      if (memcmp (box + 4, "mdat", 4) == 0)
+	{
+	  if (!hash_range (hasher, fd, start + header,
+			   MIN (start + size, end)))
+	    return FALSE;
+	  found = TRUE;
+	}
+
+      start += size;
+    }
+
+  return found;
+}
+
+
+/* RIFF (little-endian sizes) and IFF (big-endian) files are a list
+ * of chunks after a 12 byte header; chunks are padded to even sizes.
+ */
+static gboolean
+hash_chunks (Hasher *hasher, gint fd, goffset start, goffset end,
+	     const gchar *audio_chunk, gboolean big_endian)
+{
+  guchar header[8];
+  gboolean found = FALSE;
+
+  start += 12;
+  while (end - start >= 8  &&  read_at (fd, start, header, 8))
+    {
+      goffset size = big_endian ? read_be32 (header + 4)
+				: read_le32 (header + 4);
+
+      if (memcmp (header, audio_chunk, 4) == 0)
+	{
+	  if (!hash_range (hasher, fd, start + 8, MIN (start + 8 + size, end)))
+	    return FALSE;
+	  found = TRUE;
+	}
+
+      start += 8 + size + (size & 1);
+    }
+
+  return found;
+}
+
+
+gchar *
+audio_hash_fd (gint fd)
+{
+  Hasher hasher;
+  struct stat filestats;
+  guchar magic[12];
+  goffset start, end;
+  gboolean res = FALSE;
+  gchar *hash = NULL;
+
+  if (fstat (fd, &filestats) == -1)
+    return NULL;
+
+  end = filestats.st_size;
+  start = skip_leading_tags (fd, 0, end);
+  end = skip_trailing_tags (fd, start, end);
+
+  /* MD5 is plenty for telling files apart, and it's the fastest */
+  hasher.checksum = g_checksum_new (G_CHECKSUM_MD5);
+  hasher.chunk = g_malloc (HASH_CHUNK);
+  hasher.length = 0;
+
+  if (end - start >= 12  &&  read_at (fd, start, magic, 12))
+    {
+      if (memcmp (magic, "fLaC", 4) == 0)
+	res = hash_flac (&hasher, fd, start, end);
+      else if (memcmp (magic, "OggS", 4) == 0)
+	res = hash_ogg (&hasher, fd, start, end);
+      else if (memcmp (magic + 4, "ftyp", 4) == 0)
+	res = hash_mp4 (&hasher, fd, start, end);
+      else if (memcmp (magic, "RIFF", 4) == 0
+	       &&  memcmp (magic + 8, "WAVE", 4) == 0)
+	res = hash_chunks (&hasher, fd, start, end, "data", FALSE);
+      else if (memcmp (magic, "FORM", 4) == 0
+	       &&  (memcmp (magic + 8, "AIFF", 4) == 0
+		    ||  memcmp (magic + 8, "AIFC", 4) == 0))
+	res = hash_chunks (&hasher, fd, start, end, "SSND", TRUE);
+    }
+
+  /* Anything else (or a container we couldn't make sense of) is
+   * hashed whole, minus its tags */
+  if (!res)
+    {
+      g_checksum_reset (hasher.checksum);
+      hasher.length = 0;
+      res = hash_range (&hasher, fd, start, end);
+    }
+
+  /* Every file with no audio in it would have the same hash, that of
+   * nothing, and be taken for a copy of every other */
+  if (res  &&  hasher.length > 0)
+    hash = g_strdup (g_checksum_get_string (hasher.checksum));
+
+  g_free (hasher.chunk);
+  g_checksum_free (hasher.checksum);
+
+  return hash;
+}
+
+
+gchar *
+audio_hash_file (const gchar *path)
+{
+  gchar *hash;
+  gint fd;
+
+  fd = g_open (path, O_RDONLY, 0);
+  if (fd == -1)
+    return NULL;
+
+  hash = audio_hash_fd (fd);
+  close (fd);
+
+  return hash;
+}
+
+
+/* Durations.  Every container we hash says how long it plays in its
+ * headers, or (MP3) lets us work it out from the first frame, so the
+ * duration is had with a few small reads and no decoding:
+ *
+ *  - FLAC: the sample count and rate in STREAMINFO.
+ *  - Ogg: the granule position of the last page of the first stream,
+ *    in samples for Vorbis and FLAC, and at 48 kHz less the pre-skip
+ *    for Opus.
+ *  - MP4: the duration and timescale in moov/mvhd.
+ *  - WAV: the size of the data chunk over the byte rate in fmt.
+ *  - AIFF: the frame count and rate in COMM.
+ *  - MP3: the frame count in a Xing/Info or VBRI header, or failing
+ *    that the size of the file over the bitrate of its first frame.
+ */
+
+/* Look for an Ogg page or MP3 frame within this many bytes */
+#define DURATION_SCAN (64 * 1024)
+
+static gint64
+nanoseconds (guint64 units, guint64 per_second)
+{
+  if (per_second == 0)
+    return -1;
+  return (gint64) ((gdouble) units / per_second * 1e9);
+}
+
+
+/* The STREAMINFO block of a FLAC stream, at p */
+static gint64
+flac_streaminfo_duration (const guchar *p)
+{
+  guint32 rate = (p[10] << 12) | (p[11] << 4) | (p[12] >> 4);
+  guint64 samples = ((guint64) (p[13] & 0x0f) << 32) | read_be32 (p + 14);
+
+  return samples > 0 ? nanoseconds (samples, rate) : -1;
+}
+
+static gint64
+duration_flac (gint fd, goffset start)
+{
+  guchar block[4 + 18];
+
+  /* STREAMINFO always comes first */
+  if (!read_at (fd, start + 4, block, sizeof (block))  ||  (block[0] & 0x7f) != 0)
+    return -1;
+
+  return flac_streaminfo_duration (block + 4);
+}
+
+
+static gint64
+duration_ogg (gint fd, goffset start, goffset end)
+{
+  guchar header[27], segments[255], packet[64], *tail;
+  guint64 rate, granule = OGG_NO_GRANULE, skip = 0;
+  goffset from;
+  gsize len;
+  guint32 serial;
+
+  if (!read_at (fd, start, header, 27)
+      ||  !read_at (fd, start + 27, segments, header[26])
+      ||  header[26] == 0
+      ||  !read_at (fd, start + 27 + header[26], packet, sizeof (packet)))
+    return -1;
+  serial = read_le32 (header + 14);
+
+  if (memcmp (packet, "\001vorbis", 7) == 0)
+    rate = read_le32 (packet + 12);
+  else if (memcmp (packet, "OpusHead", 8) == 0)
+    {
+      rate = 48000;
+      skip = packet[10] | (packet[11] << 8);
+    }
+  else if (memcmp (packet, "\177FLAC", 5) == 0
+	   &&  memcmp (packet + 9, "fLaC", 4) == 0)
+    return flac_streaminfo_duration (packet + 17);  /* Has the length */
+  else
+    return -1;
+
+  /* The last page of our stream with a granule position */
+  from = MAX (start, end - DURATION_SCAN);
+  len = end - from;
+  tail = g_malloc (len);
+  if (read_at (fd, from, tail, len))
+    {
+      gsize i;
+
+      for (i = len >= 27 ? len - 27 + 1 : 0; i-- > 0; )
+	if (memcmp (tail + i, "OggS", 4) == 0  &&  tail[i + 4] == 0
+	    &&  read_le32 (tail + i + 14) == serial
+	    &&  read_le64 (tail + i + 6) != OGG_NO_GRANULE)
+	  {
+	    granule = read_le64 (tail + i + 6);
+	    break;
+	  }
+    }
+  g_free (tail);
+
+  if (granule == OGG_NO_GRANULE  ||  granule <= skip)
+    return -1;
+  return nanoseconds (granule - skip, rate);
+}
+
+
+/* Find the first box of type in start..end, and return the extent of
+ * its contents */
+static gboolean
+find_box (gint fd, goffset start, goffset end, const gchar *type,
+	  goffset *contents, goffset *contents_end)
+{
+  guchar box[16];
+
+  while (end - start >= 8  &&  read_at (fd, start, box, 8))
+    {
+      goffset size = read_be32 (box), header = 8;
+
+      if (size == 1)
+	{
+	  if (!read_at (fd, start + 8, box + 8, 8))
+	    return FALSE;
+	  size = (goffset) read_be64 (box + 8);
+	  header = 16;
+	}
+      else if (size == 0)
+	size = end - start;
+
+      if (size < header)
+	return FALSE;
+
+      if (memcmp (box + 4, type, 4) == 0)
+	{
+	  *contents = start + header;
+	  *contents_end = MIN (start + size, end);
+	  return TRUE;
+	}
+
+      start += size;
+    }
+
+  return FALSE;
+}
+
+static gint64
+duration_mp4 (gint fd, goffset start, goffset end)
+{
+  guchar mvhd[32];
+  goffset moov, moov_end, box, box_end;
+
+  if (!find_box (fd, start, end, "moov", &moov, &moov_end)
+      ||  !find_box (fd, moov, moov_end, "mvhd", &box, &box_end)
+      ||  box_end - box < 32  ||  !read_at (fd, box, mvhd, 32))
+    return -1;
+
+  /* Version, flags, then the creation and modification times */
+  if (mvhd[0] == 1)
+    return nanoseconds (read_be64 (mvhd + 24), read_be32 (mvhd + 20));
+  return nanoseconds (read_be32 (mvhd + 16), read_be32 (mvhd + 12));
+}
+
+
+static gint64
+duration_wav (gint fd, goffset start, goffset end)
+{
+  guchar header[8], fmt[12];
+  guint32 byte_rate = 0;
+
+  start += 12;
+  while (end - start >= 8  &&  read_at (fd, start, header, 8))
+    {
+      goffset size = read_le32 (header + 4);
+
+      if (memcmp (header, "fmt ", 4) == 0  &&  size >= 12
+	  &&  read_at (fd, start + 8, fmt, 12))
+	byte_rate = read_le32 (fmt + 8);
+      else if (memcmp (header, "data", 4) == 0)
+	return nanoseconds (MIN (size, end - start - 8), byte_rate);
+
+      start += 8 + size + (size & 1);
+    }
+
+  return -1;
+}
+
+static gint64
+duration_aiff (gint fd, goffset start, goffset end)
+{
+  guchar header[8], comm[18];
+  gint shift;
+
+  start += 12;
+  while (end - start >= 8  &&  read_at (fd, start, header, 8))
+    {
+      goffset size = read_be32 (header + 4);
+
+      if (memcmp (header, "COMM", 4) == 0)
+	{
+	  if (size < 18  ||  !read_at (fd, start + 8, comm, 18))
+	    return -1;
+
+	  /* The rate is an 80-bit IEEE extended float; only its whole
+	   * part matters */
+	  shift = 16383 + 63 - (((comm[8] & 0x7f) << 8) | comm[9]);
+	  if (shift < 0  ||  shift > 63)
+	    return -1;
+	  return nanoseconds (read_be32 (comm + 2),
+			      read_be64 (comm + 10) >> shift);
+	}
+
+      start += 8 + size + (size & 1);
+    }
+
+  return -1;
+}
+
+
+/* Parse the MPEG audio frame header at p: returns the frame length in
+ * bytes (0 if p isn't one), and sets the rest */
+static guint
+mpeg_frame (const guchar *p, guint *rate, guint *bitrate, guint *samples,
+	    guint *side_info)
+{
+  static const guint16 bitrates[5][15] =
+    {
+      { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+      { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+      { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+      { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+      { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+    };
+  static const guint rates[3] = { 44100, 48000, 32000 };
+  guint version, layer, index, table;
+  gboolean mpeg1, mono;
+
+  if (p[0] != 0xff  ||  (p[1] & 0xe0) != 0xe0)
+    return 0;
+
+  version = (p[1] >> 3) & 3;  /* 0: MPEG 2.5, 2: MPEG 2, 3: MPEG 1 */
+  layer = 4 - ((p[1] >> 1) & 3);
+  index = p[2] >> 4;
+  if (version == 1  ||  layer == 4  ||  index == 0  ||  index == 15
+      ||  ((p[2] >> 2) & 3) == 3)
+    return 0;
+
+  mpeg1 = version == 3;
+  mono = (p[3] >> 6) == 3;
+  table = mpeg1 ? layer - 1 : (layer == 1 ? 3 : 4);
+
+  *bitrate = bitrates[table][index] * 1000;
+  *rate = rates[(p[2] >> 2) & 3] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+  *samples = layer == 1 ? 384 : (layer == 3  &&  !mpeg1) ? 576 : 1152;
+  *side_info = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+
+  if (layer == 1)
+    return (12 * *bitrate / *rate + ((p[2] >> 1) & 1)) * 4;
+  return *samples / 8 * *bitrate / *rate + ((p[2] >> 1) & 1);
+}
+
+static gint64
+duration_mp3 (gint fd, goffset start, goffset end)
+{
+  guchar *buf;
+  gsize len, i;
+  guint length, next, rate, bitrate, samples, side_info, n;
+  gint64 duration = -1;
+
+  len = (gsize) MIN (end - start, DURATION_SCAN);
+  buf = g_malloc (len);
+  if (!read_at (fd, start, buf, len))
+    len = 0;
+
+  /* The first frame that is followed by another */
+  for (i = 0; i + 4 <= len; ++i)
+    {
+      length = mpeg_frame (buf + i, &rate, &bitrate, &samples, &side_info);
+      if (length == 0  ||  i + length + 4 > len
+	  ||  mpeg_frame (buf + i + length, &n, &n, &n, &n) == 0)
+	continue;
+
+      /* The frame count of a VBR file */
+      next = 4 + side_info;
+      if (i + next + 12 <= len
+	  &&  (memcmp (buf + i + next, "Xing", 4) == 0
+	       ||  memcmp (buf + i + next, "Info", 4) == 0)
+	  &&  (buf[i + next + 7] & 1))
+	duration = nanoseconds ((guint64) read_be32 (buf + i + next + 8)
+				* samples, rate);
+      else if (i + 36 + 18 <= len  &&  memcmp (buf + i + 36, "VBRI", 4) == 0)
+	duration = nanoseconds ((guint64) read_be32 (buf + i + 36 + 14)
+				* samples, rate);
+      else
+	duration = nanoseconds ((guint64) (end - start - i) * 8, bitrate);
+      break;
+    }
+
+  g_free (buf);
+  return duration;
+}
+
+
+gint64
+audio_duration_fd (gint fd)
+{
+  struct stat filestats;
+  guchar magic[12];
+  goffset start, end;
+
+  if (fstat (fd, &filestats) == -1)
+    return -1;
+
+  end = filestats.st_size;
+  start = skip_leading_tags (fd, 0, end);
+  end = skip_trailing_tags (fd, start, end);
+
+  if (end - start < 12  ||  !read_at (fd, start, magic, 12))
+    return -1;
+
+  if (memcmp (magic, "fLaC", 4) == 0)
+    return duration_flac (fd, start);
+  if (memcmp (magic, "OggS", 4) == 0)
+    return duration_ogg (fd, start, end);
+  if (memcmp (magic + 4, "ftyp", 4) == 0)
+    return duration_mp4 (fd, start, end);
+  if (memcmp (magic, "RIFF", 4) == 0  &&  memcmp (magic + 8, "WAVE", 4) == 0)
+    return duration_wav (fd, start, end);
+  if (memcmp (magic, "FORM", 4) == 0
+      &&  (memcmp (magic + 8, "AIFF", 4) == 0
+	   ||  memcmp (magic + 8, "AIFC", 4) == 0))
+    return duration_aiff (fd, start, end);
+
+  return duration_mp3 (fd, start, end);
+}
+
+
+gint64
+audio_duration_file (const gchar *path)
+{
+  gint64 duration;
+  gint fd;
+
+  fd = g_open (path, O_RDONLY, 0);
+  if (fd == -1)
+    return -1;
+
+  duration = audio_duration_fd (fd);
+  close (fd);
+
+  return duration;
+}
@@ -0,0 +1,45 @@
+/***************************************************************************
+                        audiohash.h  -  description
+                           -------------------
+  Hashes and durations of the audio in a file, ignoring its tags
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __AUDIOHASH_H__
+#define __AUDIOHASH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Return a hex digest of the audio payload of a file, skipping the
+ * metadata (ID3v1/v2, APE and Lyrics3 tags, FLAC metadata blocks,
+ * Ogg header packets, and everything in an MP4, WAV or AIFF file
+ * but its sample data), or NULL if the file can't be read or has no
+ * audio in it.  The file isn't decoded, so this costs no more than
+ * reading it.
+ */
+gchar *audio_hash_fd (gint fd);
+
+gchar *audio_hash_file (const gchar *path);
+
+/* Return how long a file plays, in nanoseconds, from what its headers
+ * say (for MP3 without a frame count, estimated from its first frame),
+ * or -1 if it's in a format we don't know.  Like the hash, this costs
+ * no decoding, only a few small reads.
+ */
+gint64 audio_duration_fd (gint fd);
+
+gint64 audio_duration_file (const gchar *path);
+
+G_END_DECLS
+
+#endif /* __AUDIOHASH_H__ */
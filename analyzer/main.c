@@ -19,6 +19,12 @@
  * moodbar-analyzer pipeline and run it.
  */
 
+/* For O_TMPFILE */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
 
 #include <gst/gst.h>
 #include <string.h>
@@ -27,15 +33,43 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#  include <linux/fs.h>
+#endif
+
+#include "audiohash.h"
+#include "moodindex.h"
+#include "moodpack.h"
 
 #define WEBPAGE "http://amarok.kde.org/wiki/Moodbar"
 
 /* The maximum number of times the main loop will run (in case
- * the file's modify time has changed) before it gives up
+ * the file's audio changed while it was analyzed) before it gives up
  */
 #define MAX_TRIES 10
 
 
+/* Save the index after this many files have been analyzed, so an
+ * interrupted batch doesn't lose all its work */
+#define INDEX_SAVE_INTERVAL 1000
+
+/* --jobs wasn't given: one file at a time, and not allowed outside
+ * batch mode */
+#define JOBS_UNSET G_MININT
+
+/* The analysis parameters */
+#define FFT_SIZE     2048
+#define FFT_STEP     1024
+#define MOOD_WIDTH   1000
+#define MOOD_HEIGHT  1
+
+/* Spectra per buffer between fftwspectrum and moodbar; this doesn't
+ * change the result, only how much work is done per buffer */
+#define FFT_FRAMES   32
+
+
 /* These should match up with the enum in moodbar.cpp */
 
 #define RETURN_SUCCESS     0
@@ -43,8 +77,89 @@
 #define RETURN_NOFILE      2
 #define RETURN_COMMANDLINE 3
 
-static gint   return_val  = RETURN_SUCCESS;
-static gchar *output_file = NULL;
+/* An analysis pipeline, built once and reused for every file.  Each
+ * one runs in its own thread with its own main context, so several
+ * can analyze different files at the same time.
+ */
+typedef struct
+{
+  GMainContext *context;
+  GMainLoop    *loop;
+  GstElement   *pipeline;
+  GstElement   *src, *decoder, *audio, *moodbar, *sink;
+
+  /* State of the file being analyzed */
+  gint          return_val;
+  const gchar  *output_file;
+  gchar        *features_file;  /* With --features, or NULL */
+  GByteArray   *mood;           /* With --pack, what reached the sink */
+} Analyzer;
+
+/* A file to analyze */
+typedef struct
+{
+  gchar    *infile, *outfile;
+  gint64    duration;  /* From the file's headers, or -1 */
+  gboolean  current;   /* Whether the index says outfile is up to date */
+  gchar    *hash;      /* Audio hash, if the index check computed one */
+  struct stat checked; /* The file as it was before the check hashed it */
+  gchar    *copy_from; /* A mood of the same audio to copy, or NULL */
+  gpointer  same_as;   /* An earlier job in the batch with the same audio */
+  gint      code;      /* The RETURN_ code, once the job is done */
+} Job;
+
+/* The files of a batch, in the order they are handed out to the
+ * worker threads */
+typedef struct
+{
+  GPtrArray   *jobs;
+  gint         next;    /* Index of the next job to hand out */
+  gint         failed;  /* Whether any job failed */
+
+  /* The index of analyzed files and our parameters, if any */
+  MoodIndex   *index;
+  const gchar *params;
+  gint         unsaved;  /* Files analyzed since the index was saved */
+} WorkQueue;
+
+G_LOCK_DEFINE_STATIC (result_lines);
+
+/* From the command line: how many spectra to compute per column of
+ * the moodbar, or 0 for all of them (see the moodbar element) */
+static gint frames_per_column = 0;
+
+/* From the command line: what to save of each frame for moodbar-render,
+ * "rgb" or "bark", or NULL to save nothing (see the moodbar element) */
+static gchar *features = NULL;
+
+/* From the command line: the pack the moods are stored in, under their
+ * output names, or NULL to write each to a file of that name */
+static MoodPack *pack = NULL;
+
+/* From the command line: whether to write compressed moods (see
+ * plugin/moodbarcodec.h) instead of raw ones */
+static gboolean compress = FALSE;
+
+
+/* Where the features of the mood in outfile go: the same name, with
+ * .moodfeat in place of .mood (or added to it) */
+static gchar *
+features_location (const gchar *outfile)
+{
+  if (g_str_has_suffix (outfile, ".mood"))
+    return g_strconcat (outfile, "feat", NULL);
+  return g_strconcat (outfile, ".moodfeat", NULL);
+}
+
+/* Remove what an analysis that failed left behind */
+static void
+remove_outputs (Analyzer *an)
+{
+  if (pack == NULL)
+    unlink (an->output_file);
+  if (an->features_file != NULL)
+    unlink (an->features_file);
+}
 
 
 static GstElement *
@@ -67,13 +182,35 @@ make_element (const gchar *elt, const gchar *name)
 }
 
 
+/* With --pack, collect the mood as it reaches the sink */
+static void
+cb_handoff (GstElement *sink,
+	    GstBuffer  *buffer,
+	    GstPad     *pad,
+	    gpointer    data)
+{
+  Analyzer *an = (Analyzer *) data;
+  GstMapInfo map;
+
+  /* Unused parameters */
+  (void) sink;
+  (void) pad;
+
+  if (gst_buffer_map (buffer, &map, GST_MAP_READ))
+    {
+      g_byte_array_append (an->mood, map.data, map.size);
+      gst_buffer_unmap (buffer, &map);
+    }
+}
+
+
 /* Check for playback errors and end-of-stream */
 static gboolean
 bus_callback (GstBus *bus,
 	      GstMessage *message,
 	      gpointer data)
 {
-  GMainLoop *loop = (GMainLoop *) data;
+  Analyzer *an = (Analyzer *) data;
 
   (void) bus;  /* Unused */
 
@@ -91,16 +228,16 @@ bus_callback (GstBus *bus,
 	g_error_free (err);
 	g_free (debug);
 	
-	return_val = RETURN_NOFILE;
-	unlink (output_file);
-	g_main_loop_quit (loop);
+	an->return_val = RETURN_NOFILE;
+	remove_outputs (an);
+	g_main_loop_quit (an->loop);
 	break;
       }
 
     case GST_MESSAGE_EOS:
       /* end-of-stream */
       g_print ("Received end-of-stream, exiting...\n");
-      g_main_loop_quit (loop);
+      g_main_loop_quit (an->loop);
       break;
 
     default:
@@ -167,100 +304,891 @@ cb_cantdecode (GstElement *dec,
   (void) pad;
   (void) caps;
 
-  GMainLoop *loop = (GMainLoop *) data;
+  Analyzer *an = (Analyzer *) data;
 
   g_print ("GStreamer does not how to decode the audio file.\n"
 	   "You probably do not have the appropriate plugin installed.\n"
 	   "Please see the wiki page at " WEBPAGE "\n"
 	   "for a plugin list, and troubleshooting tips.\n");
-  unlink (output_file);
-  return_val = RETURN_NOFILE;
-  g_main_loop_quit (loop);
+  remove_outputs (an);
+  an->return_val = RETURN_NOFILE;
+  g_main_loop_quit (an->loop);
 }
 
 
-/* Run the main loop */
-static void
-run_loop (gchar *infile, gchar *outfile)
+static Analyzer *
+analyzer_new (void)
 {
-  GMainLoop *loop;
+  Analyzer *an;
   GstPad *audiopad;
   GstBus *bus;
-  GstElement *src, *decoder, *sink, *conv;
-  GstElement *fft, *moodbar;
-  GstElement *pipeline, *audio;
+  GSource *watch;
+  GstElement *conv, *fft, *moodbar;
 
-  loop = g_main_loop_new (NULL, FALSE);
+  an = g_new0 (Analyzer, 1);
+  an->context = g_main_context_new ();
+  an->loop = g_main_loop_new (an->context, FALSE);
 
   /* Setup the pipeline */
-  pipeline = gst_pipeline_new ("pipeline");
+  an->pipeline = gst_pipeline_new ("pipeline");
 
-  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
-  gst_bus_add_watch (bus, bus_callback, loop);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (an->pipeline));
+  watch = gst_bus_create_watch (bus);
+  g_source_set_callback (watch, (GSourceFunc) bus_callback, an, NULL);
+  g_source_attach (watch, an->context);
+  g_source_unref (watch);
   gst_object_unref (bus);
 
-  src = make_element ("filesrc", "source");
-  g_object_set (G_OBJECT (src), "location", infile, NULL);
-  decoder = make_element ("decodebin", "decoder");
-  gst_bin_add_many (GST_BIN (pipeline), src, decoder, NULL);
-  gst_element_link (src, decoder);
+  an->src = make_element ("filesrc", "source");
+  an->decoder = make_element ("decodebin", "decoder");
+  gst_bin_add_many (GST_BIN (an->pipeline), an->src, an->decoder, NULL);
+  gst_element_link (an->src, an->decoder);
 
   /* Create audio output bin */
-  audio = gst_bin_new ("audiobin");
+  an->audio = gst_bin_new ("audiobin");
   conv  = make_element ("audioconvert", "aconv");
   audiopad = gst_element_get_static_pad (conv, "sink");
 
   /* Create analyzer chain */
   fft = make_element ("fftwspectrum", "fft");
-  g_object_set (G_OBJECT (fft), "def-size", 2048, "def-step", 1024,
-		"hiquality", TRUE, NULL);
+  g_object_set (G_OBJECT (fft), "def-size", FFT_SIZE, "def-step", FFT_STEP,
+		"def-frames", FFT_FRAMES, "hiquality", TRUE, NULL);
   moodbar = make_element ("moodbar", "moodbar");
-  g_object_set (G_OBJECT (moodbar), "height", 1, NULL);
-  g_object_set (G_OBJECT (moodbar), "max-width", 1000, NULL);
-  sink = make_element ("filesink", "sink");
-  g_object_set (G_OBJECT (sink), "location", outfile, NULL);
-
-  gst_bin_add_many (GST_BIN (audio), conv, fft, moodbar, sink, NULL);
-  gst_element_link_many (conv, fft, moodbar, sink, NULL);
-  gst_element_add_pad (audio, gst_ghost_pad_new ("sink", audiopad));
+  g_object_set (G_OBJECT (moodbar), "height", MOOD_HEIGHT, NULL);
+  g_object_set (G_OBJECT (moodbar), "max-width", MOOD_WIDTH, NULL);
+  g_object_set (G_OBJECT (moodbar), "frames-per-column", frames_per_column,
+		NULL);
+  if (features != NULL)
+    gst_util_set_object_arg (G_OBJECT (moodbar), "features", features);
+  an->moodbar = moodbar;
+  if (pack != NULL)
+    {
+      an->mood = g_byte_array_new ();
+      an->sink = make_element ("fakesink", "sink");
+      g_object_set (G_OBJECT (an->sink), "signal-handoffs", TRUE, NULL);
+      g_signal_connect (an->sink, "handoff", G_CALLBACK (cb_handoff), an);
+    }
+  else
+    an->sink = make_element ("filesink", "sink");
+
+  gst_bin_add_many (GST_BIN (an->audio), conv, fft, moodbar, an->sink, NULL);
+  if (compress)
+    {
+      /* The moodbar element compresses its output when that is all
+       * downstream takes */
+      GstCaps *caps = gst_caps_new_empty_simple ("application/x-moodbar");
+      GstElement *filter;
+
+      filter = make_element ("capsfilter", "compress");
+      g_object_set (G_OBJECT (filter), "caps", caps, NULL);
+      gst_caps_unref (caps);
+      gst_bin_add (GST_BIN (an->audio), filter);
+      gst_element_link_many (conv, fft, moodbar, filter, an->sink, NULL);
+    }
+  else
+    gst_element_link_many (conv, fft, moodbar, an->sink, NULL);
+  gst_element_add_pad (an->audio, gst_ghost_pad_new ("sink", audiopad));
   gst_object_unref (audiopad);
-  gst_bin_add (GST_BIN (pipeline), audio);
+  gst_bin_add (GST_BIN (an->pipeline), an->audio);
   
-  g_signal_connect (decoder, "pad-added", 
-		    G_CALLBACK (cb_newpad), audio);
-  g_signal_connect (decoder, "unknown-type", 
-		    G_CALLBACK (cb_cantdecode), loop);
+  g_signal_connect (an->decoder, "pad-added", 
+		    G_CALLBACK (cb_newpad), an->audio);
+  g_signal_connect (an->decoder, "unknown-type", 
+		    G_CALLBACK (cb_cantdecode), an);
+
+  return an;
+}
+
+
+static void
+analyzer_free (Analyzer *an)
+{
+  gst_element_set_state (an->pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (an->pipeline));
+  g_main_loop_unref (an->loop);
+  g_main_context_unref (an->context);
+  g_free (an->features_file);
+  if (an->mood != NULL)
+    g_byte_array_free (an->mood, TRUE);
+  g_free (an);
+}
+
+
+/* Run the main loop */
+static void
+run_loop (Analyzer *an, const gchar *location, const gchar *outfile)
+{
+  GstBus *bus;
+
+  an->output_file = outfile;
+  g_free (an->features_file);
+  an->features_file = features != NULL ? features_location (outfile) : NULL;
+  g_object_set (G_OBJECT (an->src), "location", location, NULL);
+  if (pack != NULL)
+    g_byte_array_set_size (an->mood, 0);
+  else
+    g_object_set (G_OBJECT (an->sink), "location", outfile, NULL);
+  g_object_set (G_OBJECT (an->moodbar), "features-location",
+		an->features_file, NULL);
 
   /* run */
+  gst_element_set_state (an->pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (an->loop);
+
+  /* Back to READY, so the pipeline (and the FFTW state in it) can be
+   * reused for the next file.  A pipeline that failed is taken all
+   * the way down to NULL to make sure nothing of it lingers. */
+  gst_element_set_state (an->pipeline, an->return_val == RETURN_SUCCESS
+			 ? GST_STATE_READY : GST_STATE_NULL);
+
+  /* Drop whatever messages this run left on the bus, so they don't
+   * end the next one */
+  bus = gst_pipeline_get_bus (GST_PIPELINE (an->pipeline));
+  gst_bus_set_flushing (bus, TRUE);
+  gst_bus_set_flushing (bus, FALSE);
+  gst_object_unref (bus);
+}
+
+
+/* Make a private copy-on-write clone of the file open on fd, if the
+ * filesystem supports it; this costs no copying, and nothing done to
+ * the original afterwards shows up in the clone.  The clone has no
+ * name, so it disappears when it is closed.  Returns its fd, or -1.
+ */
+static gint
+clone_file (gint fd, const gchar *infile)
+{
+#if defined (FICLONE) && defined (O_TMPFILE)
+  gchar *dir = g_path_get_dirname (infile);
+  gint clone = open (dir, O_TMPFILE | O_RDWR, 0600);
+
+  g_free (dir);
+  if (clone == -1)
+    return -1;
+
+  if (ioctl (clone, FICLONE, fd) == -1)
+    {
+      close (clone);
+      return -1;
+    }
+  return clone;
+#else
+  return -1;
+#endif
+}
+
+
+/* A path that opens the same file as fd, even if the file it was
+ * opened from has since been replaced or removed */
+static gchar *
+fd_location (gint fd, const gchar *infile)
+{
+  if (g_file_test ("/proc/self/fd", G_FILE_TEST_IS_DIR))
+    return g_strdup_printf ("/proc/self/fd/%d", fd);
+  return g_strdup (infile);
+}
+
+
+/* With --pack, store the mood of a run that succeeded under outfile */
+static gint
+store_mood (Analyzer *an, const gchar *outfile)
+{
+  GError *err = NULL;
+
+  if (pack == NULL  ||  an->return_val != RETURN_SUCCESS)
+    return an->return_val;
+
+  if (!mood_pack_put (pack, outfile, an->mood->data, an->mood->len, &err))
+    {
+      g_print ("Could not store the mood: %s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  return RETURN_SUCCESS;
+}
+
+
+/* Whether a and b are stats of the same, unchanged file */
+static gboolean
+same_stats (const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev  &&  a->st_ino == b->st_ino
+    &&  a->st_size == b->st_size  &&  a->st_mtime == b->st_mtime;
+}
+
+
+/* Analyze one file, and return one of the RETURN_ codes.  known_hash
+ * is the hash of its audio if that was already computed (by the index
+ * check) from the file as known_stats describe it, or NULL.  If hash
+ * is not NULL, *hash is set to the hash of the audio that was actually
+ * decoded, or NULL if it has none.
+ *
+ * Taggers edit files while we decode them, so the file is read
+ * through a descriptor we hold (a tagger that writes a new file and
+ * renames it over the old one doesn't disturb us), from a clone of
+ * it if the filesystem can make one.  Without a clone, the audio is
+ * hashed before and after decoding when the file was modified in the
+ * meantime, and the file is only analyzed again if its audio changed.
+ */
+static gint
+analyze_file (Analyzer *an, const gchar *infile, const gchar *outfile,
+	      const gchar *known_hash, const struct stat *known_stats,
+	      gchar **hash)
+{
+  gint tries, code;
+
   g_print ("Analyzing file %s\n", infile);
 
-  gst_element_set_state (pipeline, GST_STATE_PLAYING);
-  g_main_loop_run (loop);
+  for (tries = 0; tries < MAX_TRIES; ++tries)
+    {
+      struct stat before, after;
+      gchar *location, *old_hash, *new_hash;
+      gint fd, clone;
+      gboolean stable, known;
+
+      fd = open (infile, O_RDONLY);
+      if (fd == -1)
+        return RETURN_NOFILE;
+      if (fstat (fd, &before) == -1)
+	{
+	  close (fd);
+	  return RETURN_NOFILE;
+	}
+
+      /* The index check may have hashed the file long ago; its hash
+       * only holds if the file hasn't changed since */
+      known = known_hash != NULL  &&  known_stats != NULL
+	&&  same_stats (&before, known_stats);
+
+      clone = clone_file (fd, infile);
+      if (clone != -1)
+	{
+	  /* The clone is what gets decoded, so it's what is hashed,
+	   * unless the file was still as checked when it was made */
+	  old_hash = NULL;
+	  if (hash != NULL)
+	    old_hash = known  &&  fstat (fd, &after) != -1
+	      &&  same_stats (&after, &before)
+	      ? g_strdup (known_hash) : audio_hash_fd (clone);
+
+	  location = fd_location (clone, infile);
+	  an->return_val = RETURN_SUCCESS;
+	  run_loop (an, location, outfile);
+	  g_free (location);
+	  close (clone);
+	  close (fd);
+
+	  code = store_mood (an, outfile);
+	  if (hash != NULL)
+	    *hash = old_hash;
+	  return code;
+	}
+
+      /* NULL if there's no audio to hash; then only the file's
+       * size and mtime tell whether it changed */
+      old_hash = known ? g_strdup (known_hash) : audio_hash_fd (fd);
+
+      location = fd_location (fd, infile);
+      an->return_val = RETURN_SUCCESS;
+      run_loop (an, location, outfile);
+      g_free (location);
+
+      stable = fstat (fd, &after) != -1
+	&&  after.st_mtime == before.st_mtime
+	&&  after.st_size == before.st_size;
+      if (!stable)
+	{
+	  /* Only a change to the audio itself spoils the analysis */
+	  new_hash = audio_hash_fd (fd);
+	  stable = new_hash != NULL  &&  old_hash != NULL
+	    &&  strcmp (new_hash, old_hash) == 0;
+	  g_free (old_hash);
+	  old_hash = new_hash;
+	}
+      close (fd);
+
+      if (stable)
+	{
+	  if (hash != NULL)
+	    *hash = old_hash;
+	  else
+	    g_free (old_hash);
+	  return store_mood (an, outfile);
+	}
+      g_free (old_hash);
+    }
+
+
+  /* If we get here, that means that the audio was changed MAX_TRIES
+   * times while we were analyzing; give up.
+   */
+  return RETURN_NOFILE;
+}
+
+
+/***************************************************************/
+/* Batch mode                                                  */
+/***************************************************************/
+
+/* In batch mode, every file analyzed gets one line on stdout:
+ *   result <TAB> code <TAB> input file <TAB> output file
+ * where code is one of the RETURN_ codes above.  Everything else
+ * that would go to stdout goes to stderr instead.
+ */
+static void
+print_result (gint code, const gchar *infile, const gchar *outfile)
+{
+  G_LOCK (result_lines);
+  fprintf (stdout, "result\t%d\t%s\t%s\n", code, infile, outfile);
+  fflush (stdout);
+  G_UNLOCK (result_lines);
+}
+
+
+/* Add the (input, output) pairs in fields to pairs.  Returns FALSE
+ * if there's an input without an output.
+ */
+static gboolean
+add_pairs (GPtrArray *pairs, gchar **fields, guint numfields)
+{
+  guint i;
+
+  if (numfields % 2 != 0)
+    return FALSE;
+
+  for (i = 0; i < numfields; ++i)
+    g_ptr_array_add (pairs, g_strdup (fields[i]));
+
+  return TRUE;
+}
+
+
+/* A manifest has one "INFILE<TAB>OUTFILE" line per file; blank lines
+ * and lines starting with '#' are ignored.
+ */
+static gboolean
+read_manifest (GPtrArray *pairs, const gchar *filename)
+{
+  gchar *contents, **lines, **line;
+  gboolean res = TRUE;
+
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    {
+      g_printerr ("Could not read manifest %s\n", filename);
+      return FALSE;
+    }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (line = lines; *line != NULL  &&  res; ++line)
+    {
+      gchar **fields;
+      gsize len = strlen (*line);
+
+      /* Only the line ending: file names may end in blanks */
+      if (len > 0  &&  (*line)[len - 1] == '\r')
+	(*line)[len - 1] = '\0';
+      if (**line == '\0'  ||  **line == '#')
+	continue;
+
+      fields = g_strsplit (*line, "\t", 2);
+      res = g_strv_length (fields) == 2  &&  add_pairs (pairs, fields, 2);
+      if (!res)
+	g_printerr ("Malformed manifest line: %s\n", *line);
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+  return res;
+}
+
+
+/* Read "INFILE\0OUTFILE\0INFILE\0..." from stdin */
+static gboolean
+read_stdin_pairs (GPtrArray *pairs)
+{
+  GString *input = g_string_new (NULL);
+  gchar chunk[4096];
+  gsize n, pos;
+  guint before = pairs->len;
+
+  while ((n = fread (chunk, 1, sizeof (chunk), stdin)) > 0)
+    g_string_append_len (input, chunk, n);
+
+  /* Tolerate a missing final terminator */
+  if (input->len > 0  &&  input->str[input->len - 1] != '\0')
+    g_string_append_c (input, '\0');
+
+  for (pos = 0; pos < input->len; pos += strlen (&input->str[pos]) + 1)
+    g_ptr_array_add (pairs, g_strdup (&input->str[pos]));
 
-  /* cleanup */
-  gst_element_set_state (pipeline, GST_STATE_NULL);
-  gst_object_unref (GST_OBJECT (pipeline));
+  g_string_free (input, TRUE);
+
+  if ((pairs->len - before) % 2 != 0)
+    {
+      g_printerr ("Odd number of paths on standard input\n");
+      return FALSE;
+    }
+  return TRUE;
+}
+
+
+static Job *
+work_queue_pop (WorkQueue *queue)
+{
+  gint i = g_atomic_int_add (&queue->next, 1);
+
+  if (i >= (gint) queue->jobs->len)
+    return NULL;
+
+  return (Job *) g_ptr_array_index (queue->jobs, i);
 }
 
+
+static gpointer
+check_worker (gpointer data)
+{
+  WorkQueue *queue = (WorkQueue *) data;
+  Job *job;
+
+  while ((job = work_queue_pop (queue)) != NULL)
+    {
+      /* Taken first, so that a change while the file is hashed
+       * shows up as a change since the check */
+      if (stat (job->infile, &job->checked) == -1)
+	memset (&job->checked, 0, sizeof (job->checked));
+
+      job->current = mood_index_is_current (queue->index, job->infile,
+					    job->outfile, queue->params,
+					    &job->hash);
+
+      /* Has this audio been analyzed under another name? */
+      if (!job->current  &&  job->hash != NULL)
+	job->copy_from = mood_index_find_output (queue->index, job->hash,
+						 queue->params);
+    }
+
+  return NULL;
+}
+
+
+/* Save the pack's index and the index of analyzed files, whichever
+ * we have.  The pack goes first, so the index of analyzed files never
+ * lists a mood that a reader of the pack can't find quickly. */
+static void
+save_index (MoodIndex *index)
+{
+  GError *err = NULL;
+
+  if (pack != NULL  &&  !mood_pack_save_index (pack, &err))
+    {
+      g_printerr ("Could not save the index of the pack: %s\n",
+		  err->message);
+      g_clear_error (&err);
+    }
+
+  if (index != NULL  &&  !mood_index_save (index, &err))
+    {
+      g_printerr ("Could not save the index: %s\n", err->message);
+      g_error_free (err);
+    }
+}
+
+
+/* Count one more file analyzed since the index was saved, and return
+ * whether it is time to save it again.  The count wraps around to 0 in
+ * the same step, so that exactly one thread sees each wraparound and
+ * no other thread's file goes uncounted. */
+static gboolean
+count_unsaved (WorkQueue *queue)
+{
+  gint unsaved, next;
+
+  do
+    {
+      unsaved = g_atomic_int_get (&queue->unsaved);
+      next = (unsaved + 1) % INDEX_SAVE_INTERVAL;
+    }
+  while (!g_atomic_int_compare_and_exchange (&queue->unsaved, unsaved, next));
+
+  return next == 0;
+}
+
+
+/* Durations come from the files' headers (see audiohash.h), so this
+ * costs a few small reads per file and no decoding */
+static gpointer
+duration_worker (gpointer data)
+{
+  WorkQueue *queue = (WorkQueue *) data;
+  Job *job;
+
+  while ((job = work_queue_pop (queue)) != NULL)
+    job->duration = audio_duration_file (job->infile);
+
+  return NULL;
+}
+
+
+static gpointer
+analysis_worker (gpointer data)
+{
+  WorkQueue *queue = (WorkQueue *) data;
+  Analyzer *an;
+  Job *job;
+
+  an = analyzer_new ();
+
+  while ((job = work_queue_pop (queue)) != NULL)
+    {
+      gchar *hash = NULL;
+      gint code = analyze_file (an, job->infile, job->outfile, job->hash,
+				&job->checked, &hash);
+
+      /* Record the hash of the audio that was actually analyzed */
+      g_free (job->hash);
+      job->hash = hash;
+
+      job->code = code;
+      print_result (code, job->infile, job->outfile);
+      if (code != RETURN_SUCCESS)
+	g_atomic_int_set (&queue->failed, TRUE);
+
+      else if (queue->index != NULL  ||  pack != NULL)
+	{
+	  if (queue->index != NULL)
+	    mood_index_update (queue->index, job->infile, job->outfile,
+			       queue->params, job->hash);
+	  if (count_unsaved (queue))
+	    save_index (queue->index);
+	}
+    }
+
+  analyzer_free (an);
+
+  return NULL;
+}
+
+
+/* Run worker on numthreads threads, and wait for all of them */
+static void
+run_workers (GThreadFunc worker, WorkQueue *queue, guint numthreads)
+{
+  GThread **threads = g_new (GThread *, numthreads);
+  guint i;
+
+  queue->next = 0;
+
+  for (i = 0; i < numthreads; ++i)
+    threads[i] = g_thread_new ("moodbar-worker", worker, queue);
+  for (i = 0; i < numthreads; ++i)
+    g_thread_join (threads[i]);
+
+  g_free (threads);
+}
+
+
+/* Longest first; files whose duration is unknown go last */
+static gint
+compare_jobs (gconstpointer a, gconstpointer b)
+{
+  const Job *job_a = *(Job * const *) a;
+  const Job *job_b = *(Job * const *) b;
+
+  if (job_a->duration == job_b->duration)
+    return 0;
+  return job_a->duration < job_b->duration ? 1 : -1;
+}
+
+
+static void
+free_job (gpointer data)
+{
+  Job *job = (Job *) data;
+
+  g_free (job->infile);
+  g_free (job->outfile);
+  g_free (job->hash);
+  g_free (job->copy_from);
+  g_free (job);
+}
+
+
+/* Moods and features are small, so just read them in and write them
+ * out.  With --pack, from and to are keys in the pack. */
+static gboolean
+copy_file (const gchar *from, const gchar *to)
+{
+  gchar *contents;
+  gsize length;
+  gboolean res;
+
+  if (strcmp (from, to) == 0)
+    return TRUE;
+
+  if (pack != NULL)
+    {
+      contents = (gchar *) mood_pack_get (pack, from, &length);
+      res = contents != NULL
+	&&  mood_pack_put (pack, to, (const guchar *) contents, length, NULL);
+      g_free (contents);
+      return res;
+    }
+
+  if (!g_file_get_contents (from, &contents, &length, NULL))
+    return FALSE;
+
+  res = g_file_set_contents (to, contents, length, NULL);
+  g_free (contents);
+
+  return res;
+}
+
+/* Copy the mood, and its features if we save those */
+static gboolean
+copy_mood (const gchar *from, const gchar *to)
+{
+  gchar *from_features, *to_features;
+  gboolean res;
+
+  if (!copy_file (from, to))
+    return FALSE;
+  if (features == NULL)
+    return TRUE;
+
+  from_features = features_location (from);
+  to_features = features_location (to);
+  res = copy_file (from_features, to_features);
+  g_free (from_features);
+  g_free (to_features);
+
+  return res;
+}
+
+
+/* Finish job by copying the mood of the same audio from another file */
+static void
+copy_job (WorkQueue *queue, Job *job, const gchar *from)
+{
+  job->code = copy_mood (from, job->outfile) ? RETURN_SUCCESS : RETURN_NOFILE;
+
+  print_result (job->code, job->infile, job->outfile);
+  if (job->code != RETURN_SUCCESS)
+    queue->failed = TRUE;
+  else
+    mood_index_update (queue->index, job->infile, job->outfile,
+		       queue->params, job->hash);
+}
+
+
+/* Analyze the (input, output) pairs on numthreads threads.  Files
+ * the index (if any) knows to be up to date are skipped, and a file
+ * whose audio is the same as that of a file analyzed before (or
+ * earlier in the batch) gets a copy of that file's mood.  With more
+ * than one thread, the durations in the files' headers are read first
+ * and the longest files are started first, so that the batch doesn't
+ * end with one long file being analyzed while the other threads idle.
+ */
+static gint
+run_batch (GPtrArray *pairs, guint numthreads, MoodIndex *index)
+{
+  WorkQueue queue;
+  GPtrArray *all;
+  gchar *params;
+  guint i;
+
+  params = g_strdup_printf ("moodbar-%s size=%d step=%d width=%d height=%d"
+			    " frames-per-column=%d features=%s compress=%d",
+			    VERSION, FFT_SIZE, FFT_STEP,
+			    MOOD_WIDTH, MOOD_HEIGHT, frames_per_column,
+			    features != NULL ? features : "none", compress);
+
+  all = g_ptr_array_new_with_free_func (free_job);
+  queue.jobs = g_ptr_array_new ();
+  queue.failed = FALSE;
+  queue.index = index;
+  queue.params = params;
+  queue.unsaved = 0;
+
+  for (i = 0; i + 1 < pairs->len; i += 2)
+    {
+      Job *job = g_new0 (Job, 1);
+
+      job->infile   = g_strdup ((gchar *) g_ptr_array_index (pairs, i));
+      job->outfile  = g_strdup ((gchar *) g_ptr_array_index (pairs, i + 1));
+      job->duration = -1;
+      g_ptr_array_add (all, job);
+      g_ptr_array_add (queue.jobs, job);
+    }
+
+  numthreads = CLAMP (numthreads, 1, MAX (all->len, 1));
+
+  if (index != NULL)
+    {
+      GHashTable *first_with_hash;
+
+      run_workers (check_worker, &queue, numthreads);
+
+      first_with_hash = g_hash_table_new (g_str_hash, g_str_equal);
+      g_ptr_array_set_size (queue.jobs, 0);
+
+      for (i = 0; i < all->len; ++i)
+	{
+	  Job *job = (Job *) g_ptr_array_index (all, i);
+
+	  if (job->current)
+	    print_result (RETURN_SUCCESS, job->infile, job->outfile);
+	  else if (job->copy_from != NULL)
+	    copy_job (&queue, job, job->copy_from);
+	  else if (job->hash != NULL
+		   &&  (job->same_as = g_hash_table_lookup (first_with_hash,
+							    job->hash)))
+	    ;  /* Copied once the first one is analyzed */
+	  else
+	    {
+	      if (job->hash != NULL)
+		g_hash_table_insert (first_with_hash, job->hash, job);
+	      g_ptr_array_add (queue.jobs, job);
+	    }
+	}
+
+      g_hash_table_destroy (first_with_hash);
+    }
+
+  if (numthreads > 1  &&  queue.jobs->len > numthreads)
+    {
+      run_workers (duration_worker, &queue, numthreads);
+      g_ptr_array_sort (queue.jobs, compare_jobs);
+    }
+
+  run_workers (analysis_worker, &queue, numthreads);
+
+  for (i = 0; i < all->len; ++i)
+    {
+      Job *job = (Job *) g_ptr_array_index (all, i);
+      Job *first = (Job *) job->same_as;
+
+      if (first == NULL)
+	continue;
+
+      if (first->code == RETURN_SUCCESS)
+	copy_job (&queue, job, first->outfile);
+      else
+	{
+	  print_result (first->code, job->infile, job->outfile);
+	  queue.failed = TRUE;
+	}
+    }
+
+  if (index != NULL  ||  pack != NULL)
+    save_index (index);
+
+  g_ptr_array_free (queue.jobs, TRUE);
+  g_ptr_array_free (all, TRUE);
+  g_free (params);
+
+  return queue.failed ? RETURN_NOFILE : RETURN_SUCCESS;
+}
+
+
+static gboolean
+pack_contains (const gchar *output, gpointer data)
+{
+  return mood_pack_contains ((MoodPack *) data, output);
+}
+
+static gboolean
+open_pack (const gchar *packfile)
+{
+  GError *err = NULL;
+
+  if (packfile == NULL)
+    return TRUE;
+
+  pack = mood_pack_open (packfile, &err);
+  if (pack == NULL)
+    {
+      g_printerr ("Could not open the pack: %s\n", err->message);
+      g_error_free (err);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+close_pack (void)
+{
+  GError *err = NULL;
+
+  if (pack != NULL  &&  !mood_pack_close (pack, &err))
+    {
+      g_printerr ("Could not save the index of the pack: %s\n",
+		  err->message);
+      g_error_free (err);
+    }
+  pack = NULL;
+}
+
+
 /* normal g_print has problems with non-ascii characters */
 void print_no_encoding_conversion(const gchar *p)
 {
     fputs(p, stdout);
 }
 
+/* In batch mode stdout is reserved for the result lines */
+static void
+print_to_stderr (const gchar *p)
+{
+  fputs (p, stderr);
+}
+
 gint
 main (gint argc, gchar *argv[])
 {
-  gint tries;
+  Analyzer *an;
+  MoodIndex *index = NULL;
+  gint res;
 
   g_set_print_handler(print_no_encoding_conversion);
   /* Command-line parsing */
-  gchar *outfile = NULL, *infile = NULL;
+  gchar *outfile = NULL, *infile = NULL, *manifest = NULL;
+  gchar *indexfile = NULL, *packfile = NULL;
+  gboolean batch = FALSE, from_stdin = FALSE;
+  gint jobs = JOBS_UNSET;
   gchar **array = NULL;
   const GOptionEntry entries[] = 
     {
       { "output", 'o', 0, G_OPTION_ARG_FILENAME, &outfile,
-	"The output .mood file", NULL },
+	"The output .mood file (with --pack, its key in the pack)", NULL },
+      { "batch", 'b', 0, G_OPTION_ARG_NONE, &batch,
+	"Analyze many files: the arguments are INFILE OUTFILE pairs", NULL },
+      { "manifest", 'm', 0, G_OPTION_ARG_FILENAME, &manifest,
+	"Analyze the INFILE<TAB>OUTFILE pairs listed in FILE", "FILE" },
+      { "null", '0', 0, G_OPTION_ARG_NONE, &from_stdin,
+	"Analyze the NUL-separated INFILE OUTFILE pairs on standard input",
+	NULL },
+      { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+	"In batch mode, analyze N files at a time (0: one per CPU)", "N" },
+      { "index", 'i', 0, G_OPTION_ARG_FILENAME, &indexfile,
+	"In batch mode, skip the files FILE says are up to date, and "
+	"record the files analyzed in it", "FILE" },
+      { "frames-per-column", 'f', 0, G_OPTION_ARG_INT, &frames_per_column,
+	"Only compute about N spectra per output column, so long files "
+	"take no longer than short ones (0: all of them)", "N" },
+      { "features", 'F', 0, G_OPTION_ARG_STRING, &features,
+	"Also save each frame's rgb or bark band energies next to the "
+	"output, as .moodfeat, for moodbar-render", "KIND" },
+      { "pack", 'p', 0, G_OPTION_ARG_FILENAME, &packfile,
+	"Store the moods in the pack FILE, under their output names, "
+	"instead of one file each (see moodbar-pack)", "FILE" },
+      { "compress", 'z', 0, G_OPTION_ARG_NONE, &compress,
+	"Write compressed moods, about a quarter smaller, which the mooddec "
+	"element and moodbar-pack get --decode turn back into raw ones",
+	NULL },
       { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &array,
 	"The file to analyze", NULL },
       { NULL, '\0', 0, 0, NULL, NULL, NULL }
@@ -279,12 +1207,99 @@ main (gint argc, gchar *argv[])
     }
   g_option_context_free (ctx);
 
+  if (features != NULL
+      &&  strcmp (features, "rgb") != 0  &&  strcmp (features, "bark") != 0)
+    {
+      g_print ("--features takes rgb or bark\n\n");
+      return RETURN_COMMANDLINE;
+    }
+
+  if (features != NULL  &&  packfile != NULL)
+    {
+      g_print ("--features can't be used with --pack\n\n");
+      return RETURN_COMMANDLINE;
+    }
+
+  if (batch  ||  manifest != NULL  ||  from_stdin)
+    {
+      GPtrArray *pairs = g_ptr_array_new_with_free_func (g_free);
+      const gchar *problem = NULL;
+
+      g_set_print_handler (print_to_stderr);
+
+      /* read_manifest and read_stdin_pairs say what's wrong themselves */
+      if (outfile != NULL)
+	problem = "--output can't be used in batch mode";
+      else if (array != NULL  &&  !batch)
+	problem = "Files to analyze on the command line need --batch";
+      else if (array != NULL  &&  !add_pairs (pairs, array,
+					      g_strv_length (array)))
+	problem = "--batch takes INFILE OUTFILE pairs, but the last "
+	  "INFILE has no OUTFILE";
+
+      if (problem != NULL
+	  ||  (manifest != NULL  &&  !read_manifest (pairs, manifest))
+	  ||  (from_stdin  &&  !read_stdin_pairs (pairs)))
+	{
+	  if (problem != NULL)
+	    g_printerr ("%s\n\n", problem);
+	  g_ptr_array_free (pairs, TRUE);
+	  return RETURN_COMMANDLINE;
+	}
+
+      gst_init (&argc, &argv);
+
+      if (jobs == JOBS_UNSET)
+	jobs = 1;
+      else if (jobs <= 0)
+	jobs = g_get_num_processors ();
+
+      if (!open_pack (packfile))
+	{
+	  g_ptr_array_free (pairs, TRUE);
+	  return RETURN_COMMANDLINE;
+	}
+
+      if (indexfile != NULL)
+	{
+	  index = mood_index_open (indexfile, &err);
+	  if (index == NULL)
+	    {
+	      g_printerr ("Could not open the index: %s\n", err->message);
+	      close_pack ();
+	      g_ptr_array_free (pairs, TRUE);
+	      return RETURN_COMMANDLINE;
+	    }
+	  if (pack != NULL)
+	    mood_index_set_output_test (index, pack_contains, pack);
+	}
+
+      res = run_batch (pairs, (guint) jobs, index);
+
+      if (index != NULL)
+	mood_index_free (index);
+      close_pack ();
+      g_ptr_array_free (pairs, TRUE);
+      return res;
+    }
+
+  if (indexfile != NULL)
+    {
+      g_print ("--index can only be used in batch mode\n\n");
+      return RETURN_COMMANDLINE;
+    }
+
+  if (jobs != JOBS_UNSET)
+    {
+      g_print ("--jobs can only be used in batch mode\n\n");
+      return RETURN_COMMANDLINE;
+    }
+
   if (outfile == NULL) 
     {
       g_print ("Please specify an output .mood file\n\n");
       return RETURN_COMMANDLINE;
     }
-  output_file = outfile;
 
   if (array == NULL  ||  *array == NULL) 
     {
@@ -297,29 +1312,13 @@ main (gint argc, gchar *argv[])
 
   gst_init (&argc, &argv);
 
+  if (!open_pack (packfile))
+    return RETURN_COMMANDLINE;
 
-  /* Each time the analyzer loop is run, check if the file has been
-   * modified; if so, try again.  This prevents metadata updates from
-   * screwing up the analyzer.
-   */
-  for (tries = 0; tries < MAX_TRIES; ++tries)
-    {
-      struct stat filestats;
-      time_t oldtime;
-
-      if (stat (infile, &filestats) == -1)
-        return RETURN_NOFILE;
-      oldtime = filestats.st_mtime;
-
-      run_loop (infile, outfile);
+  an = analyzer_new ();
+  res = analyze_file (an, infile, outfile, NULL, NULL, NULL);
+  analyzer_free (an);
+  close_pack ();
 
-      if (stat (infile, &filestats) != -1  &&  filestats.st_mtime == oldtime)
-        return return_val;
-    }
-
-
-  /* If we get here, that means that the file was modified MAX_TRIES
-   * times while we were analyzing; give up.
-   */
-  return RETURN_NOFILE;
+  return res;
 }
@@ -0,0 +1,353 @@
+/***************************************************************************
+                        moodindex.c  -  description
+                           -------------------
+  Index of analyzed files, so unchanged files aren't analyzed again
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* The index is a text file with a header line and one line per
+ * analyzed file, with these tab-separated fields:
+ *
+ *   input path, inode, size, mtime, audio hash,
+ *   analysis parameters, output path
+ *
+ * The strings are escaped with g_strescape, so they can't contain
+ * tabs or newlines.  Whenever the inode, size and mtime of a file
+ * still match its entry, the file is taken to be unchanged without
+ * reading it.  Otherwise the audio in the file is hashed (see
+ * audiohash.c), so that a file that was only touched or retagged
+ * isn't analyzed again.  The index also maps audio hashes back to
+ * entries, so a copy of a file that was already analyzed can reuse
+ * its mood.
+ *
+ * Version 1 indexes hashed the whole file; their hashes are dropped
+ * when they're loaded.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "moodindex.h"
+#include "audiohash.h"
+
+#define INDEX_HEADER "# moodbar index 2"
+#define INDEX_HEADER_V1 "# moodbar index 1"
+
+typedef struct
+{
+  gchar   *path;
+  guint64  inode;
+  guint64  size;
+  gint64   mtime;
+  gchar   *hash;
+  gchar   *params;
+  gchar   *output;
+} MoodIndexEntry;
+
+struct _MoodIndex
+{
+  gchar      *filename;
+  GHashTable *entries;  /* path -> MoodIndexEntry */
+  GHashTable *by_hash;  /* audio hash -> MoodIndexEntry */
+  GMutex      lock;
+
+  MoodIndexOutputTest output_exists;
+  gpointer            output_data;
+};
+
+
+static gboolean
+file_exists (const gchar *output, gpointer data)
+{
+  (void) data;  /* Unused */
+
+  return g_file_test (output, G_FILE_TEST_EXISTS);
+}
+
+
+static void
+free_entry (gpointer data)
+{
+  MoodIndexEntry *entry = (MoodIndexEntry *) data;
+
+  g_free (entry->path);
+  g_free (entry->hash);
+  g_free (entry->params);
+  g_free (entry->output);
+  g_free (entry);
+}
+
+
+/* Add entry, replacing any entry for the same path.  Call with the
+ * lock held (or before the index is shared).
+ */
+static void
+add_entry (MoodIndex *index, MoodIndexEntry *entry)
+{
+  MoodIndexEntry *old;
+
+  old = (MoodIndexEntry *) g_hash_table_lookup (index->entries, entry->path);
+  if (old != NULL  &&  old->hash != NULL
+      &&  g_hash_table_lookup (index->by_hash, old->hash) == old)
+    g_hash_table_remove (index->by_hash, old->hash);
+
+  g_hash_table_replace (index->entries, entry->path, entry);
+  if (entry->hash != NULL)
+    g_hash_table_replace (index->by_hash, entry->hash, entry);
+}
+
+
+static gboolean
+parse_line (MoodIndex *index, const gchar *line, gboolean keep_hash)
+{
+  MoodIndexEntry *entry;
+  gchar **fields;
+
+  fields = g_strsplit (line, "\t", -1);
+  if (g_strv_length (fields) != 7)
+    {
+      g_strfreev (fields);
+      return FALSE;
+    }
+
+  entry = g_new0 (MoodIndexEntry, 1);
+  entry->path   = g_strcompress (fields[0]);
+  entry->inode  = g_ascii_strtoull (fields[1], NULL, 10);
+  entry->size   = g_ascii_strtoull (fields[2], NULL, 10);
+  entry->mtime  = g_ascii_strtoll (fields[3], NULL, 10);
+  entry->hash   = keep_hash && *fields[4] ? g_strdup (fields[4]) : NULL;
+  entry->params = g_strcompress (fields[5]);
+  entry->output = g_strcompress (fields[6]);
+  g_strfreev (fields);
+
+  add_entry (index, entry);
+  return TRUE;
+}
+
+
+MoodIndex *
+mood_index_open (const gchar *filename, GError **error)
+{
+  MoodIndex *index;
+  gchar *contents, **lines, **line;
+  gboolean keep_hash;
+  GError *err = NULL;
+
+  index = g_new0 (MoodIndex, 1);
+  index->filename = g_strdup (filename);
+  index->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  NULL, free_entry);
+  index->by_hash = g_hash_table_new (g_str_hash, g_str_equal);
+  index->output_exists = file_exists;
+  g_mutex_init (&index->lock);
+
+  if (!g_file_get_contents (filename, &contents, NULL, &err))
+    {
+      /* A new index */
+      if (g_error_matches (err, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+	{
+	  g_error_free (err);
+	  return index;
+	}
+
+      g_propagate_error (error, err);
+      mood_index_free (index);
+      return NULL;
+    }
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  if (lines[0] == NULL  ||  (strcmp (lines[0], INDEX_HEADER) != 0
+			     &&  strcmp (lines[0], INDEX_HEADER_V1) != 0))
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		   "%s is not a moodbar index", filename);
+      g_strfreev (lines);
+      mood_index_free (index);
+      return NULL;
+    }
+
+  keep_hash = strcmp (lines[0], INDEX_HEADER) == 0;
+  for (line = &lines[1]; *line != NULL; ++line)
+    if (**line != '\0'  &&  !parse_line (index, *line, keep_hash))
+      g_warning ("Ignoring malformed line in %s", filename);
+
+  g_strfreev (lines);
+  return index;
+}
+
+
+gboolean
+mood_index_save (MoodIndex *index, GError **error)
+{
+  GString *contents;
+  GHashTableIter iter;
+  gpointer value;
+  gboolean res;
+
+  contents = g_string_new (INDEX_HEADER "\n");
+
+  g_mutex_lock (&index->lock);
+  g_hash_table_iter_init (&iter, index->entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      MoodIndexEntry *entry = (MoodIndexEntry *) value;
+      gchar *path   = g_strescape (entry->path, NULL);
+      gchar *params = g_strescape (entry->params, NULL);
+      gchar *output = g_strescape (entry->output, NULL);
+
+      g_string_append_printf (contents,
+			      "%s\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT
+			      "\t%" G_GINT64_FORMAT "\t%s\t%s\t%s\n",
+			      path, entry->inode, entry->size, entry->mtime,
+			      entry->hash ? entry->hash : "", params, output);
+      g_free (path);
+      g_free (params);
+      g_free (output);
+    }
+  g_mutex_unlock (&index->lock);
+
+  /* This writes a temporary file and renames it into place */
+  res = g_file_set_contents (index->filename, contents->str, contents->len,
+			     error);
+  g_string_free (contents, TRUE);
+
+  return res;
+}
+
+
+void
+mood_index_free (MoodIndex *index)
+{
+  g_hash_table_unref (index->by_hash);
+  g_hash_table_unref (index->entries);
+  g_mutex_clear (&index->lock);
+  g_free (index->filename);
+  g_free (index);
+}
+
+
+void
+mood_index_set_output_test (MoodIndex *index, MoodIndexOutputTest test,
+			    gpointer data)
+{
+  index->output_exists = test;
+  index->output_data = data;
+}
+
+
+gboolean
+mood_index_is_current (MoodIndex *index, const gchar *infile,
+		       const gchar *outfile, const gchar *params,
+		       gchar **hash)
+{
+  MoodIndexEntry *entry;
+  struct stat filestats;
+  gboolean res = FALSE;
+
+  *hash = NULL;
+
+  if (g_stat (infile, &filestats) == -1)
+    return FALSE;
+
+  g_mutex_lock (&index->lock);
+
+  entry = (MoodIndexEntry *) g_hash_table_lookup (index->entries, infile);
+  if (entry != NULL
+      &&  entry->inode == (guint64) filestats.st_ino
+      &&  entry->size == (guint64) filestats.st_size
+      &&  entry->mtime == (gint64) filestats.st_mtime)
+    {
+      res = strcmp (entry->params, params) == 0
+	&&  strcmp (entry->output, outfile) == 0
+	&&  index->output_exists (outfile, index->output_data);
+      goto out;
+    }
+
+  /* The file is new or was touched; hash its audio.  Don't hold the
+   * lock while reading the file. */
+  g_mutex_unlock (&index->lock);
+  *hash = audio_hash_file (infile);
+  g_mutex_lock (&index->lock);
+
+  entry = (MoodIndexEntry *) g_hash_table_lookup (index->entries, infile);
+  if (*hash != NULL  &&  entry != NULL  &&  entry->hash != NULL
+      &&  strcmp (*hash, entry->hash) == 0)
+    {
+      entry->inode = filestats.st_ino;
+      entry->size  = filestats.st_size;
+      entry->mtime = filestats.st_mtime;
+      res = strcmp (entry->params, params) == 0
+	&&  strcmp (entry->output, outfile) == 0
+	&&  index->output_exists (outfile, index->output_data);
+    }
+
+ out:
+  g_mutex_unlock (&index->lock);
+  return res;
+}
+
+
+gchar *
+mood_index_find_output (MoodIndex *index, const gchar *hash,
+			const gchar *params)
+{
+  MoodIndexEntry *entry;
+  gchar *res = NULL;
+
+  g_mutex_lock (&index->lock);
+
+  entry = (MoodIndexEntry *) g_hash_table_lookup (index->by_hash, hash);
+  if (entry != NULL  &&  strcmp (entry->params, params) == 0)
+    res = g_strdup (entry->output);
+
+  g_mutex_unlock (&index->lock);
+
+  if (res != NULL  &&  !index->output_exists (res, index->output_data))
+    {
+      g_free (res);
+      res = NULL;
+    }
+
+  return res;
+}
+
+
+void
+mood_index_update (MoodIndex *index, const gchar *infile,
+		   const gchar *outfile, const gchar *params,
+		   const gchar *hash)
+{
+  MoodIndexEntry *entry;
+  struct stat filestats;
+
+  if (g_stat (infile, &filestats) == -1)
+    return;
+
+  entry = g_new0 (MoodIndexEntry, 1);
+  entry->path   = g_strdup (infile);
+  entry->inode  = filestats.st_ino;
+  entry->size   = filestats.st_size;
+  entry->mtime  = filestats.st_mtime;
+  entry->hash   = hash != NULL ? g_strdup (hash) : audio_hash_file (infile);
+  entry->params = g_strdup (params);
+  entry->output = g_strdup (outfile);
+
+  g_mutex_lock (&index->lock);
+  add_entry (index, entry);
+  g_mutex_unlock (&index->lock);
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+                        moodindex.h  -  description
+                           -------------------
+  Index of analyzed files, so unchanged files aren't analyzed again
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MOODINDEX_H__
+#define __MOODINDEX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MoodIndex MoodIndex;
+
+/* Whether the output an entry names still exists */
+typedef gboolean (*MoodIndexOutputTest) (const gchar *output, gpointer data);
+
+/* Load the index in filename, or start an empty one if it doesn't
+ * exist yet.  Returns NULL (and sets error) if it can't be read.
+ */
+MoodIndex *mood_index_open (const gchar *filename, GError **error);
+
+/* Write the index back to the file it was opened from */
+gboolean mood_index_save (MoodIndex *index, GError **error);
+
+void mood_index_free (MoodIndex *index);
+
+/* Check outputs with test rather than looking for a file of that name,
+ * for outputs that aren't files (see moodbar --pack) */
+void mood_index_set_output_test (MoodIndex *index, MoodIndexOutputTest test,
+				 gpointer data);
+
+/* Whether outfile already holds the mood of infile as analyzed with
+ * params, so infile needn't be analyzed again.  This only stats the
+ * file if it is unchanged; if it is new or was touched, its audio is
+ * hashed to see if it really changed, and *hash is set to the hash
+ * (free it with g_free).  Otherwise *hash is NULL.
+ */
+gboolean mood_index_is_current (MoodIndex *index, const gchar *infile,
+				const gchar *outfile, const gchar *params,
+				gchar **hash);
+
+/* The output file of an entry whose audio hashes to hash and that was
+ * analyzed with params, if that file still exists, or NULL
+ */
+gchar *mood_index_find_output (MoodIndex *index, const gchar *hash,
+			       const gchar *params);
+
+/* Record that infile was just analyzed into outfile with params.  If
+ * hash is NULL, infile is hashed again.
+ */
+void mood_index_update (MoodIndex *index, const gchar *infile,
+			const gchar *outfile, const gchar *params,
+			const gchar *hash);
+
+G_END_DECLS
+
+#endif /* __MOODINDEX_H__ */
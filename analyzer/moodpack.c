@@ -0,0 +1,872 @@
+/***************************************************************************
+                        moodpack.c  -  description
+                           -------------------
+  Many moods in one file, with an index for looking them up by name
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* A pack keeps the moods of a whole library in two files, rather than
+ * one small file per track.  The data file starts with a header
+ *
+ *   offset  size
+ *        0     8  magic, "MOODPACK"
+ *        8     4  version, 1
+ *       12     4  reserved, 0
+ *       16     8  pack id, chosen at random when the pack is created
+ *                 or compacted
+ *
+ * followed by one record per stored mood:
+ *
+ *   key length (4 bytes), mood length (4 bytes), key, mood
+ *
+ * Records are only ever appended.  Storing a key again appends a new
+ * record, and the old one is dead weight until the pack is compacted.
+ *
+ * The index, in the data file's name plus ".idx", is a hash table:
+ *
+ *        0     8  magic, "MOODPIDX"
+ *        8     4  version, 1
+ *       12     4  number of slots, a power of two
+ *       16     8  id of the pack it indexes
+ *       24     8  length of the data file it covers
+ *       32     8  number of keys
+ *
+ * followed by the slots, each the 64-bit FNV-1a hash of a key and the
+ * offset of its newest record (0 in empty slots), placed by linear
+ * probing in a table at most half full.  All numbers are little-endian.
+ *
+ * The index is only written now and then, and always replaced by
+ * renaming, so a reader never sees half of one; readers scan the few
+ * records the index doesn't cover yet themselves.  If the index is
+ * missing or belongs to another pack (for a moment while the pack is
+ * compacted), readers scan the whole data file, which is slow but
+ * still right.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "moodpack.h"
+
+#define DATA_MAGIC   "MOODPACK"
+#define INDEX_MAGIC  "MOODPIDX"
+#define PACK_VERSION 1
+
+#define DATA_HEADER_SIZE   24
+#define INDEX_HEADER_SIZE  40
+#define RECORD_HEADER_SIZE 8
+#define SLOT_SIZE          16
+
+/* The smallest index */
+#define MIN_SLOTS 16
+
+/* mood_pack_close saves the index once this many moods aren't in it,
+ * so a reader never has many records to scan */
+#define UNINDEXED_MAX 256
+
+#define FNV_OFFSET G_GUINT64_CONSTANT (0xcbf29ce484222325)
+#define FNV_PRIME  G_GUINT64_CONSTANT (0x100000001b3)
+
+struct _MoodPackReader
+{
+  GMappedFile  *data_map, *index_map;
+  const guchar *data;
+  guint64       length;    /* Of the data, up to the last whole record */
+  guint64       id;
+
+  const guchar *slots;     /* NULL if the index can't be used */
+  guint32       numslots;
+  guint64       indexed;   /* Length of the data the index covers */
+
+  GHashTable   *tail;      /* key -> offset, of records past indexed */
+  guint         tail_records;
+};
+
+struct _MoodPack
+{
+  gchar      *filename, *index_filename;
+  gint        fd;
+  guint64     id;
+  guint64     length;      /* Of the data file */
+  guint       unindexed;   /* Records added since the index was saved */
+  GHashTable *keys;        /* key -> offset of its newest record */
+  GMutex      lock;
+};
+
+typedef void (*OffsetFunc) (const gchar *key, guint64 offset, gpointer data);
+
+
+static guint64
+fnv1a (const gchar *key, gsize length)
+{
+  guint64 hash = FNV_OFFSET;
+  gsize i;
+
+  for (i = 0; i < length; ++i)
+    {
+      hash ^= (guchar) key[i];
+      hash *= FNV_PRIME;
+    }
+
+  return hash;
+}
+
+static guint32
+get_uint32 (const guchar *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, 4);
+  return GUINT32_FROM_LE (v);
+}
+
+static guint64
+get_uint64 (const guchar *p)
+{
+  guint64 v;
+
+  memcpy (&v, p, 8);
+  return GUINT64_FROM_LE (v);
+}
+
+static void
+put_uint32 (guchar *p, guint32 v)
+{
+  v = GUINT32_TO_LE (v);
+  memcpy (p, &v, 4);
+}
+
+static void
+put_uint64 (guchar *p, guint64 v)
+{
+  v = GUINT64_TO_LE (v);
+  memcpy (p, &v, 8);
+}
+
+static guint64 *
+new_offset (guint64 offset)
+{
+  guint64 *p = g_new (guint64, 1);
+
+  *p = offset;
+  return p;
+}
+
+
+/* Read the lengths of the record at offset in the length bytes at
+ * data.  Returns FALSE if there is no whole record there. */
+static gboolean
+parse_record (const guchar *data, guint64 length, guint64 offset,
+	      guint32 *keylen, guint32 *moodlen)
+{
+  if (offset < DATA_HEADER_SIZE  ||  offset > length
+      ||  length - offset < RECORD_HEADER_SIZE)
+    return FALSE;
+
+  *keylen = get_uint32 (data + offset);
+  *moodlen = get_uint32 (data + offset + 4);
+
+  return *keylen > 0  &&  (guint64) *keylen + *moodlen
+    <= length - offset - RECORD_HEADER_SIZE;
+}
+
+
+/* Use the index in reader->index_map, if it is an index of this
+ * version of reader's data */
+static gboolean
+use_index (MoodPackReader *reader)
+{
+  const guchar *index;
+  guint64 length, indexed;
+  guint32 numslots;
+
+  if (reader->index_map == NULL)
+    return FALSE;
+
+  index = (const guchar *) g_mapped_file_get_contents (reader->index_map);
+  length = g_mapped_file_get_length (reader->index_map);
+  if (length < INDEX_HEADER_SIZE  ||  memcmp (index, INDEX_MAGIC, 8) != 0
+      ||  get_uint32 (index + 8) != PACK_VERSION)
+    return FALSE;
+
+  numslots = get_uint32 (index + 12);
+  indexed = get_uint64 (index + 24);
+  if (numslots == 0  ||  (numslots & (numslots - 1)) != 0
+      ||  length != INDEX_HEADER_SIZE + (guint64) numslots * SLOT_SIZE
+      ||  get_uint64 (index + 16) != reader->id
+      ||  indexed < DATA_HEADER_SIZE  ||  indexed > reader->length)
+    return FALSE;
+
+  reader->slots = index + INDEX_HEADER_SIZE;
+  reader->numslots = numslots;
+  reader->indexed = indexed;
+  return TRUE;
+}
+
+
+MoodPackReader *
+mood_pack_reader_open (const gchar *filename, GError **error)
+{
+  MoodPackReader *reader;
+  gchar *index_filename;
+  guint64 offset;
+  guint32 keylen, moodlen;
+
+  reader = g_new0 (MoodPackReader, 1);
+  reader->tail = g_hash_table_new_full (g_str_hash, g_str_equal,
+					g_free, g_free);
+
+  reader->data_map = g_mapped_file_new (filename, FALSE, error);
+  if (reader->data_map == NULL)
+    {
+      mood_pack_reader_free (reader);
+      return NULL;
+    }
+  reader->data = (const guchar *) g_mapped_file_get_contents (reader->data_map);
+  reader->length = g_mapped_file_get_length (reader->data_map);
+
+  if (reader->length < DATA_HEADER_SIZE
+      ||  memcmp (reader->data, DATA_MAGIC, 8) != 0
+      ||  get_uint32 (reader->data + 8) != PACK_VERSION)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		   "%s is not a moodbar pack", filename);
+      mood_pack_reader_free (reader);
+      return NULL;
+    }
+  reader->id = get_uint64 (reader->data + 16);
+
+  index_filename = g_strconcat (filename, ".idx", NULL);
+  reader->index_map = g_mapped_file_new (index_filename, FALSE, NULL);
+  g_free (index_filename);
+
+  if (!use_index (reader))
+    {
+      if (reader->index_map != NULL)
+	g_mapped_file_unref (reader->index_map);
+      reader->index_map = NULL;
+      reader->indexed = DATA_HEADER_SIZE;
+    }
+
+  /* The records added since the index was saved, newest last */
+  for (offset = reader->indexed;
+       parse_record (reader->data, reader->length, offset,
+		     &keylen, &moodlen);
+       offset += RECORD_HEADER_SIZE + (guint64) keylen + moodlen)
+    {
+      g_hash_table_replace (reader->tail,
+			    g_strndup ((const gchar *) reader->data + offset
+				       + RECORD_HEADER_SIZE, keylen),
+			    new_offset (offset));
+      reader->tail_records++;
+    }
+
+  /* Whatever follows is a record that is still being written */
+  reader->length = offset;
+
+  return reader;
+}
+
+
+void
+mood_pack_reader_free (MoodPackReader *reader)
+{
+  if (reader->index_map != NULL)
+    g_mapped_file_unref (reader->index_map);
+  if (reader->data_map != NULL)
+    g_mapped_file_unref (reader->data_map);
+  g_hash_table_unref (reader->tail);
+  g_free (reader);
+}
+
+
+/* The offset of the record the index has for key, or 0 */
+static guint64
+index_lookup (MoodPackReader *reader, const gchar *key, gsize keylen)
+{
+  guint64 hash, offset;
+  guint32 mask, i, n, recordlen, moodlen;
+  const guchar *slot;
+
+  if (reader->slots == NULL)
+    return 0;
+
+  hash = fnv1a (key, keylen);
+  mask = reader->numslots - 1;
+
+  for (n = 0, i = (guint32) hash & mask; n < reader->numslots;
+       ++n, i = (i + 1) & mask)
+    {
+      slot = reader->slots + (gsize) i * SLOT_SIZE;
+      offset = get_uint64 (slot + 8);
+      if (offset == 0)
+	break;
+
+      if (get_uint64 (slot) == hash
+	  &&  parse_record (reader->data, reader->length, offset,
+			    &recordlen, &moodlen)
+	  &&  recordlen == keylen
+	  &&  memcmp (reader->data + offset + RECORD_HEADER_SIZE,
+		      key, keylen) == 0)
+	return offset;
+    }
+
+  return 0;
+}
+
+
+const guchar *
+mood_pack_reader_lookup (MoodPackReader *reader, const gchar *key,
+			 gsize *length)
+{
+  guint64 *tail, offset;
+  guint32 keylen, moodlen;
+
+  tail = (guint64 *) g_hash_table_lookup (reader->tail, key);
+  offset = tail != NULL ? *tail : index_lookup (reader, key, strlen (key));
+
+  if (offset == 0  ||  !parse_record (reader->data, reader->length, offset,
+				      &keylen, &moodlen))
+    return NULL;
+
+  *length = moodlen;
+  return reader->data + offset + RECORD_HEADER_SIZE + keylen;
+}
+
+
+/* Call func with the offset of the newest record of every key */
+static void
+foreach_offset (MoodPackReader *reader, OffsetFunc func, gpointer data)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint64 offset;
+  guint32 i, keylen, moodlen;
+  gchar *name;
+
+  for (i = 0; reader->slots != NULL  &&  i < reader->numslots; ++i)
+    {
+      offset = get_uint64 (reader->slots + (gsize) i * SLOT_SIZE + 8);
+      if (offset == 0  ||  !parse_record (reader->data, reader->length,
+					  offset, &keylen, &moodlen))
+	continue;
+
+      /* Skip the keys that were stored again since */
+      name = g_strndup ((const gchar *) reader->data + offset
+			+ RECORD_HEADER_SIZE, keylen);
+      if (!g_hash_table_contains (reader->tail, name))
+	func (name, offset, data);
+      g_free (name);
+    }
+
+  g_hash_table_iter_init (&iter, reader->tail);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    func ((const gchar *) key, *(guint64 *) value, data);
+}
+
+
+typedef struct
+{
+  MoodPackReader *reader;
+  MoodPackFunc    func;
+  gpointer        data;
+} ForeachClosure;
+
+static void
+foreach_mood (const gchar *key, guint64 offset, gpointer data)
+{
+  ForeachClosure *closure = (ForeachClosure *) data;
+  MoodPackReader *reader = closure->reader;
+  guint32 keylen, moodlen;
+
+  if (!parse_record (reader->data, reader->length, offset, &keylen,
+		     &moodlen))
+    return;
+
+  closure->func (key, reader->data + offset + RECORD_HEADER_SIZE + keylen,
+		 moodlen, closure->data);
+}
+
+void
+mood_pack_reader_foreach (MoodPackReader *reader, MoodPackFunc func,
+			  gpointer data)
+{
+  ForeachClosure closure = { reader, func, data };
+
+  foreach_offset (reader, foreach_mood, &closure);
+}
+
+
+/***************************************************************/
+/* Writing                                                     */
+/***************************************************************/
+
+static void
+set_error_from_errno (GError **error, const gchar *what,
+		      const gchar *filename)
+{
+  gint saved_errno = errno;
+
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+	       "Could not %s %s: %s", what, filename,
+	       g_strerror (saved_errno));
+}
+
+static gboolean
+write_all (gint fd, const guchar *buf, gsize length, guint64 offset)
+{
+  while (length > 0)
+    {
+      gssize n = pwrite (fd, buf, length, (off_t) offset);
+
+      if (n == -1  &&  errno == EINTR)
+	continue;
+      if (n <= 0)
+	{
+	  if (n == 0)
+	    errno = EIO;
+	  return FALSE;
+	}
+
+      buf += n;
+      length -= n;
+      offset += n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_all (gint fd, guchar *buf, gsize length, guint64 offset)
+{
+  while (length > 0)
+    {
+      gssize n = pread (fd, buf, length, (off_t) offset);
+
+      if (n == -1  &&  errno == EINTR)
+	continue;
+      if (n <= 0)
+	{
+	  if (n == 0)
+	    errno = EIO;
+	  return FALSE;
+	}
+
+      buf += n;
+      length -= n;
+      offset += n;
+    }
+
+  return TRUE;
+}
+
+/* Start a new data file on fd, with a new id */
+static gboolean
+write_header (gint fd, guint64 *id)
+{
+  guchar header[DATA_HEADER_SIZE];
+
+  *id = ((guint64) g_random_int () << 32) | g_random_int ();
+
+  memcpy (header, DATA_MAGIC, 8);
+  put_uint32 (header + 8, PACK_VERSION);
+  put_uint32 (header + 12, 0);
+  put_uint64 (header + 16, *id);
+
+  return write_all (fd, header, DATA_HEADER_SIZE, 0);
+}
+
+
+static void
+free_pack (MoodPack *pack)
+{
+  if (pack->fd != -1)
+    close (pack->fd);
+  g_hash_table_unref (pack->keys);
+  g_mutex_clear (&pack->lock);
+  g_free (pack->filename);
+  g_free (pack->index_filename);
+  g_free (pack);
+}
+
+static void
+add_key (const gchar *key, guint64 offset, gpointer data)
+{
+  MoodPack *pack = (MoodPack *) data;
+
+  g_hash_table_replace (pack->keys, g_strdup (key), new_offset (offset));
+}
+
+
+MoodPack *
+mood_pack_open (const gchar *filename, GError **error)
+{
+  MoodPack *pack;
+  MoodPackReader *reader;
+  struct stat filestats;
+
+  pack = g_new0 (MoodPack, 1);
+  pack->filename = g_strdup (filename);
+  pack->index_filename = g_strconcat (filename, ".idx", NULL);
+  pack->keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+				      g_free, g_free);
+  g_mutex_init (&pack->lock);
+
+  pack->fd = g_open (filename, O_RDWR | O_CREAT, 0644);
+  if (pack->fd == -1)
+    {
+      set_error_from_errno (error, "open", filename);
+      free_pack (pack);
+      return NULL;
+    }
+
+  if (flock (pack->fd, LOCK_EX | LOCK_NB) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		   "%s is being written by another process", filename);
+      free_pack (pack);
+      return NULL;
+    }
+
+  if (fstat (pack->fd, &filestats) == -1)
+    {
+      set_error_from_errno (error, "stat", filename);
+      free_pack (pack);
+      return NULL;
+    }
+
+  /* A new pack */
+  if (filestats.st_size == 0)
+    {
+      if (!write_header (pack->fd, &pack->id))
+	{
+	  set_error_from_errno (error, "write to", filename);
+	  free_pack (pack);
+	  return NULL;
+	}
+      pack->length = DATA_HEADER_SIZE;
+      return pack;
+    }
+
+  reader = mood_pack_reader_open (filename, error);
+  if (reader == NULL)
+    {
+      free_pack (pack);
+      return NULL;
+    }
+
+  pack->id = reader->id;
+  pack->length = reader->length;
+  pack->unindexed = reader->slots != NULL
+    ? reader->tail_records : UNINDEXED_MAX;
+  foreach_offset (reader, add_key, pack);
+  mood_pack_reader_free (reader);
+
+  /* Drop a record that was only partly written */
+  if ((guint64) filestats.st_size > pack->length
+      &&  ftruncate (pack->fd, (off_t) pack->length) == -1)
+    {
+      set_error_from_errno (error, "truncate", filename);
+      free_pack (pack);
+      return NULL;
+    }
+
+  return pack;
+}
+
+
+gboolean
+mood_pack_close (MoodPack *pack, GError **error)
+{
+  gboolean res = TRUE;
+
+  if (pack->unindexed >= UNINDEXED_MAX)
+    res = mood_pack_save_index (pack, error);
+
+  free_pack (pack);
+  return res;
+}
+
+
+gboolean
+mood_pack_put (MoodPack *pack, const gchar *key, const guchar *mood,
+	       gsize length, GError **error)
+{
+  gsize keylen = strlen (key), size;
+  guchar *record;
+  gboolean res;
+
+  g_return_val_if_fail (keylen > 0  &&  keylen <= G_MAXUINT32, FALSE);
+  g_return_val_if_fail (length <= G_MAXUINT32, FALSE);
+
+  size = RECORD_HEADER_SIZE + keylen + length;
+  record = g_malloc (size);
+  put_uint32 (record, (guint32) keylen);
+  put_uint32 (record + 4, (guint32) length);
+  memcpy (record + RECORD_HEADER_SIZE, key, keylen);
+  memcpy (record + RECORD_HEADER_SIZE + keylen, mood, length);
+
+  g_mutex_lock (&pack->lock);
+
+  /* If this fails, the next record overwrites what it left */
+  res = write_all (pack->fd, record, size, pack->length);
+  if (res)
+    {
+      g_hash_table_replace (pack->keys, g_strdup (key),
+			    new_offset (pack->length));
+      pack->length += size;
+      pack->unindexed++;
+    }
+  else
+    set_error_from_errno (error, "write to", pack->filename);
+
+  g_mutex_unlock (&pack->lock);
+
+  g_free (record);
+  return res;
+}
+
+
+gboolean
+mood_pack_contains (MoodPack *pack, const gchar *key)
+{
+  gboolean res;
+
+  g_mutex_lock (&pack->lock);
+  res = g_hash_table_contains (pack->keys, key);
+  g_mutex_unlock (&pack->lock);
+
+  return res;
+}
+
+
+guchar *
+mood_pack_get (MoodPack *pack, const gchar *key, gsize *length)
+{
+  guchar header[RECORD_HEADER_SIZE], *mood = NULL;
+  guint64 *offset;
+  guint32 keylen, moodlen;
+
+  g_mutex_lock (&pack->lock);
+
+  offset = (guint64 *) g_hash_table_lookup (pack->keys, key);
+  if (offset != NULL
+      &&  read_all (pack->fd, header, RECORD_HEADER_SIZE, *offset))
+    {
+      keylen = get_uint32 (header);
+      moodlen = get_uint32 (header + 4);
+      mood = g_malloc (MAX (moodlen, 1));
+      if (read_all (pack->fd, mood, moodlen,
+		    *offset + RECORD_HEADER_SIZE + keylen))
+	*length = moodlen;
+      else
+	{
+	  g_free (mood);
+	  mood = NULL;
+	}
+    }
+
+  g_mutex_unlock (&pack->lock);
+
+  return mood;
+}
+
+
+/* The index of the keys of pack, *length bytes.  Call with the lock
+ * held. */
+static guchar *
+build_index (MoodPack *pack, gsize *length)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint64 hash;
+  guint32 numslots = MIN_SLOTS, mask, i;
+  guint numkeys = g_hash_table_size (pack->keys);
+  guchar *index, *slots;
+
+  while (numslots < 2 * numkeys)
+    numslots *= 2;
+  mask = numslots - 1;
+
+  *length = INDEX_HEADER_SIZE + (gsize) numslots * SLOT_SIZE;
+  index = g_malloc0 (*length);
+  memcpy (index, INDEX_MAGIC, 8);
+  put_uint32 (index + 8, PACK_VERSION);
+  put_uint32 (index + 12, numslots);
+  put_uint64 (index + 16, pack->id);
+  put_uint64 (index + 24, pack->length);
+  put_uint64 (index + 32, numkeys);
+
+  slots = index + INDEX_HEADER_SIZE;
+  g_hash_table_iter_init (&iter, pack->keys);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      hash = fnv1a ((const gchar *) key, strlen ((const gchar *) key));
+      for (i = (guint32) hash & mask;
+	   get_uint64 (slots + (gsize) i * SLOT_SIZE + 8) != 0;
+	   i = (i + 1) & mask)
+	;
+      put_uint64 (slots + (gsize) i * SLOT_SIZE, hash);
+      put_uint64 (slots + (gsize) i * SLOT_SIZE + 8, *(guint64 *) value);
+    }
+
+  return index;
+}
+
+
+gboolean
+mood_pack_save_index (MoodPack *pack, GError **error)
+{
+  guchar *index;
+  gsize length;
+  gboolean res;
+
+  g_mutex_lock (&pack->lock);
+
+  /* The records must be on disk before an index that points to them */
+  if (fsync (pack->fd) == -1)
+    {
+      set_error_from_errno (error, "sync", pack->filename);
+      g_mutex_unlock (&pack->lock);
+      return FALSE;
+    }
+
+  index = build_index (pack, &length);
+
+  /* This writes a temporary file and renames it into place */
+  res = g_file_set_contents (pack->index_filename, (const gchar *) index,
+			     length, error);
+  if (res)
+    pack->unindexed = 0;
+
+  g_mutex_unlock (&pack->lock);
+
+  g_free (index);
+  return res;
+}
+
+
+/* Copy the newest record of every key of pack to the new data file on
+ * fd, and set *keys to their new offsets.  Call with the lock held. */
+static gboolean
+copy_records (MoodPack *pack, gint fd, guint64 *length, GHashTable **keys)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guchar *record = NULL;
+  gsize size;
+  gboolean res = TRUE;
+
+  *keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  g_hash_table_iter_init (&iter, pack->keys);
+  while (res  &&  g_hash_table_iter_next (&iter, &key, &value))
+    {
+      guint64 offset = *(guint64 *) value;
+      guchar header[RECORD_HEADER_SIZE];
+
+      res = read_all (pack->fd, header, RECORD_HEADER_SIZE, offset);
+      if (!res)
+	break;
+
+      size = RECORD_HEADER_SIZE + (gsize) get_uint32 (header)
+	+ get_uint32 (header + 4);
+      record = g_realloc (record, size);
+      res = read_all (pack->fd, record, size, offset)
+	&&  write_all (fd, record, size, *length);
+      if (res)
+	{
+	  g_hash_table_insert (*keys, g_strdup ((const gchar *) key),
+			       new_offset (*length));
+	  *length += size;
+	}
+    }
+
+  g_free (record);
+  return res;
+}
+
+
+gboolean
+mood_pack_compact (MoodPack *pack, guint64 *before, guint64 *after,
+		   GError **error)
+{
+  GHashTable *keys = NULL;
+  gchar *tmpname;
+  guint64 id, length = DATA_HEADER_SIZE;
+  gint fd;
+
+  tmpname = g_strconcat (pack->filename, ".tmp", NULL);
+
+  g_mutex_lock (&pack->lock);
+
+  fd = g_open (tmpname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    {
+      set_error_from_errno (error, "create", tmpname);
+      goto fail;
+    }
+
+  /* Locked before it is renamed into place, so no other writer can
+   * open it in between */
+  if (flock (fd, LOCK_EX | LOCK_NB) == -1
+      ||  !write_header (fd, &id)
+      ||  !copy_records (pack, fd, &length, &keys)
+      ||  fsync (fd) == -1)
+    {
+      set_error_from_errno (error, "write to", tmpname);
+      goto fail;
+    }
+
+  if (g_rename (tmpname, pack->filename) == -1)
+    {
+      set_error_from_errno (error, "replace", pack->filename);
+      goto fail;
+    }
+
+  if (before != NULL)
+    *before = pack->length;
+  if (after != NULL)
+    *after = length;
+
+  close (pack->fd);
+  pack->fd = fd;
+  pack->id = id;
+  pack->length = length;
+  g_hash_table_unref (pack->keys);
+  pack->keys = keys;
+
+  g_mutex_unlock (&pack->lock);
+  g_free (tmpname);
+
+  /* Until this is done, readers scan the whole pack */
+  return mood_pack_save_index (pack, error);
+
+ fail:
+  if (fd != -1)
+    {
+      close (fd);
+      g_unlink (tmpname);
+    }
+  if (keys != NULL)
+    g_hash_table_unref (keys);
+
+  g_mutex_unlock (&pack->lock);
+  g_free (tmpname);
+  return FALSE;
+}
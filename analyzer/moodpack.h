@@ -0,0 +1,88 @@
+/***************************************************************************
+                        moodpack.h  -  description
+                           -------------------
+  Many moods in one file, with an index for looking them up by name
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MOODPACK_H__
+#define __MOODPACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Reading.  A reader maps the pack and its index into memory when it
+ * is opened, and sees the pack as it was then; looking a mood up costs
+ * a hash of its key and a probe or two, without any system calls.
+ * Readers can be used while the pack is being written or compacted.
+ */
+typedef struct _MoodPackReader MoodPackReader;
+
+typedef void (*MoodPackFunc) (const gchar *key, const guchar *mood,
+			      gsize length, gpointer data);
+
+/* Open the pack in filename (its index is filename.idx), or return
+ * NULL and set error */
+MoodPackReader *mood_pack_reader_open (const gchar *filename,
+				       GError **error);
+
+void mood_pack_reader_free (MoodPackReader *reader);
+
+/* The mood stored under key, or NULL.  The mood is length bytes in the
+ * reader's mapping, and stays valid until the reader is freed.
+ */
+const guchar *mood_pack_reader_lookup (MoodPackReader *reader,
+				       const gchar *key, gsize *length);
+
+/* Call func for the newest mood of every key, in no particular order */
+void mood_pack_reader_foreach (MoodPackReader *reader, MoodPackFunc func,
+			       gpointer data);
+
+
+/* Writing.  Only one process at a time can have a pack open for
+ * writing; the threads of that process can share it.
+ */
+typedef struct _MoodPack MoodPack;
+
+/* Open the pack in filename for writing, creating it if it doesn't
+ * exist, or return NULL and set error.  Moods that were added after
+ * the index was last saved are found again, and a mood that was only
+ * partly written when its writer died is dropped.
+ */
+MoodPack *mood_pack_open (const gchar *filename, GError **error);
+
+/* Write back the index if enough moods were added since it was last
+ * saved, and close the pack */
+gboolean mood_pack_close (MoodPack *pack, GError **error);
+
+/* Store mood under key, replacing whatever was stored under it */
+gboolean mood_pack_put (MoodPack *pack, const gchar *key,
+			const guchar *mood, gsize length, GError **error);
+
+gboolean mood_pack_contains (MoodPack *pack, const gchar *key);
+
+/* A copy of the mood stored under key (free it with g_free), or NULL */
+guchar *mood_pack_get (MoodPack *pack, const gchar *key, gsize *length);
+
+/* Rewrite the index, so it covers every mood in the pack */
+gboolean mood_pack_save_index (MoodPack *pack, GError **error);
+
+/* Rewrite the pack with only the newest mood of each key, dropping
+ * the ones that were replaced, and save its index.  Sets *before and
+ * *after to the size of the pack before and after, if not NULL.
+ */
+gboolean mood_pack_compact (MoodPack *pack, guint64 *before, guint64 *after,
+			    GError **error);
+
+G_END_DECLS
+
+#endif /* __MOODPACK_H__ */
@@ -0,0 +1,281 @@
+/***************************************************************************
+                        pack.c  -  description
+                           -------------------
+  Look moods up in a pack, add moods to it and compact it
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* moodbar-pack works on the packs that moodbar --pack writes (see
+ * moodpack.c):
+ *
+ *   moodbar-pack get PACK KEY [OUTFILE]    write the mood of KEY to
+ *                                          OUTFILE, or standard output;
+ *                                          with --decode, a compressed
+ *                                          mood is written raw
+ *   moodbar-pack list PACK                 print KEY<TAB>LENGTH lines
+ *   moodbar-pack add PACK KEY FILE [KEY FILE...]
+ *                                          store copies of .mood files,
+ *                                          so that a library's moods
+ *                                          can go into a pack without
+ *                                          analyzing it again; the
+ *                                          files are left alone
+ *   moodbar-pack compact PACK              drop the moods that were
+ *                                          replaced
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "moodpack.h"
+#include "moodbarcodec.h"
+
+/* These match the analyzer's */
+#define RETURN_SUCCESS     0
+#define RETURN_NOFILE      2
+#define RETURN_COMMANDLINE 3
+
+/* From the command line: whether get writes compressed moods raw */
+static gboolean decode = FALSE;
+
+
+static gint
+get_mood (const gchar *packfile, const gchar *key, const gchar *outfile)
+{
+  MoodPackReader *reader;
+  const guchar *mood;
+  guchar *image = NULL;
+  GError *err = NULL;
+  gsize length;
+  guint width, height;
+  gint res = RETURN_SUCCESS;
+
+  reader = mood_pack_reader_open (packfile, &err);
+  if (reader == NULL)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  mood = mood_pack_reader_lookup (reader, key, &length);
+  if (mood == NULL)
+    {
+      g_printerr ("%s has no mood for %s\n", packfile, key);
+      res = RETURN_NOFILE;
+      goto out;
+    }
+
+  if (decode  &&  gst_moodbar_codec_is_compressed (mood, length))
+    {
+      image = gst_moodbar_codec_decode (mood, length, &width, &height);
+      if (image == NULL)
+	{
+	  g_printerr ("The mood of %s in %s is corrupt\n", key, packfile);
+	  res = RETURN_NOFILE;
+	  goto out;
+	}
+      mood = image;
+      length = (gsize) width * height * 3;
+    }
+
+  if (outfile == NULL)
+    {
+      if (fwrite (mood, 1, length, stdout) != length  ||  fflush (stdout) != 0)
+	res = RETURN_NOFILE;
+    }
+  else if (!g_file_set_contents (outfile, (const gchar *) mood, length, &err))
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      res = RETURN_NOFILE;
+    }
+
+ out:
+  g_free (image);
+  mood_pack_reader_free (reader);
+  return res;
+}
+
+
+static void
+print_entry (const gchar *key, const guchar *mood, gsize length,
+	     gpointer data)
+{
+  (void) mood;  /* Unused */
+  (void) data;
+
+  printf ("%s\t%" G_GSIZE_FORMAT "\n", key, length);
+}
+
+static gint
+list_moods (const gchar *packfile)
+{
+  MoodPackReader *reader;
+  GError *err = NULL;
+
+  reader = mood_pack_reader_open (packfile, &err);
+  if (reader == NULL)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  mood_pack_reader_foreach (reader, print_entry, NULL);
+  mood_pack_reader_free (reader);
+
+  return RETURN_SUCCESS;
+}
+
+
+/* Store the files of the (key, file) pairs in args */
+static gint
+add_moods (const gchar *packfile, gchar **args, guint numargs)
+{
+  MoodPack *pack;
+  GError *err = NULL;
+  gchar *contents;
+  gsize length;
+  guint i;
+  gint res = RETURN_SUCCESS;
+
+  pack = mood_pack_open (packfile, &err);
+  if (pack == NULL)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  for (i = 0; i + 1 < numargs; i += 2)
+    {
+      if (!g_file_get_contents (args[i + 1], &contents, &length, &err))
+	{
+	  g_printerr ("%s\n", err->message);
+	  g_clear_error (&err);
+	  res = RETURN_NOFILE;
+	  continue;
+	}
+
+      if (!mood_pack_put (pack, args[i], (const guchar *) contents, length,
+			  &err))
+	{
+	  g_printerr ("%s\n", err->message);
+	  g_clear_error (&err);
+	  res = RETURN_NOFILE;
+	}
+      g_free (contents);
+    }
+
+  if (!mood_pack_save_index (pack, &err))
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      res = RETURN_NOFILE;
+    }
+
+  mood_pack_close (pack, NULL);
+  return res;
+}
+
+
+static gint
+compact_pack (const gchar *packfile)
+{
+  MoodPack *pack;
+  GError *err = NULL;
+  guint64 before, after;
+  gboolean res;
+
+  pack = mood_pack_open (packfile, &err);
+  if (pack == NULL)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  res = mood_pack_compact (pack, &before, &after, &err);
+  if (res)
+    g_print ("%s: %" G_GUINT64_FORMAT " bytes, was %" G_GUINT64_FORMAT "\n",
+	     packfile, after, before);
+  else
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+    }
+
+  mood_pack_close (pack, NULL);
+  return res ? RETURN_SUCCESS : RETURN_NOFILE;
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gchar **array = NULL;
+  const GOptionEntry entries[] =
+    {
+      { "decode", 'd', 0, G_OPTION_ARG_NONE, &decode,
+	"get writes compressed moods (moodbar --compress) raw", NULL },
+      { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &array,
+	"The command and its arguments", NULL },
+      { NULL, '\0', 0, 0, NULL, NULL, NULL }
+    };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  const gchar *command;
+  guint n;
+
+  ctx = g_option_context_new ("COMMAND PACK [ARGS...] - "
+			      "Work with packs of moods");
+  g_option_context_set_description (ctx,
+    "Commands:\n"
+    "  get PACK KEY [OUTFILE]           Write the mood of KEY to OUTFILE, "
+    "or standard output\n"
+    "  list PACK                        List the keys and the lengths of "
+    "their moods\n"
+    "  add PACK KEY FILE [KEY FILE...]  Store the mood in each FILE under "
+    "its KEY\n"
+    "  compact PACK                     Drop the moods that were replaced\n");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+
+  if (!g_option_context_parse (ctx, &argc, &argv, &err))
+    {
+      g_printerr ("Error initializing: %s\n", err->message);
+      return RETURN_COMMANDLINE;
+    }
+  g_option_context_free (ctx);
+
+  n = array != NULL ? g_strv_length (array) : 0;
+  command = n > 0 ? array[0] : "";
+
+  if (strcmp (command, "get") == 0  &&  (n == 3  ||  n == 4))
+    return get_mood (array[1], array[2], n == 4 ? array[3] : NULL);
+
+  if (strcmp (command, "list") == 0  &&  n == 2)
+    return list_moods (array[1]);
+
+  if (strcmp (command, "add") == 0  &&  n >= 4  &&  n % 2 == 0)
+    return add_moods (array[1], &array[2], n - 2);
+
+  if (strcmp (command, "compact") == 0  &&  n == 2)
+    return compact_pack (array[1]);
+
+  g_printerr ("Please give a command: get, list, add or compact "
+	      "(see --help)\n\n");
+  return RETURN_COMMANDLINE;
+}
@@ -0,0 +1,172 @@
+/***************************************************************************
+                        pngwrite.c  -  description
+                           -------------------
+  Minimal writer of RGB PNG images
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Moodbars are a few kilobytes of pixels, so rather than pull in
+ * libpng or zlib, the image data is stored in uncompressed deflate
+ * blocks; the file is a little larger than the raw pixels.  Every row
+ * is repeated in a moodbar, so a real compressor would do much
+ * better, but pngenc or any image tool can recompress it if that
+ * matters.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "pngwrite.h"
+
+/* The largest stored deflate block */
+#define STORED_BLOCK_MAX 65535
+
+
+static guint32
+crc32_update (guint32 crc, const guchar *data, gsize length)
+{
+  static guint32 table[256];
+  static gsize initialized = 0;
+  gsize i;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint32 c;
+      guint n, k;
+
+      for (n = 0; n < 256; ++n)
+	{
+	  c = n;
+	  for (k = 0; k < 8; ++k)
+	    c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+	  table[n] = c;
+	}
+      g_once_init_leave (&initialized, 1);
+    }
+
+  crc ^= 0xffffffffU;
+  for (i = 0; i < length; ++i)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return crc ^ 0xffffffffU;
+}
+
+static void
+append_uint32_be (GByteArray *out, guint32 v)
+{
+  guchar b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+  g_byte_array_append (out, b, 4);
+}
+
+/* Append a chunk of the given type: length, type, data and the CRC of
+ * the type and data */
+static void
+append_chunk (GByteArray *out, const gchar *type, const guchar *data,
+	      gsize length)
+{
+  guint32 crc;
+
+  append_uint32_be (out, (guint32) length);
+  g_byte_array_append (out, (const guchar *) type, 4);
+  if (length > 0)
+    g_byte_array_append (out, data, length);
+
+  crc = crc32_update (0, (const guchar *) type, 4);
+  crc = crc32_update (crc, data, length);
+  append_uint32_be (out, crc);
+}
+
+/* Wrap data in a zlib stream of stored blocks */
+static GByteArray *
+zlib_stored (const guchar *data, gsize length)
+{
+  GByteArray *z = g_byte_array_new ();
+  static const guchar header[2] = { 0x78, 0x01 };
+  guint32 s1 = 1, s2 = 0;
+  gsize pos = 0, i, n;
+
+  g_byte_array_append (z, header, 2);
+
+  do
+    {
+      guchar block[5];
+
+      n = MIN (length - pos, STORED_BLOCK_MAX);
+      block[0] = pos + n == length;  /* BFINAL, BTYPE 00 */
+      block[1] = n & 0xff;
+      block[2] = n >> 8;
+      block[3] = ~n & 0xff;
+      block[4] = (~n >> 8) & 0xff;
+      g_byte_array_append (z, block, 5);
+      g_byte_array_append (z, data + pos, n);
+      pos += n;
+    }
+  while (pos < length);
+
+  for (i = 0; i < length; ++i)
+    {
+      s1 = (s1 + data[i]) % 65521;
+      s2 = (s2 + s1) % 65521;
+    }
+  append_uint32_be (z, (s2 << 16) | s1);
+
+  return z;
+}
+
+
+gboolean
+png_write_rgb (const gchar *filename, const guchar *pixels,
+	       guint width, guint height, GError **error)
+{
+  static const guchar signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+  GByteArray *out, *z;
+  guchar ihdr[13], *raw;
+  gsize rowsize = (gsize) width * 3, y;
+  gboolean res;
+
+  /* Each row is preceded by its filter type, 0 (none) */
+  raw = g_malloc ((rowsize + 1) * height);
+  for (y = 0; y < height; ++y)
+    {
+      raw[y * (rowsize + 1)] = 0;
+      memcpy (raw + y * (rowsize + 1) + 1, pixels + y * rowsize, rowsize);
+    }
+  z = zlib_stored (raw, (rowsize + 1) * height);
+  g_free (raw);
+
+  ihdr[0] = width >> 24;
+  ihdr[1] = width >> 16;
+  ihdr[2] = width >> 8;
+  ihdr[3] = width;
+  ihdr[4] = height >> 24;
+  ihdr[5] = height >> 16;
+  ihdr[6] = height >> 8;
+  ihdr[7] = height;
+  ihdr[8] = 8;   /* bit depth */
+  ihdr[9] = 2;   /* colour type: RGB */
+  ihdr[10] = 0;  /* compression */
+  ihdr[11] = 0;  /* filter */
+  ihdr[12] = 0;  /* no interlace */
+
+  out = g_byte_array_new ();
+  g_byte_array_append (out, signature, 8);
+  append_chunk (out, "IHDR", ihdr, 13);
+  append_chunk (out, "IDAT", z->data, z->len);
+  append_chunk (out, "IEND", NULL, 0);
+  g_byte_array_free (z, TRUE);
+
+  res = g_file_set_contents (filename, (const gchar *) out->data, out->len,
+			     error);
+  g_byte_array_free (out, TRUE);
+
+  return res;
+}
@@ -0,0 +1,30 @@
+/***************************************************************************
+                        pngwrite.h  -  description
+                           -------------------
+  Minimal writer of RGB PNG images
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __PNGWRITE_H__
+#define __PNGWRITE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Write the width x height image of rgb triples at pixels (row by
+ * row, top to bottom) to filename as an 8-bit RGB PNG */
+gboolean png_write_rgb (const gchar *filename, const guchar *pixels,
+			guint width, guint height, GError **error);
+
+G_END_DECLS
+
+#endif /* __PNGWRITE_H__ */
@@ -0,0 +1,315 @@
+/***************************************************************************
+                        render.c  -  description
+                           -------------------
+  Draw moodbars from saved features, without decoding the audio
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* moodbar-render takes the feature files the moodbar element saves
+ * (with its features-location property, or moodbar --features) and
+ * draws them at any width and height, with any resampling and colour
+ * theme.  The frames are normalized and averaged exactly as the
+ * element does (the same code, in plugin/moodbarrender.c), so with the
+ * default theme the result is byte for byte what the element would
+ * have pushed.  Only the feature file is read, which takes
+ * milliseconds, where analyzing the audio again takes seconds.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "moodbarfeatures.h"
+#include "moodbarrender.h"
+#include "spectrumkernels.h"
+#include "pngwrite.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_kernels_debug);
+
+/* These match the analyzer's */
+#define RETURN_SUCCESS     0
+#define RETURN_NOFILE      2
+#define RETURN_COMMANDLINE 3
+
+#define WIDTH_DEFAULT  1000
+#define HEIGHT_DEFAULT 1
+
+/* A colour theme maps each normalized pixel (r, g, b), from 0 to 255,
+ * to matrix * (r, g, b) + offset, clamped */
+typedef struct
+{
+  const gchar *name;
+  gfloat matrix[9];
+  gfloat offset[3];
+} Theme;
+
+static const Theme themes[] =
+  {
+    { "default", { 1.f, 0.f, 0.f,  0.f, 1.f, 0.f,  0.f, 0.f, 1.f },
+      { 0.f, 0.f, 0.f } },
+    { "gray", { 0.299f, 0.587f, 0.114f,  0.299f, 0.587f, 0.114f,
+		0.299f, 0.587f, 0.114f },
+      { 0.f, 0.f, 0.f } },
+    { "sepia", { 0.393f, 0.769f, 0.189f,  0.349f, 0.686f, 0.168f,
+		 0.272f, 0.534f, 0.131f },
+      { 0.f, 0.f, 0.f } },
+    { "inverted", { -1.f, 0.f, 0.f,  0.f, -1.f, 0.f,  0.f, 0.f, -1.f },
+      { 255.f, 255.f, 255.f } },
+    { "swapped", { 0.f, 0.f, 1.f,  0.f, 1.f, 0.f,  1.f, 0.f, 0.f },
+      { 0.f, 0.f, 0.f } }
+  };
+
+
+/* Look up a theme by name, or parse one from 9 comma-separated matrix
+ * entries (row by row), optionally followed by 3 offsets */
+static gboolean
+parse_theme (const gchar *spec, Theme *theme)
+{
+  gchar **fields;
+  guint i, n;
+  gboolean res = TRUE;
+
+  for (i = 0; i < G_N_ELEMENTS (themes); ++i)
+    if (strcmp (spec, themes[i].name) == 0)
+      {
+	*theme = themes[i];
+	return TRUE;
+      }
+
+  fields = g_strsplit (spec, ",", 0);
+  n = g_strv_length (fields);
+  if (n != 9  &&  n != 12)
+    res = FALSE;
+
+  memset (theme, 0, sizeof (Theme));
+  theme->name = spec;
+  for (i = 0; res  &&  i < n; ++i)
+    {
+      gchar *end;
+      gdouble v = g_ascii_strtod (fields[i], &end);
+
+      if (end == fields[i]  ||  *end != '\0')
+	res = FALSE;
+      else if (i < 9)
+	theme->matrix[i] = (gfloat) v;
+      else
+	theme->offset[i - 9] = (gfloat) v;
+    }
+
+  g_strfreev (fields);
+  return res;
+}
+
+static void
+apply_theme (const Theme *theme, guchar *row, guint width)
+{
+  const gfloat *m = theme->matrix;
+  gfloat in[3], out;
+  guint i, c;
+
+  for (i = 0; i < width; ++i, row += 3)
+    {
+      for (c = 0; c < 3; ++c)
+	in[c] = row[c];
+      for (c = 0; c < 3; ++c)
+	{
+	  out = m[3*c] * in[0] + m[3*c + 1] * in[1] + m[3*c + 2] * in[2]
+	    + theme->offset[c];
+	  row[c] = (guchar) (CLAMP (out, 0.f, 255.f) + 0.5f);
+	}
+    }
+}
+
+
+/* The frames of features as the moodbar element keeps them: (r, g, b,
+ * 0) quadruples, after a frame 0 of zeroes that the element never
+ * fills in but normalizes along with the others */
+static gfloat *
+features_to_rgbx (const GstMoodbarFeatures *features)
+{
+  gfloat *rgbx, *frame;
+  guint64 i;
+
+  rgbx = g_new0 (gfloat,
+		 (features->numframes + 1) * GST_MOODBAR_FRAME_FLOATS);
+  for (i = 0; i < features->numframes; ++i)
+    {
+      frame = &rgbx[(i + 1) * GST_MOODBAR_FRAME_FLOATS];
+      if (features->kind == GST_MOODBAR_FEATURES_BARK)
+	gst_moodbar_frame_rgb (&features->data[i * features->channels],
+			       frame);
+      else
+	memcpy (frame, &features->data[i * features->channels],
+		3 * sizeof (gfloat));
+    }
+
+  return rgbx;
+}
+
+
+static gboolean
+has_suffix_nocase (const gchar *s, const gchar *suffix)
+{
+  gsize n = strlen (s), m = strlen (suffix);
+
+  return n >= m  &&  g_ascii_strcasecmp (s + n - m, suffix) == 0;
+}
+
+/* Draw the features in infile to outfile: a PNG if its name ends in
+ * .png, raw rgb triples (a .mood file) otherwise */
+static gint
+render_file (const gchar *infile, const gchar *outfile, guint max_width,
+	     guint height, GstMoodbarResample resample, const Theme *theme)
+{
+  GstMoodbarFeatures *features;
+  GstMoodbarNormalization norm;
+  GError *err = NULL;
+  gfloat *rgbx;
+  guchar *pixels;
+  guint numframes, width, line;
+  gsize rowsize;
+  gboolean res;
+
+  features = gst_moodbar_features_load (infile, &err);
+  if (features == NULL)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  if (features->numframes < 2  ||  features->numframes >= G_MAXUINT)
+    {
+      g_printerr ("%s has no moodbar to draw\n", infile);
+      gst_moodbar_features_free (features);
+      return RETURN_NOFILE;
+    }
+
+  /* As in gst_moodbar_render */
+  numframes = (guint) features->numframes;
+  if (max_width == 0  ||  numframes <= max_width)
+    width = numframes - 1;
+  else
+    width = max_width;
+
+  rgbx = features_to_rgbx (features);
+  gst_moodbar_features_free (features);
+
+  rowsize = (gsize) width * 3;
+  pixels = g_malloc (rowsize * height);
+
+  gst_moodbar_normalize (rgbx, numframes, &norm);
+  gst_moodbar_render_row (rgbx, numframes, &norm, resample, width, pixels);
+  apply_theme (theme, pixels, width);
+  for (line = 1; line < height; ++line)
+    memcpy (pixels + line * rowsize, pixels, rowsize);
+  g_free (rgbx);
+
+  if (has_suffix_nocase (outfile, ".png"))
+    res = png_write_rgb (outfile, pixels, width, height, &err);
+  else
+    res = g_file_set_contents (outfile, (const gchar *) pixels,
+			       rowsize * height, &err);
+  g_free (pixels);
+
+  if (!res)
+    {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      return RETURN_NOFILE;
+    }
+
+  return RETURN_SUCCESS;
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gint width = WIDTH_DEFAULT, height = HEIGHT_DEFAULT;
+  gchar *resample_name = NULL, *theme_spec = NULL;
+  gchar **array = NULL;
+  GstMoodbarResample resample = GST_MOODBAR_RESAMPLE_BOX;
+  Theme theme = themes[0];
+  const GOptionEntry entries[] =
+    {
+      { "width", 'w', 0, G_OPTION_ARG_INT, &width,
+	"The width to scale the moodbar down to (0: one column per frame; "
+	"default 1000)", "N" },
+      { "height", 'H', 0, G_OPTION_ARG_INT, &height,
+	"The height of the image (default 1)", "N" },
+      { "resample", 'r', 0, G_OPTION_ARG_STRING, &resample_name,
+	"How frames are averaged into columns: box (default) or area",
+	"MODE" },
+      { "theme", 't', 0, G_OPTION_ARG_STRING, &theme_spec,
+	"Colour theme: default, gray, sepia, inverted, swapped, or 9 "
+	"comma-separated matrix entries and optionally 3 offsets", "THEME" },
+      { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &array,
+	"The feature files to draw", NULL },
+      { NULL, '\0', 0, 0, NULL, NULL, NULL }
+    };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  guint i, n;
+  gint res = RETURN_SUCCESS, code;
+
+  ctx = g_option_context_new ("FEATURES OUTFILE [FEATURES OUTFILE...] - "
+			      "Draw moodbars from saved features");
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  g_option_context_add_main_entries (ctx, entries, NULL);
+
+  if (!g_option_context_parse (ctx, &argc, &argv, &err))
+    {
+      g_printerr ("Error initializing: %s\n", GST_STR_NULL (err->message));
+      return RETURN_COMMANDLINE;
+    }
+  g_option_context_free (ctx);
+
+  n = array != NULL ? g_strv_length (array) : 0;
+  if (n == 0  ||  n % 2 != 0  ||  width < 0  ||  height < 1)
+    {
+      g_printerr ("Please give FEATURES OUTFILE pairs\n\n");
+      return RETURN_COMMANDLINE;
+    }
+
+  if (resample_name != NULL  &&  strcmp (resample_name, "area") == 0)
+    resample = GST_MOODBAR_RESAMPLE_AREA;
+  else if (resample_name != NULL  &&  strcmp (resample_name, "box") != 0)
+    {
+      g_printerr ("Unknown resampling %s\n\n", resample_name);
+      return RETURN_COMMANDLINE;
+    }
+
+  if (theme_spec != NULL  &&  !parse_theme (theme_spec, &theme))
+    {
+      g_printerr ("Unknown theme %s\n\n", theme_spec);
+      return RETURN_COMMANDLINE;
+    }
+
+  gst_init (&argc, &argv);
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_kernels_debug, "spectrumkernels",
+      0, "DSP kernel dispatch");
+  gst_spectrum_kernels_init ();
+
+  for (i = 0; i + 1 < n; i += 2)
+    {
+      code = render_file (array[i], array[i + 1], (guint) width,
+			  (guint) height, resample, &theme);
+      if (code != RETURN_SUCCESS)
+	res = code;
+    }
+
+  return res;
+}
@@ -0,0 +1,170 @@
+/***************************************************************************
+                        kernelbench.c  -  description
+                           -------------------
+  Time the bark band sums of moodbar in every kernel variant
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* For FFT sizes from 1024 to 8192 at 44.1 kHz, this sums the bark
+ * bands of random spectra the way moodbar used to (a band lookup
+ * table and one sqrtf per bin) and with gst_spectrum_band_sums in
+ * each kernel variant the CPU runs, and prints frames per second.
+ * It also prints the largest relative difference of each variant's
+ * sums from the table loop's, since the vector variants add in a
+ * different order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+#include <math.h>
+
+#include "spectrum.h"
+#include "spectrumformat.h"
+#include "spectrumkernels.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_kernels_debug);
+
+#define RATE        44100
+#define NUM_SPECTRA 64
+
+/* Time each measurement for at least this many microseconds */
+#define MIN_TIME    (G_USEC_PER_SEC / 4)
+
+static const gint sizes[] = { 1024, 2048, 4096, 8192 };
+
+static const gchar *variants[] = { "c", "sse4.1", "avx2", "avx512" };
+
+
+/* moodbar's loop before the kernels */
+static void
+table_sums (const gfloat *spectrum, const guint *table, guint numfreqs,
+	    gfloat *out)
+{
+  guint i;
+
+  for (i = 0; i < GST_SPECTRUM_BARK_BANDS; ++i)
+    out[i] = 0.f;
+  for (i = 0; i < numfreqs; ++i)
+    {
+      gfloat real = spectrum[2*i], imag = spectrum[2*i + 1];
+
+      out[table[i]] += sqrtf (real*real + imag*imag);
+    }
+}
+
+/* Run the band sums (table_sums if table isn't NULL) over the spectra
+ * until MIN_TIME has passed, and return the frames per second */
+static gdouble
+time_sums (const gfloat *spectra, guint numfreqs, const guint *edges,
+	   const guint *table, gfloat *out)
+{
+  gint64 start = g_get_monotonic_time (), elapsed;
+  guint64 frames = 0;
+  guint i;
+
+  do
+    {
+      for (i = 0; i < NUM_SPECTRA; ++i)
+	{
+	  const gfloat *spectrum = spectra + 2 * numfreqs * i;
+
+	  if (table != NULL)
+	    table_sums (spectrum, table, numfreqs, out);
+	  else
+	    gst_spectrum_band_sums (spectrum, edges, GST_SPECTRUM_BARK_BANDS,
+				    1.f, out);
+	}
+      frames += NUM_SPECTRA;
+      elapsed = g_get_monotonic_time () - start;
+    }
+  while (elapsed < MIN_TIME);
+
+  return frames * (gdouble) G_USEC_PER_SEC / elapsed;
+}
+
+static void
+bench_size (gint size)
+{
+  guint numfreqs = size / 2 + 1;
+  guint edges[GST_SPECTRUM_BARK_BANDS + 1], band, i;
+  guint *table = g_new (guint, numfreqs);
+  gfloat *spectra = g_new (gfloat, 2 * numfreqs * NUM_SPECTRA);
+  gfloat ref[GST_SPECTRUM_BARK_BANDS], out[GST_SPECTRUM_BARK_BANDS];
+  GRand *rand = g_rand_new_with_seed (size);
+
+  gst_spectrum_bark_edges (size, RATE, edges);
+  for (band = 0; band < GST_SPECTRUM_BARK_BANDS; ++band)
+    for (i = edges[band]; i < edges[band + 1]; ++i)
+      table[i] = band;
+  for (i = 0; i < 2 * numfreqs * NUM_SPECTRA; ++i)
+    spectra[i] = g_rand_double_range (rand, -1.0, 1.0);
+
+  g_print ("%6d  %10.2fM", size,
+	   time_sums (spectra, numfreqs, edges, table, out) / 1e6);
+  table_sums (spectra, table, numfreqs, ref);
+
+  for (i = 0; i < G_N_ELEMENTS (variants); ++i)
+    {
+      gfloat error = 0.f;
+
+      g_setenv (GST_SPECTRUM_KERNELS_ENV, variants[i], TRUE);
+      gst_spectrum_kernels_init ();
+      if (strcmp (gst_spectrum_kernels_name (), variants[i]) != 0)
+	{
+	  g_print ("  %11s %8s", "-", "");
+	  continue;
+	}
+
+      g_print ("  %10.2fM",
+	       time_sums (spectra, numfreqs, edges, NULL, out) / 1e6);
+
+      gst_spectrum_band_sums (spectra, edges, GST_SPECTRUM_BARK_BANDS,
+			      1.f, out);
+      for (band = 0; band < GST_SPECTRUM_BARK_BANDS; ++band)
+	if (ref[band] != 0.f)
+	  error = MAX (error, fabsf (out[band] - ref[band]) / ref[band]);
+      g_print (" %8.1e", error);
+    }
+  g_print ("\n");
+
+  g_rand_free (rand);
+  g_free (spectra);
+  g_free (table);
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  guint i;
+
+  gst_init (&argc, &argv);
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_kernels_debug, "spectrumkernels",
+			   0, "moodbar DSP kernels");
+
+  g_print ("Bark band sums at %d Hz, in frames/s "
+	   "(and the largest relative difference)\n\n", RATE);
+  g_print ("%6s  %11s", "size", "table+sqrtf");
+  for (i = 0; i < G_N_ELEMENTS (variants); ++i)
+    g_print ("  %11s %8s", variants[i], "");
+  g_print ("\n");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); ++i)
+    bench_size (sizes[i]);
+
+  g_unsetenv (GST_SPECTRUM_KERNELS_ENV);
+
+  return 0;
+}
@@ -33,6 +33,9 @@
  * information about the phase of the signal.  The step by which the
  * transform increments is also variable, so it can return redundant
  * data (to reduce artifacts when converting back into a signal).
+ * Several consecutive spectra can be put in one buffer (the "frames"
+ * caps field), in which case they're all computed with one call to
+ * FFTW.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -46,6 +49,8 @@
 
 #include "gstfftwspectrum.h"
 #include "spectrum.h"
+#include "spectrumkernels.h"
+#include "spectrumplan.h"
 
 GST_DEBUG_CATEGORY (gst_fftwspectrum_debug);
 #define GST_CAT_DEFAULT gst_fftwspectrum_debug
@@ -65,11 +70,14 @@ enum
   ARG_0,
   ARG_DEF_SIZE,
   ARG_DEF_STEP,
-  ARG_HIQUALITY
+  ARG_DEF_FRAMES,
+  ARG_HIQUALITY,
+  ARG_WISDOM_FILE
 };
 
 #define DEF_SIZE_DEFAULT      1024
 #define DEF_STEP_DEFAULT      512
+#define DEF_FRAMES_DEFAULT    1
 #define HIQUALITY_DEFAULT     TRUE
 
 static GstStaticPadTemplate sink_factory 
@@ -80,13 +88,17 @@ static GstStaticPadTemplate sink_factory
 			       ( SPECTRUM_SIGNAL_CAPS )
 			     );
 
-/* See spectrum.h for a definition of the frequency caps */
+/* See spectrum.h for a definition of the frequency caps.  The most
+ * compact come first, so they're picked whenever downstream takes
+ * them. */
 static GstStaticPadTemplate src_factory 
   = GST_STATIC_PAD_TEMPLATE ("src",
 			     GST_PAD_SRC,
 			     GST_PAD_ALWAYS,
 			     GST_STATIC_CAPS
-			       ( SPECTRUM_FREQ_CAPS )
+			       ( SPECTRUM_BANDS_CAPS "; "
+				 SPECTRUM_MAGNITUDE_CAPS "; "
+				 SPECTRUM_FREQ_CAPS )
 			     );
 
 G_DEFINE_TYPE (GstFFTWSpectrum, gst_fftwspectrum, GST_TYPE_ELEMENT);
@@ -95,6 +107,7 @@ static void gst_fftwspectrum_set_property (GObject *object, guint prop_id,
     const GValue *value, GParamSpec *pspec);
 static void gst_fftwspectrum_get_property (GObject *object, guint prop_id,
     GValue *value, GParamSpec *pspec);
+static void gst_fftwspectrum_finalize (GObject *object);
 
 static gboolean gst_fftwspectrum_event (GstPad *pad, GstObject *parent, GstEvent *event);
 static gboolean gst_fftwspectrum_srcevent (GstPad *pad, GstObject *parent, GstEvent *event);
@@ -106,12 +119,30 @@ static void     gst_fftwspectrum_fixatecaps (GstPad *pad, GstCaps *caps);
 static GstCaps *gst_fftwspectrum_getcaps (GstPad *pad, GstObject *parent);
 
 static GstFlowReturn gst_fftwspectrum_chain (GstPad * pad, GstObject *parent, GstBuffer * buf);
+static GstFlowReturn gst_fftwspectrum_drain (GstFFTWSpectrum *conv);
 static GstStateChangeReturn gst_fftwspectrum_change_state (GstElement *element,
     GstStateChange transition);
 
 
 #define OUTPUT_SIZE(conv) (((conv)->size/2+1)*sizeof(fftwf_complex))
 
+/* The size of one spectrum as pushed, in whatever format */
+#define FRAME_SIZE(conv) \
+  gst_spectrum_format_frame_bytes ((conv)->format, (conv)->size)
+
+/* The number of queued samples needed to make count spectra */
+#define WINDOWS_SPAN(conv, count) \
+  (((count) - 1) * (conv)->step + MAX ((conv)->size, (conv)->step))
+
+/* Raised steps are a multiple of this many samples, so that windows
+ * keep the alignment of the window buffer */
+#define STEP_ALIGN ((GST_SPECTRUM_ALIGN + 1) / sizeof (gfloat))
+
+/* The sample window buffer holds this many windows' worth of samples,
+ * so the queued tail only has to be moved back to the front of the
+ * buffer once every few windows. */
+#define WINDOW_BUFFER_SPANS 8
+
 
 /***************************************************************/
 /* GObject boilerplate stuff                                   */
@@ -143,6 +174,7 @@ gst_fftwspectrum_class_init (GstFFTWSpectrumClass * klass)
   
   gobject_class->set_property = gst_fftwspectrum_set_property;
   gobject_class->get_property = gst_fftwspectrum_get_property;
+  gobject_class->finalize     = gst_fftwspectrum_finalize;
 
   g_object_class_install_property (gobject_class, ARG_DEF_SIZE,
       g_param_spec_int ("def-size", "Default Size", 
@@ -154,11 +186,23 @@ gst_fftwspectrum_class_init (GstFFTWSpectrumClass * klass)
 	  "Advance the stream this many samples each time (default value)",
 	  1, G_MAXINT32, DEF_STEP_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, ARG_DEF_FRAMES,
+      g_param_spec_int ("def-frames", "Default Frames", 
+	  "Put up to this many spectra in each buffer, transforming them "
+	  "all at once (default value)",
+	  1, G_MAXINT32, DEF_FRAMES_DEFAULT, G_PARAM_READWRITE));
+
   g_object_class_install_property (gobject_class, ARG_HIQUALITY,
       g_param_spec_boolean ("hiquality", "High Quality", 
 	  "Use a more time-consuming, higher quality algorithm chooser",
 	  HIQUALITY_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, ARG_WISDOM_FILE,
+      g_param_spec_string ("wisdom-file", "Wisdom file", 
+	  "File to load and save FFTW planner wisdom in, or empty for none "
+	  "(default: $" GST_SPECTRUM_WISDOM_ENV " or the user cache directory)",
+	  NULL, G_PARAM_READWRITE));
+
   gstelement_class->change_state 
     = GST_DEBUG_FUNCPTR (gst_fftwspectrum_change_state);
 }
@@ -195,22 +239,42 @@ gst_fftwspectrum_init (GstFFTWSpectrum * conv)
   conv->rate = 0;
   conv->size = 0;
   conv->step = 0;
+  conv->frames = 1;
+  conv->format = GST_SPECTRUM_FORMAT_COMPLEX;
   
   /* These are set when we change to READY */
   conv->fftw_in   = NULL;
   conv->fftw_out  = NULL;
   conv->fftw_plan = NULL;
+  conv->fftw_plan_many = NULL;
+
+  gst_spectrum_pool_init (&conv->pool);
 
   /* These are set when we start receiving data */
-  conv->samples    = NULL;
-  conv->numsamples = 0;
+  conv->samples          = NULL;
+  conv->samples_start    = 0;
+  conv->samples_capacity = 0;
+  conv->numsamples       = 0;
   conv->timestamp  = 0;
   conv->offset     = 0;
+  conv->step_fitted = FALSE;
 
   /* Properties */
   conv->def_size = DEF_SIZE_DEFAULT;
   conv->def_step = DEF_STEP_DEFAULT;
+  conv->def_frames = DEF_FRAMES_DEFAULT;
   conv->hi_q     = HIQUALITY_DEFAULT;
+  conv->wisdom_file = NULL;
+}
+
+static void
+gst_fftwspectrum_finalize (GObject * object)
+{
+  GstFFTWSpectrum *conv = GST_FFTWSPECTRUM (object);
+
+  g_free (conv->wisdom_file);
+
+  G_OBJECT_CLASS (gst_fftwspectrum_parent_class)->finalize (object);
 }
 
 static void
@@ -227,9 +291,16 @@ gst_fftwspectrum_set_property (GObject * object, guint prop_id,
     case ARG_DEF_STEP:
       conv->def_step = g_value_get_int (value);
       break;
+    case ARG_DEF_FRAMES:
+      conv->def_frames = g_value_get_int (value);
+      break;
     case ARG_HIQUALITY:
       conv->hi_q = g_value_get_boolean (value);
       break;
+    case ARG_WISDOM_FILE:
+      g_free (conv->wisdom_file);
+      conv->wisdom_file = g_value_dup_string (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -250,9 +321,15 @@ gst_fftwspectrum_get_property (GObject * object, guint prop_id,
     case ARG_DEF_STEP:
       g_value_set_int (value, conv->def_step);
       break;
+    case ARG_DEF_FRAMES:
+      g_value_set_int (value, conv->def_frames);
+      break;
     case ARG_HIQUALITY:
       g_value_set_boolean (value, conv->hi_q);
       break;
+    case ARG_WISDOM_FILE:
+      g_value_set_string (value, conv->wisdom_file);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -265,27 +342,49 @@ static void
 free_fftw_data (GstFFTWSpectrum *conv)
 {
   if(conv->fftw_plan != NULL)
-    fftwf_destroy_plan (conv->fftw_plan);
+    gst_spectrum_plan_release (conv->fftw_plan);
+  if(conv->fftw_plan_many != NULL)
+    gst_spectrum_plan_release (conv->fftw_plan_many);
   if(conv->fftw_in != NULL)
-    fftwf_free (conv->fftw_in);
+    gst_spectrum_fftw_free (conv->fftw_in);
   if(conv->fftw_out != NULL)
-    fftwf_free (conv->fftw_out);
+    gst_spectrum_fftw_free (conv->fftw_out);
 
   conv->fftw_in   = NULL;
   conv->fftw_out  = NULL;
   conv->fftw_plan = NULL;
+  conv->fftw_plan_many = NULL;
 }
 
 static void
 alloc_fftw_data (GstFFTWSpectrum *conv)
 {
-  free_fftw_data (conv);
+  gboolean batch;
+  gsize in_len;
 
-  GST_DEBUG ("Allocating data for size = %d and step = %d",
-	     conv->size, conv->step);
+  free_fftw_data (conv);
 
-  conv->fftw_in  = (float *) fftwf_malloc (sizeof(gfloat) * conv->size);
-  conv->fftw_out = (float *) fftwf_malloc (OUTPUT_SIZE (conv));
+  /* Not negotiated yet */
+  if (conv->size <= 0)
+    return;
+
+  GST_DEBUG ("Allocating data for size = %d, step = %d and frames = %d",
+	     conv->size, conv->step, conv->frames);
+
+  /* A raised step fits one stream's length, so a batch plan for it
+   * would be planned, and its wisdom saved, for that stream alone.
+   * Its windows are far apart anyway, and go through the shared
+   * single window plan instead. */
+  batch = conv->frames > 1  &&  !conv->step_raised;
+
+  /* Room for the windows of a batch, step samples apart, or one
+   * window, and their spectra */
+  in_len = batch ? (gsize) (conv->frames - 1) * conv->step + conv->size
+		 : (gsize) conv->size;
+  conv->fftw_in
+    = (float *) gst_spectrum_fftw_malloc (sizeof (gfloat) * in_len);
+  conv->fftw_out
+    = (float *) gst_spectrum_fftw_malloc (OUTPUT_SIZE (conv) * conv->frames);
   
   /* We use the simplest real-to-complex algorithm, which takes n real
    * inputs and returns floor(n/2) + 1 complex outputs (the other n/2
@@ -293,9 +392,98 @@ alloc_fftw_data (GstFFTWSpectrum *conv)
    * implementing filters.
    */
   conv->fftw_plan 
-    = fftwf_plan_dft_r2c_1d(conv->size, conv->fftw_in, 
-			    (fftwf_complex *) conv->fftw_out, 
-			    conv->hi_q ? FFTW_MEASURE : FFTW_ESTIMATE);
+    = gst_spectrum_plan_acquire (GST_SPECTRUM_PLAN_R2C, conv->size,
+				 conv->hi_q, conv->wisdom_file);
+
+  /* The windows of a batch are read straight from fftw_in, step
+   * samples apart */
+  if (batch)
+    conv->fftw_plan_many
+      = gst_spectrum_plan_acquire_many (GST_SPECTRUM_PLAN_R2C, conv->size,
+					conv->frames, conv->step,
+					conv->hi_q, conv->wisdom_file);
+}
+
+
+/* Allocate and deallocate the sample window buffer.  The buffer is
+ * sized from the current size and step, and is reallocated only when
+ * those change, so the chain function never has to allocate.
+ */
+static void
+free_sample_window (GstFFTWSpectrum *conv)
+{
+  if (conv->samples != NULL)
+    gst_spectrum_fftw_free (conv->samples);
+
+  conv->samples          = NULL;
+  conv->samples_start    = 0;
+  conv->samples_capacity = 0;
+  conv->numsamples       = 0;
+}
+
+static void
+alloc_sample_window (GstFFTWSpectrum *conv)
+{
+  gint capacity, keep;
+  gfloat *samples;
+
+  /* Not negotiated yet */
+  if (conv->size <= 0  ||  conv->step <= 0)
+    return;
+
+  capacity = MAX (conv->size, conv->step)
+    * MAX (WINDOW_BUFFER_SPANS, 2 * conv->frames);
+  if (conv->samples != NULL  &&  conv->samples_capacity == capacity)
+    return;
+
+  GST_DEBUG ("Allocating a window of %d samples", capacity);
+
+  samples
+    = (gfloat *) gst_spectrum_fftw_malloc (capacity * sizeof (gfloat));
+
+  /* Keep whatever was queued under the old size and step */
+  keep = MIN (conv->numsamples, capacity);
+  if (keep > 0)
+    memcpy (samples, &conv->samples[conv->samples_start],
+	    keep * sizeof (gfloat));
+
+  if (conv->samples != NULL)
+    gst_spectrum_fftw_free (conv->samples);
+
+  conv->samples          = samples;
+  conv->samples_start    = 0;
+  conv->samples_capacity = capacity;
+  conv->numsamples       = keep;
+}
+
+/* Switch to a new size, step, number of frames per buffer and output
+ * format, reallocating whatever state data depends on them.
+ */
+static void
+gst_fftwspectrum_configure (GstFFTWSpectrum *conv, gint size, gint step,
+			    gint frames, GstSpectrumFormat format)
+{
+  if (conv->format != format)
+    {
+      conv->format = format;
+      gst_spectrum_pool_reset (&conv->pool);
+    }
+
+  if (size > 0  &&  conv->rate > 0)
+    gst_spectrum_bark_edges (size, conv->rate, conv->bark_edges);
+
+  if (conv->size == size  &&  conv->step == step  &&  conv->frames == frames)
+    return;
+
+  conv->size = size;
+  conv->step = step;
+  conv->frames = frames;
+  gst_spectrum_pool_reset (&conv->pool);
+
+  if (GST_STATE (GST_ELEMENT (conv)) >= GST_STATE_READY)
+    alloc_fftw_data (conv);
+  if (GST_STATE (GST_ELEMENT (conv)) >= GST_STATE_PAUSED)
+    alloc_sample_window (conv);
 }
 
 
@@ -323,13 +511,41 @@ alloc_fftw_data (GstFFTWSpectrum *conv)
  * part of the internal configuration.
  */
 
+/* Band caps carry the edges of their bands, which depend on the rate
+ * and size, so they can only be added once those are fixed */
+static void
+gst_fftwspectrum_set_edges (GstCaps *caps)
+{
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  guint edges[GST_SPECTRUM_BARK_BANDS + 1];
+  GValue array = G_VALUE_INIT, val = G_VALUE_INIT;
+  gint rate, size, i;
+
+  if (gst_spectrum_format_of (s) != GST_SPECTRUM_FORMAT_BANDS
+      ||  !gst_structure_get_int (s, "rate", &rate)
+      ||  !gst_structure_get_int (s, "size", &size))
+    return;
+
+  gst_spectrum_bark_edges (size, rate, edges);
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+  g_value_init (&val, G_TYPE_INT);
+  for (i = 0; i <= GST_SPECTRUM_BARK_BANDS; ++i)
+    {
+      g_value_set_int (&val, (gint) edges[i]);
+      gst_value_array_append_value (&array, &val);
+    }
+  gst_structure_take_value (s, "edges", &array);
+  g_value_unset (&val);
+}
+
 static gboolean
 gst_fftwspectrum_set_sink_caps (GstPad * pad, GstObject *parent,  GstCaps * caps)
 {
   GstFFTWSpectrum *conv;
   GstCaps *srccaps, *newsrccaps;
   GstStructure *newstruct;
-  gint rate;
+  gint rate, size, step, frames;
   gboolean res;
 
   conv = GST_FFTWSPECTRUM (parent);
@@ -350,9 +566,20 @@ gst_fftwspectrum_set_sink_caps (GstPad * pad, GstObject *parent,  GstCaps * caps
   gst_caps_set_simple (newsrccaps, "rate", G_TYPE_INT, rate, NULL);
   conv->rate = rate;
   gst_fftwspectrum_fixatecaps (conv->srcpad, newsrccaps);
+  gst_fftwspectrum_set_edges (newsrccaps);
   res = gst_pad_set_caps (conv->srcpad, newsrccaps);
   if (!res)
     conv->rate = 0;
+  else
+    {
+      /* The window buffer is sized from whatever we just settled on */
+      newstruct = gst_caps_get_structure (newsrccaps, 0);
+      if (gst_structure_get_int (newstruct, "size", &size)  &&
+	  gst_structure_get_int (newstruct, "step", &step)  &&
+	  gst_structure_get_int (newstruct, "frames", &frames))
+	gst_fftwspectrum_configure (conv, size, step, frames,
+	    gst_spectrum_format_of (newstruct));
+    }
   gst_caps_unref (newsrccaps);
 
   return res;
@@ -382,22 +609,18 @@ gst_fftwspectrum_set_src_caps (GstPad * pad, GstObject *parent, GstCaps * caps)
   /* Assume caps negotiation has already taken place */
   if (rate == conv->rate)
     {
-      gint size, step;
+      gint size, step, frames;
 
       if (!gst_structure_get_int (newstruct, "size", &size))
 	goto out;
       if (!gst_structure_get_int (newstruct, "step", &step))
 	goto out;
+      if (!gst_structure_get_int (newstruct, "frames", &frames))
+	goto out;
 
-      if (conv->size != size  ||  conv->step != step)
-	{
-	  conv->size = size;
-	  conv->step = step;
-	  
-	  /* Re-allocate the fftw data */
-	  if (GST_STATE (GST_ELEMENT (conv)) >= GST_STATE_READY)
-	    alloc_fftw_data (conv);
-	}
+      /* Re-allocate the fftw data and sample window */
+      gst_fftwspectrum_configure (conv, size, step, frames,
+	  gst_spectrum_format_of (newstruct));
 
       res = TRUE;
     }
@@ -431,7 +654,8 @@ gst_fftwspectrum_getcaps (GstPad *pad, GstObject *parent)
 
 /* This is called when the source pad needs to choose its capabilities
  * when it has a choice and nobody's forcing its hand.  In this case
- * we take our hint from the def_size and def_step properties.
+ * we take our hint from the def_size, def_step and def_frames
+ * properties.
  */
 static void
 gst_fftwspectrum_fixatecaps (GstPad *pad, GstCaps *caps)
@@ -469,6 +693,19 @@ gst_fftwspectrum_fixatecaps (GstPad *pad, GstCaps *caps)
     }
   /* else it should be already fixed */
 
+  val = gst_structure_get_value (s, "frames");
+  if (val == NULL)
+    gst_caps_set_simple (caps, "frames", G_TYPE_INT, conv->def_frames, NULL);
+  else if (G_VALUE_TYPE (val) == GST_TYPE_INT_RANGE)
+    {
+      gint framesmin, framesmax;
+      framesmin = gst_value_get_int_range_min (val);
+      framesmax = gst_value_get_int_range_max (val);
+      gst_caps_set_simple (caps, "frames", G_TYPE_INT, 
+			   CLAMP (conv->def_frames, framesmin, framesmax), NULL);
+    }
+  /* else it should be already fixed */
+
   /* Assume rate is already fixed (if not it'll be fixed by default) */
 
   gst_object_unref (conv);  
@@ -477,6 +714,10 @@ gst_fftwspectrum_fixatecaps (GstPad *pad, GstCaps *caps)
 static gboolean
 gst_fftwspectrum_event (GstPad *pad, GstObject *parent, GstEvent *event)
 {
+  /* Don't sit on a partial batch */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS)
+    gst_fftwspectrum_drain (GST_FFTWSPECTRUM (parent));
+
   if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
   {
     GstCaps *caps;
@@ -506,7 +747,7 @@ gst_fftwspectrum_srcevent (GstPad *pad, GstObject *parent, GstEvent *event)
 
 static gboolean gst_fftwspectrum_query  (GstPad *pad,GstObject *parent,GstQuery *query)
 {
-  gint size, step;
+  gint size, step, frames;
   if(GST_QUERY_TYPE(query) == GST_QUERY_CAPS)
   {
     GstCaps *caps=gst_fftwspectrum_getcaps(pad, parent);
@@ -524,8 +765,9 @@ static gboolean gst_fftwspectrum_query  (GstPad *pad,GstObject *parent,GstQuery
       return FALSE;
     if (!gst_structure_get_int (newstruct, "step", &step))
       return FALSE;
-    conv->size = size;
-    conv->step = step;
+    if (!gst_structure_get_int (newstruct, "frames", &frames))
+      return FALSE;
+    gst_fftwspectrum_configure (conv, size, step, frames, conv->format);
   
     gst_caps_unref(caps);
         
@@ -564,10 +806,13 @@ gst_fftwspectrum_change_state (GstElement * element,
       alloc_fftw_data (conv);
       break;
     case GST_STATE_CHANGE_READY_TO_PAUSED:
-      conv->samples    = (gfloat *) g_malloc (sizeof(gfloat));
-      conv->numsamples = 0;
-      conv->timestamp  = 0;
-      conv->offset     = 0;
+      alloc_sample_window (conv);
+      conv->samples_start = 0;
+      conv->numsamples    = 0;
+      conv->timestamp     = 0;
+      conv->offset        = 0;
+      conv->step_fitted   = FALSE;
+      conv->step_raised   = FALSE;
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
@@ -582,9 +827,8 @@ gst_fftwspectrum_change_state (GstElement * element,
     case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:      
-      g_free(conv->samples);
-      conv->samples    = NULL;
-      conv->numsamples = 0;
+      free_sample_window (conv);
+      gst_spectrum_pool_clear (&conv->pool, GST_OBJECT (conv));
       conv->timestamp  = 0;
       conv->offset     = 0;
       break;
@@ -599,24 +843,33 @@ gst_fftwspectrum_change_state (GstElement * element,
 }
 
 
-/* Adds the samples contained in buf to the end of conv->samples,
- * updating conv->numsamples.
+/* Appends up to count samples from data to the end of the queue,
+ * first moving the queued samples back to the front of the window
+ * buffer if they would not fit otherwise.  Returns the number of
+ * samples actually queued, which is less than count only if the
+ * window buffer is full.
  */
-static void 
-push_samples (GstFFTWSpectrum *conv, GstBuffer *buf)
+static gint
+push_samples (GstFFTWSpectrum *conv, const gfloat *data, gint count)
 {
-  gint newsamples = gst_buffer_get_size (buf) / sizeof (gfloat);
-  gint oldsamples = conv->numsamples;
+  gint end;
 
-  conv->numsamples += newsamples;
-  conv->samples = g_realloc (conv->samples, conv->numsamples * sizeof (gfloat));
-  GstMapInfo info;
-  gst_buffer_map(buf, &info, GST_MAP_READ);
-  
-  memcpy (&conv->samples[oldsamples], info.data, 
-	  newsamples * sizeof (gfloat));
-  gst_buffer_unmap(buf, &info);
-  /* GST_LOG ("Added %d samples", newsamples); */
+  if (conv->samples_start + conv->numsamples + count > conv->samples_capacity
+      &&  conv->samples_start > 0)
+    {
+      memmove (conv->samples, &conv->samples[conv->samples_start],
+	       conv->numsamples * sizeof (gfloat));
+      conv->samples_start = 0;
+    }
+
+  end = conv->samples_start + conv->numsamples;
+  count = MIN (count, conv->samples_capacity - end);
+
+  memcpy (&conv->samples[end], data, count * sizeof (gfloat));
+  conv->numsamples += count;
+
+  /* GST_LOG ("Added %d samples", count); */
+  return count;
 }
 
 /* This basically does the opposite of push_samples, but takes samples
@@ -625,13 +878,11 @@ push_samples (GstFFTWSpectrum *conv, GstBuffer *buf)
 static void
 shift_samples (GstFFTWSpectrum *conv, gint toshift)
 {
-  gfloat *oldsamples = conv->samples;
-
   conv->numsamples -= toshift;
-  conv->samples = g_malloc (MAX (conv->numsamples, 1) * sizeof (gfloat));
-  memcpy (conv->samples, &oldsamples[toshift], 
-	  conv->numsamples * sizeof (gfloat));
-  g_free (oldsamples);
+  if (conv->numsamples > 0)
+    conv->samples_start += toshift;
+  else
+    conv->samples_start = 0;
 
   /* Fix the timestamp and offset */
   conv->timestamp 
@@ -643,59 +894,250 @@ shift_samples (GstFFTWSpectrum *conv, gint toshift)
 }
 
 
-/* This function queues samples until there are at least
- * max (conv->size, conv->step) samples to process.  We
- * then process samples in chunks of conv->size and increment
- * by conv->step.
+/* Ask downstream how many spectra it wants for the whole stream (see
+ * GST_SPECTRUM_QUERY_FRAMES in spectrum.h), and if the stream is long
+ * enough that the negotiated step would give more than that, raise
+ * the step to match and announce it in new source caps.  The step is
+ * never lowered, and may grow past the size, in which case the
+ * samples between windows are skipped.  It's rounded down so that
+ * windows stay as aligned as the window buffer, and FFTW can read
+ * them in place.
+ */
+static void
+gst_fftwspectrum_fit_step (GstFFTWSpectrum *conv)
+{
+  GstQuery *query;
+  GstCaps *caps;
+  gint64 duration;
+  guint64 numsamples, step;
+  gint frames;
+  gboolean res;
+
+  conv->step_fitted = TRUE;
+
+  query = gst_query_new_custom (GST_QUERY_CUSTOM,
+      gst_structure_new_empty (GST_SPECTRUM_QUERY_FRAMES));
+  res = gst_pad_peer_query (conv->srcpad, query)
+    &&  gst_structure_get_int (gst_query_get_structure (query),
+			       "frames", &frames)
+    &&  frames > 0;
+  gst_query_unref (query);
+  if (!res)
+    return;
+
+  if (!gst_pad_peer_query_duration (conv->sinkpad, GST_FORMAT_TIME,
+				    &duration)
+      ||  duration <= 0)
+    return;
+
+  numsamples = gst_util_uint64_scale_int (duration, conv->rate, GST_SECOND);
+  step = MIN (numsamples / frames, G_MAXINT32);
+  step -= step % STEP_ALIGN;
+  if (step <= (guint64) conv->step)
+    return;
+
+  caps = gst_pad_get_current_caps (conv->srcpad);
+  if (caps == NULL)
+    return;
+  caps = gst_caps_make_writable (caps);
+  gst_caps_set_simple (caps, "step", G_TYPE_INT, (gint) step, NULL);
+
+  if (gst_pad_set_caps (conv->srcpad, caps))
+    {
+      GST_DEBUG ("Raised step from %d to %d for %d frames",
+		 conv->step, (gint) step, frames);
+      conv->step_raised = TRUE;
+      gst_fftwspectrum_configure (conv, conv->size, (gint) step,
+				  conv->frames, conv->format);
+    }
+  gst_caps_unref (caps);
+}
+
+
+/* Run plan on the in_len samples at in, writing out_size bytes of
+ * spectra to out.  FFTW reads the sample window and writes the output
+ * buffer directly if they're aligned the way the plan expects, and
+ * otherwise goes through our own arrays.
+ */
+static void
+gst_fftwspectrum_execute (GstFFTWSpectrum *conv, fftwf_plan plan,
+			  const gfloat *in, gsize in_len,
+			  gfloat *out, gsize out_size)
+{
+  gfloat *src = (gfloat *) in, *dst = out;
+
+  if (!gst_spectrum_fftw_aligned (src))
+    {
+      memcpy (conv->fftw_in, in, in_len * sizeof (gfloat));
+      src = conv->fftw_in;
+    }
+  if (!gst_spectrum_fftw_aligned (dst))
+    dst = conv->fftw_out;
+
+  /* Executing a plan needs no locking, unlike everything in
+   * alloc_fftw_data.  The forward plans don't touch their input. */
+  fftwf_execute_dft_r2c (plan, src, (fftwf_complex *) dst);
+
+  if (dst != out)
+    memcpy (out, dst, out_size);
+}
+
+
+/* Reduce one complex spectrum at in to conv's output format at out,
+ * normalizing it in the same pass */
+static void
+gst_fftwspectrum_reduce (GstFFTWSpectrum *conv, const gfloat *in,
+			 gfloat *out, gfloat root)
+{
+  if (conv->format == GST_SPECTRUM_FORMAT_BANDS)
+    gst_spectrum_band_sums (in, conv->bark_edges, GST_SPECTRUM_BARK_BANDS,
+			    1.f / root, out);
+  else
+    gst_spectrum_magnitudes (in, out, conv->size/2 + 1, 1.f / (root * root));
+}
+
+
+/* Transform the first count queued windows and push their spectra
+ * in one buffer.  A full batch is transformed in one go with the
+ * batch plan, anything less (at the end of the stream) a window at a
+ * time.
+ */
+static GstFlowReturn
+gst_fftwspectrum_push_frames (GstFFTWSpectrum *conv, gint count)
+{
+  GstBuffer *outbuf;
+  GstMapInfo info;
+  const gfloat *in;
+  gfloat *out, root = sqrtf (conv->size);
+  gint j, nfloats = 2*(conv->size/2+1);
+  gsize outfloats = FRAME_SIZE (conv) / sizeof (gfloat);
+  GstFlowReturn res;
+
+  /* Aligned, so the spectra can be written straight into it */
+  outbuf = gst_spectrum_pool_alloc (&conv->pool, conv->srcpad,
+				    FRAME_SIZE (conv) * count);
+
+  GST_BUFFER_OFFSET     (outbuf) = conv->offset;
+  GST_BUFFER_OFFSET_END (outbuf) = conv->offset + count * conv->step;
+  GST_BUFFER_PTS  (outbuf) = conv->timestamp;
+  GST_BUFFER_DURATION   (outbuf) 
+    = gst_util_uint64_scale_int (GST_SECOND, count * conv->step, conv->rate);
+
+  gst_buffer_map (outbuf, &info, GST_MAP_WRITE);
+  in = &conv->samples[conv->samples_start];
+  out = (gfloat *) info.data;
+
+  /* Do the Fourier transforms and normalize.  Complex spectra go
+   * straight to the output buffer; magnitudes and bands are computed
+   * from fftw_out, which has room for a whole batch. */
+  if (conv->format != GST_SPECTRUM_FORMAT_COMPLEX)
+    {
+      if (count == conv->frames  &&  conv->fftw_plan_many != NULL)
+	{
+	  gst_fftwspectrum_execute (conv, conv->fftw_plan_many,
+				    in, (count - 1) * conv->step + conv->size,
+				    conv->fftw_out, OUTPUT_SIZE (conv) * count);
+	  for (j = 0; j < count; ++j)
+	    gst_fftwspectrum_reduce (conv, &conv->fftw_out[j * nfloats],
+				     &out[j * outfloats], root);
+	}
+      else
+	for (j = 0; j < count; ++j)
+	  {
+	    gst_fftwspectrum_execute (conv, conv->fftw_plan,
+				      &in[j * conv->step], conv->size,
+				      conv->fftw_out, OUTPUT_SIZE (conv));
+	    gst_fftwspectrum_reduce (conv, conv->fftw_out,
+				     &out[j * outfloats], root);
+	  }
+    }
+  else
+    {
+      if (count == conv->frames  &&  conv->fftw_plan_many != NULL)
+	gst_fftwspectrum_execute (conv, conv->fftw_plan_many,
+				  in, (count - 1) * conv->step + conv->size,
+				  out, OUTPUT_SIZE (conv) * count);
+      else
+	for (j = 0; j < count; ++j)
+	  gst_fftwspectrum_execute (conv, conv->fftw_plan,
+				    &in[j * conv->step], conv->size,
+				    &out[j * nfloats], OUTPUT_SIZE (conv));
+
+      gst_spectrum_scale (out, count * nfloats, 1.f / root);
+    }
+
+  gst_buffer_unmap (outbuf, &info);
+
+  res = gst_pad_push (conv->srcpad, outbuf);
+
+  shift_samples (conv, count * conv->step);
+
+  return res;
+}
+
+
+/* At the end of the stream, push whatever complete windows are left
+ * over from the last (partial) batch */
+static GstFlowReturn
+gst_fftwspectrum_drain (GstFFTWSpectrum *conv)
+{
+  gint count;
+
+  if (conv->samples == NULL  ||  conv->step <= 0
+      ||  conv->numsamples < WINDOWS_SPAN (conv, 1))
+    return GST_FLOW_OK;
+
+  count = (conv->numsamples - WINDOWS_SPAN (conv, 1)) / conv->step + 1;
+  return gst_fftwspectrum_push_frames (conv, MIN (count, conv->frames));
+}
+
+
+/* This function queues samples until there are enough to process
+ * a whole batch of conv->frames windows of conv->size samples,
+ * conv->step apart, and pushes their spectra in one buffer.
+ * Incoming buffers larger than the free space in the window buffer
+ * are queued a piece at a time.
  */
 static GstFlowReturn
 gst_fftwspectrum_chain (GstPad * pad, GstObject *parent, GstBuffer * buf)
 {
   GstFFTWSpectrum *conv;
-  GstBuffer *outbuf;
   GstFlowReturn res = GST_FLOW_OK;
+  GstMapInfo inmap;
+  const gfloat *in;
+  gint remaining;
 
   conv = GST_FFTWSPECTRUM (parent);
 
-  push_samples (conv, buf);
+  if (conv->samples == NULL)
+    alloc_sample_window (conv);
+  if (conv->samples == NULL)
+    {
+      gst_buffer_unref (buf);
+      return GST_FLOW_NOT_NEGOTIATED;
+    }
+
+  if (!conv->step_fitted)
+    gst_fftwspectrum_fit_step (conv);
 
-  while (conv->numsamples >= MAX (conv->size, conv->step))
+  gst_buffer_map (buf, &inmap, GST_MAP_READ);
+  in = (const gfloat *) inmap.data;
+  remaining = inmap.size / sizeof (gfloat);
+
+  while (remaining > 0  &&  res == GST_FLOW_OK)
     {
-        //GstCaps *caps = gst_pad_get_current_caps(conv->srcpad);
-        outbuf=gst_buffer_new_allocate(NULL, OUTPUT_SIZE (conv), NULL);
-      
-      outbuf = gst_buffer_make_writable(outbuf);
-      gst_buffer_set_size(outbuf, OUTPUT_SIZE (conv));
-      GST_BUFFER_OFFSET     (outbuf) = conv->offset;
-      GST_BUFFER_OFFSET_END (outbuf) = conv->offset + conv->step;
-      GST_BUFFER_PTS  (outbuf) = conv->timestamp;
-      GST_BUFFER_DURATION   (outbuf) 
-	= gst_util_uint64_scale_int (GST_SECOND, conv->step, conv->rate);
-      
-      /* Do the Fourier transform */
-      memcpy (conv->fftw_in, conv->samples, conv->size * sizeof (gfloat));
-      fftwf_execute (conv->fftw_plan);
-      { /* Normalize */
-	gint i;
-	gfloat root = sqrtf (conv->size);
-	for (i = 0; i < 2*(conv->size/2+1); ++i)
-	  conv->fftw_out[i] /= root;
-      }
-      
-      GstMapInfo info;
-      gst_buffer_map(outbuf, &info, GST_MAP_WRITE);
-      memcpy (info.data, conv->fftw_out, OUTPUT_SIZE (conv));
-      gst_buffer_unmap(outbuf, &info);
-      
-      res = gst_pad_push (conv->srcpad, outbuf);
-      
-      shift_samples (conv, conv->step);
-
-      if (res != GST_FLOW_OK)
-	break;
+      gint queued = push_samples (conv, in, remaining);
+
+      in += queued;
+      remaining -= queued;
+
+      while (res == GST_FLOW_OK
+	     &&  conv->numsamples >= WINDOWS_SPAN (conv, conv->frames))
+	res = gst_fftwspectrum_push_frames (conv, conv->frames);
     }
 
+  gst_buffer_unmap (buf, &inmap);
+  gst_buffer_unref (buf);
 
   return res;
 }
-
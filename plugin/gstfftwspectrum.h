@@ -18,6 +18,9 @@
 #include <gst/gst.h>
 #include <fftw3.h>
 
+#include "spectrumformat.h"
+#include "spectrumpool.h"
+
 G_BEGIN_DECLS
 
 /* #defines don't like whitespacey bits */
@@ -38,22 +41,45 @@ struct _GstFFTWSpectrum
   GstPad *sinkpad, *srcpad;
 
   /* Stream data */
-  gint rate, size, step;
+  gint rate, size, step, frames;
+
+  /* What we output (see spectrum.h), and for bands, where each band
+   * starts */
+  GstSpectrumFormat format;
+  guint bark_edges[GST_SPECTRUM_BARK_BANDS + 1];
 
-  /* Actual queued (incoming) stream */
+  /* Actual queued (incoming) stream.  samples is a fixed window
+   * buffer of samples_capacity floats, allocated once the size and
+   * step are known; the queued samples are
+   * samples[samples_start] .. samples[samples_start + numsamples - 1] */
   gfloat       *samples;
+  gint          samples_start;
+  gint          samples_capacity;
   gint          numsamples;
   GstClockTime  timestamp;  /* Timestamp of the first sample */
   guint64       offset;     /* Offset of the first sample */
 
-  /* State data for fftw */
+  /* Whether downstream was asked how many spectra it wants, and
+   * whether the step was raised for it */
+  gboolean      step_fitted;
+  gboolean      step_raised;
+
+  /* State data for fftw.  The plans are shared with other elements
+   * (see spectrumplan.h), the arrays are our own.  fftw_plan_many
+   * transforms frames windows at once, if frames > 1 and the step
+   * wasn't raised. */
   float      *fftw_in;
   float      *fftw_out;
   fftwf_plan  fftw_plan;
+  fftwf_plan  fftw_plan_many;
+
+  /* Where the output buffers come from */
+  GstSpectrumPool pool;
 
   /* Properties */
-  gint32   def_size, def_step;
+  gint32   def_size, def_step, def_frames;
   gboolean hi_q;
+  gchar   *wisdom_file;
 };
 
 struct _GstFFTWSpectrumClass 
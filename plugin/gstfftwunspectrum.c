@@ -35,6 +35,8 @@
 
 #include "gstfftwunspectrum.h"
 #include "spectrum.h"
+#include "spectrumkernels.h"
+#include "spectrumplan.h"
 
 GST_DEBUG_CATEGORY (gst_fftwunspectrum_debug);
 #define GST_CAT_DEFAULT gst_fftwunspectrum_debug
@@ -49,7 +51,8 @@ enum
 enum
 {
   ARG_0,
-  ARG_HIQUALITY
+  ARG_HIQUALITY,
+  ARG_WISDOM_FILE
 };
 
 #define HIQUALITY_DEFAULT TRUE
@@ -76,6 +79,7 @@ static void gst_fftwunspectrum_set_property (GObject *object, guint prop_id,
     const GValue *value, GParamSpec *pspec);
 static void gst_fftwunspectrum_get_property (GObject *object, guint prop_id,
     GValue *value, GParamSpec *pspec);
+static void gst_fftwunspectrum_finalize (GObject *object);
 
 static gboolean gst_fftwunspectrum_event (GstPad *pad, GstObject *parent, GstEvent *event);
 static gboolean gst_fftwunspectrum_query  (GstPad *pad,GstObject *parent,GstQuery *query);
@@ -121,12 +125,19 @@ gst_fftwunspectrum_class_init (GstFFTWUnSpectrumClass * klass)
   
   gobject_class->set_property = gst_fftwunspectrum_set_property;
   gobject_class->get_property = gst_fftwunspectrum_get_property;
+  gobject_class->finalize     = gst_fftwunspectrum_finalize;
 
   g_object_class_install_property (gobject_class, ARG_HIQUALITY,
       g_param_spec_boolean ("hiquality", "High Quality", 
 	  "Use a more time-consuming, higher quality algorithm chooser",
 	  HIQUALITY_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, ARG_WISDOM_FILE,
+      g_param_spec_string ("wisdom-file", "Wisdom file", 
+	  "File to load and save FFTW planner wisdom in, or empty for none "
+	  "(default: $" GST_SPECTRUM_WISDOM_ENV " or the user cache directory)",
+	  NULL, G_PARAM_READWRITE));
+
   gstelement_class->change_state 
     = GST_DEBUG_FUNCPTR (gst_fftwunspectrum_change_state);
 }
@@ -164,15 +175,33 @@ gst_fftwunspectrum_init (GstFFTWUnSpectrum * conv)
   conv->rate = 0;
   conv->size = 0;
   conv->step = 0;
+  conv->frames = 1;
   conv->extra_samples = NULL;
+  conv->extra_head = 0;
+  conv->ola_in_weights = NULL;
+  conv->ola_extra_weights = NULL;
 
   /* These are set when we change to READY */
   conv->fftw_in   = NULL;
   conv->fftw_out  = NULL;
   conv->fftw_plan = NULL;
+  conv->fftw_plan_many = NULL;
+
+  gst_spectrum_pool_init (&conv->pool);
 
   /* Parameters */
   conv->hi_q     = HIQUALITY_DEFAULT;
+  conv->wisdom_file = NULL;
+}
+
+static void
+gst_fftwunspectrum_finalize (GObject * object)
+{
+  GstFFTWUnSpectrum *conv = GST_FFTWUNSPECTRUM (object);
+
+  g_free (conv->wisdom_file);
+
+  G_OBJECT_CLASS (gst_fftwunspectrum_parent_class)->finalize (object);
 }
 
 static void
@@ -186,6 +215,10 @@ gst_fftwunspectrum_set_property (GObject * object, guint prop_id,
     case ARG_HIQUALITY:
       conv->hi_q = g_value_get_boolean (value);
       break;
+    case ARG_WISDOM_FILE:
+      g_free (conv->wisdom_file);
+      conv->wisdom_file = g_value_dup_string (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -203,6 +236,9 @@ gst_fftwunspectrum_get_property (GObject * object, guint prop_id,
     case ARG_HIQUALITY:
       g_value_set_boolean (value, conv->hi_q);
       break;
+    case ARG_WISDOM_FILE:
+      g_value_set_string (value, conv->wisdom_file);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -215,15 +251,18 @@ static void
 free_fftw_data (GstFFTWUnSpectrum *conv)
 {
   if(conv->fftw_plan != NULL)
-    fftwf_destroy_plan (conv->fftw_plan);
+    gst_spectrum_plan_release (conv->fftw_plan);
+  if(conv->fftw_plan_many != NULL)
+    gst_spectrum_plan_release (conv->fftw_plan_many);
   if(conv->fftw_in != NULL)
-    fftwf_free (conv->fftw_in);
+    gst_spectrum_fftw_free (conv->fftw_in);
   if(conv->fftw_out != NULL)
-    fftwf_free (conv->fftw_out);
+    gst_spectrum_fftw_free (conv->fftw_out);
 
   conv->fftw_in   = NULL;
   conv->fftw_out  = NULL;
   conv->fftw_plan = NULL;
+  conv->fftw_plan_many = NULL;
 }
 
 
@@ -232,36 +271,115 @@ alloc_fftw_data (GstFFTWUnSpectrum *conv)
 {
   free_fftw_data (conv);
 
-  conv->fftw_in  = (float *) fftwf_malloc (INPUT_SIZE (conv));
-  conv->fftw_out = (float *) fftwf_malloc (sizeof(float) * conv->size);
+  /* Not negotiated yet */
+  if (conv->size <= 0)
+    return;
+
+  conv->fftw_in
+    = (float *) gst_spectrum_fftw_malloc (INPUT_SIZE (conv) * conv->frames);
+  conv->fftw_out = (float *) gst_spectrum_fftw_malloc 
+    (sizeof(float) * conv->size * conv->frames);
   
   conv->fftw_plan 
-    = fftwf_plan_dft_c2r_1d(conv->size, (fftwf_complex *) conv->fftw_in, 
-			    conv->fftw_out, 
-			    conv->hi_q ? FFTW_MEASURE : FFTW_ESTIMATE);
+    = gst_spectrum_plan_acquire (GST_SPECTRUM_PLAN_C2R, conv->size,
+				 conv->hi_q, conv->wisdom_file);
+
+  /* A full buffer's inverse transforms go to fftw_out back to back */
+  if (conv->frames > 1)
+    conv->fftw_plan_many
+      = gst_spectrum_plan_acquire_many (GST_SPECTRUM_PLAN_C2R, conv->size,
+					conv->frames, conv->size,
+					conv->hi_q, conv->wisdom_file);
 }
 
 
-/* Allocate and deallocate the extra samples */
+/* Allocate and deallocate the extra samples and their weights */
 
 static void
 free_extra_samples (GstFFTWUnSpectrum *conv)
 {
   if (conv->extra_samples != NULL)
     g_free (conv->extra_samples);
+  if (conv->ola_in_weights != NULL)
+    g_free (conv->ola_in_weights);
 
   conv->extra_samples = NULL;
+  conv->extra_head = 0;
+  conv->ola_in_weights = NULL;
+  conv->ola_extra_weights = NULL;
+}
+
+
+/* Average the input data with the overlap.  This is kind of
+ * complicated, since there may be more than one buffer that overlaps
+ * the same sample, so we may need to take a _weighted_ average of our
+ * sample with the stored one.  Plus we linearly interpolate this
+ * weighted average so that the new data has its full weight at the
+ * end of the overlap data and has zero weight at the beginning -- this
+ * is to smooth transitions.  The end result doesn't have perfect
+ * mathematical properties, but is a good approximation and sounds
+ * just fine.
+ *
+ * None of that depends on the data, so the weights are worked out
+ * here, once per size and step.
+ */
+static void
+compute_ola_weights (GstFFTWUnSpectrum *conv)
+{
+  gint i, num_others, extra = NUM_EXTRA_SAMPLES (conv);
+  gfloat start_weight, end_weight, weight, pct;
+  gfloat norm = 1.f / sqrtf (conv->size);
+
+  for (i = 0; i < extra; ++i)
+    {
+      /* The number of samples this has already been averaged
+       * against so far. */
+      num_others = ((extra - i - 1) / conv->step) + 1;
+
+      if (num_others == ((extra - 1) / conv->step) + 1)
+	start_weight = 0.f;
+      else
+	start_weight 
+	  = (1.f / ((gfloat) num_others) 
+	     + 1.f / (((gfloat) num_others) + 1.f)) / 2.f;
+
+      if (num_others == 1)
+	end_weight = 1.f;
+      else
+	end_weight 
+	  = (1.f / ((gfloat) num_others) 
+	     + 1.f / (((gfloat) num_others) - 1.f)) / 2.f;
+	  
+      /* This is the percentage of the way to the next time 
+       * num_others changes */
+      pct = ((gfloat) (i - MAX (extra - num_others * conv->step, 0)))
+	/ ((gfloat) (extra - (num_others-1) * conv->step 
+		     - MAX (extra - num_others * conv->step, 0)));
+      weight = start_weight * (1-pct) + end_weight * pct;
+
+      conv->ola_in_weights[i]    = weight * norm;
+      conv->ola_extra_weights[i] = 1 - weight;
+    }
 }
 
 
 static void
 alloc_extra_samples (GstFFTWUnSpectrum *conv)
 {
+  gint extra = NUM_EXTRA_SAMPLES (conv);
+
   free_extra_samples (conv);
 
-  if(NUM_EXTRA_SAMPLES (conv) > 0)
-    conv->extra_samples 
-      = (gfloat *) g_malloc (NUM_EXTRA_SAMPLES (conv) * sizeof (gfloat));
+  if (extra > 0)
+    {
+      /* Silence before the first frame */
+      conv->extra_samples = (gfloat *) g_malloc0 (extra * sizeof (gfloat));
+
+      conv->ola_in_weights 
+	= (gfloat *) g_malloc (2 * extra * sizeof (gfloat));
+      conv->ola_extra_weights = conv->ola_in_weights + extra;
+      compute_ola_weights (conv);
+    }
 }
 
 static gboolean
@@ -287,6 +405,10 @@ static gboolean gst_fftwunspectrum_query  (GstPad *pad,GstObject *parent,GstQuer
         gst_query_set_caps_result(query, gst_fftwunspectrum_getcaps(pad));
         return TRUE;
     }
+
+    /* Offer upstream aligned buffers, which we can transform in place */
+    if(GST_QUERY_TYPE(query) == GST_QUERY_ALLOCATION)
+      return gst_spectrum_pool_propose_spectra(query);
     
   return gst_pad_query_default(pad, parent, query);
 }
@@ -328,7 +450,7 @@ gst_fftwunspectrum_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps)
   GstFFTWUnSpectrum *conv;
   GstCaps *srccaps, *newsrccaps;
   GstStructure *newstruct;
-  gint rate, size, step;
+  gint rate, size, step, frames;
   gboolean res;
 
   conv = GST_FFTWUNSPECTRUM (parent);
@@ -342,6 +464,7 @@ gst_fftwunspectrum_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps)
   if (!gst_structure_get_int (newstruct, "rate", &rate) || 
       !gst_structure_get_int (newstruct, "size", &size) ||
       !gst_structure_get_int (newstruct, "step", &step) ||
+      !gst_structure_get_int (newstruct, "frames", &frames) ||
       size < step)
     {
       gst_caps_unref (newsrccaps);
@@ -358,6 +481,8 @@ gst_fftwunspectrum_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps)
       conv->rate = rate;
       conv->size = size;
       conv->step = step;
+      conv->frames = frames;
+      gst_spectrum_pool_reset (&conv->pool);
       
       /* Re-allocate the fftw data */
       if (GST_STATE (GST_ELEMENT (conv)) >= GST_STATE_READY)
@@ -431,6 +556,7 @@ gst_fftwunspectrum_change_state (GstElement * element,
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:      
       free_extra_samples (conv);
+      gst_spectrum_pool_clear (&conv->pool, GST_OBJECT (conv));
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       free_fftw_data (conv);
@@ -443,133 +569,152 @@ gst_fftwunspectrum_change_state (GstElement * element,
 }
 
 
+/* Turn one inverse transform (size samples in frame) into the next
+ * step samples of output in out, overlapping it with the previous
+ * ones.  The normalization is folded into the copies and the blend,
+ * so each sample of frame is only touched once.
+ */
+static void
+gst_fftwunspectrum_overlap (GstFFTWUnSpectrum *conv, gfloat *frame,
+			    gfloat *out)
+{
+  gint extra = NUM_EXTRA_SAMPLES (conv);
+  gint head, done, first;
+  gfloat norm = 1.f / sqrtf (conv->size);
+  gfloat *ring = conv->extra_samples;
+
+  /* conv->size == conv->step; frame may already be out */
+  if (extra == 0)
+    {
+      if (out == frame)
+	gst_spectrum_scale (out, conv->size, norm);
+      else
+	gst_spectrum_scale_to (frame, out, conv->size, norm);
+      return;
+    }
+
+  /* Average the start of the frame with the stored samples, in two
+   * parts if the ring wraps (see compute_ola_weights) */
+  head  = conv->extra_head;
+  first = extra - head;
+  gst_spectrum_blend (frame, conv->ola_in_weights,
+		      &ring[head], conv->ola_extra_weights, first);
+  gst_spectrum_blend (&frame[first], &conv->ola_in_weights[first],
+		      ring, &conv->ola_extra_weights[first], head);
+
+  /* The oldest samples are done now.  Copy them out, and put the end
+   * of the frame, which the next frames will overlap, in their place:
+   * that makes them the newest. */
+  done  = MIN (extra, conv->step);
+  first = MIN (done, extra - head);
+
+  memcpy (out, &ring[head], first * sizeof (gfloat));
+  memcpy (&out[first], ring, (done - first) * sizeof (gfloat));
+
+  gst_spectrum_scale_to (&frame[conv->size - done], &ring[head], first, norm);
+  gst_spectrum_scale_to (&frame[conv->size - done + first], ring,
+			 done - first, norm);
+
+  conv->extra_head = (head + done) % extra;
+
+  /* Now copy the non-overlap part of the data if applicable */
+  if (conv->step > extra)
+    gst_spectrum_scale_to (&frame[extra], &out[extra], conv->step - extra,
+			   norm);
+}
+
+
+/* Run plan on the in_size bytes of spectra at in, writing the
+ * signal to out if that's given and aligned the way the plan expects,
+ * or else to fftw_out.  Returns where the signal went.  Inverse
+ * transforms use their input as scratch space, so in is only used
+ * directly if we may overwrite it (and it is aligned); otherwise it
+ * is copied to fftw_in first.
+ */
+static gfloat *
+gst_fftwunspectrum_execute (GstFFTWUnSpectrum *conv, fftwf_plan plan,
+			    guint8 *in, gboolean in_writable, gsize in_size,
+			    gfloat *out)
+{
+  gfloat *src = (gfloat *) in, *dst = out;
+
+  if (!in_writable  ||  !gst_spectrum_fftw_aligned (src))
+    {
+      memcpy (conv->fftw_in, in, in_size);
+      src = conv->fftw_in;
+    }
+  if (dst == NULL  ||  !gst_spectrum_fftw_aligned (dst))
+    dst = conv->fftw_out;
+
+  fftwf_execute_dft_c2r (plan, (fftwf_complex *) src, dst);
+
+  return dst;
+}
+
+
 static GstFlowReturn
 gst_fftwunspectrum_chain (GstPad * pad, GstObject *parent, GstBuffer * buf)
 {
   GstFFTWUnSpectrum *conv;
   GstBuffer *outbuf;
   GstFlowReturn res = GST_FLOW_OK;
+  GstMapInfo info, binfo;
+  gfloat *out, *frame;
+  gboolean writable, direct;
+  gsize nframes, j;
 
   conv = GST_FFTWUNSPECTRUM (gst_pad_get_parent (pad));
 
-  /* Pedantry */
-  if (gst_buffer_get_size (buf) != INPUT_SIZE (conv))
+  /* Pedantry.  A buffer may hold several spectra (see spectrum.h) */
+  if (conv->size == 0  ||  gst_buffer_get_size (buf) % INPUT_SIZE (conv) != 0)
     return GST_FLOW_ERROR;
+  nframes = gst_buffer_get_size (buf) / INPUT_SIZE (conv);
 
-  outbuf=gst_buffer_new_allocate(NULL, INPUT_SIZE (conv), NULL);
-      
-      
-  gst_buffer_set_size(outbuf,conv->step * sizeof (gfloat));
+  outbuf = gst_spectrum_pool_alloc (&conv->pool, conv->srcpad,
+				    nframes * conv->step * sizeof (gfloat));
   GST_BUFFER_OFFSET     (outbuf) = GST_BUFFER_OFFSET     (buf);
   GST_BUFFER_OFFSET_END (outbuf) = GST_BUFFER_OFFSET_END (buf);
   GST_BUFFER_PTS  (outbuf) = GST_BUFFER_PTS(outbuf);
   GST_BUFFER_DURATION   (outbuf) = GST_BUFFER_DURATION   (buf);
-      
-  /* Do the Fourier transform */
-  
-  GstMapInfo info;
-  gst_buffer_map(buf, &info, GST_MAP_READ);
-  
-  memcpy (conv->fftw_in, info.data, INPUT_SIZE (conv));
-  gst_buffer_unmap(buf, &info);
-  fftwf_execute (conv->fftw_plan);
-  { /* Normalize */
-    gint i;
-    gfloat root = sqrtf (conv->size);
-    for (i = 0; i < conv->size; ++i)
-      conv->fftw_out[i] /= root;
-  }
 
-  /* Average with overlap sample data */
-  if (NUM_EXTRA_SAMPLES (conv) > 0)
-    {
-      gint i, num_others, extra = NUM_EXTRA_SAMPLES (conv);
-      GstMapInfo binfo;
-      gst_buffer_map(outbuf, &binfo, GST_MAP_WRITE);
-      gfloat *out = (gfloat *) binfo.data;
-      gfloat start_weight, end_weight, weight, pct;
-
-      /* Average the input data with the overlap.  This code is kind
-       * of complicated, since there may be more than one buffer that
-       * overlaps the same sample, so we may need to take a _weighted_
-       * average of our sample with the stored one.  Plus we linearly
-       * interpolate this weighted average so that the new data has
-       * its full weight at the end of the overlap data and has zero
-       * weight at the beginning -- this is to smooth transitions.
-       * The end result doesn't have perfect mathematical properties,
-       * but is a good approximation and sounds just fine.
-       */
-
-      /* GST_LOG ("Starting interpolation..."); */
-
-      for (i = 0; i < extra; ++i)
-	{
-	  /* The number of samples this has already been averaged
-	   * against so far. */
-	  num_others = ((extra - i - 1) / conv->step) + 1;
-
-	  if (num_others == ((extra - 1) / conv->step) + 1)
-	    start_weight = 0.f;
-	  else
-	    start_weight 
-	      = (1.f / ((gfloat) num_others) 
-		 + 1.f / (((gfloat) num_others) + 1.f)) / 2.f;
-
-	  if (num_others == 1)
-	    end_weight = 1.f;
-	  else
-	    end_weight 
-	      = (1.f / ((gfloat) num_others) 
-		 + 1.f / (((gfloat) num_others) - 1.f)) / 2.f;
-	  
-	  /* This is the percentage of the way to the next time 
-	   * num_others changes */
-	  pct = ((gfloat) (i - MAX (extra - num_others * conv->step, 0)))
-	    / ((gfloat) (extra - (num_others-1) * conv->step 
-			 - MAX (extra - num_others * conv->step, 0)));
-	  weight = start_weight * (1-pct) + end_weight * pct;
-
-	  /* GST_LOG ("%d = pct: %f -> weight: %f", i, pct, weight); */
-
-	  conv->extra_samples[i] 
-	    = (conv->fftw_out[i] * weight + 
-	       conv->extra_samples[i] * (1-weight));
-	}
-
-      /* Copy the overlap part of the data */
-      memcpy (out, conv->extra_samples,
-	      MIN (extra, conv->step) * sizeof (gfloat));
-
-      /* Now copy the non-overlap part of the data if applicable */
-      if (conv->step > extra)
-	memcpy (&out[extra], &conv->fftw_out[extra], 
-		(conv->step - extra) * sizeof (gfloat));
-      
-      /* Move extra_data over and copy the end of our data in */
-      for (i = 0; i < extra - conv->step; ++i)  /* May run 0 times */
-	conv->extra_samples[i] = conv->extra_samples[i + conv->step];
+  /* If the input is ours alone, FFTW can work in it directly */
+  writable = gst_buffer_is_writable (buf);
+  gst_buffer_map(buf, &info, writable ? GST_MAP_READWRITE : GST_MAP_READ);
+  gst_buffer_map(outbuf, &binfo, GST_MAP_WRITE);
+  out = (gfloat *) binfo.data;
 
-      memcpy (&conv->extra_samples[MAX (extra - conv->step, 0)],
-	      &conv->fftw_out[conv->size - MIN (extra, conv->step)],
-	      MIN (extra, conv->step) * sizeof (gfloat));
-      
-      gst_buffer_unmap(outbuf, &binfo);
+  /* Without overlap, the signal can go straight to the output */
+  direct = NUM_EXTRA_SAMPLES (conv) == 0;
+
+  /* Do the Fourier transforms, all at once for a full buffer */
+  if (nframes == (gsize) conv->frames  &&  conv->fftw_plan_many != NULL)
+    {
+      frame = gst_fftwunspectrum_execute (conv, conv->fftw_plan_many,
+					  info.data, writable,
+					  nframes * INPUT_SIZE (conv),
+					  direct ? out : NULL);
+
+      for (j = 0; j < nframes; ++j)
+	gst_fftwunspectrum_overlap (conv, &frame[j * conv->size],
+				    &out[j * conv->step]);
     }
+  else
+    for (j = 0; j < nframes; ++j)
+      {
+	frame = gst_fftwunspectrum_execute (conv, conv->fftw_plan,
+					    info.data + j * INPUT_SIZE (conv),
+					    writable, INPUT_SIZE (conv),
+					    direct ? &out[j * conv->step]
+						   : NULL);
+	gst_fftwunspectrum_overlap (conv, frame, &out[j * conv->step]);
+      }
+
+  gst_buffer_unmap(outbuf, &binfo);
+  gst_buffer_unmap(buf, &info);
 
-  else  /* conv->size == conv->step */
-  {
-      
-    GstMapInfo binfo;
-    gst_buffer_map(outbuf, &binfo, GST_MAP_WRITE);
-    memcpy (binfo.data, conv->fftw_out, conv->size * sizeof (gfloat));
-    gst_buffer_unmap(outbuf, &binfo);
-  }
-  
   res = gst_pad_push (conv->srcpad, outbuf);
 
   gst_buffer_unref (buf);
 
   return res;
 }
-
-
@@ -18,6 +18,8 @@
 #include <gst/gst.h>
 #include <fftw3.h>
 
+#include "spectrumpool.h"
+
 G_BEGIN_DECLS
 
 /* #defines don't like whitespacey bits */
@@ -38,19 +40,35 @@ struct _GstFFTWUnSpectrum
   GstPad *sinkpad, *srcpad;
 
   /* Stream data */
-  gint rate, size, step;
+  gint rate, size, step, frames;
 
   /* This is used to store samples for which there is overlapping 
-   * spectrum data (when size > step) */
+   * spectrum data (when size > step).  It's a ring: the oldest sample
+   * is at extra_head. */
   gfloat *extra_samples;
-
-  /* State data for fftw */
+  gint    extra_head;
+
+  /* The weights the start of each frame and the stored samples are
+   * averaged with, one per stored sample.  ola_in_weights includes
+   * the normalization of the frame. */
+  gfloat *ola_in_weights;
+  gfloat *ola_extra_weights;
+
+  /* State data for fftw.  The plans are shared with other elements
+   * (see spectrumplan.h), the arrays are our own.  fftw_plan_many
+   * transforms a whole buffer of frames spectra at once, if
+   * frames > 1. */
   float      *fftw_in;
   float      *fftw_out;
   fftwf_plan  fftw_plan;
+  fftwf_plan  fftw_plan_many;
+
+  /* Where the output buffers come from */
+  GstSpectrumPool pool;
 
-  /* Property */
+  /* Properties */
   gboolean hi_q;
+  gchar   *wisdom_file;
 };
 
 struct _GstFFTWUnSpectrumClass 
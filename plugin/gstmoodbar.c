@@ -21,6 +21,10 @@
  * <programlisting>
  * gst-launch filesrc location=test.mp3 ! mad ! audioconvert ! fftwspectrum ! moodbar height=50 ! pngenc ! filesink location=test.png
  * </programlisting>
+ * Several sizes from one analysis, through request pads:
+ * <programlisting>
+ * gst-launch filesrc location=test.mp3 ! mad ! audioconvert ! fftwspectrum ! moodbar name=m src_0::max-width=300 src_0::height=50 src_1::max-width=32 src_1::height=8 m.src_0 ! pngenc ! filesink location=test.png m.src_1 ! pngenc ! filesink location=thumb.png
+ * </programlisting>
  * </para>
  * </refsect2>
  */
@@ -37,17 +41,21 @@
  * Since we have to perform some normalization, we queue up all
  * of our analysis until we get an EOS event, at which point we 
  * normalize and do the output.  If a max-width is specified, the
- * output is scaled down to the desired width if necessary.
+ * output is scaled down to the desired width if necessary.  Each
+ * src_%u request pad gets an image of its own max-width and height,
+ * from the same analysis.
  */
 
 /* More precisely, the analysis performed is as follows:
  *  (1) the spectrum is broken into 24 parts, called "bark bands"
- *      (Gav's terminology), as given in bark_bands below
+ *      (Gav's terminology), as given in spectrumformat.c
  *  (2) we compute the size of the first 8 bark bands and store
  *      that as the "red" component; similarly for blue and green
  *  (3) after receiving an EOS, we normalize all of the analysis
  *      done in (1) and (2) and return a stream of rgb triples
- *      (application/x-raw-rgb)
+ *      (application/x-raw-rgb), or the same compressed
+ *      (application/x-moodbar, see moodbarcodec.c) if that is what
+ *      downstream takes
  */
 
 #ifdef HAVE_CONFIG_H
@@ -55,11 +63,15 @@
 #endif
 
 #include <gst/gst.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 
 #include "gstmoodbar.h"
+#include "moodbarcodec.h"
 #include "spectrum.h"
+#include "spectrumkernels.h"
+#include "spectrumpool.h"
 
 GST_DEBUG_CATEGORY (gst_moodbar_debug);
 #define GST_CAT_DEFAULT gst_moodbar_debug
@@ -75,67 +87,118 @@ enum
 {
   ARG_0,
   ARG_HEIGHT,
-  ARG_MAX_WIDTH
+  ARG_MAX_WIDTH,
+  ARG_FRAMES_PER_COLUMN,
+  ARG_STREAMING,
+  ARG_RESAMPLE,
+  ARG_FEATURES_LOCATION,
+  ARG_FEATURES
 };
 
+/* Only the band sums are used, so those are preferred, then the
+ * magnitudes */
 static GstStaticPadTemplate sink_factory 
   = GST_STATIC_PAD_TEMPLATE ("sink",
 			     GST_PAD_SINK,
 			     GST_PAD_ALWAYS,
 			     GST_STATIC_CAPS 
-			       ( SPECTRUM_FREQ_CAPS )
+			       ( SPECTRUM_BANDS_CAPS "; "
+				 SPECTRUM_MAGNITUDE_CAPS "; "
+				 SPECTRUM_FREQ_CAPS )
 			     );
 
+/* Raw images unless downstream only takes compressed moods (see
+ * moodbarcodec.h) */
+#define MOODBAR_SRC_CAPS \
+  "video/x-raw, format=(string) RGB, " \
+    "bpp = (int) 24, " \
+    "depth = (int) 24, " \
+    "height = (int) [ 1, MAX ], " \
+    "width = (int) [ 1, MAX ], " \
+    "framerate = (fraction) 0/1; " \
+  GST_MOODBAR_CODEC_CAPS
+
 static GstStaticPadTemplate src_factory 
   = GST_STATIC_PAD_TEMPLATE ("src",
 			     GST_PAD_SRC,
 			     GST_PAD_ALWAYS,
-			     GST_STATIC_CAPS
-			       ( "video/x-raw, format=(string) RGB, " 
-				   "bpp = (int) 24, "
-				   "depth = (int) 24, "
-				   "height = (int) [ 1, MAX ], "
-				   "width = (int) [ 1, MAX ], "
-				   "framerate = (fraction) 0/1"
-			       )
+			     GST_STATIC_CAPS (MOODBAR_SRC_CAPS)
 			     );
 
-G_DEFINE_TYPE (GstMoodbar, gst_moodbar, GST_TYPE_ELEMENT);
+static GstStaticPadTemplate src_request_factory 
+  = GST_STATIC_PAD_TEMPLATE ("src_%u",
+			     GST_PAD_SRC,
+			     GST_PAD_REQUEST,
+			     GST_STATIC_CAPS (MOODBAR_SRC_CAPS)
+			     );
+
+static void gst_moodbar_child_proxy_init (gpointer g_iface,
+    gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (GstMoodbar, gst_moodbar, GST_TYPE_ELEMENT,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_CHILD_PROXY,
+			   gst_moodbar_child_proxy_init));
+
+G_DEFINE_TYPE (GstMoodbarPad, gst_moodbar_pad, GST_TYPE_PAD);
 
 static void gst_moodbar_set_property (GObject *object, guint prop_id,
     const GValue *value, GParamSpec *pspec);
 static void gst_moodbar_get_property (GObject *object, guint prop_id,
     GValue *value, GParamSpec *pspec);
+static void gst_moodbar_finalize (GObject *object);
 
 static gboolean gst_moodbar_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps);
 static gboolean gst_moodbar_sink_event  (GstPad *pad, GstObject *parent, GstEvent *event);
+static gboolean gst_moodbar_sink_query  (GstPad *pad, GstObject *parent, GstQuery *query);
 
 static GstFlowReturn gst_moodbar_chain (GstPad *pad, GstObject *parent, GstBuffer *buf);
 static GstStateChangeReturn gst_moodbar_change_state (GstElement *element,
     GstStateChange transition);
+static GstPad *gst_moodbar_request_new_pad (GstElement *element,
+    GstPadTemplate *templ, const gchar *name, const GstCaps *caps);
+static void gst_moodbar_release_pad (GstElement *element, GstPad *pad);
 
 static void gst_moodbar_finish (GstMoodbar *mood);
 
 /* This is a failsafe so we don't eat up all of a computer's memory
- * if we hit an endless stream. */
+ * if we hit an endless stream.  With max-width set, we switch to
+ * streaming mode instead of failing. */
 #define MAX_TRIPLES (1024*1024*4)  
 
 #define NUMFREQS(mood) ((mood)->size/2+1)
 
-/* Allocate mood->r, mood->g, and mood->b in chunks of this many */
+/* Allocate mood->rgbx in chunks of this many frames */
 #define FRAME_CHUNK 1000
 
+/* Floats per frame in mood->rgbx */
+#define FRAME_FLOATS GST_MOODBAR_FRAME_FLOATS
+
 /* Default height of the output image */
 #define HEIGHT_DEFAULT 1
 
 /* Default max-width of the output image, or 0 for no rescaling */
 #define MAX_WIDTH_DEFAULT 0
 
-/* We use this table to break up the incoming spectrum into segments */
-static const guint bark_bands[24] 
-  = { 100,  200,  300,  400,  510,  630,  770,   920, 
-      1080, 1270, 1480, 1720, 2000, 2320, 2700,  3150, 
-      3700, 4400, 5300, 6400, 7700, 9500, 12000, 15500 };
+/* Default number of spectra to ask for per output column, or 0 to
+ * take all of them */
+#define FRAMES_PER_COLUMN_DEFAULT 0
+
+/* Whether to use bounded-memory streaming by default */
+#define STREAMING_DEFAULT FALSE
+
+/* Default resampling of frames into columns */
+#define RESAMPLE_DEFAULT GST_MOODBAR_RESAMPLE_BOX
+
+/* Default features to save, with features-location set */
+#define FEATURES_DEFAULT GST_MOODBAR_FEATURES_RGB
+
+/* Histogram bins for streaming normalization: values from
+ * 2^HIST_LOG_MIN to 2^(HIST_LOG_MIN + HIST_OCTAVES), with
+ * HIST_BINS_PER_OCTAVE bins per octave */
+#define HIST_LOG_MIN          (-40)
+#define HIST_OCTAVES          64
+#define HIST_BINS_PER_OCTAVE  32
+#define HIST_BINS             (HIST_OCTAVES * HIST_BINS_PER_OCTAVE)
 
 
 /***************************************************************/
@@ -143,6 +206,44 @@ static const guint bark_bands[24]
 /***************************************************************/
 
 
+#define GST_TYPE_MOODBAR_RESAMPLE (gst_moodbar_resample_get_type())
+
+static GType
+gst_moodbar_resample_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue resample[] =
+    {
+      { GST_MOODBAR_RESAMPLE_BOX,  "Whole frames per column", "box" },
+      { GST_MOODBAR_RESAMPLE_AREA, "Frames weighted by overlap", "area" },
+      { 0, NULL, NULL},
+    };
+
+  if (!type)
+    type = g_enum_register_static ("GstMoodbarResample", resample);
+
+  return type;
+}
+
+#define GST_TYPE_MOODBAR_FEATURES_KIND (gst_moodbar_features_kind_get_type())
+
+static GType
+gst_moodbar_features_kind_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue features[] =
+    {
+      { GST_MOODBAR_FEATURES_RGB,  "Red, green and blue", "rgb" },
+      { GST_MOODBAR_FEATURES_BARK, "Bark band energies",  "bark" },
+      { 0, NULL, NULL},
+    };
+
+  if (!type)
+    type = g_enum_register_static ("GstMoodbarFeaturesKind", features);
+
+  return type;
+}
+
 /* initialize the plugin's class */
 static void
 gst_moodbar_class_init (GstMoodbarClass * klass)
@@ -157,6 +258,8 @@ gst_moodbar_class_init (GstMoodbarClass * klass)
 
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&src_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_request_factory));
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&sink_factory));
   gst_element_class_set_details_simple (element_class, 
@@ -167,6 +270,7 @@ gst_moodbar_class_init (GstMoodbarClass * klass)
   
   gobject_class->set_property = gst_moodbar_set_property;
   gobject_class->get_property = gst_moodbar_get_property;
+  gobject_class->finalize = gst_moodbar_finalize;
 
   g_object_class_install_property (gobject_class, ARG_HEIGHT,
       g_param_spec_int ("height", "Image height", 
@@ -178,8 +282,42 @@ gst_moodbar_class_init (GstMoodbarClass * klass)
 	  "The maximum width of the resulting raw image, or 0 for no rescaling",
 	  0, G_MAXINT32, MAX_WIDTH_DEFAULT, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, ARG_FRAMES_PER_COLUMN,
+      g_param_spec_int ("frames-per-column", "Frames per column", 
+	  "With max-width set, ask upstream for only this many spectra per "
+	  "output column (roughly), or 0 for all of them",
+	  0, G_MAXINT32, FRAMES_PER_COLUMN_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, ARG_STREAMING,
+      g_param_spec_boolean ("streaming", "Streaming", 
+	  "With max-width set, analyze in memory proportional to max-width "
+	  "instead of to the length of the stream",
+	  STREAMING_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, ARG_RESAMPLE,
+      g_param_spec_enum ("resample", "Resampling", 
+	  "With max-width set, how frames are averaged into columns: each "
+	  "frame into one column (box), or split between the columns it "
+	  "straddles (area)",
+	  GST_TYPE_MOODBAR_RESAMPLE, RESAMPLE_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, ARG_FEATURES_LOCATION,
+      g_param_spec_string ("features-location", "Features location", 
+	  "Also save the analyzed frames before normalization to this "
+	  "file, for moodbar-render, or NULL for none",
+	  NULL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, ARG_FEATURES,
+      g_param_spec_enum ("features", "Features", 
+	  "What to save of each frame to features-location",
+	  GST_TYPE_MOODBAR_FEATURES_KIND, FEATURES_DEFAULT, G_PARAM_READWRITE));
+
   gstelement_class->change_state 
     = GST_DEBUG_FUNCPTR (gst_moodbar_change_state);
+  gstelement_class->request_new_pad
+    = GST_DEBUG_FUNCPTR (gst_moodbar_request_new_pad);
+  gstelement_class->release_pad
+    = GST_DEBUG_FUNCPTR (gst_moodbar_release_pad);
 }
 
 /* initialize the new element
@@ -197,6 +335,8 @@ gst_moodbar_init (GstMoodbar *mood)
           (gst_element_class_get_pad_template (klass, "sink"), "sink");
   gst_pad_set_event_function (mood->sinkpad,
 			      GST_DEBUG_FUNCPTR (gst_moodbar_sink_event));
+  gst_pad_set_query_function (mood->sinkpad,
+			      GST_DEBUG_FUNCPTR (gst_moodbar_sink_query));
   gst_pad_set_chain_function (mood->sinkpad, 
 			      GST_DEBUG_FUNCPTR (gst_moodbar_chain));
 
@@ -208,20 +348,49 @@ gst_moodbar_init (GstMoodbar *mood)
   gst_element_add_pad (GST_ELEMENT (mood), mood->sinkpad);
   gst_element_add_pad (GST_ELEMENT (mood), mood->srcpad);
 
+  mood->outputs = NULL;
+  mood->next_output = 0;
+
   /* These are set once the (sink) capabilities are determined */
   mood->rate = 0;
   mood->size = 0;
-  mood->barkband_table = NULL;
+  mood->format = GST_SPECTRUM_FORMAT_COMPLEX;
+  memset (mood->bark_edges, 0, sizeof (mood->bark_edges));
   
   /* These are allocated when we change to PAUSED */
-  mood->r = NULL;
-  mood->g = NULL;
-  mood->b = NULL;
+  mood->rgbx = NULL;
   mood->numframes = 0;
 
+  /* These are allocated when we change to PAUSED, in streaming mode */
+  mood->stream_active = FALSE;
+  mood->col_r = NULL;
+  mood->col_g = NULL;
+  mood->col_b = NULL;
+  mood->col_frames = NULL;
+  mood->numcols = 0;
+  mood->col_capacity = 0;
+  mood->col_span = 0;
+  mood->hist = NULL;
+  mood->features = NULL;
+
   /* Property */
   mood->height = HEIGHT_DEFAULT;
   mood->max_width = MAX_WIDTH_DEFAULT;
+  mood->frames_per_column = FRAMES_PER_COLUMN_DEFAULT;
+  mood->streaming = STREAMING_DEFAULT;
+  mood->resample = RESAMPLE_DEFAULT;
+  mood->features_location = NULL;
+  mood->features_kind = FEATURES_DEFAULT;
+}
+
+static void
+gst_moodbar_finalize (GObject *object)
+{
+  GstMoodbar *mood = GST_MOODBAR (object);
+
+  g_free (mood->features_location);
+
+  G_OBJECT_CLASS (gst_moodbar_parent_class)->finalize (object);
 }
 
 
@@ -238,6 +407,22 @@ static void gst_moodbar_set_property (GObject *object, guint prop_id,
     case ARG_MAX_WIDTH:
       mood->max_width = (guint) g_value_get_int (value);
       break;
+    case ARG_FRAMES_PER_COLUMN:
+      mood->frames_per_column = (guint) g_value_get_int (value);
+      break;
+    case ARG_STREAMING:
+      mood->streaming = g_value_get_boolean (value);
+      break;
+    case ARG_RESAMPLE:
+      mood->resample = (GstMoodbarResample) g_value_get_enum (value);
+      break;
+    case ARG_FEATURES_LOCATION:
+      g_free (mood->features_location);
+      mood->features_location = g_value_dup_string (value);
+      break;
+    case ARG_FEATURES:
+      mood->features_kind = (GstMoodbarFeaturesKind) g_value_get_enum (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -259,13 +444,282 @@ static void gst_moodbar_get_property (GObject *object, guint prop_id,
     case ARG_MAX_WIDTH:
       g_value_set_int (value, (int) mood->max_width);
       break;
+    case ARG_FRAMES_PER_COLUMN:
+      g_value_set_int (value, (int) mood->frames_per_column);
+      break;
+    case ARG_STREAMING:
+      g_value_set_boolean (value, mood->streaming);
+      break;
+    case ARG_RESAMPLE:
+      g_value_set_enum (value, mood->resample);
+      break;
+    case ARG_FEATURES_LOCATION:
+      g_value_set_string (value, mood->features_location);
+      break;
+    case ARG_FEATURES:
+      g_value_set_enum (value, mood->features_kind);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+
+
+
+/* Request pads: each src_%u pad has its own max-width and height,
+ * which can be set from gst-launch as src_0::max-width and so on
+ * through GstChildProxy */
+
+static void gst_moodbar_pad_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec);
+static void gst_moodbar_pad_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec);
+
+enum
+{
+  PAD_ARG_0,
+  PAD_ARG_HEIGHT,
+  PAD_ARG_MAX_WIDTH
+};
+
+static void
+gst_moodbar_pad_class_init (GstMoodbarPadClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  gobject_class->set_property = gst_moodbar_pad_set_property;
+  gobject_class->get_property = gst_moodbar_pad_get_property;
+
+  g_object_class_install_property (gobject_class, PAD_ARG_HEIGHT,
+      g_param_spec_int ("height", "Image height", 
+	  "The height of the image pushed on this pad",
+	  1, G_MAXINT32, HEIGHT_DEFAULT, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PAD_ARG_MAX_WIDTH,
+      g_param_spec_int ("max-width", "Image maximum width", 
+	  "The maximum width of the image pushed on this pad, or 0 for no "
+	  "rescaling",
+	  0, G_MAXINT32, MAX_WIDTH_DEFAULT, G_PARAM_READWRITE));
+}
+
+static void
+gst_moodbar_pad_init (GstMoodbarPad *pad)
+{
+  pad->height = HEIGHT_DEFAULT;
+  pad->max_width = MAX_WIDTH_DEFAULT;
+}
+
+static void gst_moodbar_pad_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec)
+{
+  GstMoodbarPad *pad = GST_MOODBAR_PAD (object);
+
+  switch (prop_id) 
+    {
+    case PAD_ARG_HEIGHT:
+      pad->height = (guint) g_value_get_int (value);
+      break;
+    case PAD_ARG_MAX_WIDTH:
+      pad->max_width = (guint) g_value_get_int (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+static void gst_moodbar_pad_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec)
+{
+  GstMoodbarPad *pad = GST_MOODBAR_PAD (object);
+
+  switch (prop_id) 
+    {
+    case PAD_ARG_HEIGHT:
+      g_value_set_int (value, (int) pad->height);
+      break;
+    case PAD_ARG_MAX_WIDTH:
+      g_value_set_int (value, (int) pad->max_width);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static GstPad *
+gst_moodbar_request_new_pad (GstElement *element, GstPadTemplate *templ,
+			     const gchar *name, const GstCaps *caps)
+{
+  GstMoodbar *mood = GST_MOODBAR (element);
+  GstPad *pad;
+  gchar *padname;
+  guint index;
+
+  GST_OBJECT_LOCK (mood);
+  if (name != NULL  &&  sscanf (name, "src_%u", &index) == 1)
+    {
+      padname = g_strdup (name);
+      mood->next_output = MAX (mood->next_output, index + 1);
+    }
+  else
+    padname = g_strdup_printf ("src_%u", mood->next_output++);
+  GST_OBJECT_UNLOCK (mood);
+
+  pad = GST_PAD (g_object_new (GST_TYPE_MOODBAR_PAD, "name", padname,
+			       "direction", GST_PAD_SRC,
+			       "template", templ, NULL));
+  g_free (padname);
+
+  if (!gst_element_add_pad (element, pad))
+    return NULL;
 
+  GST_OBJECT_LOCK (mood);
+  mood->outputs = g_list_append (mood->outputs, pad);
+  GST_OBJECT_UNLOCK (mood);
+
+  gst_child_proxy_child_added (GST_CHILD_PROXY (mood), G_OBJECT (pad),
+			       GST_OBJECT_NAME (pad));
+
+  return pad;
+}
+
+static void
+gst_moodbar_release_pad (GstElement *element, GstPad *pad)
+{
+  GstMoodbar *mood = GST_MOODBAR (element);
+
+  GST_OBJECT_LOCK (mood);
+  mood->outputs = g_list_remove (mood->outputs, pad);
+  GST_OBJECT_UNLOCK (mood);
+
+  gst_child_proxy_child_removed (GST_CHILD_PROXY (mood), G_OBJECT (pad),
+				 GST_OBJECT_NAME (pad));
+  gst_element_remove_pad (element, pad);
+}
+
+static GObject *
+gst_moodbar_child_proxy_get_child_by_index (GstChildProxy *proxy,
+					    guint index)
+{
+  GstMoodbar *mood = GST_MOODBAR (proxy);
+  GObject *child;
+
+  GST_OBJECT_LOCK (mood);
+  child = (GObject *) g_list_nth_data (mood->outputs, index);
+  if (child != NULL)
+    g_object_ref (child);
+  GST_OBJECT_UNLOCK (mood);
+
+  return child;
+}
+
+static guint
+gst_moodbar_child_proxy_get_children_count (GstChildProxy *proxy)
+{
+  GstMoodbar *mood = GST_MOODBAR (proxy);
+  guint count;
+
+  GST_OBJECT_LOCK (mood);
+  count = g_list_length (mood->outputs);
+  GST_OBJECT_UNLOCK (mood);
+
+  return count;
+}
+
+static void
+gst_moodbar_child_proxy_init (gpointer g_iface, gpointer iface_data)
+{
+  GstChildProxyInterface *iface = g_iface;
+
+  iface->get_child_by_index = gst_moodbar_child_proxy_get_child_by_index;
+  iface->get_children_count = gst_moodbar_child_proxy_get_children_count;
+}
+
+
+/* An image to push: the pad it goes out on, and its size */
+typedef struct
+{
+  GstPad *pad;
+  guint max_width, height;
+} GstMoodbarOutput;
+
+static GstMoodbarOutput *
+gst_moodbar_output_new (GstPad *pad, guint max_width, guint height)
+{
+  GstMoodbarOutput *out = g_new (GstMoodbarOutput, 1);
+
+  out->pad = gst_object_ref (pad);
+  out->max_width = max_width;
+  out->height = height;
+
+  return out;
+}
+
+static void
+gst_moodbar_output_free (gpointer data)
+{
+  GstMoodbarOutput *out = (GstMoodbarOutput *) data;
+
+  gst_object_unref (out->pad);
+  g_free (out);
+}
+
+/* The images to make: the always pad's, if it's linked or there are
+ * no request pads, then one for each request pad.  Free the list with
+ * g_list_free_full (outputs, gst_moodbar_output_free). */
+static GList *
+gst_moodbar_outputs (GstMoodbar *mood)
+{
+  GList *outputs = NULL, *l;
+  GstMoodbarPad *pad;
+
+  GST_OBJECT_LOCK (mood);
+  for (l = mood->outputs; l != NULL; l = l->next)
+    {
+      pad = GST_MOODBAR_PAD (l->data);
+      outputs = g_list_prepend (outputs, 
+				gst_moodbar_output_new (GST_PAD (pad),
+							pad->max_width,
+							pad->height));
+    }
+  GST_OBJECT_UNLOCK (mood);
+
+  if (outputs == NULL  ||  gst_pad_is_linked (mood->srcpad))
+    outputs = g_list_prepend (outputs,
+			      gst_moodbar_output_new (mood->srcpad,
+						      mood->max_width,
+						      mood->height));
+
+  return g_list_reverse (outputs);
+}
+
+/* The largest max-width of the images, or 0 if one of them isn't
+ * rescaled.  This is what the analysis has to keep enough frames
+ * for. */
+static guint
+gst_moodbar_widest (GstMoodbar *mood)
+{
+  GList *outputs = gst_moodbar_outputs (mood), *l;
+  GstMoodbarOutput *out;
+  guint widest = 0;
+
+  for (l = outputs; l != NULL; l = l->next)
+    {
+      out = (GstMoodbarOutput *) l->data;
+      if (out->max_width == 0)
+	{
+	  widest = 0;
+	  break;
+	}
+      widest = MAX (widest, out->max_width);
+    }
+
+  g_list_free_full (outputs, gst_moodbar_output_free);
+  return widest;
+}
 
 
 /***************************************************************/
@@ -273,38 +727,17 @@ static void gst_moodbar_get_property (GObject *object, guint prop_id,
 /***************************************************************/
 
 
-/* This calculates a table that caches which bark band slot each
- * incoming band is supposed to go in. */
+/* This caches which incoming bands make up each bark band.  The bark
+ * bands are contiguous ranges of bands, so all we need is where each
+ * one starts. */
 static void
-calc_barkband_table (GstMoodbar *mood)
+calc_bark_edges (GstMoodbar *mood)
 {
-  guint i;
-  guint barkband = 0;
-
   /* Avoid divide-by-zero */
   if (!mood->size  ||  !mood->rate)
     return;
 
-  if (mood->barkband_table)
-    g_free (mood->barkband_table);
-
-  mood->barkband_table = g_malloc (NUMFREQS (mood) * sizeof (guint));
-  
-  for (i = 0; i < NUMFREQS (mood); ++i)
-    {
-      if (barkband < 23 &&
-	  (guint) GST_SPECTRUM_BAND_FREQ (i, mood->size, mood->rate) 
-	    >= bark_bands[barkband])
-	barkband++;
-
-      mood->barkband_table[i] = barkband;
-
-      /*
-      GST_LOG ("Band %d (frequency %f) -> barkband %d (frequency %d)",
-	       i, GST_SPECTRUM_BAND_FREQ (i, mood->size, mood->rate),
-	       barkband, bark_bands[barkband]);
-      */
-    }
+  gst_spectrum_bark_edges (mood->size, mood->rate, mood->bark_edges);
 }
 
 
@@ -332,7 +765,8 @@ gst_moodbar_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps)
   
   mood->rate = rate;
   mood->size = (guint) size;
-  calc_barkband_table (mood);
+  mood->format = gst_spectrum_format_of (newstruct);
+  calc_bark_edges (mood);
  
  out:
 
@@ -343,9 +777,7 @@ gst_moodbar_set_sink_caps (GstPad *pad, GstObject *parent, GstCaps *caps)
 static gboolean
 gst_moodbar_sink_event  (GstPad *pad, GstObject *parent, GstEvent *event)
 {
-  GstMoodbar *mood;
-  gboolean res = TRUE;
-  mood = GST_MOODBAR (gst_pad_get_parent (pad));
+  GstMoodbar *mood = GST_MOODBAR (parent);
 
   if (GST_EVENT_TYPE (event) == GST_EVENT_EOS)
     gst_moodbar_finish (mood);
@@ -357,12 +789,365 @@ gst_moodbar_sink_event  (GstPad *pad, GstObject *parent, GstEvent *event)
     
     gst_moodbar_set_sink_caps(pad, parent, caps);
   }
-  
 
-  res = gst_pad_push_event (mood->srcpad, event);
-  gst_object_unref (mood);
+  /* Sends the event on every src pad (except the spectrum caps, which
+   * the images replace in gst_moodbar_push_image) */
+  return gst_pad_event_default (pad, parent, event);
+}
 
-  return res;
+
+/* Since the output is averaged down to max-width columns anyway, we
+ * can tell fftwspectrum to only compute about frames-per-column
+ * spectra per column (see GST_SPECTRUM_QUERY_FRAMES in spectrum.h),
+ * which makes the cost of a track independent of its length.
+ *
+ * fftwspectrum then spaces its windows evenly, skipping the samples
+ * in between once the step exceeds the window size.  Each column is
+ * then the average of at least frames-per-column (k) windows spread
+ * evenly over its span instead of all of them, so it can't leave the
+ * range of the full resolution frames in that span, and for steady
+ * music it is an unbiased estimate of the full resolution column,
+ * off by about s/sqrt(k) where s is the spread of the frame values
+ * within the column.  With k = 16 that's a quarter of the spread;
+ * the normalization statistics are taken over max-width * k frames
+ * and are off by much less.  Short events (a single drum hit) can
+ * fall between windows and be lost; use 0 to keep everything.
+ */
+static gboolean
+gst_moodbar_sink_query (GstPad *pad, GstObject *parent, GstQuery *query)
+{
+  GstMoodbar *mood = GST_MOODBAR (parent);
+  const GstStructure *qs = gst_query_get_structure (query);
+
+  if (GST_QUERY_TYPE (query) == GST_QUERY_CUSTOM  &&  qs != NULL
+      &&  gst_structure_has_name (qs, GST_SPECTRUM_QUERY_FRAMES))
+    {
+      GstStructure *s;
+      guint widest = gst_moodbar_widest (mood);
+
+      if (widest == 0  ||  mood->frames_per_column == 0)
+	return FALSE;
+
+      s = gst_query_writable_structure (query);
+      gst_structure_set (s, "frames", G_TYPE_INT,
+			 (gint) MIN ((guint64) widest
+				     * mood->frames_per_column, G_MAXINT32),
+			 NULL);
+      return TRUE;
+    }
+
+  /* Spectra are only read, so any pool will do; ours saves fftwspectrum
+   * from allocating every buffer */
+  if (GST_QUERY_TYPE (query) == GST_QUERY_ALLOCATION)
+    return gst_spectrum_pool_propose_spectra (query);
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+
+/***************************************************************/
+/* Streaming mode                                              */
+/***************************************************************/
+
+/* In streaming mode, memory doesn't grow with the stream.  Frames are
+ * summed into at most 2 * max-width columns of col_span frames each;
+ * when the columns run out, neighbouring columns are merged pairwise
+ * and col_span doubles, so there are always between max-width and
+ * 2 * max-width columns (once there are that many frames) which are
+ * averaged down to max-width at the end as usual.  With request pads,
+ * max-width here is the widest of their images.
+ *
+ * normalize() needs several passes over all of the values, so for
+ * each of r, g and b we keep a histogram of the values with
+ * HIST_BINS_PER_OCTAVE logarithmic bins per octave, holding the count
+ * and sum of the values in each bin, and compute the same statistics
+ * from it at the end.  Only the thresholds between "above" and
+ * "below" get rounded to a bin, so they are off by at most 1/32 of
+ * an octave (about 2%).  The other difference from the exact mode is
+ * that a column is normalized as a whole, not frame by frame, which
+ * only matters for columns whose frames straddle the clipping limits
+ * of the normalization.  Frames that aren't finite are left out.
+ * Saved features don't add up either: they go to the file as each
+ * frame is analyzed.
+ */
+
+struct _GstMoodbarHistogram
+{
+  guint64 count[HIST_BINS];
+  gdouble sum[HIST_BINS];
+  guint64 n;
+  gdouble total;
+  gfloat  min, max;
+  guint64 min_count, max_count;  /* How often min and max occurred */
+};
+
+
+static guint
+hist_bin (gfloat val)
+{
+  gint bin;
+
+  if (val <= 0.f)
+    return 0;
+
+  bin = (gint) floorf ((log2f (val) - HIST_LOG_MIN) * HIST_BINS_PER_OCTAVE);
+  return (guint) CLAMP (bin, 0, HIST_BINS - 1);
+}
+
+static void
+hist_add (GstMoodbarHistogram *hist, gfloat val)
+{
+  guint bin = hist_bin (val);
+
+  hist->count[bin]++;
+  hist->sum[bin] += val;
+  hist->n++;
+  hist->total += val;
+
+  if (val < hist->min)
+    {
+      hist->min = val;
+      hist->min_count = 0;
+    }
+  if (val == hist->min)
+    hist->min_count++;
+
+  if (val > hist->max)
+    {
+      hist->max = val;
+      hist->max_count = 0;
+    }
+  if (val == hist->max)
+    hist->max_count++;
+}
+
+/* Whether the values in the bin of val count as being above threshold */
+static gboolean
+hist_bin_above (const GstMoodbarHistogram *hist, guint bin, gdouble threshold)
+{
+  return hist->sum[bin] / hist->count[bin] > threshold;
+}
+
+/* Add up the values (other than the smallest and largest ones, like
+ * normalize() does) which are above threshold, or not above it.
+ */
+static void
+hist_range (const GstMoodbarHistogram *hist, gdouble threshold,
+	    gboolean above, gdouble *sum, gdouble *count)
+{
+  guint bin;
+
+  *sum = 0.;
+  *count = 0.;
+
+  for (bin = 0; bin < HIST_BINS; ++bin)
+    if (hist->count[bin] > 0
+	&&  hist_bin_above (hist, bin, threshold) == above)
+      {
+	*sum += hist->sum[bin];
+	*count += hist->count[bin];
+      }
+
+  bin = hist_bin (hist->min);
+  if (hist_bin_above (hist, bin, threshold) == above)
+    {
+      *sum -= hist->min * (gdouble) hist->min_count;
+      *count -= hist->min_count;
+    }
+
+  bin = hist_bin (hist->max);
+  if (hist->max != hist->min
+      &&  hist_bin_above (hist, bin, threshold) == above)
+    {
+      *sum -= hist->max * (gdouble) hist->max_count;
+      *count -= hist->max_count;
+    }
+}
+
+/* The equivalent of normalize(), giving the offset and scale that it
+ * would apply */
+static void
+hist_normalization (const GstMoodbarHistogram *hist,
+		    gfloat *mini_out, gfloat *delta_out)
+{
+  gdouble avg, avgu, avgb, avguu, avgbb, sum, count, extremes;
+  gfloat mini, maxi, delta;
+
+  if (hist->n == 0  ||  hist->min == hist->max)
+    {
+      *mini_out = hist->n == 0 ? 0.f : hist->min;
+      *delta_out = 1.f;
+      return;
+    }
+
+  extremes = hist->min * (gdouble) hist->min_count
+    + hist->max * (gdouble) hist->max_count;
+  avg = (hist->total - extremes) / (gdouble) hist->n;
+
+  hist_range (hist, avg, TRUE, &sum, &count);
+  avgu = sum / count;
+  hist_range (hist, avg, FALSE, &sum, &count);
+  avgb = sum / count;
+
+  hist_range (hist, avgu, TRUE, &sum, &count);
+  avguu = sum / count;
+  hist_range (hist, avgb, FALSE, &sum, &count);
+  avgbb = sum / count;
+
+  mini = MAX (avg + (avgb - avg) * 2.f, avgbb);
+  maxi = MIN (avg + (avgu - avg) * 2.f, avguu);
+  delta = maxi - mini;
+
+  if (delta == 0.f)
+    delta = 1.f;
+
+  *mini_out = mini;
+  *delta_out = delta;
+}
+
+
+static void
+gst_moodbar_stream_free (GstMoodbar *mood)
+{
+  g_free (mood->col_r);
+  g_free (mood->col_g);
+  g_free (mood->col_b);
+  g_free (mood->col_frames);
+  g_free (mood->hist);
+
+  mood->col_r = NULL;
+  mood->col_g = NULL;
+  mood->col_b = NULL;
+  mood->col_frames = NULL;
+  mood->hist = NULL;
+  mood->numcols = 0;
+  mood->col_capacity = 0;
+  mood->col_span = 0;
+  mood->stream_active = FALSE;
+}
+
+static void
+gst_moodbar_stream_alloc (GstMoodbar *mood)
+{
+  guint i;
+
+  gst_moodbar_stream_free (mood);
+
+  mood->col_capacity = 2 * gst_moodbar_widest (mood);
+  mood->col_r = g_new0 (gdouble, mood->col_capacity);
+  mood->col_g = g_new0 (gdouble, mood->col_capacity);
+  mood->col_b = g_new0 (gdouble, mood->col_capacity);
+  mood->col_frames = g_new0 (guint, mood->col_capacity);
+  mood->col_span = 1;
+
+  mood->hist = g_new0 (GstMoodbarHistogram, 3);
+  for (i = 0; i < 3; ++i)
+    {
+      mood->hist[i].min = G_MAXFLOAT;
+      mood->hist[i].max = -G_MAXFLOAT;
+    }
+
+  mood->stream_active = TRUE;
+}
+
+/* Halve the number of columns by adding up neighbours */
+static void
+gst_moodbar_stream_merge (GstMoodbar *mood)
+{
+  guint i;
+
+  for (i = 0; i < mood->numcols / 2; ++i)
+    {
+      mood->col_r[i] = mood->col_r[2*i] + mood->col_r[2*i + 1];
+      mood->col_g[i] = mood->col_g[2*i] + mood->col_g[2*i + 1];
+      mood->col_b[i] = mood->col_b[2*i] + mood->col_b[2*i + 1];
+      mood->col_frames[i]
+	= mood->col_frames[2*i] + mood->col_frames[2*i + 1];
+    }
+
+  mood->numcols /= 2;
+  mood->col_span *= 2;
+}
+
+static void
+gst_moodbar_stream_frame (GstMoodbar *mood, gfloat r, gfloat g, gfloat b)
+{
+  guint i;
+
+  if (!finite (r)  ||  !finite (g)  ||  !finite (b))
+    return;
+
+  hist_add (&mood->hist[0], r);
+  hist_add (&mood->hist[1], g);
+  hist_add (&mood->hist[2], b);
+
+  if (mood->numcols == 0
+      ||  mood->col_frames[mood->numcols - 1] == mood->col_span)
+    {
+      if (mood->numcols == mood->col_capacity)
+	gst_moodbar_stream_merge (mood);
+
+      i = mood->numcols++;
+      mood->col_r[i] = 0.;
+      mood->col_g[i] = 0.;
+      mood->col_b[i] = 0.;
+      mood->col_frames[i] = 0;
+    }
+
+  i = mood->numcols - 1;
+  mood->col_r[i] += r;
+  mood->col_g[i] += g;
+  mood->col_b[i] += b;
+  mood->col_frames[i]++;
+}
+
+/* Switch to streaming mode in the middle of a stream, folding the
+ * frames stored so far into the columns */
+static void
+gst_moodbar_start_streaming (GstMoodbar *mood)
+{
+  guint i;
+
+  GST_DEBUG ("Switching to streaming mode after %u frames", mood->numframes);
+
+  gst_moodbar_stream_alloc (mood);
+
+  /* Frame 0 is never filled in; see allocate_another_frame */
+  for (i = 1; i <= mood->numframes; ++i)
+    gst_moodbar_stream_frame (mood, mood->rgbx[FRAME_FLOATS * i],
+			      mood->rgbx[FRAME_FLOATS * i + 1],
+			      mood->rgbx[FRAME_FLOATS * i + 2]);
+
+  mood->rgbx = (gfloat *) g_realloc (mood->rgbx, FRAME_CHUNK * FRAME_FLOATS
+				     * sizeof (gfloat));
+  mood->numframes = 0;
+}
+
+/* The columns' averages as frames, for gst_moodbar_render_row, and
+ * the normalization the histograms give.  Every column counts the
+ * same, though the last one may hold fewer frames than col_span. */
+static gfloat *
+gst_moodbar_stream_frames (GstMoodbar *mood, GstMoodbarNormalization *norm)
+{
+  gfloat *rgbx = g_new (gfloat, FRAME_FLOATS * mood->numcols);
+  guint i, c;
+
+  for (c = 0; c < 3; ++c)
+    hist_normalization (&mood->hist[c], &norm->mini[c], &norm->delta[c]);
+  norm->mini[3] = 0.f;
+  norm->delta[3] = 1.f;
+
+  for (i = 0; i < mood->numcols; ++i)
+    {
+      gfloat *frame = &rgbx[FRAME_FLOATS * i];
+
+      frame[0] = (gfloat) (mood->col_r[i] / mood->col_frames[i]);
+      frame[1] = (gfloat) (mood->col_g[i] / mood->col_frames[i]);
+      frame[2] = (gfloat) (mood->col_b[i] / mood->col_frames[i]);
+      frame[3] = 0.f;
+    }
+
+  return rgbx;
 }
 
 
@@ -380,13 +1165,33 @@ gst_moodbar_change_state (GstElement *element, GstStateChange transition)
   switch (transition)
     {
     case GST_STATE_CHANGE_NULL_TO_READY:
-      calc_barkband_table (mood);
+      calc_bark_edges (mood);
       break;
     case GST_STATE_CHANGE_READY_TO_PAUSED:
-      mood->r = (gfloat *) g_malloc (FRAME_CHUNK * sizeof(gfloat));
-      mood->g = (gfloat *) g_malloc (FRAME_CHUNK * sizeof(gfloat));
-      mood->b = (gfloat *) g_malloc (FRAME_CHUNK * sizeof(gfloat));
+      if (mood->features_location != NULL  &&  *mood->features_location)
+	{
+	  GError *err = NULL;
+
+	  mood->features
+	    = gst_moodbar_features_writer_new (mood->features_location,
+					       mood->features_kind, &err);
+	  if (mood->features == NULL)
+	    {
+	      GST_ELEMENT_ERROR (mood, RESOURCE, OPEN_WRITE,
+				 ("Could not save the features"),
+				 ("%s", err->message));
+	      g_error_free (err);
+	      return GST_STATE_CHANGE_FAILURE;
+	    }
+	}
+
+      /* Frame 0 is never filled in (see allocate_another_frame), but
+       * is normalized along with the others, so make it 0 */
+      mood->rgbx = (gfloat *) g_malloc0 (FRAME_CHUNK * FRAME_FLOATS 
+					 * sizeof(gfloat));
       mood->numframes = 0;
+      if (mood->streaming  &&  gst_moodbar_widest (mood) > 0)
+	gst_moodbar_stream_alloc (mood);
       break;
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
       break;
@@ -401,17 +1206,14 @@ gst_moodbar_change_state (GstElement *element, GstStateChange transition)
     case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:      
-      g_free (mood->r);
-      g_free (mood->g);
-      g_free (mood->b);
-      mood->r = NULL;
-      mood->g = NULL;
-      mood->b = NULL;
+      g_free (mood->rgbx);
+      mood->rgbx = NULL;
       mood->numframes = 0;
+      gst_moodbar_stream_free (mood);
+      gst_moodbar_features_writer_free (mood->features);
+      mood->features = NULL;
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
-      g_free (mood->barkband_table);
-      mood->barkband_table = NULL;
       break;
     default:
       break;
@@ -435,13 +1237,12 @@ allocate_another_frame (GstMoodbar *mood)
 
   if(mood->numframes % FRAME_CHUNK == 0)
     {
-      guint size = (mood->numframes + FRAME_CHUNK) * sizeof (gfloat);
+      gsize size 
+	= (mood->numframes + FRAME_CHUNK) * FRAME_FLOATS * sizeof (gfloat);
 
-      mood->r = (gfloat *) g_realloc (mood->r, size);
-      mood->g = (gfloat *) g_realloc (mood->g, size);
-      mood->b = (gfloat *) g_realloc (mood->b, size);
+      mood->rgbx = (gfloat *) g_realloc (mood->rgbx, size);
 
-      if (mood->r == NULL || mood->g == NULL || mood->b == NULL)
+      if (mood->rgbx == NULL)
 	return FALSE;
     }
 
@@ -449,184 +1250,225 @@ allocate_another_frame (GstMoodbar *mood)
 }
 
 
-/* This function does most of the analysis on the spectra we
- * get as input and caches them.  We actually push buffers
- * once we receive an EOS signal.
+/* Analyze one spectrum into an (r, g, b) frame.  out holds complex
+ * values, their magnitudes or the bark band sums, as negotiated.
+ * Returns FALSE if there's no room for another frame.
  */
-static GstFlowReturn
-gst_moodbar_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
+static gboolean
+gst_moodbar_analyze_frame (GstMoodbar *mood, const gfloat *out)
 {
-  GstMoodbar *mood = GST_MOODBAR (parent);
-  guint i;
-  gfloat amplitudes[24], rgb[3] = {0.f, 0.f, 0.f};
-  gfloat *out, real, imag;
-  guint numfreqs = NUMFREQS (mood);
+  gfloat amplitudes[24], rgb[3];
 
-  if (gst_buffer_get_size (buf) != numfreqs * sizeof (gfloat) * 2)
+  if (!mood->stream_active)
     {
-      gst_object_unref (mood);
-      return GST_FLOW_ERROR;
+      /* Rather than give up on a long stream, go on in streaming mode
+       * if we know how wide the output will be */
+      if (mood->numframes + 1 == MAX_TRIPLES
+	  &&  gst_moodbar_widest (mood) > 0)
+	gst_moodbar_start_streaming (mood);
+      else if (!allocate_another_frame (mood))
+	return FALSE;
     }
 
+  /* Calculate total amplitudes for the different bark bands, unless
+   * fftwspectrum already did (see spectrumkernels.c) */
   
-  GstMapInfo info;
-  gst_buffer_map(buf, &info, GST_MAP_READ);
-  out = (gfloat *) info.data;
+  if (mood->format == GST_SPECTRUM_FORMAT_BANDS)
+    memcpy (amplitudes, out, sizeof (amplitudes));
+  else if (mood->format == GST_SPECTRUM_FORMAT_MAGNITUDE)
+    gst_spectrum_range_sums (out, mood->bark_edges, 24, amplitudes);
+  else
+    gst_spectrum_band_sums (out, mood->bark_edges, 24, 1.f, amplitudes);
 
-  if (!allocate_another_frame (mood))
-    return GST_FLOW_ERROR;
+  gst_moodbar_frame_rgb (amplitudes, rgb);
 
-  /* Calculate total amplitudes for the different bark bands */
-  
-  for (i = 0; i < 24; ++i)
-    amplitudes[i] = 0.f;
+  if (mood->features != NULL)
+    gst_moodbar_features_writer_add (mood->features,
+				     mood->features_kind
+				     == GST_MOODBAR_FEATURES_BARK
+				     ? amplitudes : rgb);
 
-  for (i = 0; i < numfreqs; ++i)
+  if (mood->stream_active)
+    gst_moodbar_stream_frame (mood, rgb[0], rgb[1], rgb[2]);
+  else
     {
-      real = out[2*i];  imag = out[2*i + 1];
-      amplitudes[mood->barkband_table[i]] += sqrtf (real*real + imag*imag);
+      gfloat *frame = &mood->rgbx[FRAME_FLOATS * mood->numframes];
+
+      frame[0] = rgb[0];
+      frame[1] = rgb[1];
+      frame[2] = rgb[2];
+      frame[3] = 0.f;
     }
 
-  /* Now divide the bark bands into thirds and compute their total 
-   * amplitudes */
+  return TRUE;
+}
 
-  for (i = 0; i < 24; ++i)
-    rgb[i/8] += amplitudes[i] * amplitudes[i];
 
-  rgb[0] = sqrtf (rgb[0]);
-  rgb[1] = sqrtf (rgb[1]);
-  rgb[2] = sqrtf (rgb[2]);
+/* This function does most of the analysis on the spectra we
+ * get as input and caches them.  We actually push buffers
+ * once we receive an EOS signal.  A buffer may hold several
+ * spectra (see spectrum.h).
+ */
+static GstFlowReturn
+gst_moodbar_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
+{
+  GstMoodbar *mood = GST_MOODBAR (parent);
+  GstFlowReturn res = GST_FLOW_OK;
+  gsize framesize
+    = gst_spectrum_format_frame_bytes (mood->format, mood->size);
+  gsize pos;
 
-  mood->r[mood->numframes] = rgb[0];
-  mood->g[mood->numframes] = rgb[1];
-  mood->b[mood->numframes] = rgb[2];
+  if (mood->size == 0
+      ||  gst_buffer_get_size (buf) % framesize != 0)
+    {
+      gst_buffer_unref (buf);
+      return GST_FLOW_ERROR;
+    }
+
+  GstMapInfo info;
+  gst_buffer_map(buf, &info, GST_MAP_READ);
+
+  for (pos = 0; pos < info.size  &&  res == GST_FLOW_OK; pos += framesize)
+    if (!gst_moodbar_analyze_frame (mood, (const gfloat *) (info.data + pos)))
+      res = GST_FLOW_ERROR;
 
   gst_buffer_unmap(buf, &info);
   
   gst_buffer_unref (buf);
 
-  return GST_FLOW_OK;
+  return res;
 }
 
 
-/* The normalization code was copied from Gav Wood's Exscalibar
- * library, normalise.cpp
- */
-static void
-normalize (gfloat *vals, guint numvals)
+/* Replace buf, an image of identical rows, with its compressed mood */
+static GstBuffer *
+gst_moodbar_compress (GstBuffer *buf, guint width, guint height)
 {
-  gfloat mini, maxi, tu = 0.f, tb = 0.f;
-  gfloat avgu = 0.f, avgb = 0.f, delta, avg = 0.f;
-  gfloat avguu = 0.f, avgbb = 0.f;
-  guint i;
-  gint t = 0;
+  GstMapInfo info;
+  guchar *data;
+  gsize length;
 
-  if (!numvals) 
-    return;
+  gst_buffer_map (buf, &info, GST_MAP_READ);
+  data = gst_moodbar_codec_encode (info.data, width, height, &length);
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
 
-  int z=0;
-  do
-  {
-    mini = maxi = vals[0] = vals[z]; //sometimes, somewhy, [0] contains nan; this allows circumventing the problem and generating a proper mood
-  } while (isnan(vals[z++]));
+  buf = gst_buffer_new_wrapped (data, length);
+  GST_BUFFER_OFFSET (buf) = 0;
+  return buf;
+}
 
-  for (i = 1; i < numvals; i++)
-    {
-      if (vals[i] > maxi) 
-	maxi = vals[i];
-      else if (vals[i] < mini) 
-	mini = vals[i];
-    }
+/* Announce the size of the image we're about to push in buf, in the
+ * first of our formats that downstream takes, and push it */
+static void
+gst_moodbar_push_image (GstMoodbar *mood, const GstMoodbarOutput *out,
+			GstBuffer *buf, guint output_width)
+{
+  GstCaps *caps = gst_pad_get_allowed_caps (out->pad);
+  gboolean res, compressed;
 
-  for (i = 0; i < numvals; i++)
+  if (caps == NULL  ||  gst_caps_is_empty (caps))
     {
-      if(vals[i] != mini && vals[i] != maxi)
-	{
-	  avg += vals[i] / ((gfloat) numvals); 
-	  t++; 
-	}
+      if (caps != NULL)
+	gst_caps_unref (caps);
+      gst_buffer_unref (buf);
+      return;
     }
 
-  for (i = 0; i < numvals; i++)
+  caps = gst_caps_make_writable (gst_caps_truncate (caps));
+  gst_caps_set_simple (caps, "width", G_TYPE_INT, output_width, NULL);
+  gst_caps_set_simple (caps, "height", G_TYPE_INT, out->height, NULL);
+  caps = gst_caps_fixate (caps);
+  compressed = gst_structure_has_name (gst_caps_get_structure (caps, 0),
+				       "application/x-moodbar");
+  res = gst_pad_set_caps (out->pad, caps);
+  gst_caps_unref (caps);
+  if (!res)
     {
-      if (vals[i] != mini && vals[i] != maxi)
-	{
-	  if (vals[i] > avg) 
-	    { 
-	      avgu += vals[i]; 
-	      tu++; 
-	    }
-	  else 
-	    { 
-	      avgb += vals[i]; 
-	      tb++; 
-	    }
-	}
+      gst_buffer_unref (buf);
+      return;
     }
 
-  avgu /= (gfloat) tu;
-  avgb /= (gfloat) tb;
+  if (compressed)
+    buf = gst_moodbar_compress (buf, output_width, out->height);
 
-  tu = 0.f; 
-  tb = 0.f;
-  for (i = 0; i < numvals; i++)
-    {
-      if (vals[i] != mini && vals[i] != maxi)
-	{
-	  if (vals[i] > avgu) 
-	    { 
-	      avguu += vals[i]; 
-	      tu++; 
-	    }
+  gst_pad_push (out->pad, buf);
+}
 
-	  else if (vals[i] < avgb) 
-	    { 
-	      avgbb += vals[i]; 
-	      tb++; 
-	    }
-	}
-    }
 
-  avguu /= (gfloat) tu;
-  avgbb /= (gfloat) tb;
+/* In streaming mode, all that's left is to normalize and average the
+ * columns; every row of the image is the same */
+static void
+gst_moodbar_finish_streaming (GstMoodbar *mood, const GstMoodbarOutput *out)
+{
+  GstMoodbarNormalization norm;
+  GstBuffer *buf;
+  GstMapInfo info;
+  gfloat *rgbx;
+  guint64 numframes = 0;
+  guint max_width, output_width, line, i;
+  gsize rowsize;
+
+  for (i = 0; i < mood->numcols; ++i)
+    numframes += mood->col_frames[i];
+
+  /* The same width as gst_moodbar_render would give; the columns were
+   * kept for the widest image (see gst_moodbar_stream_alloc), so there
+   * are at least that many of them */
+  max_width = out->max_width > 0 ? out->max_width : mood->col_capacity / 2;
+  if (numframes <= max_width)
+    output_width = (guint) numframes - 1;
+  else
+    output_width = max_width;
 
-  mini = MAX (avg + (avgb - avg) * 2.f, avgbb);
-  maxi = MIN (avg + (avgu - avg) * 2.f, avguu);
-  delta = maxi - mini;
+  /* As there, a single frame makes no columns */
+  if (numframes == 0  ||  output_width == 0)
+    return;
 
-  if (delta == 0.f)
-    delta = 1.f;
+  rowsize = output_width * 3 * sizeof (guchar);
+  buf = gst_buffer_new_and_alloc (rowsize * out->height);
+  if (!buf)
+    return;
+  GST_BUFFER_OFFSET (buf) = 0;
 
-  for (i = 0; i < numvals; i++)
-    vals[i] = finite (vals[i]) ? MIN(1.f, MAX(0.f, (vals[i] - mini) / delta))
-                               : 0.f;
-}
+  rgbx = gst_moodbar_stream_frames (mood, &norm);
 
+  gst_buffer_map (buf, &info, GST_MAP_WRITE);
+  gst_moodbar_render_row (rgbx, mood->numcols, &norm, mood->resample,
+			  output_width, info.data);
+  for (line = 1; line < out->height; ++line)
+    memcpy (info.data + line * rowsize, info.data, rowsize);
+  gst_buffer_unmap (buf, &info);
 
+  g_free (rgbx);
 
-/* This function normalizes all of the cached r,g,b data and 
- * finally pushes a monster buffer with all of our output.
- */
-static void 
-gst_moodbar_finish (GstMoodbar *mood)
+  gst_moodbar_push_image (mood, out, buf, output_width);
+}
+
+
+/* Average the normalized frames down to the image for out, and push
+ * that monster buffer */
+static void
+gst_moodbar_render (GstMoodbar *mood, const GstMoodbarNormalization *norm,
+		    const GstMoodbarOutput *out)
 {
   GstBuffer *buf;
   guchar *data;
   guint line;
   guint output_width;
 
-  if (mood->max_width == 0
-        || mood->numframes <= mood->max_width)
+  if (out->max_width == 0
+        || mood->numframes <= out->max_width)
     output_width = mood->numframes-1;
   else
-    output_width = mood->max_width;
+    output_width = out->max_width;
 
-  normalize (mood->r, mood->numframes);
-  normalize (mood->g, mood->numframes);
-  normalize (mood->b, mood->numframes);
+  /* Frame 0 is never filled in, so a single frame makes no columns */
+  if (output_width == 0)
+    return;
 
   buf = gst_buffer_new_and_alloc 
-            (output_width * mood->height * 3 * sizeof (guchar));
+            (output_width * out->height * 3 * sizeof (guchar));
   if (!buf)
     return;
   /* Don't set the timestamp, duration, etc. since it's irrelevant */
@@ -637,45 +1479,72 @@ gst_moodbar_finish (GstMoodbar *mood)
   gst_buffer_map(buf, &info, GST_MAP_READWRITE);
   data = info.data;
 
-  gfloat r, g, b;
-  guint i, j, n;
-  guint start, end;
-  for (line = 0; line < mood->height; ++line)
-    {
-      for (i = 0; i < output_width; ++i)
-	{
-	  r = 0.f;  g = 0.f;  b = 0.f;
-	  start = i * mood->numframes / output_width;
-	  end = (i + 1) * mood->numframes / output_width;
-	  if ( start == end )
-	    end = start + 1;
+  /* Every line is the same, so only the first is worked out */
+  gst_moodbar_render_row (mood->rgbx, mood->numframes, norm, mood->resample,
+			  output_width, data);
 
-	  for( j = start; j < end; j++ )
-	    {
-	      r += mood->r[j] * 255.f;
-	      g += mood->g[j] * 255.f;
-	      b += mood->b[j] * 255.f;
-	    }
+  for (line = 1; line < out->height; ++line)
+    memcpy (info.data + line * output_width * 3, info.data,
+	    output_width * 3);
 
-	  n = end - start;
+  gst_buffer_unmap(buf, &info);
 
-	  *(data++) = (guchar) (r / ((gfloat) n));
-	  *(data++) = (guchar) (g / ((gfloat) n));
-	  *(data++) = (guchar) (b / ((gfloat) n));
-	}
+  /* Now we (finally) know the width of the image we're pushing */
+  gst_moodbar_push_image (mood, out, buf, output_width);
+}
+
+
+/* Put the features of the frames in place at features-location */
+static void
+gst_moodbar_save_features (GstMoodbar *mood)
+{
+  GError *err = NULL;
+  gboolean res;
+
+  res = gst_moodbar_features_writer_finish (mood->features,
+					    (guint) mood->rate,
+					    (guint) mood->size, &err);
+  gst_moodbar_features_writer_free (mood->features);
+  mood->features = NULL;
+
+  if (!res)
+    {
+      GST_ELEMENT_ERROR (mood, RESOURCE, OPEN_WRITE,
+			 ("Could not save the features"),
+			 ("%s", err->message));
+      g_error_free (err);
     }
+}
 
-  { /* Now we (finally) know the width of the image we're pushing */
-    GstCaps *caps = gst_caps_copy (gst_pad_query_caps (mood->srcpad, NULL));
-    gboolean res;
-    gst_caps_set_simple (caps, "width", G_TYPE_INT, output_width, NULL);
-    gst_caps_set_simple (caps, "height", G_TYPE_INT, mood->height, NULL);
-    res = gst_pad_set_caps (mood->srcpad, caps);
-    gst_caps_unref (caps);
-    if (!res)
-      return;
-  }
 
-  gst_buffer_unmap(buf, &info);
-  gst_pad_push (mood->srcpad, buf);
+/* This function normalizes all of the cached r,g,b data and 
+ * finally pushes an image on each output.  The normalization is
+ * shared; only the averaging into columns is done per image.
+ */
+static void 
+gst_moodbar_finish (GstMoodbar *mood)
+{
+  GstMoodbarNormalization norm;
+  GList *outputs, *l;
+
+  if (mood->features != NULL)
+    gst_moodbar_save_features (mood);
+
+  /* Nothing to draw */
+  if (!mood->stream_active  &&  mood->numframes == 0)
+    return;
+
+  outputs = gst_moodbar_outputs (mood);
+
+  if (mood->stream_active)
+    for (l = outputs; l != NULL; l = l->next)
+      gst_moodbar_finish_streaming (mood, (GstMoodbarOutput *) l->data);
+  else
+    {
+      gst_moodbar_normalize (mood->rgbx, mood->numframes, &norm);
+      for (l = outputs; l != NULL; l = l->next)
+	gst_moodbar_render (mood, &norm, (GstMoodbarOutput *) l->data);
+    }
+
+  g_list_free_full (outputs, gst_moodbar_output_free);
 }
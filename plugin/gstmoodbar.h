@@ -17,6 +17,10 @@
 
 #include <gst/gst.h>
 
+#include "spectrumformat.h"
+#include "moodbarfeatures.h"
+#include "moodbarrender.h"
+
 G_BEGIN_DECLS
 
 /* #defines don't like whitespacey bits */
@@ -27,8 +31,18 @@ G_BEGIN_DECLS
 #define GST_MOODBAR_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_MOODBAR,GstMoodbarClass))
 
+#define GST_TYPE_MOODBAR_PAD \
+  (gst_moodbar_pad_get_type())
+#define GST_MOODBAR_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_MOODBAR_PAD,GstMoodbarPad))
+
 typedef struct _GstMoodbar      GstMoodbar;
 typedef struct _GstMoodbarClass GstMoodbarClass;
+typedef struct _GstMoodbarPad      GstMoodbarPad;
+typedef struct _GstMoodbarPadClass GstMoodbarPadClass;
+
+/* Value histogram for streaming normalization, see gstmoodbar.c */
+typedef struct _GstMoodbarHistogram GstMoodbarHistogram;
 
 struct _GstMoodbar
 {
@@ -36,19 +50,48 @@ struct _GstMoodbar
 
   GstPad *sinkpad, *srcpad;
 
+  /* Request pads (GstMoodbarPads), each of which gets its own image
+   * from the same analysis; protected by the object lock */
+  GList *outputs;
+  guint next_output;
+
   /* Stream data */
   gint rate, size;
+
+  /* What the incoming spectra are (see spectrum.h) */
+  GstSpectrumFormat format;
   
-  /* Cached band -> bark band table */
-  guint *barkband_table;
+  /* Cached bark band edges: band k is made of bins bark_edges[k] up
+   * to bark_edges[k+1] - 1 */
+  guint bark_edges[GST_SPECTRUM_BARK_BANDS + 1];
 
-  /* Queued moodbar data */
-  gfloat *r, *g, *b;
+  /* Queued moodbar data, as (r, g, b, unused) quadruples so that
+   * all three are normalized together (see gstmoodbar.c) */
+  gfloat *rgbx;
   guint numframes;
 
+  /* Streaming mode: instead of the frames, we keep numcols column
+   * sums of col_span frames each, and a histogram of each of r, g
+   * and b for normalization.  The column sums take up
+   * col_capacity = 2 * max_width slots. */
+  gboolean stream_active;
+  gdouble *col_r, *col_g, *col_b;
+  guint *col_frames;
+  guint numcols, col_capacity, col_span;
+  GstMoodbarHistogram *hist;
+
+  /* With features-location set, writes every frame's features (see
+   * moodbarfeatures.h) as it's analyzed */
+  GstMoodbarFeaturesWriter *features;
+
   /* Property */
   guint height;
   guint max_width;
+  guint frames_per_column;
+  gboolean streaming;
+  GstMoodbarResample resample;
+  gchar *features_location;
+  GstMoodbarFeaturesKind features_kind;
 };
 
 struct _GstMoodbarClass 
@@ -56,7 +99,23 @@ struct _GstMoodbarClass
   GstElementClass parent_class;
 };
 
+/* A src_%u request pad, with the size of its own image */
+struct _GstMoodbarPad
+{
+  GstPad pad;
+
+  /* Property */
+  guint height;
+  guint max_width;
+};
+
+struct _GstMoodbarPadClass
+{
+  GstPadClass parent_class;
+};
+
 GType gst_moodbar_get_type (void);
+GType gst_moodbar_pad_get_type (void);
 
 G_END_DECLS
 
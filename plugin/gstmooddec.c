@@ -0,0 +1,280 @@
+/* GStreamer moodbar plugin: compressed mood decoder
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/**
+ * SECTION:element-mooddec
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * <para>
+ * <programlisting>
+ * gst-launch filesrc location=test.moodz ! mooddec ! pngenc ! filesink location=test.png
+ * </programlisting>
+ * </para>
+ * </refsect2>
+ */
+
+/* This element turns a compressed mood (application/x-moodbar, as
+ * moodbar outputs when downstream asks for it; see moodbarcodec.h)
+ * back into the raw image moodbar would have output.  The mood is
+ * decoded as its buffers arrive, however they are cut, so only the
+ * row being decoded is ever held; the image is pushed as soon as the
+ * last code is in.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+
+#include "gstmooddec.h"
+
+GST_DEBUG_CATEGORY (gst_mooddec_debug);
+#define GST_CAT_DEFAULT gst_mooddec_debug
+
+static GstStaticPadTemplate sink_factory 
+  = GST_STATIC_PAD_TEMPLATE ("sink",
+			     GST_PAD_SINK,
+			     GST_PAD_ALWAYS,
+			     GST_STATIC_CAPS (GST_MOODBAR_CODEC_CAPS)
+			     );
+
+/* The same as moodbar's raw images */
+static GstStaticPadTemplate src_factory 
+  = GST_STATIC_PAD_TEMPLATE ("src",
+			     GST_PAD_SRC,
+			     GST_PAD_ALWAYS,
+			     GST_STATIC_CAPS 
+			       ( "video/x-raw, format=(string) RGB, "
+				   "bpp = (int) 24, "
+				   "depth = (int) 24, "
+				   "height = (int) [ 1, MAX ], "
+				   "width = (int) [ 1, MAX ], "
+				   "framerate = (fraction) 0/1" )
+			     );
+
+G_DEFINE_TYPE (GstMoodDec, gst_mooddec, GST_TYPE_ELEMENT);
+
+static void gst_mooddec_finalize (GObject *object);
+
+static gboolean gst_mooddec_sink_event (GstPad *pad, GstObject *parent, GstEvent *event);
+static GstFlowReturn gst_mooddec_chain (GstPad *pad, GstObject *parent, GstBuffer *buf);
+static GstStateChangeReturn gst_mooddec_change_state (GstElement *element,
+    GstStateChange transition);
+
+
+/***************************************************************/
+/* GObject boilerplate stuff                                   */
+/***************************************************************/
+
+static void
+gst_mooddec_class_init (GstMoodDecClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *element_class = (GstElementClass *) klass;
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_set_details_simple (element_class, 
+      "Moodbar decoder",
+      "Codec/Decoder/Image",
+      "Decode a compressed mood into a stream of (uchar) rgb triples",
+      "Joe Rabinoff <bobqwatson@yahoo.com>" );
+
+  gobject_class->finalize = gst_mooddec_finalize;
+
+  element_class->change_state 
+    = GST_DEBUG_FUNCPTR (gst_mooddec_change_state);
+}
+
+static void
+gst_mooddec_init (GstMoodDec *mooddec)
+{
+  GstElementClass *klass = GST_ELEMENT_GET_CLASS (mooddec);
+
+  mooddec->sinkpad =
+      gst_pad_new_from_template 
+          (gst_element_class_get_pad_template (klass, "sink"), "sink");
+  gst_pad_set_event_function (mooddec->sinkpad,
+			      GST_DEBUG_FUNCPTR (gst_mooddec_sink_event));
+  gst_pad_set_chain_function (mooddec->sinkpad, 
+			      GST_DEBUG_FUNCPTR (gst_mooddec_chain));
+
+  mooddec->srcpad =
+      gst_pad_new_from_template 
+          (gst_element_class_get_pad_template (klass, "src"), "src");
+  gst_pad_use_fixed_caps (mooddec->srcpad);
+
+  gst_element_add_pad (GST_ELEMENT (mooddec), mooddec->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (mooddec), mooddec->srcpad);
+
+  gst_moodbar_decoder_init (&mooddec->dec);
+  mooddec->pushed = FALSE;
+}
+
+static void
+gst_mooddec_finalize (GObject *object)
+{
+  GstMoodDec *mooddec = GST_MOODDEC (object);
+
+  gst_moodbar_decoder_clear (&mooddec->dec);
+
+  G_OBJECT_CLASS (gst_mooddec_parent_class)->finalize (object);
+}
+
+
+/***************************************************************/
+/* Decoding                                                    */
+/***************************************************************/
+
+static void
+gst_mooddec_reset (GstMoodDec *mooddec)
+{
+  gst_moodbar_decoder_clear (&mooddec->dec);
+  mooddec->pushed = FALSE;
+}
+
+
+/* Announce the size of the decoded image and push it */
+static GstFlowReturn
+gst_mooddec_push_image (GstMoodDec *mooddec)
+{
+  const GstMoodbarDecoder *dec = &mooddec->dec;
+  gsize rowsize = (gsize) dec->width * 3;
+  GstBuffer *buf;
+  GstMapInfo info;
+  GstCaps *caps;
+  guint line;
+  gboolean res;
+
+  /* The decoder only takes headers whose height fits in a gint and
+   * whose image fits in memory (see moodbarcodec.c), so neither the
+   * size here nor the caps below overflow */
+  buf = gst_buffer_new_allocate (NULL, rowsize * dec->height, NULL);
+  if (buf == NULL)
+    {
+      GST_ELEMENT_ERROR (mooddec, RESOURCE, NO_SPACE_LEFT,
+			 ("Could not allocate the decoded mood"),
+			 ("%u x %u pixels", dec->width, dec->height));
+      return GST_FLOW_ERROR;
+    }
+
+  gst_buffer_map (buf, &info, GST_MAP_WRITE);
+  for (line = 0; line < dec->height; ++line)
+    memcpy (info.data + line * rowsize, dec->row, rowsize);
+  gst_buffer_unmap (buf, &info);
+  GST_BUFFER_OFFSET (buf) = 0;
+
+  caps = gst_caps_new_simple ("video/x-raw",
+			      "format", G_TYPE_STRING, "RGB",
+			      "bpp", G_TYPE_INT, 24,
+			      "depth", G_TYPE_INT, 24,
+			      "width", G_TYPE_INT, (gint) dec->width,
+			      "height", G_TYPE_INT, (gint) dec->height,
+			      "framerate", GST_TYPE_FRACTION, 0, 1,
+			      NULL);
+  res = gst_pad_set_caps (mooddec->srcpad, caps);
+  gst_caps_unref (caps);
+  if (!res)
+    {
+      gst_buffer_unref (buf);
+      return GST_FLOW_NOT_NEGOTIATED;
+    }
+
+  mooddec->pushed = TRUE;
+  return gst_pad_push (mooddec->srcpad, buf);
+}
+
+
+static GstFlowReturn
+gst_mooddec_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
+{
+  GstMoodDec *mooddec = GST_MOODDEC (parent);
+  GstMapInfo info;
+  gboolean res;
+
+  /* Anything after the mood is ignored */
+  if (mooddec->pushed)
+    {
+      gst_buffer_unref (buf);
+      return GST_FLOW_OK;
+    }
+
+  gst_buffer_map (buf, &info, GST_MAP_READ);
+  res = gst_moodbar_decoder_feed (&mooddec->dec, info.data, info.size);
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
+
+  if (!res)
+    {
+      GST_ELEMENT_ERROR (mooddec, STREAM, DECODE, (NULL),
+			 ("Not a compressed mood, or not of a version "
+			  "we know"));
+      return GST_FLOW_ERROR;
+    }
+
+  if (gst_moodbar_decoder_done (&mooddec->dec))
+    return gst_mooddec_push_image (mooddec);
+
+  return GST_FLOW_OK;
+}
+
+
+static gboolean
+gst_mooddec_sink_event (GstPad *pad, GstObject *parent, GstEvent *event)
+{
+  GstMoodDec *mooddec = GST_MOODDEC (parent);
+
+  switch (GST_EVENT_TYPE (event))
+    {
+    case GST_EVENT_CAPS:
+      /* The image's caps are set when it is pushed */
+      gst_event_unref (event);
+      return TRUE;
+
+    case GST_EVENT_FLUSH_STOP:
+      gst_mooddec_reset (mooddec);
+      break;
+
+    case GST_EVENT_EOS:
+      if (!mooddec->pushed)
+	GST_ELEMENT_ERROR (mooddec, STREAM, DECODE, (NULL),
+			   ("The compressed mood ended after %u of %u "
+			    "channels", mooddec->dec.decoded,
+			    mooddec->dec.width * 3));
+      break;
+
+    default:
+      break;
+    }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+
+static GstStateChangeReturn
+gst_mooddec_change_state (GstElement *element, GstStateChange transition)
+{
+  GstMoodDec *mooddec = GST_MOODDEC (element);
+  GstStateChangeReturn res;
+
+  res = GST_ELEMENT_CLASS (gst_mooddec_parent_class)->change_state (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+    gst_mooddec_reset (mooddec);
+
+  return res;
+}
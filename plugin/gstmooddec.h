@@ -0,0 +1,52 @@
+/* GStreamer moodbar plugin: compressed mood decoder
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __GST_MOODDEC_H__
+#define __GST_MOODDEC_H__
+
+#include <gst/gst.h>
+
+#include "moodbarcodec.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_MOODDEC \
+  (gst_mooddec_get_type())
+#define GST_MOODDEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_MOODDEC,GstMoodDec))
+#define GST_MOODDEC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_MOODDEC,GstMoodDecClass))
+
+typedef struct _GstMoodDec      GstMoodDec;
+typedef struct _GstMoodDecClass GstMoodDecClass;
+
+struct _GstMoodDec
+{
+  GstElement element;
+
+  GstPad *sinkpad, *srcpad;
+
+  /* The mood being decoded, and whether its image has been pushed */
+  GstMoodbarDecoder dec;
+  gboolean pushed;
+};
+
+struct _GstMoodDecClass 
+{
+  GstElementClass parent_class;
+};
+
+GType gst_mooddec_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_MOODDEC_H__ */
@@ -44,6 +44,7 @@
 
 #include "gstspectrumeq.h"
 #include "spectrum.h"
+#include "spectrumkernels.h"
 
 #define GST_CAT_DEFAULT gst_spectrumeq_debug
 GST_DEBUG_CATEGORY (gst_spectrumeq_debug);
@@ -68,7 +69,8 @@ static GstStaticPadTemplate spectrumeq_sink_template
 			     GST_PAD_SINK,
 			     GST_PAD_ALWAYS,
 			     GST_STATIC_CAPS 
-			       ( SPECTRUM_FREQ_CAPS )
+			       ( SPECTRUM_FREQ_CAPS "; "
+				 SPECTRUM_MAGNITUDE_CAPS )
 			     );
 
 static GstStaticPadTemplate spectrumeq_src_template 
@@ -76,7 +78,8 @@ static GstStaticPadTemplate spectrumeq_src_template
 			     GST_PAD_SRC,
 			     GST_PAD_ALWAYS,
 			     GST_STATIC_CAPS 
-			       ( SPECTRUM_FREQ_CAPS )
+			       ( SPECTRUM_FREQ_CAPS "; "
+				 SPECTRUM_MAGNITUDE_CAPS )
 			     );
 
 G_DEFINE_TYPE (GstSpectrumEq, gst_spectrumeq, GST_TYPE_BASE_TRANSFORM);
@@ -90,6 +93,8 @@ static GstFlowReturn gst_spectrumeq_transform_ip (GstBaseTransform *base,
     GstBuffer *outbuf);
 static gboolean gst_spectrumeq_set_caps (GstBaseTransform *base, GstCaps *incaps,
     GstCaps *outcaps);
+static void gst_spectrumeq_set_bands (GstSpectrumEq *spec, gfloat *bands,
+    guint numbands);
 
 
 /* Presets -- these are different sections of a Gaussian */
@@ -207,6 +212,11 @@ gst_spectrumeq_dispose (GObject *object)
   spec->bands    = NULL;
   spec->numbands = 0;
 
+  g_free (spec->gains);
+  g_free (spec->pending);
+  spec->gains   = NULL;
+  spec->pending = NULL;
+
   G_OBJECT_CLASS (gst_spectrumeq_parent_class)->dispose (object);
 }
 
@@ -271,6 +281,10 @@ gst_spectrumeq_init (GstSpectrumEq *spec)
   spec->numbands = 1;
 
   spec->numfreqs = 0;
+  spec->magnitude = FALSE;
+
+  spec->gains   = NULL;
+  spec->pending = NULL;
 }
 
 
@@ -281,33 +295,32 @@ gst_spectrumeq_set_property (GObject *object, guint prop_id, const GValue *value
   GstSpectrumEq *spec = GST_SPECTRUMEQ (object);
   GArray *array;
   GValue *val;
+  gfloat *newbands;
   guint i;
 
   switch (prop_id)
     {
     case ARG_EQUALIZER:
-      /* spec->bands should ALWAYS be allocated here */
-      g_free (spec->bands);
       array = (GArray *) g_value_get_boxed (value);
 
       /* It doesn't make sense to have zero bands */
       if (array->len == 0)
 	{
-	  spec->bands = (gfloat *) g_malloc (1 * sizeof (gfloat));
-	  spec->bands[0] = 1.0;
-	  spec->numbands = 1;
+	  newbands = (gfloat *) g_malloc (1 * sizeof (gfloat));
+	  newbands[0] = 1.0;
+	  gst_spectrumeq_set_bands (spec, newbands, 1);
 	}
 
       else
 	{
-	  spec->numbands = array->len;
-	  spec->bands = (gfloat *) g_malloc (spec->numbands * sizeof (gfloat));
+	  newbands = (gfloat *) g_malloc (array->len * sizeof (gfloat));
 
-	  for (i = 0; i < spec->numbands; ++i)
+	  for (i = 0; i < array->len; ++i)
 	    {
 	      val = &g_array_index (array, GValue, i);
-	      spec->bands[i] = g_value_get_float (val);
+	      newbands[i] = g_value_get_float (val);
 	    }
+	  gst_spectrumeq_set_bands (spec, newbands, array->len);
 	}
 
       break;
@@ -337,11 +350,9 @@ gst_spectrumeq_set_property (GObject *object, guint prop_id, const GValue *value
 	    return;
 	  };
 	
-	/* spec->bands should ALWAYS be allocated here */
-	g_free (spec->bands);
-	spec->numbands = size;
-	spec->bands = (gfloat *) g_malloc (spec->numbands * sizeof (gfloat));
-	memcpy (spec->bands, bands, spec->numbands * sizeof (gfloat));
+	newbands = (gfloat *) g_malloc (size * sizeof (gfloat));
+	memcpy (newbands, bands, size * sizeof (gfloat));
+	gst_spectrumeq_set_bands (spec, newbands, size);
       }
       break;
     default:
@@ -363,6 +374,7 @@ gst_spectrumeq_get_property (GObject *object, guint prop_id, GValue *value,
   switch (prop_id) 
     {
     case ARG_EQUALIZER:
+      GST_OBJECT_LOCK (spec);
       array = g_array_sized_new (FALSE, TRUE, sizeof (GValue), spec->numbands);
       for (i = 0; i < spec->numbands; ++i)
 	{
@@ -371,6 +383,7 @@ gst_spectrumeq_get_property (GObject *object, guint prop_id, GValue *value,
 	  g_value_set_float (&val, spec->bands[i]);
 	  array = g_array_append_val (array, val);
 	}
+      GST_OBJECT_UNLOCK (spec);
       g_value_take_boxed (value, array);
       break;
     default:
@@ -380,6 +393,99 @@ gst_spectrumeq_get_property (GObject *object, guint prop_id, GValue *value,
 }
 
 
+/***************************************************************/
+/* Gain tables                                                 */
+/***************************************************************/
+
+/* Interpolate the bands into a table of scale factors for spectra of
+ * numfreqs bins.  Called with the object lock held.
+ */
+static GstSpectrumEqGains *
+gst_spectrumeq_gains_new (const gfloat *bands, guint numbands,
+			  guint numfreqs, gboolean magnitude)
+{
+  GstSpectrumEqGains *gains;
+  guint i, len = numfreqs * (magnitude ? 1 : 2);
+
+  gains = (GstSpectrumEqGains *) 
+    g_malloc (G_STRUCT_OFFSET (GstSpectrumEqGains, gains) 
+	      + MAX (len, 1) * sizeof (gfloat));
+  gains->numfreqs  = numfreqs;
+  gains->magnitude = magnitude;
+  gains->len       = len;
+
+  for (i = 0; i < numfreqs; ++i)
+    {
+      gfloat pct, band, prevband, scalefactor;
+
+      if (numbands == 1)
+	scalefactor = bands[0];
+
+      else
+	{
+	  /* Do a simple linear interpolation between bands to get the
+	   * amplitude scale factor */
+	  pct      = ((gfloat) i) / ((gfloat) numfreqs);
+	  band     = pct * ((gfloat) (numbands-1));
+	  prevband = floorf (band);
+	  
+	  if(((guint) prevband) >= numbands - 1)
+	    scalefactor = bands[numbands - 1];
+
+	  else
+	    scalefactor = (band - prevband) * bands[((guint) prevband)+1]
+	           + (1 - (band - prevband)) * bands[(guint) prevband];
+	}
+
+      if (magnitude)
+	gains->gains[i] = scalefactor;
+      else
+	gains->gains[2*i] = gains->gains[2*i + 1] = scalefactor;
+    }
+
+  return gains;
+}
+
+/* Replace the pending table, returning the one it replaces (if the
+ * streaming thread hasn't taken it yet).  This is the only way the
+ * pending table is touched, so neither thread ever waits on the other.
+ */
+static GstSpectrumEqGains *
+gst_spectrumeq_swap_pending (GstSpectrumEq *spec, GstSpectrumEqGains *gains)
+{
+  gpointer old;
+
+  do
+    old = g_atomic_pointer_get (&spec->pending);
+  while (!g_atomic_pointer_compare_and_exchange (&spec->pending, old, gains));
+
+  return (GstSpectrumEqGains *) old;
+}
+
+/* Takes ownership of bands.  The new table is built here, in the
+ * application's thread, and handed to the streaming thread through
+ * spec->pending; if there are no caps yet, set_caps builds it.
+ */
+static void
+gst_spectrumeq_set_bands (GstSpectrumEq *spec, gfloat *bands, guint numbands)
+{
+  GstSpectrumEqGains *gains = NULL;
+
+  GST_OBJECT_LOCK (spec);
+  g_free (spec->bands);
+  spec->bands    = bands;
+  spec->numbands = numbands;
+
+  if (spec->numfreqs > 0)
+    gains = gst_spectrumeq_gains_new (spec->bands, spec->numbands,
+				      spec->numfreqs, spec->magnitude);
+  GST_OBJECT_UNLOCK (spec);
+
+  if (gains)
+    g_free (gst_spectrumeq_swap_pending (spec, gains));
+}
+
+
 /***************************************************************/
 /* Capabilities negotiation                                    */
 /***************************************************************/
@@ -391,22 +497,35 @@ static gboolean
 gst_spectrumeq_set_caps (GstBaseTransform *base, GstCaps *incaps, GstCaps *outcaps)
 {
   GstSpectrumEq *spec = GST_SPECTRUMEQ (base);
+  GstSpectrumEqGains *gains;
   GstStructure *s;
   gint size;
 
   GST_DEBUG_OBJECT (spec,
     "set_caps: in %" GST_PTR_FORMAT " out %" GST_PTR_FORMAT, incaps, outcaps);
 
+  GST_OBJECT_LOCK (spec);
   spec->numfreqs = 0;
+  GST_OBJECT_UNLOCK (spec);
+
+  g_free (spec->gains);
+  spec->gains = NULL;
 
   if (!gst_caps_is_equal (incaps, outcaps))
     return FALSE;
 
   s = gst_caps_get_structure (incaps, 0);
-  if (!gst_structure_get_int (s, "size", &size))
+  if (!gst_structure_get_int (s, "size", &size) || size <= 0)
     return FALSE;
 
+  GST_OBJECT_LOCK (spec);
   spec->numfreqs = (guint) (size / 2 + 1);
+  spec->magnitude = gst_structure_has_name (s, SPECTRUM_MAGNITUDE_NAME);
+  gains = gst_spectrumeq_gains_new (spec->bands, spec->numbands,
+				    spec->numfreqs, spec->magnitude);
+  GST_OBJECT_UNLOCK (spec);
+
+  spec->gains = gains;
 
   return TRUE;
 }
@@ -420,46 +539,38 @@ static GstFlowReturn
 gst_spectrumeq_transform_ip (GstBaseTransform *base, GstBuffer *outbuf)
 {
   GstSpectrumEq *spec = GST_SPECTRUMEQ (base);
-  gfloat *data;
-  guint i;
-
-  /* Pedantry */
-  if (gst_buffer_get_size (outbuf) != spec->numfreqs * sizeof (gfloat) * 2)
-    return GST_FLOW_ERROR;
-  
+  GstSpectrumEqGains *gains;
   GstMapInfo info;
-  gst_buffer_map(outbuf, &info, GST_MAP_READWRITE);
-  data = (gfloat *) info.data;
-
-  for (i = 0; i < spec->numfreqs; ++i)
+  gsize framesize, pos;
+
+  /* Pick up the table for the latest bands, if there is one.  A table
+   * built for other caps predates the last set_caps, which already
+   * used the bands it was built from. */
+  gains = gst_spectrumeq_swap_pending (spec, NULL);
+  if (gains && gains->numfreqs == spec->numfreqs
+      && gains->magnitude == spec->magnitude)
     {
-      gfloat pct, band, prevband, scalefactor;
-
-      if (spec->numbands == 1)
-	scalefactor = spec->bands[0];
-
-      else
-	{
-	  /* Do a simple linear interpolation between bands to get the
-	   * amplitude scale factor */
-	  pct      = ((gfloat) i) / ((gfloat) spec->numfreqs);
-	  band     = pct * ((gfloat) (spec->numbands-1));
-	  prevband = floorf (band);
-	  
-	  if(((guint) prevband) >= spec->numbands - 1)
-	    scalefactor = spec->bands[spec->numbands - 1];
+      g_free (spec->gains);
+      spec->gains = gains;
+    }
+  else
+    g_free (gains);
 
-	  else
-	    scalefactor = (band - prevband) * spec->bands[((guint) prevband)+1]
-	           + (1 - (band - prevband)) * spec->bands[(guint) prevband];
+  if (spec->gains == NULL)
+    return GST_FLOW_NOT_NEGOTIATED;
+  framesize = spec->gains->len * sizeof (gfloat);
 
-	}
+  /* Pedantry.  A buffer may hold several spectra (see spectrum.h) */
+  if (framesize == 0  ||  gst_buffer_get_size (outbuf) % framesize != 0)
+    return GST_FLOW_ERROR;
+  
+  if (!gst_buffer_map (outbuf, &info, GST_MAP_READWRITE))
+    return GST_FLOW_ERROR;
 
-      *(++data) *= scalefactor;
-      *(++data) *= scalefactor;
-    } 
+  for (pos = 0; pos < info.size; pos += framesize)
+    gst_spectrum_multiply ((gfloat *) (info.data + pos), spec->gains->gains,
+			   spec->gains->len);
 
-  gst_buffer_unmap(outbuf, &info);
+  gst_buffer_unmap (outbuf, &info);
   return GST_FLOW_OK;
 }
-
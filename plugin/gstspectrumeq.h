@@ -41,16 +41,38 @@ typedef enum
 
 typedef struct _GstSpectrumEq      GstSpectrumEq;
 typedef struct _GstSpectrumEqClass GstSpectrumEqClass;
+typedef struct _GstSpectrumEqGains GstSpectrumEqGains;
+
+/* The scale factor of every float of a spectrum, interpolated from the
+ * bands.  Complex spectra get each factor twice, for the real and the
+ * imaginary part, so applying the table is a plain multiply.
+ */
+struct _GstSpectrumEqGains {
+  guint    numfreqs;
+  gboolean magnitude;
+
+  guint    len;
+  gfloat   gains[1];
+};
 
 struct _GstSpectrumEq {
   GstBaseTransform element;
 
-  /* Scale factors for the different bands (set by a property) */
+  /* Scale factors for the different bands (set by a property), and
+   * the caps below, are protected by the object lock */
   gfloat *bands;
   guint   numbands;
 
-  /* The number of complex numbers in each buffer */
+  /* The number of complex numbers (or magnitudes, if magnitude is
+   * set) in each spectrum */
   guint numfreqs;
+  gboolean magnitude;
+
+  /* The table in use, only touched by the streaming thread, and the
+   * table the properties were last set to, which the streaming thread
+   * takes over atomically before the next buffer */
+  GstSpectrumEqGains *gains;
+  GstSpectrumEqGains *pending;
 };
 
 struct _GstSpectrumEqClass {
@@ -0,0 +1,364 @@
+/* GStreamer moodbar plugin: compressed moods
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Each channel of each column is coded as its difference d from the
+ * same channel of the column before (the column before the first is
+ * black), taken modulo 256 into -128..127 and folded to u = 2d for
+ * d >= 0 and -2d - 1 otherwise, so that small differences of either
+ * sign are small numbers.  u is then written as a Rice code with
+ * parameter k: u >> k in unary (that many ones, then a zero),
+ * followed by the low k bits of u.  If u >> k would take ESCAPE ones
+ * or more, ESCAPE ones are written instead, followed by all 8 bits of
+ * u, so no code is longer than MAX_CODE_BITS.
+ *
+ * k adapts to each channel as in LOCO-I: it is the smallest k for
+ * which count << k >= sum, where sum is the total of the u so far and
+ * count their number, both halved whenever count reaches RESET so
+ * that k follows the music.  A column of a quiet passage then costs
+ * about three bits, and the codes never cost much more than the 24
+ * bits of a raw column.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <string.h>
+
+#include "moodbarcodec.h"
+
+#define ESCAPE        12
+#define MAX_K         7
+#define MAX_CODE_BITS (ESCAPE + 8)
+#define RESET         64
+
+/* The starting state of each channel: k = 3 */
+#define SUM_START     8
+#define COUNT_START   1
+
+/* Moods wider than this, or whose images are bigger than this many
+ * bytes, are taken to be garbage */
+#define MAX_WIDTH       (1 << 26)
+#define MAX_IMAGE_BYTES ((gsize) 1 << 30)
+
+
+static guint
+rice_parameter (guint sum, guint count)
+{
+  guint k = 0;
+
+  while (k < MAX_K  &&  (count << k) < sum)
+    ++k;
+
+  return k;
+}
+
+static void
+adapt (guint *sum, guint *count, guint u)
+{
+  *sum += u;
+  if (++*count == RESET)
+    {
+      *sum >>= 1;
+      *count >>= 1;
+    }
+}
+
+static void
+put_uint32 (guchar *p, guint32 v)
+{
+  v = GUINT32_TO_LE (v);
+  memcpy (p, &v, 4);
+}
+
+static guint32
+get_uint32 (const guchar *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, 4);
+  return GUINT32_FROM_LE (v);
+}
+
+
+/***************************************************************/
+/* Encoding                                                    */
+/***************************************************************/
+
+typedef struct
+{
+  guchar *out;
+  guint32 bits;   /* nbits pending bits, at the bottom */
+  guint nbits;
+} BitWriter;
+
+/* Append the low n bits of value; n is at most MAX_CODE_BITS */
+static void
+put_bits (BitWriter *w, guint32 value, guint n)
+{
+  w->bits = (w->bits << n) | value;
+  w->nbits += n;
+  while (w->nbits >= 8)
+    {
+      w->nbits -= 8;
+      *w->out++ = (guchar) (w->bits >> w->nbits);
+    }
+}
+
+guchar *
+gst_moodbar_codec_encode (const guchar *row, guint width, guint height,
+			  gsize *length)
+{
+  BitWriter w;
+  guchar *data, prev[3] = { 0, 0, 0 };
+  guint sum[3], count[3], i, c, k, u, q;
+  gint8 d;
+
+  g_return_val_if_fail (width > 0  &&  width <= MAX_WIDTH, NULL);
+  g_return_val_if_fail (height > 0, NULL);
+
+  data = g_malloc (GST_MOODBAR_CODEC_HEADER_SIZE
+		   + ((gsize) width * 3 * MAX_CODE_BITS + 7) / 8);
+  memcpy (data, GST_MOODBAR_CODEC_MAGIC, 4);
+  put_uint32 (data + 4, GST_MOODBAR_CODEC_VERSION);
+  put_uint32 (data + 8, width);
+  put_uint32 (data + 12, height);
+
+  for (c = 0; c < 3; ++c)
+    {
+      sum[c] = SUM_START;
+      count[c] = COUNT_START;
+    }
+
+  w.out = data + GST_MOODBAR_CODEC_HEADER_SIZE;
+  w.bits = 0;
+  w.nbits = 0;
+
+  for (i = 0; i < width; ++i, row += 3)
+    for (c = 0; c < 3; ++c)
+      {
+	d = (gint8) (row[c] - prev[c]);
+	u = d >= 0 ? 2 * (guint) d : 2 * (guint) -d - 1;
+	prev[c] = row[c];
+
+	k = rice_parameter (sum[c], count[c]);
+	q = u >> k;
+	if (q < ESCAPE)
+	  {
+	    /* q ones and a zero */
+	    put_bits (&w, ((1u << q) - 1) << 1, q + 1);
+	    put_bits (&w, u & ((1u << k) - 1), k);
+	  }
+	else
+	  {
+	    put_bits (&w, (1u << ESCAPE) - 1, ESCAPE);
+	    put_bits (&w, u, 8);
+	  }
+	adapt (&sum[c], &count[c], u);
+      }
+
+  if (w.nbits > 0)
+    put_bits (&w, 0, 8 - w.nbits);
+
+  *length = w.out - data;
+  return data;
+}
+
+
+/***************************************************************/
+/* Decoding                                                    */
+/***************************************************************/
+
+void
+gst_moodbar_decoder_init (GstMoodbarDecoder *dec)
+{
+  guint c;
+
+  memset (dec, 0, sizeof (GstMoodbarDecoder));
+  for (c = 0; c < 3; ++c)
+    {
+      dec->sum[c] = SUM_START;
+      dec->count[c] = COUNT_START;
+    }
+}
+
+void
+gst_moodbar_decoder_clear (GstMoodbarDecoder *dec)
+{
+  g_free (dec->row);
+  gst_moodbar_decoder_init (dec);
+}
+
+gboolean
+gst_moodbar_decoder_done (const GstMoodbarDecoder *dec)
+{
+  return dec->row != NULL  &&  dec->decoded == dec->width * 3;
+}
+
+
+/* Take in the header once it is complete */
+static gboolean
+read_header (GstMoodbarDecoder *dec)
+{
+  const guchar *h = dec->header;
+
+  if (memcmp (h, GST_MOODBAR_CODEC_MAGIC, 4) != 0
+      ||  get_uint32 (h + 4) != GST_MOODBAR_CODEC_VERSION)
+    return FALSE;
+
+  dec->width = get_uint32 (h + 8);
+  dec->height = get_uint32 (h + 12);
+  if (dec->width == 0  ||  dec->width > MAX_WIDTH  ||  dec->height == 0
+      ||  dec->height > G_MAXINT
+      ||  dec->height > MAX_IMAGE_BYTES / ((gsize) dec->width * 3))
+    return FALSE;
+
+  dec->row = g_malloc ((gsize) dec->width * 3);
+  return TRUE;
+}
+
+
+/* The number of leading ones of bits, up to ESCAPE */
+static inline guint
+leading_ones (guint64 bits)
+{
+#ifdef __GNUC__
+  return ~bits != 0 ? MIN ((guint) __builtin_clzll (~bits), ESCAPE) : ESCAPE;
+#else
+  guint q = 0;
+
+  while (q < ESCAPE  &&  (bits >> (63 - q)) & 1)
+    ++q;
+  return q;
+#endif
+}
+
+
+gboolean
+gst_moodbar_decoder_feed (GstMoodbarDecoder *dec, const guchar *data,
+			  gsize length)
+{
+  guint64 bits;
+  guint nbits, total, decoded, c, k, q, u, need;
+  guint sum[3], count[3];
+  guchar *row, prev[3];
+  gsize n;
+
+  if (dec->header_length < GST_MOODBAR_CODEC_HEADER_SIZE)
+    {
+      n = MIN (length, GST_MOODBAR_CODEC_HEADER_SIZE - dec->header_length);
+      memcpy (dec->header + dec->header_length, data, n);
+      dec->header_length += n;
+      data += n;
+      length -= n;
+
+      if (dec->header_length < GST_MOODBAR_CODEC_HEADER_SIZE)
+	return TRUE;
+      if (!read_header (dec))
+	return FALSE;
+    }
+
+  /* The state is kept in locals while decoding, since every store to
+   * row could otherwise alias it */
+  bits = dec->bits;
+  nbits = dec->nbits;
+  decoded = dec->decoded;
+  total = dec->width * 3;
+  row = dec->row;
+  c = decoded % 3;
+  memcpy (sum, dec->sum, sizeof (sum));
+  memcpy (count, dec->count, sizeof (count));
+  memcpy (prev, dec->prev, sizeof (prev));
+
+  while (decoded < total)
+    {
+      /* Keep the bit buffer topped up */
+      while (nbits <= 56  &&  length > 0)
+	{
+	  bits |= (guint64) *data++ << (56 - nbits);
+	  nbits += 8;
+	  --length;
+	}
+
+      /* Stop if the next code isn't all in yet.  The bits below
+       * nbits are zero, so they never pass for the ones of a code. */
+      k = rice_parameter (sum[c], count[c]);
+      q = leading_ones (bits);
+      need = q < ESCAPE ? q + 1 + k : ESCAPE + 8;
+      if (nbits < need)
+	break;
+
+      if (q < ESCAPE)
+	u = (q << k) | (guint) ((bits >> (64 - need)) & ((1u << k) - 1));
+      else
+	u = (guint) (bits >> (64 - need)) & 0xff;
+      bits <<= need;
+      nbits -= need;
+
+      adapt (&sum[c], &count[c], u);
+      prev[c] += (u & 1) ? -(gint) ((u + 1) / 2) : (gint) (u / 2);
+      row[decoded++] = prev[c];
+      c = c == 2 ? 0 : c + 1;
+    }
+
+  dec->bits = bits;
+  dec->nbits = nbits;
+  dec->decoded = decoded;
+  memcpy (dec->sum, sum, sizeof (sum));
+  memcpy (dec->count, count, sizeof (count));
+  memcpy (dec->prev, prev, sizeof (prev));
+
+  return TRUE;
+}
+
+
+gboolean
+gst_moodbar_codec_is_compressed (const guchar *data, gsize length)
+{
+  /* A raw mood may start with the magic too, but hardly with the
+   * version after it */
+  return length >= GST_MOODBAR_CODEC_HEADER_SIZE
+    &&  memcmp (data, GST_MOODBAR_CODEC_MAGIC, 4) == 0
+    &&  get_uint32 (data + 4) == GST_MOODBAR_CODEC_VERSION;
+}
+
+
+guchar *
+gst_moodbar_codec_decode (const guchar *data, gsize length,
+			  guint *width, guint *height)
+{
+  GstMoodbarDecoder dec;
+  guchar *image = NULL;
+  gsize rowsize;
+  guint line;
+
+  gst_moodbar_decoder_init (&dec);
+
+  if (gst_moodbar_decoder_feed (&dec, data, length)
+      &&  gst_moodbar_decoder_done (&dec))
+    {
+      rowsize = (gsize) dec.width * 3;
+      image = g_try_malloc (rowsize * dec.height);
+      if (image != NULL)
+	{
+	  memcpy (image, dec.row, rowsize);
+	  for (line = 1; line < dec.height; ++line)
+	    memcpy (image + line * rowsize, image, rowsize);
+	  *width = dec.width;
+	  *height = dec.height;
+	}
+    }
+
+  gst_moodbar_decoder_clear (&dec);
+  return image;
+}
@@ -0,0 +1,93 @@
+/* GStreamer moodbar plugin: compressed moods
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Every row of a moodbar is the same, and neighbouring columns are
+ * close in colour, so a compressed mood (application/x-moodbar) codes
+ * only the first row, as the difference of each channel from the
+ * column before, with adaptive Rice codes.  A compressed mood is a
+ * header of little-endian fields
+ *
+ *   offset  size
+ *        0     4  magic, "MBRC"
+ *        4     4  version, GST_MOODBAR_CODEC_VERSION
+ *        8     4  width
+ *       12     4  height
+ *
+ * followed by 3 * width codes (red, green and blue of each column in
+ * turn), packed most significant bit first, with the last byte padded
+ * with zeroes.  See moodbarcodec.c for the codes.
+ */
+
+#ifndef __MOODBARCODEC_H__
+#define __MOODBARCODEC_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GST_MOODBAR_CODEC_MAGIC       "MBRC"
+#define GST_MOODBAR_CODEC_VERSION     1
+#define GST_MOODBAR_CODEC_HEADER_SIZE 16
+
+#define GST_MOODBAR_CODEC_CAPS \
+  "application/x-moodbar, " \
+    "height = (int) [ 1, MAX ], " \
+    "width = (int) [ 1, MAX ]"
+
+/* A decoder that can be fed a compressed mood in pieces of any size,
+ * as they are read.  Once the header is in, width and height are set,
+ * and row fills up from the left as codes are decoded.
+ */
+typedef struct
+{
+  guint width, height;
+  guchar *row;      /* width rgb triples, or NULL before the header */
+  guint decoded;    /* Channels of row decoded so far */
+
+  /*< private >*/
+  guchar header[GST_MOODBAR_CODEC_HEADER_SIZE];
+  guint header_length;
+  guint64 bits;     /* nbits unread bits, from the top */
+  guint nbits;
+  guint sum[3], count[3];
+  guchar prev[3];
+} GstMoodbarDecoder;
+
+/* Code the first row of the width x height image of rgb triples at
+ * row (all of its rows are taken to be the same).  Returns the
+ * compressed mood, *length bytes; free it with g_free. */
+guchar *gst_moodbar_codec_encode (const guchar *row, guint width,
+				  guint height, gsize *length);
+
+/* Decode the length bytes at data, a whole compressed mood, to all
+ * height rows of its image, or return NULL if they aren't one */
+guchar *gst_moodbar_codec_decode (const guchar *data, gsize length,
+				  guint *width, guint *height);
+
+/* Whether the length bytes at data start like a compressed mood */
+gboolean gst_moodbar_codec_is_compressed (const guchar *data, gsize length);
+
+void gst_moodbar_decoder_init (GstMoodbarDecoder *dec);
+void gst_moodbar_decoder_clear (GstMoodbarDecoder *dec);
+
+/* Decode what can be decoded of the next length bytes.  Returns FALSE
+ * if the stream isn't a compressed mood; bytes past the end of the
+ * mood are ignored. */
+gboolean gst_moodbar_decoder_feed (GstMoodbarDecoder *dec,
+				   const guchar *data, gsize length);
+
+/* Whether the whole row has been decoded */
+gboolean gst_moodbar_decoder_done (const GstMoodbarDecoder *dec);
+
+G_END_DECLS
+
+#endif /* __MOODBARCODEC_H__ */
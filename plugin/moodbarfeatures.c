@@ -0,0 +1,300 @@
+/* GStreamer moodbar plugin: saved analysis features
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "moodbarfeatures.h"
+#include "spectrumformat.h"
+
+#define HEADER_SIZE 40
+
+/* Where the number of frames is in the header */
+#define NUMFRAMES_OFFSET 32
+
+struct _GstMoodbarFeaturesWriter
+{
+  gchar *filename;
+  gchar *tmpname;   /* What we write to, renamed to filename at the end */
+  FILE *file;
+  GstMoodbarFeaturesKind kind;
+  guint channels;
+  guint64 numframes;
+};
+
+
+guint
+gst_moodbar_features_channels (GstMoodbarFeaturesKind kind)
+{
+  return kind == GST_MOODBAR_FEATURES_BARK ? GST_SPECTRUM_BARK_BANDS : 3;
+}
+
+
+static void
+put_uint32 (guchar *p, guint32 v)
+{
+  v = GUINT32_TO_LE (v);
+  memcpy (p, &v, 4);
+}
+
+static guint32
+get_uint32 (const guchar *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, 4);
+  return GUINT32_FROM_LE (v);
+}
+
+/* Copy n floats from from to to, swapping their bytes on big-endian
+ * hosts; the same both ways */
+static void
+copy_floats_le (gpointer to, gconstpointer from, gsize n)
+{
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  memcpy (to, from, n * 4);
+#else
+  const guint32 *src = (const guint32 *) from;
+  guint32 *dest = (guint32 *) to, v;
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    {
+      memcpy (&v, &src[i], 4);
+      v = GUINT32_SWAP_LE_BE (v);
+      memcpy (&dest[i], &v, 4);
+    }
+#endif
+}
+
+
+static void
+put_header (guchar *header, GstMoodbarFeaturesKind kind, guint channels,
+	    guint rate, guint size, guint64 numframes)
+{
+  numframes = GUINT64_TO_LE (numframes);
+
+  memcpy (header, GST_MOODBAR_FEATURES_MAGIC, 8);
+  put_uint32 (header + 8, GST_MOODBAR_FEATURES_VERSION);
+  put_uint32 (header + 12, kind);
+  put_uint32 (header + 16, channels);
+  put_uint32 (header + 20, rate);
+  put_uint32 (header + 24, size);
+  put_uint32 (header + 28, 0);
+  memcpy (header + NUMFRAMES_OFFSET, &numframes, 8);
+}
+
+static void
+set_file_error (GError **error, const gchar *what, const gchar *filename,
+		gint errsv)
+{
+  g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errsv),
+	       "Could not %s %s: %s", what, filename, g_strerror (errsv));
+}
+
+
+GstMoodbarFeaturesWriter *
+gst_moodbar_features_writer_new (const gchar *filename,
+				 GstMoodbarFeaturesKind kind, GError **error)
+{
+  GstMoodbarFeaturesWriter *writer;
+  guchar header[HEADER_SIZE];
+  gint fd, errsv;
+
+  writer = g_new0 (GstMoodbarFeaturesWriter, 1);
+  writer->filename = g_strdup (filename);
+  writer->tmpname = g_strconcat (filename, ".XXXXXX", NULL);
+  writer->kind = kind;
+  writer->channels = gst_moodbar_features_channels (kind);
+
+  fd = g_mkstemp_full (writer->tmpname, O_WRONLY, 0666);
+  if (fd == -1)
+    {
+      set_file_error (error, "create", writer->tmpname, errno);
+      g_free (writer->tmpname);
+      writer->tmpname = NULL;
+      gst_moodbar_features_writer_free (writer);
+      return NULL;
+    }
+
+  writer->file = fdopen (fd, "wb");
+  if (writer->file == NULL)
+    {
+      errsv = errno;
+      close (fd);
+      set_file_error (error, "open", writer->tmpname, errsv);
+      gst_moodbar_features_writer_free (writer);
+      return NULL;
+    }
+
+  /* The real header is written by _finish, once the number of frames
+   * is known; until then, the file is no feature file */
+  memset (header, 0, HEADER_SIZE);
+  fwrite (header, HEADER_SIZE, 1, writer->file);
+
+  return writer;
+}
+
+
+void
+gst_moodbar_features_writer_add (GstMoodbarFeaturesWriter *writer,
+				 const gfloat *frame)
+{
+  guint32 le[GST_SPECTRUM_BARK_BANDS];
+
+  /* Write errors stick to the file, and are reported by _finish */
+  copy_floats_le (le, frame, writer->channels);
+  fwrite (le, 4, writer->channels, writer->file);
+  writer->numframes++;
+}
+
+
+gboolean
+gst_moodbar_features_writer_finish (GstMoodbarFeaturesWriter *writer,
+				    guint rate, guint size, GError **error)
+{
+  guchar header[HEADER_SIZE];
+  gboolean res;
+  gint errsv = 0;
+
+  put_header (header, writer->kind, writer->channels, rate, size,
+	      writer->numframes);
+
+  errno = 0;
+  res = fseek (writer->file, 0, SEEK_SET) == 0
+    &&  fwrite (header, HEADER_SIZE, 1, writer->file) == 1
+    &&  fflush (writer->file) == 0  &&  !ferror (writer->file);
+  if (!res)
+    errsv = errno != 0 ? errno : EIO;
+
+  if (fclose (writer->file) != 0  &&  res)
+    {
+      res = FALSE;
+      errsv = errno;
+    }
+  writer->file = NULL;
+
+  if (!res)
+    set_file_error (error, "write", writer->tmpname, errsv);
+  else if (g_rename (writer->tmpname, writer->filename) != 0)
+    {
+      set_file_error (error, "replace", writer->filename, errno);
+      res = FALSE;
+    }
+
+  if (!res)
+    g_unlink (writer->tmpname);
+  g_free (writer->tmpname);
+  writer->tmpname = NULL;
+
+  return res;
+}
+
+
+void
+gst_moodbar_features_writer_free (GstMoodbarFeaturesWriter *writer)
+{
+  if (writer == NULL)
+    return;
+
+  if (writer->file != NULL)
+    fclose (writer->file);
+  if (writer->tmpname != NULL)
+    g_unlink (writer->tmpname);
+
+  g_free (writer->tmpname);
+  g_free (writer->filename);
+  g_free (writer);
+}
+
+
+GstMoodbarFeatures *
+gst_moodbar_features_load (const gchar *filename, GError **error)
+{
+  GstMoodbarFeatures *features;
+  gchar *contents;
+  const guchar *p;
+  gsize length;
+  guint64 numframes;
+  guint32 version, kind, channels;
+
+  if (!g_file_get_contents (filename, &contents, &length, error))
+    return NULL;
+  p = (const guchar *) contents;
+
+  if (length < HEADER_SIZE
+      ||  memcmp (p, GST_MOODBAR_FEATURES_MAGIC, 8) != 0)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		   "%s is not a moodbar feature file", filename);
+      g_free (contents);
+      return NULL;
+    }
+
+  version = get_uint32 (p + 8);
+  kind = get_uint32 (p + 12);
+  channels = get_uint32 (p + 16);
+  memcpy (&numframes, p + 32, 8);
+  numframes = GUINT64_FROM_LE (numframes);
+
+  if (version != GST_MOODBAR_FEATURES_VERSION)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		   "%s has features of version %u, not %u", filename,
+		   version, GST_MOODBAR_FEATURES_VERSION);
+      g_free (contents);
+      return NULL;
+    }
+
+  if (kind > GST_MOODBAR_FEATURES_BARK
+      ||  channels != gst_moodbar_features_channels (kind)
+      ||  numframes > (length - HEADER_SIZE) / 4 / channels
+      ||  length != HEADER_SIZE + numframes * channels * 4)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		   "%s is damaged", filename);
+      g_free (contents);
+      return NULL;
+    }
+
+  features = g_new (GstMoodbarFeatures, 1);
+  features->kind = (GstMoodbarFeaturesKind) kind;
+  features->channels = channels;
+  features->rate = get_uint32 (p + 20);
+  features->size = get_uint32 (p + 24);
+  features->numframes = numframes;
+  features->data = g_new (gfloat, numframes * channels);
+  copy_floats_le (features->data, p + HEADER_SIZE, numframes * channels);
+
+  g_free (contents);
+  return features;
+}
+
+
+void
+gst_moodbar_features_free (GstMoodbarFeatures *features)
+{
+  if (features == NULL)
+    return;
+
+  g_free (features->data);
+  g_free (features);
+}
@@ -0,0 +1,94 @@
+/* GStreamer moodbar plugin: saved analysis features
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* The moodbar element can save the frames it analyzed before they are
+ * normalized, so that moodbars of other widths, normalizations or
+ * colours can be drawn later without decoding the audio again (see
+ * moodbar-render).  A feature file is a header of little-endian
+ * fields:
+ *
+ *   offset  size
+ *        0     8  magic, "MOODFEAT"
+ *        8     4  version, GST_MOODBAR_FEATURES_VERSION
+ *       12     4  kind, a GstMoodbarFeaturesKind
+ *       16     4  channels per frame: 3 for rgb, 24 for bark
+ *       20     4  sample rate of the audio, or 0
+ *       24     4  FFT size of the spectra, or 0
+ *       28     4  reserved, 0
+ *       32     8  number of frames
+ *
+ * followed by the frames, each one float per channel, as
+ * little-endian IEEE 754 singles.  Readers reject other versions.
+ */
+
+#ifndef __MOODBARFEATURES_H__
+#define __MOODBARFEATURES_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GST_MOODBAR_FEATURES_MAGIC   "MOODFEAT"
+#define GST_MOODBAR_FEATURES_VERSION 1
+
+/* What each frame holds */
+typedef enum
+{
+  GST_MOODBAR_FEATURES_RGB,   /* the r, g and b before normalization */
+  GST_MOODBAR_FEATURES_BARK   /* the energies of the 24 bark bands */
+} GstMoodbarFeaturesKind;
+
+typedef struct
+{
+  GstMoodbarFeaturesKind kind;
+  guint channels;
+  guint rate, size;
+  guint64 numframes;
+  gfloat *data;   /* numframes * channels floats */
+} GstMoodbarFeatures;
+
+/* The number of floats per frame of kind */
+guint gst_moodbar_features_channels (GstMoodbarFeaturesKind kind);
+
+/* Writes a feature file a frame at a time, so that saving the
+ * features of a long stream takes no memory.  The frames go to a
+ * temporary file next to filename, which replaces filename once it's
+ * complete; until then, filename is left alone. */
+typedef struct _GstMoodbarFeaturesWriter GstMoodbarFeaturesWriter;
+
+GstMoodbarFeaturesWriter *
+gst_moodbar_features_writer_new (const gchar *filename,
+				 GstMoodbarFeaturesKind kind, GError **error);
+
+/* Append a frame of gst_moodbar_features_channels (kind) floats */
+void gst_moodbar_features_writer_add (GstMoodbarFeaturesWriter *writer,
+				      const gfloat *frame);
+
+/* Fill in the header, with the rate and FFT size of the spectra, and
+ * put the file in place.  Either way, the writer only has to be freed
+ * after this. */
+gboolean gst_moodbar_features_writer_finish (GstMoodbarFeaturesWriter *writer,
+					     guint rate, guint size,
+					     GError **error);
+
+/* Free the writer, deleting the file if it wasn't finished */
+void gst_moodbar_features_writer_free (GstMoodbarFeaturesWriter *writer);
+
+/* Read the features in filename, or return NULL and set error */
+GstMoodbarFeatures *gst_moodbar_features_load (const gchar *filename,
+					       GError **error);
+
+void gst_moodbar_features_free (GstMoodbarFeatures *features);
+
+G_END_DECLS
+
+#endif /* __MOODBARFEATURES_H__ */
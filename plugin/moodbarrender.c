@@ -0,0 +1,225 @@
+/* GStreamer moodbar plugin: normalizing and drawing moodbars
+ * Copyright (C) 2006 Joseph Rabinoff <bobqwatson@yahoo.com>
+ * Some code copyright (C) 2005 Gav Wood
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <math.h>
+
+#include "moodbarrender.h"
+#include "spectrumformat.h"
+#include "spectrumkernels.h"
+
+
+/* The bark bands are divided into thirds, and each colour is the
+ * total amplitude of one third */
+void
+gst_moodbar_frame_rgb (const gfloat *bands, gfloat *rgb)
+{
+  guint i;
+
+  rgb[0] = rgb[1] = rgb[2] = 0.f;
+  for (i = 0; i < GST_SPECTRUM_BARK_BANDS; ++i)
+    rgb[i / (GST_SPECTRUM_BARK_BANDS / 3)] += bands[i] * bands[i];
+
+  rgb[0] = sqrtf (rgb[0]);
+  rgb[1] = sqrtf (rgb[1]);
+  rgb[2] = sqrtf (rgb[2]);
+}
+
+
+/* The normalization algorithm was copied from Gav Wood's Exscalibar
+ * library, normalise.cpp.  For each of r, g and b it takes
+ *
+ *   avg   = the sum of the values other than the smallest and largest
+ *           ones, over the number of values
+ *   avgu  = the average of those values above avg
+ *   avgb  = the average of those values not above avg
+ *   avguu = the average of those values above avgu
+ *   avgbb = the average of those values below avgb
+ *
+ * and maps MAX (2 avgb - avg, avgbb) to 0 and MIN (2 avgu - avg, avguu)
+ * to 1, clamping the rest.
+ *
+ * Done as written that's five passes over each channel.  Here the
+ * frames are rgbx quadruples, one SIMD vector each, and all three
+ * channels are normalized together in two passes: the first
+ * (gst_spectrum_rgbx_stats) finds the smallest and largest values and
+ * the sum, which gives avg; the second gives avgu and avgb, and sorts
+ * the values into NORM_BINS bins on either side of avg, from which
+ * avguu and avgbb are taken.  The mapping itself is applied as the
+ * frames are averaged into columns, by gst_spectrum_rgbx_prefix_sums
+ * in gst_moodbar_render_row.
+ *
+ * avg, avgu and avgb come out the same as before, apart from rounding
+ * (the sums are now kept in doubles, where the original used floats).
+ * For avguu and avgbb, the values in the bin that avgu (or avgb) falls
+ * in all count as above it or all count as below it, depending on
+ * their average; as the bins are 1/NORM_BINS of the range from avg to
+ * the largest (smallest) value, that moves those thresholds by at most
+ * that much.  On the synthetic tracks of tests/normalizetest.c, up to
+ * 300000 frames long, the output differs from the five-pass version by
+ * at most 1 in 255, in about one pixel in a thousand, and the test
+ * fails beyond that.
+ */
+
+#define NORM_BINS 4096
+
+/* The average of the values of bins (count and sum pairs) that are
+ * above threshold, or not above it */
+static gfloat
+normalize_bins_average (const gdouble *bins, gfloat threshold, gboolean above)
+{
+  gdouble sum = 0., count = 0.;
+  guint b;
+
+  for (b = 0; b < NORM_BINS; ++b)
+    if (bins[2*b] > 0.  &&  (bins[2*b + 1] / bins[2*b] > threshold) == above)
+      {
+	count += bins[2*b];
+	sum   += bins[2*b + 1];
+      }
+
+  return (gfloat) (sum / count);
+}
+
+void
+gst_moodbar_normalize (gfloat *rgbx, guint numvals,
+		       GstMoodbarNormalization *norm)
+{
+  GstSpectrumRgbxStats stats;
+  GstSpectrumRgbxBinning binning;
+  gfloat *mini = stats.mini, *maxi = stats.maxi, *avg = binning.split;
+  gdouble *bins;
+  gfloat x;
+  guint i, c;
+
+  if (!numvals) 
+    return;
+
+  /* Sometimes, somewhy, [0] contains nan; this allows circumventing
+   * the problem and generating a proper mood */
+  for (c = 0; c < 3; ++c)
+    for (i = 0; i < numvals  &&  isnan (rgbx[c]); ++i)
+      rgbx[c] = rgbx[GST_MOODBAR_FRAME_FLOATS * i + c];
+
+  /* Pass 1 */
+  gst_spectrum_rgbx_stats (rgbx, numvals, &stats);
+
+  /* The values other than the extremes are all finite, unless some
+   * are NaN, which (as in the five-pass version) turns the whole
+   * channel to 0 below */
+  for (c = 0; c < 4; ++c)
+    {
+      if (mini[c] - mini[c] == 0.f)
+	stats.sum[c] -= mini[c] * (gdouble) stats.nmini[c];
+      if (maxi[c] != mini[c]  &&  maxi[c] - maxi[c] == 0.f)
+	stats.sum[c] -= maxi[c] * (gdouble) stats.nmaxi[c];
+      avg[c] = (gfloat) (stats.sum[c] / numvals);
+
+      /* The bins of the values not above avg (side 0) and of those
+       * above it (side 1).  Only the extremes can be infinite, which
+       * leaves one wide bin. */
+      binning.skip_lo[c] = mini[c];
+      binning.skip_hi[c] = maxi[c];
+
+      binning.origin[0][c] = mini[c];
+      x = NORM_BINS / (avg[c] - mini[c]);
+      binning.scale[0][c] = x - x == 0.f ? x : 0.f;
+
+      binning.origin[1][c] = avg[c];
+      x = NORM_BINS / (maxi[c] - avg[c]);
+      binning.scale[1][c] = x - x == 0.f ? x : 0.f;
+    }
+  binning.nbins = NORM_BINS;
+
+  /* Pass 2 */
+  bins = g_new0 (gdouble, 3 * 2 * 2 * NORM_BINS);
+  gst_spectrum_rgbx_bins (rgbx, numvals, &binning, bins);
+
+  for (c = 0; c < 3; ++c)
+    {
+      gfloat avgu, avgb, avguu, avgbb, lo, hi, delta;
+      const gdouble *below = &bins[2 * (2*c) * NORM_BINS];
+      const gdouble *above = &bins[2 * (2*c + 1) * NORM_BINS];
+
+      /* Every value comes out as 0 */
+      if (stats.nan[c] > 0.f)
+	{
+	  norm->mini[c] = norm->delta[c] = NAN;
+	  continue;
+	}
+
+      avgu  = normalize_bins_average (above, -G_MAXFLOAT, TRUE);
+      avgb  = normalize_bins_average (below, G_MAXFLOAT, FALSE);
+      avguu = normalize_bins_average (above, avgu, TRUE);
+      avgbb = normalize_bins_average (below, avgb, FALSE);
+
+      lo = MAX (avg[c] + (avgb - avg[c]) * 2.f, avgbb);
+      hi = MIN (avg[c] + (avgu - avg[c]) * 2.f, avguu);
+      delta = hi - lo;
+
+      if (delta == 0.f)
+	delta = 1.f;
+
+      norm->mini[c] = lo;
+      norm->delta[c] = delta;
+    }
+  norm->mini[3] = 0.f;
+  norm->delta[3] = 1.f;
+
+  g_free (bins);
+}
+
+
+/* Column i averages the normalized frames from positions[i] up to
+ * positions[i+1], which is the difference of the running sums at
+ * those two positions.  With box resampling the positions are whole
+ * frames, so each frame goes into one column; with area resampling
+ * they're spaced evenly, and a frame straddling two columns is split
+ * between them.  Since width <= numframes, no column is empty. */
+void
+gst_moodbar_render_row (const gfloat *rgbx, guint numframes,
+			const GstMoodbarNormalization *norm,
+			GstMoodbarResample resample,
+			guint width, guchar *row)
+{
+  gdouble *positions, *sums;
+  guint i, c;
+
+  if (width == 0)
+    return;
+
+  positions = g_new (gdouble, width + 1);
+  sums = g_new (gdouble, GST_MOODBAR_FRAME_FLOATS * (width + 1));
+  for (i = 0; i <= width; ++i)
+    if (resample == GST_MOODBAR_RESAMPLE_AREA)
+      positions[i] = (gdouble) i * numframes / width;
+    else
+      positions[i] = (gdouble) ((guint64) i * numframes / width);
+
+  gst_spectrum_rgbx_prefix_sums (rgbx, numframes, norm->mini, norm->delta,
+				 positions, width + 1, sums);
+
+  for (i = 0; i < width; ++i)
+    for (c = 0; c < 3; ++c)
+      *(row++) = (guchar) ((sums[GST_MOODBAR_FRAME_FLOATS * (i + 1) + c]
+			    - sums[GST_MOODBAR_FRAME_FLOATS * i + c]) * 255.
+			   / (positions[i + 1] - positions[i]));
+
+  g_free (positions);
+  g_free (sums);
+}
@@ -0,0 +1,61 @@
+/* GStreamer moodbar plugin: normalizing and drawing moodbars
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* The part of the moodbar element that turns the analyzed frames into
+ * an image.  It doesn't need a pipeline, so moodbar-render uses it to
+ * draw moodbars from saved features (see moodbarfeatures.h).
+ */
+
+#ifndef __MOODBARRENDER_H__
+#define __MOODBARRENDER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The frames are (r, g, b, unused) quadruples */
+#define GST_MOODBAR_FRAME_FLOATS 4
+
+/* How frames are averaged into the columns of the image, when there
+ * are more frames than columns (see gst_moodbar_render_row) */
+typedef enum
+{
+  GST_MOODBAR_RESAMPLE_BOX,
+  GST_MOODBAR_RESAMPLE_AREA
+} GstMoodbarResample;
+
+/* Each channel c of a frame is drawn as (v - mini[c]) / delta[c],
+ * clamped to [0, 1] */
+typedef struct
+{
+  gfloat mini[4], delta[4];
+} GstMoodbarNormalization;
+
+/* The r, g and b of a frame, from the energies of its
+ * GST_SPECTRUM_BARK_BANDS bark bands */
+void gst_moodbar_frame_rgb (const gfloat *bands, gfloat *rgb);
+
+/* Work out the normalization of the first numframes frames at rgbx.
+ * A NaN in the first frame is replaced with a later value. */
+void gst_moodbar_normalize (gfloat *rgbx, guint numframes,
+			    GstMoodbarNormalization *norm);
+
+/* Average the numframes frames at rgbx, normalized with norm, down to
+ * width rgb triples at row; width must be from 1 to numframes */
+void gst_moodbar_render_row (const gfloat *rgbx, guint numframes,
+			     const GstMoodbarNormalization *norm,
+			     GstMoodbarResample resample,
+			     guint width, guchar *row);
+
+G_END_DECLS
+
+#endif /* __MOODBARRENDER_H__ */
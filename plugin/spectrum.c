@@ -21,7 +21,9 @@
 #include "gstfftwunspectrum.h"
 #include "gstspectrumeq.h"
 #include "gstmoodbar.h"
+#include "gstmooddec.h"
 #include "spectrum.h"
+#include "spectrumkernels.h"
 
 
 /***************************************************************/
@@ -32,6 +34,10 @@ GST_DEBUG_CATEGORY_EXTERN (gst_fftwspectrum_debug);
 GST_DEBUG_CATEGORY_EXTERN (gst_fftwunspectrum_debug);
 GST_DEBUG_CATEGORY_EXTERN (gst_spectrumeq_debug);
 GST_DEBUG_CATEGORY_EXTERN (gst_moodbar_debug);
+GST_DEBUG_CATEGORY_EXTERN (gst_mooddec_debug);
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_plan_debug);
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_pool_debug);
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_kernels_debug);
 
 
 /* entry point to initialize the plug-in
@@ -57,6 +63,9 @@ plugin_init (GstPlugin * plugin)
   if (!gst_element_register (plugin, "moodbar",
 			     GST_RANK_NONE, GST_TYPE_MOODBAR))
     return FALSE;
+  if (!gst_element_register (plugin, "mooddec",
+			     GST_RANK_NONE, GST_TYPE_MOODDEC))
+    return FALSE;
 
   GST_DEBUG_CATEGORY_INIT (gst_fftwspectrum_debug, "fftwspectrum",
       0, "FFTW Sample-to-Spectrum Converter Plugin");
@@ -66,6 +75,17 @@ plugin_init (GstPlugin * plugin)
       0, "Spectrum-space Equalizer");
   GST_DEBUG_CATEGORY_INIT (gst_moodbar_debug, "moodbar",
       0, "Moodbar analyzer");
+  GST_DEBUG_CATEGORY_INIT (gst_mooddec_debug, "mooddec",
+      0, "Compressed mood decoder");
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_plan_debug, "spectrumplan",
+      0, "FFTW plan cache");
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_pool_debug, "spectrumpool",
+      0, "Spectrum buffer pools");
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_kernels_debug, "spectrumkernels",
+      0, "DSP kernel dispatch");
+
+  /* Pick the DSP kernels for this CPU before any element runs */
+  gst_spectrum_kernels_init ();
 
   return TRUE;
 }
@@ -31,11 +31,14 @@
  *   step:  the number of signals advanced after the current buffer
  *   width: the size of the real & imaginary parts of the data
  *   endianness: ditto
+ *   frames: the most spectra a buffer may hold
  *
- * Each audio/x-spectrum-complex-float buffer represents the Fourier
- * transform of size samples, and hence _must_ have exactly
- * floor(size/2) + 1 complex floats in it; in other words, its
- * buffer size must be (floor(size/2) + 1) * 2 * sizeof(gfloat)
+ * Each spectrum is the Fourier transform of size samples, and hence
+ * _must_ have exactly floor(size/2) + 1 complex floats in it, taking
+ * up (floor(size/2) + 1) * 2 * sizeof(gfloat) bytes.  An
+ * audio/x-spectrum-complex-float buffer holds between 1 and frames
+ * consecutive spectra back to back, each step samples after the
+ * last, so its size must be a multiple of that.
  */
 
 #define SPECTRUM_FREQ_CAPS "audio/x-spectrum-complex-float, " \
@@ -43,7 +46,70 @@
 			     "endianness = (int) BYTE_ORDER, " \
 			     "width = (int) 32, " \
 			     "size = (int) [ 1, MAX ], " \
-			     "step = (int) [ 1, MAX ]"
+			     "step = (int) [ 1, MAX ], " \
+			     "frames = (int) [ 1, MAX ]"
+
+/* The size in bytes of one spectrum of the given size */
+#define GST_SPECTRUM_FRAME_BYTES(size) \
+  (((size)/2 + 1) * 2 * sizeof (gfloat))
+
+
+/* audio/x-spectrum-magnitude-float has the same properties and
+ * layout as audio/x-spectrum-complex-float, except that each band is
+ * a single float holding the magnitude sqrt(r*r + i*i) of the complex
+ * value, so a spectrum is half the size.  fftwspectrum produces it
+ * when downstream takes it, which is when downstream has no use for
+ * the phase (moodbar, or spectrumeq feeding moodbar); fftwunspectrum
+ * can't use it.
+ */
+
+#define SPECTRUM_MAGNITUDE_NAME "audio/x-spectrum-magnitude-float"
+
+#define SPECTRUM_MAGNITUDE_CAPS SPECTRUM_MAGNITUDE_NAME ", " \
+			     "rate = (int) [ 1, MAX ], " \
+			     "endianness = (int) BYTE_ORDER, " \
+			     "width = (int) 32, " \
+			     "size = (int) [ 1, MAX ], " \
+			     "step = (int) [ 1, MAX ], " \
+			     "frames = (int) [ 1, MAX ]"
+
+/* The size in bytes of one magnitude spectrum of the given size */
+#define GST_SPECTRUM_MAGNITUDE_FRAME_BYTES(size) \
+  (((size)/2 + 1) * sizeof (gfloat))
+
+
+/* audio/x-spectrum-bands is a spectrum reduced to the 24 "bark bands"
+ * moodbar works with (see spectrumformat.h): each frame is 24 floats,
+ * the sum of the magnitudes of the bins in each band.  It has the
+ * properties of audio/x-spectrum-complex-float, plus
+ *   bands: the number of bands per frame (24)
+ *   edges: an array of bands + 1 ints; band k is made of the bins
+ *          edges[k] up to edges[k+1] - 1 of the full spectrum of size
+ *          samples, so empty bands have equal edges.
+ * edges is set by fftwspectrum once the size and rate are fixed.
+ */
+
+#define SPECTRUM_BANDS_NAME "audio/x-spectrum-bands"
+
+#define SPECTRUM_BANDS_CAPS SPECTRUM_BANDS_NAME ", " \
+			     "rate = (int) [ 1, MAX ], " \
+			     "endianness = (int) BYTE_ORDER, " \
+			     "width = (int) 32, " \
+			     "size = (int) [ 1, MAX ], " \
+			     "step = (int) [ 1, MAX ], " \
+			     "frames = (int) [ 1, MAX ], " \
+			     "bands = (int) 24"
+
+
+/* fftwspectrum asks downstream how many spectra a whole stream
+ * should be turned into, with a custom query whose structure has this
+ * name.  An element that reduces the stream to a fixed number of
+ * values anyway (moodbar with frames-per-column set) answers by
+ * setting the "frames" (int) field, and fftwspectrum raises its step
+ * so that the stream yields about that many spectra, instead of
+ * computing spectra that would only be averaged away.
+ */
+#define GST_SPECTRUM_QUERY_FRAMES "spectrum-frames"
 
 
 /* Given a band number from a spectrum made from size audio
@@ -0,0 +1,76 @@
+/* GStreamer moodbar plugin spectrum formats
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "spectrumformat.h"
+#include "spectrum.h"
+
+/* The upper edges (in Hz) of the bark bands; anything above the last
+ * one goes in the last band too */
+static const guint bark_bands[GST_SPECTRUM_BARK_BANDS] 
+  = { 100,  200,  300,  400,  510,  630,  770,   920, 
+      1080, 1270, 1480, 1720, 2000, 2320, 2700,  3150, 
+      3700, 4400, 5300, 6400, 7700, 9500, 12000, 15500 };
+
+
+GstSpectrumFormat
+gst_spectrum_format_of (const GstStructure *s)
+{
+  if (gst_structure_has_name (s, SPECTRUM_BANDS_NAME))
+    return GST_SPECTRUM_FORMAT_BANDS;
+  if (gst_structure_has_name (s, SPECTRUM_MAGNITUDE_NAME))
+    return GST_SPECTRUM_FORMAT_MAGNITUDE;
+  return GST_SPECTRUM_FORMAT_COMPLEX;
+}
+
+
+gsize
+gst_spectrum_format_frame_bytes (GstSpectrumFormat format, gint size)
+{
+  switch (format)
+    {
+    case GST_SPECTRUM_FORMAT_BANDS:
+      return GST_SPECTRUM_BARK_BANDS * sizeof (gfloat);
+    case GST_SPECTRUM_FORMAT_MAGNITUDE:
+      return GST_SPECTRUM_MAGNITUDE_FRAME_BYTES (size);
+    default:
+      return GST_SPECTRUM_FRAME_BYTES (size);
+    }
+}
+
+
+/* This is moodbar's original band assignment: walking up the bins, a
+ * bin moves on to the next band once its frequency reaches the edge
+ * of the current one, at most one band per bin.
+ */
+void
+gst_spectrum_bark_edges (gint size, gint rate, guint *edges)
+{
+  guint i, numfreqs = size / 2 + 1;
+  guint barkband = 0;
+
+  edges[0] = 0;
+  for (i = 0; i < numfreqs; ++i)
+    if (barkband < GST_SPECTRUM_BARK_BANDS - 1  &&
+	(guint) GST_SPECTRUM_BAND_FREQ (i, size, rate) 
+	  >= bark_bands[barkband])
+      edges[++barkband] = i;
+
+  /* Bands never reached are empty */
+  while (barkband < GST_SPECTRUM_BARK_BANDS)
+    edges[++barkband] = numfreqs;
+}
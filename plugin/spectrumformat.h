@@ -0,0 +1,48 @@
+/* GStreamer moodbar plugin spectrum formats
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __SPECTRUMFORMAT_H__
+#define __SPECTRUMFORMAT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* The frequency caps of spectrum.h */
+typedef enum
+{
+  GST_SPECTRUM_FORMAT_COMPLEX,    /* audio/x-spectrum-complex-float */
+  GST_SPECTRUM_FORMAT_MAGNITUDE,  /* audio/x-spectrum-magnitude-float */
+  GST_SPECTRUM_FORMAT_BANDS       /* audio/x-spectrum-bands */
+} GstSpectrumFormat;
+
+/* The number of bark bands a spectrum is split into */
+#define GST_SPECTRUM_BARK_BANDS 24
+
+/* The format of the given caps structure, which must be one of the
+ * frequency caps */
+GstSpectrumFormat gst_spectrum_format_of (const GstStructure *s);
+
+/* The size in bytes of one frame of a spectrum of size samples */
+gsize gst_spectrum_format_frame_bytes (GstSpectrumFormat format, gint size);
+
+/* Fill in the GST_SPECTRUM_BARK_BANDS + 1 edges of the bark bands of
+ * a spectrum of size samples at rate: band k is made of the bins
+ * edges[k] up to edges[k+1] - 1, and edges[GST_SPECTRUM_BARK_BANDS]
+ * is the number of bins, size/2 + 1.  The bands are contiguous and in
+ * order, and some (at the top, for low rates) may be empty.
+ */
+void gst_spectrum_bark_edges (gint size, gint rate, guint *edges);
+
+G_END_DECLS
+
+#endif  /* __SPECTRUMFORMAT_H__ */
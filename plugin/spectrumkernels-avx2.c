@@ -0,0 +1,140 @@
+/* GStreamer moodbar plugin DSP kernels, AVX2 variant
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Built with -mavx2 -mfma; only called on CPUs that have them.  The
+ * sums work 8 bins at a time, then 4, since most of the bark bands at
+ * the bottom are only a few bins wide.  Shuffling within the 128-bit
+ * lanes leaves the bins out of order, which doesn't matter for a sum.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "spectrumkernels-private.h"
+#include "spectrumkernels-generic.h"
+#include "spectrumkernels-x86.h"
+
+
+static inline __m128
+fold (__m256 v)
+{
+  return _mm_add_ps (_mm256_castps256_ps128 (v), _mm256_extractf128_ps (v, 1));
+}
+
+static inline gfloat
+hsum (__m128 v)
+{
+  v = _mm_add_ps (v, _mm_movehl_ps (v, v));
+  v = _mm_add_ss (v, _mm_shuffle_ps (v, v, 1));
+  return _mm_cvtss_f32 (v);
+}
+
+static inline __m128
+magnitudes4 (const gfloat *spectrum)
+{
+  __m128 lo = _mm_loadu_ps (spectrum), hi = _mm_loadu_ps (spectrum + 4);
+  __m128 re = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (2, 0, 2, 0));
+  __m128 im = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (3, 1, 3, 1));
+
+  return _mm_sqrt_ps (_mm_fmadd_ps (re, re, _mm_mul_ps (im, im)));
+}
+
+static void
+band_sums_avx2 (const gfloat *spectrum, const guint *edges, guint nbands,
+		gfloat scale, gfloat *out)
+{
+  guint b, i, end;
+  __m256 acc, lo, hi, re, im;
+  __m128 acc4;
+  gfloat sum, real, imag;
+
+  for (b = 0; b < nbands; ++b)
+    {
+      acc = _mm256_setzero_ps ();
+      end = edges[b + 1];
+      for (i = edges[b]; i + 8 <= end; i += 8)
+	{
+	  lo = _mm256_loadu_ps (&spectrum[2*i]);
+	  hi = _mm256_loadu_ps (&spectrum[2*i + 8]);
+	  re = _mm256_shuffle_ps (lo, hi, _MM_SHUFFLE (2, 0, 2, 0));
+	  im = _mm256_shuffle_ps (lo, hi, _MM_SHUFFLE (3, 1, 3, 1));
+	  acc = _mm256_add_ps (acc,
+	      _mm256_sqrt_ps (_mm256_fmadd_ps (re, re, _mm256_mul_ps (im, im))));
+	}
+
+      acc4 = fold (acc);
+      if (i + 4 <= end)
+	{
+	  acc4 = _mm_add_ps (acc4, magnitudes4 (&spectrum[2*i]));
+	  i += 4;
+	}
+
+      sum = hsum (acc4);
+      for (; i < end; ++i)
+	{
+	  real = spectrum[2*i];  imag = spectrum[2*i + 1];
+	  sum += sqrtf (real*real + imag*imag);
+	}
+      out[b] = sum * scale;
+    }
+}
+
+static void
+range_sums_avx2 (const gfloat *vals, const guint *edges, guint nranges,
+		 gfloat *out)
+{
+  guint r, i, end;
+  __m256 acc;
+  __m128 acc4;
+  gfloat sum;
+
+  for (r = 0; r < nranges; ++r)
+    {
+      acc = _mm256_setzero_ps ();
+      end = edges[r + 1];
+      for (i = edges[r]; i + 8 <= end; i += 8)
+	acc = _mm256_add_ps (acc, _mm256_loadu_ps (&vals[i]));
+
+      acc4 = fold (acc);
+      if (i + 4 <= end)
+	{
+	  acc4 = _mm_add_ps (acc4, _mm_loadu_ps (&vals[i]));
+	  i += 4;
+	}
+
+      sum = hsum (acc4);
+      for (; i < end; ++i)
+	sum += vals[i];
+      out[r] = sum;
+    }
+}
+
+
+const GstSpectrumKernels gst_spectrum_kernels_avx2 =
+  {
+    "avx2",
+    scale_generic,
+    multiply_generic,
+    scale_to_generic,
+    blend_generic,
+    magnitudes_generic,
+    band_sums_avx2,
+    range_sums_avx2,
+    rgbx_stats_x86,
+    rgbx_bins_x86,
+    rgbx_prefix_sums_x86
+  };
@@ -0,0 +1,168 @@
+/* GStreamer moodbar plugin DSP kernels, AVX-512 variant
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Built with -mavx512f -mfma; only called on CPUs that have them.
+ * The sums work 16 bins at a time, then 8 and 4 for the narrow bands
+ * at the bottom of the spectrum.  Complex values are deinterleaved
+ * across both registers with a single permute.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "spectrumkernels-private.h"
+#include "spectrumkernels-generic.h"
+#include "spectrumkernels-x86.h"
+
+
+static inline __m256
+fold512 (__m512 v)
+{
+  return _mm256_add_ps (_mm512_castps512_ps256 (v),
+      _mm256_castpd_ps (_mm512_extractf64x4_pd (_mm512_castps_pd (v), 1)));
+}
+
+static inline __m128
+fold256 (__m256 v)
+{
+  return _mm_add_ps (_mm256_castps256_ps128 (v), _mm256_extractf128_ps (v, 1));
+}
+
+static inline gfloat
+hsum (__m128 v)
+{
+  v = _mm_add_ps (v, _mm_movehl_ps (v, v));
+  v = _mm_add_ss (v, _mm_shuffle_ps (v, v, 1));
+  return _mm_cvtss_f32 (v);
+}
+
+static void
+band_sums_avx512 (const gfloat *spectrum, const guint *edges, guint nbands,
+		  gfloat scale, gfloat *out)
+{
+  const __m512i even = _mm512_setr_epi32 (0, 2, 4, 6, 8, 10, 12, 14,
+					  16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i odd  = _mm512_setr_epi32 (1, 3, 5, 7, 9, 11, 13, 15,
+					  17, 19, 21, 23, 25, 27, 29, 31);
+  guint b, i, end;
+  __m512 acc, lo, hi, re, im;
+  __m256 acc8, lo8, hi8, re8, im8;
+  __m128 acc4, lo4, hi4, re4, im4;
+  gfloat sum, real, imag;
+
+  for (b = 0; b < nbands; ++b)
+    {
+      acc = _mm512_setzero_ps ();
+      end = edges[b + 1];
+      for (i = edges[b]; i + 16 <= end; i += 16)
+	{
+	  lo = _mm512_loadu_ps (&spectrum[2*i]);
+	  hi = _mm512_loadu_ps (&spectrum[2*i + 16]);
+	  re = _mm512_permutex2var_ps (lo, even, hi);
+	  im = _mm512_permutex2var_ps (lo, odd, hi);
+	  acc = _mm512_add_ps (acc,
+	      _mm512_sqrt_ps (_mm512_fmadd_ps (re, re, _mm512_mul_ps (im, im))));
+	}
+
+      acc8 = fold512 (acc);
+      if (i + 8 <= end)
+	{
+	  lo8 = _mm256_loadu_ps (&spectrum[2*i]);
+	  hi8 = _mm256_loadu_ps (&spectrum[2*i + 8]);
+	  re8 = _mm256_shuffle_ps (lo8, hi8, _MM_SHUFFLE (2, 0, 2, 0));
+	  im8 = _mm256_shuffle_ps (lo8, hi8, _MM_SHUFFLE (3, 1, 3, 1));
+	  acc8 = _mm256_add_ps (acc8,
+	      _mm256_sqrt_ps (_mm256_fmadd_ps (re8, re8,
+					       _mm256_mul_ps (im8, im8))));
+	  i += 8;
+	}
+
+      acc4 = fold256 (acc8);
+      if (i + 4 <= end)
+	{
+	  lo4 = _mm_loadu_ps (&spectrum[2*i]);
+	  hi4 = _mm_loadu_ps (&spectrum[2*i + 4]);
+	  re4 = _mm_shuffle_ps (lo4, hi4, _MM_SHUFFLE (2, 0, 2, 0));
+	  im4 = _mm_shuffle_ps (lo4, hi4, _MM_SHUFFLE (3, 1, 3, 1));
+	  acc4 = _mm_add_ps (acc4,
+	      _mm_sqrt_ps (_mm_fmadd_ps (re4, re4, _mm_mul_ps (im4, im4))));
+	  i += 4;
+	}
+
+      sum = hsum (acc4);
+      for (; i < end; ++i)
+	{
+	  real = spectrum[2*i];  imag = spectrum[2*i + 1];
+	  sum += sqrtf (real*real + imag*imag);
+	}
+      out[b] = sum * scale;
+    }
+}
+
+static void
+range_sums_avx512 (const gfloat *vals, const guint *edges, guint nranges,
+		   gfloat *out)
+{
+  guint r, i, end;
+  __m512 acc;
+  __m256 acc8;
+  __m128 acc4;
+  gfloat sum;
+
+  for (r = 0; r < nranges; ++r)
+    {
+      acc = _mm512_setzero_ps ();
+      end = edges[r + 1];
+      for (i = edges[r]; i + 16 <= end; i += 16)
+	acc = _mm512_add_ps (acc, _mm512_loadu_ps (&vals[i]));
+
+      acc8 = fold512 (acc);
+      if (i + 8 <= end)
+	{
+	  acc8 = _mm256_add_ps (acc8, _mm256_loadu_ps (&vals[i]));
+	  i += 8;
+	}
+
+      acc4 = fold256 (acc8);
+      if (i + 4 <= end)
+	{
+	  acc4 = _mm_add_ps (acc4, _mm_loadu_ps (&vals[i]));
+	  i += 4;
+	}
+
+      sum = hsum (acc4);
+      for (; i < end; ++i)
+	sum += vals[i];
+      out[r] = sum;
+    }
+}
+
+
+const GstSpectrumKernels gst_spectrum_kernels_avx512 =
+  {
+    "avx512",
+    scale_generic,
+    multiply_generic,
+    scale_to_generic,
+    blend_generic,
+    magnitudes_generic,
+    band_sums_avx512,
+    range_sums_avx512,
+    rgbx_stats_x86,
+    rgbx_bins_x86,
+    rgbx_prefix_sums_x86
+  };
@@ -0,0 +1,188 @@
+/* GStreamer moodbar plugin DSP kernels, portable variant
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <math.h>
+
+#include "spectrumkernels-private.h"
+#include "spectrumkernels-generic.h"
+
+
+static void
+band_sums_c (const gfloat *spectrum, const guint *edges, guint nbands,
+	     gfloat scale, gfloat *out)
+{
+  guint b, i;
+  gfloat sum, real, imag;
+
+  for (b = 0; b < nbands; ++b)
+    {
+      sum = 0.f;
+      for (i = edges[b]; i < edges[b + 1]; ++i)
+	{
+	  real = spectrum[2*i];  imag = spectrum[2*i + 1];
+	  sum += sqrtf (real*real + imag*imag);
+	}
+      out[b] = sum * scale;
+    }
+}
+
+static void
+range_sums_c (const gfloat *vals, const guint *edges, guint nranges,
+	      gfloat *out)
+{
+  guint r, i;
+  gfloat sum;
+
+  for (r = 0; r < nranges; ++r)
+    {
+      sum = 0.f;
+      for (i = edges[r]; i < edges[r + 1]; ++i)
+	sum += vals[i];
+      out[r] = sum;
+    }
+}
+
+static void
+rgbx_stats_c (const gfloat *rgbx, gsize n, GstSpectrumRgbxStats *stats)
+{
+  gsize i;
+  guint c;
+  gfloat v;
+
+  for (c = 0; c < 4; ++c)
+    {
+      stats->mini[c] = stats->maxi[c] = n > 0 ? rgbx[c] : 0.f;
+      stats->nmini[c] = stats->nmaxi[c] = 0.f;
+      stats->sum[c] = 0.;
+      stats->nan[c] = 0.f;
+    }
+
+  for (i = 0; i < n; ++i)
+    for (c = 0; c < 4; ++c)
+      {
+	v = rgbx[4*i + c];
+
+	if (v < stats->mini[c])
+	  {
+	    stats->mini[c] = v;
+	    stats->nmini[c] = 0.f;
+	  }
+	if (v == stats->mini[c])
+	  stats->nmini[c]++;
+
+	if (v > stats->maxi[c])
+	  {
+	    stats->maxi[c] = v;
+	    stats->nmaxi[c] = 0.f;
+	  }
+	if (v == stats->maxi[c])
+	  stats->nmaxi[c]++;
+
+	/* v - v is 0 only if v is finite */
+	if (v - v == 0.f)
+	  stats->sum[c] += v;
+	else if (isnan (v))
+	  stats->nan[c]++;
+      }
+}
+
+static void
+rgbx_bins_c (const gfloat *rgbx, gsize n, const GstSpectrumRgbxBinning *binning,
+	     gdouble *bins)
+{
+  gsize i;
+  guint c, side, bin;
+  gfloat v;
+
+  for (i = 0; i < n; ++i)
+    for (c = 0; c < 3; ++c)
+      {
+	v = rgbx[4*i + c];
+	if (v == binning->skip_lo[c]  ||  v == binning->skip_hi[c]  ||  v != v)
+	  continue;
+
+	/* Which side a value is on is usually a coin toss, so no
+	 * branches */
+	side = v > binning->split[c];
+	bin = (guint) ((v - binning->origin[side][c])
+		       * binning->scale[side][c]);
+	bin = (2*c + side) * binning->nbins + MIN (bin, binning->nbins - 1);
+
+	bins[2*bin]++;
+	bins[2*bin + 1] += v;
+      }
+}
+
+static inline gfloat
+rgbx_normalize_c (gfloat v, gfloat mini, gfloat delta)
+{
+  gfloat x = (v - mini) / delta;
+
+  x = x > 0.f ? x : 0.f;
+  x = x < 1.f ? x : 1.f;
+
+  /* v - v is 0 only if v is finite */
+  return v - v == 0.f ? x : 0.f;
+}
+
+static void
+rgbx_prefix_sums_c (const gfloat *rgbx, gsize n, const gfloat *mini,
+		    const gfloat *delta, const gdouble *positions,
+		    guint npositions, gdouble *sums)
+{
+  gdouble run[4] = { 0., 0., 0., 0. }, frac;
+  gfloat acc[4];
+  gsize i = 0, whole;
+  guint k, c;
+
+  for (k = 0; k < npositions; ++k)
+    {
+      /* Each stretch is summed in floats, which vectorizes */
+      whole = MIN ((gsize) positions[k], n);
+      for (c = 0; c < 4; ++c)
+	acc[c] = 0.f;
+      for (; i < whole; ++i)
+	for (c = 0; c < 4; ++c)
+	  acc[c] += rgbx_normalize_c (rgbx[4*i + c], mini[c], delta[c]);
+      for (c = 0; c < 4; ++c)
+	run[c] += acc[c];
+
+      frac = positions[k] - (gdouble) whole;
+      for (c = 0; c < 4; ++c)
+	sums[4*k + c] = run[c];
+      if (frac > 0.  &&  whole < n)
+	for (c = 0; c < 4; ++c)
+	  sums[4*k + c]
+	    += frac * rgbx_normalize_c (rgbx[4*whole + c], mini[c], delta[c]);
+    }
+}
+
+
+const GstSpectrumKernels gst_spectrum_kernels_c =
+  {
+    "c",
+    scale_generic,
+    multiply_generic,
+    scale_to_generic,
+    blend_generic,
+    magnitudes_generic,
+    band_sums_c,
+    range_sums_c,
+    rgbx_stats_c,
+    rgbx_bins_c,
+    rgbx_prefix_sums_c
+  };
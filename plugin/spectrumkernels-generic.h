@@ -0,0 +1,76 @@
+/* GStreamer moodbar plugin DSP kernels, element-wise loops
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* The element-wise kernels are the same C for every variant: each
+ * spectrumkernels-*.c file includes this and the compiler vectorizes
+ * the loops for that file's instruction set.  They're written without
+ * branches or calls (beyond sqrtf, which the variants are built not
+ * to set errno for) so that it can.
+ */
+
+#ifndef __SPECTRUMKERNELS_GENERIC_H__
+#define __SPECTRUMKERNELS_GENERIC_H__
+
+#include <glib.h>
+#include <math.h>
+
+static void
+scale_generic (gfloat * restrict data, gsize n, gfloat factor)
+{
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    data[i] *= factor;
+}
+
+static void
+multiply_generic (gfloat * restrict data, const gfloat * restrict factors,
+		  gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    data[i] *= factors[i];
+}
+
+static void
+scale_to_generic (const gfloat * restrict in, gfloat * restrict out, gsize n,
+		  gfloat factor)
+{
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    out[i] = in[i] * factor;
+}
+
+static void
+blend_generic (const gfloat * restrict in, const gfloat * restrict in_weights,
+	       gfloat * restrict acc, const gfloat * restrict acc_weights,
+	       gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    acc[i] = in[i] * in_weights[i] + acc[i] * acc_weights[i];
+}
+
+static void
+magnitudes_generic (const gfloat * restrict in, gfloat * restrict out,
+		    gsize n, gfloat scale)
+{
+  gsize i;
+
+  for (i = 0; i < n; ++i)
+    out[i] = sqrtf ((in[2*i] * in[2*i] + in[2*i + 1] * in[2*i + 1]) * scale);
+}
+
+#endif  /* __SPECTRUMKERNELS_GENERIC_H__ */
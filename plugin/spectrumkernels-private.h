@@ -0,0 +1,63 @@
+/* GStreamer moodbar plugin DSP kernel variants
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __SPECTRUMKERNELS_PRIVATE_H__
+#define __SPECTRUMKERNELS_PRIVATE_H__
+
+#include <glib.h>
+
+#include "spectrumkernels.h"
+
+G_BEGIN_DECLS
+
+/* One variant of every kernel in spectrumkernels.h.  Each variant is
+ * built in its own file, with the compiler flags for its instruction
+ * set, and is only ever called if the CPU has that instruction set.
+ */
+typedef struct
+{
+  const gchar *name;
+
+  void (*scale)           (gfloat *data, gsize n, gfloat factor);
+  void (*multiply)        (gfloat *data, const gfloat *factors, gsize n);
+  void (*scale_to)        (const gfloat *in, gfloat *out, gsize n,
+			   gfloat factor);
+  void (*blend)           (const gfloat *in, const gfloat *in_weights,
+			   gfloat *acc, const gfloat *acc_weights, gsize n);
+  void (*magnitudes)      (const gfloat *in, gfloat *out, gsize n,
+			   gfloat scale);
+  void (*band_sums)       (const gfloat *spectrum, const guint *edges,
+			   guint nbands, gfloat scale, gfloat *out);
+  void (*range_sums)      (const gfloat *vals, const guint *edges,
+			   guint nranges, gfloat *out);
+  void (*rgbx_stats)      (const gfloat *rgbx, gsize n,
+			   GstSpectrumRgbxStats *stats);
+  void (*rgbx_bins)       (const gfloat *rgbx, gsize n,
+			   const GstSpectrumRgbxBinning *binning,
+			   gdouble *bins);
+  void (*rgbx_prefix_sums) (const gfloat *rgbx, gsize n,
+			    const gfloat *mini, const gfloat *delta,
+			    const gdouble *positions, guint npositions,
+			    gdouble *sums);
+} GstSpectrumKernels;
+
+extern const GstSpectrumKernels gst_spectrum_kernels_c;
+
+#ifdef HAVE_X86_KERNELS
+extern const GstSpectrumKernels gst_spectrum_kernels_sse41;
+extern const GstSpectrumKernels gst_spectrum_kernels_avx2;
+extern const GstSpectrumKernels gst_spectrum_kernels_avx512;
+#endif
+
+G_END_DECLS
+
+#endif  /* __SPECTRUMKERNELS_PRIVATE_H__ */
@@ -0,0 +1,108 @@
+/* GStreamer moodbar plugin DSP kernels, SSE4.1 variant
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Built with -msse4.1; only called on CPUs that have it.  The sums
+ * work 4 bins at a time.  The order of the bins within a sum doesn't
+ * matter, so complex values are deinterleaved with a single shuffle
+ * that leaves them out of order.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <math.h>
+#include <immintrin.h>
+
+#include "spectrumkernels-private.h"
+#include "spectrumkernels-generic.h"
+#include "spectrumkernels-x86.h"
+
+
+static inline gfloat
+hsum (__m128 v)
+{
+  v = _mm_add_ps (v, _mm_movehl_ps (v, v));
+  v = _mm_add_ss (v, _mm_shuffle_ps (v, v, 1));
+  return _mm_cvtss_f32 (v);
+}
+
+static void
+band_sums_sse41 (const gfloat *spectrum, const guint *edges, guint nbands,
+		 gfloat scale, gfloat *out)
+{
+  guint b, i, end;
+  __m128 acc, lo, hi, re, im;
+  gfloat sum, real, imag;
+
+  for (b = 0; b < nbands; ++b)
+    {
+      acc = _mm_setzero_ps ();
+      end = edges[b + 1];
+      for (i = edges[b]; i + 4 <= end; i += 4)
+	{
+	  lo = _mm_loadu_ps (&spectrum[2*i]);
+	  hi = _mm_loadu_ps (&spectrum[2*i + 4]);
+	  re = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (2, 0, 2, 0));
+	  im = _mm_shuffle_ps (lo, hi, _MM_SHUFFLE (3, 1, 3, 1));
+	  acc = _mm_add_ps (acc, _mm_sqrt_ps (_mm_add_ps (_mm_mul_ps (re, re),
+							  _mm_mul_ps (im, im))));
+	}
+
+      sum = hsum (acc);
+      for (; i < end; ++i)
+	{
+	  real = spectrum[2*i];  imag = spectrum[2*i + 1];
+	  sum += sqrtf (real*real + imag*imag);
+	}
+      out[b] = sum * scale;
+    }
+}
+
+static void
+range_sums_sse41 (const gfloat *vals, const guint *edges, guint nranges,
+		  gfloat *out)
+{
+  guint r, i, end;
+  __m128 acc;
+  gfloat sum;
+
+  for (r = 0; r < nranges; ++r)
+    {
+      acc = _mm_setzero_ps ();
+      end = edges[r + 1];
+      for (i = edges[r]; i + 4 <= end; i += 4)
+	acc = _mm_add_ps (acc, _mm_loadu_ps (&vals[i]));
+
+      sum = hsum (acc);
+      for (; i < end; ++i)
+	sum += vals[i];
+      out[r] = sum;
+    }
+}
+
+
+const GstSpectrumKernels gst_spectrum_kernels_sse41 =
+  {
+    "sse4.1",
+    scale_generic,
+    multiply_generic,
+    scale_to_generic,
+    blend_generic,
+    magnitudes_generic,
+    band_sums_sse41,
+    range_sums_sse41,
+    rgbx_stats_x86,
+    rgbx_bins_x86,
+    rgbx_prefix_sums_x86
+  };
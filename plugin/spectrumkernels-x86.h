@@ -0,0 +1,225 @@
+/* GStreamer moodbar plugin DSP kernels, x86 rgbx loops
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* A frame of 4 floats is one 128-bit vector, so the rgbx kernels are
+ * the same SSE4.1 code for every x86 variant (the AVX ones just encode
+ * it differently).  The compiler doesn't vectorize these by itself: the
+ * statistics are conditional updates and the running sums stop at
+ * uneven positions.
+ */
+
+#ifndef __SPECTRUMKERNELS_X86_H__
+#define __SPECTRUMKERNELS_X86_H__
+
+#include <glib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "spectrumkernels.h"
+
+typedef struct
+{
+  __m128  mini, maxi, nmini, nmaxi, nan;
+  __m128d sumlo, sumhi;
+} RgbxAcc;
+
+static inline void
+rgbx_acc_init (RgbxAcc *acc, __m128 first)
+{
+  acc->mini = acc->maxi = first;
+  acc->nmini = acc->nmaxi = acc->nan = _mm_setzero_ps ();
+  acc->sumlo = acc->sumhi = _mm_setzero_pd ();
+}
+
+/* The branch-free version of rgbx_stats_c's loop body: a new minimum
+ * resets its count, then every value equal to the minimum adds 1 */
+static inline void
+rgbx_acc_add (RgbxAcc *acc, __m128 v)
+{
+  const __m128 one = _mm_set1_ps (1.f);
+  __m128 finite;
+
+  acc->nmini = _mm_andnot_ps (_mm_cmplt_ps (v, acc->mini), acc->nmini);
+  acc->mini  = _mm_min_ps (v, acc->mini);
+  acc->nmini = _mm_add_ps (acc->nmini,
+			   _mm_and_ps (_mm_cmpeq_ps (v, acc->mini), one));
+
+  acc->nmaxi = _mm_andnot_ps (_mm_cmpgt_ps (v, acc->maxi), acc->nmaxi);
+  acc->maxi  = _mm_max_ps (v, acc->maxi);
+  acc->nmaxi = _mm_add_ps (acc->nmaxi,
+			   _mm_and_ps (_mm_cmpeq_ps (v, acc->maxi), one));
+
+  finite = _mm_and_ps (v, _mm_cmpeq_ps (_mm_sub_ps (v, v), _mm_setzero_ps ()));
+  acc->sumlo = _mm_add_pd (acc->sumlo, _mm_cvtps_pd (finite));
+  acc->sumhi = _mm_add_pd (acc->sumhi,
+			   _mm_cvtps_pd (_mm_movehl_ps (finite, finite)));
+  acc->nan = _mm_add_ps (acc->nan, _mm_and_ps (_mm_cmpunord_ps (v, v), one));
+}
+
+/* Count the extremes of a and b that are the extremes of both */
+static inline __m128
+rgbx_count_merge (__m128 ext, __m128 exta, __m128 na, __m128 extb, __m128 nb)
+{
+  return _mm_add_ps (_mm_and_ps (_mm_cmpeq_ps (exta, ext), na),
+		     _mm_and_ps (_mm_cmpeq_ps (extb, ext), nb));
+}
+
+static void
+rgbx_stats_x86 (const gfloat *rgbx, gsize n, GstSpectrumRgbxStats *stats)
+{
+  RgbxAcc a, b;
+  __m128 mini, maxi;
+  gsize i;
+
+  if (n == 0)
+    {
+      memset (stats, 0, sizeof (*stats));
+      return;
+    }
+
+  /* Two sets of accumulators, for even and odd frames, to halve the
+   * chains of dependent minimums and maximums */
+  rgbx_acc_init (&a, _mm_loadu_ps (rgbx));
+  rgbx_acc_init (&b, _mm_loadu_ps (rgbx));
+
+  for (i = 0; i + 2 <= n; i += 2)
+    {
+      rgbx_acc_add (&a, _mm_loadu_ps (&rgbx[4*i]));
+      rgbx_acc_add (&b, _mm_loadu_ps (&rgbx[4*i + 4]));
+    }
+  if (i < n)
+    rgbx_acc_add (&a, _mm_loadu_ps (&rgbx[4*i]));
+
+  mini = _mm_min_ps (a.mini, b.mini);
+  maxi = _mm_max_ps (a.maxi, b.maxi);
+  _mm_storeu_ps (stats->mini, mini);
+  _mm_storeu_ps (stats->maxi, maxi);
+  _mm_storeu_ps (stats->nmini,
+		 rgbx_count_merge (mini, a.mini, a.nmini, b.mini, b.nmini));
+  _mm_storeu_ps (stats->nmaxi,
+		 rgbx_count_merge (maxi, a.maxi, a.nmaxi, b.maxi, b.nmaxi));
+  _mm_storeu_pd (&stats->sum[0], _mm_add_pd (a.sumlo, b.sumlo));
+  _mm_storeu_pd (&stats->sum[2], _mm_add_pd (a.sumhi, b.sumhi));
+  _mm_storeu_ps (stats->nan, _mm_add_ps (a.nan, b.nan));
+}
+
+static inline __m128
+rgbx_select (__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps (_mm_and_ps (mask, a), _mm_andnot_ps (mask, b));
+}
+
+/* The bins are worked out for a whole frame at once, but have to be
+ * added to one value at a time */
+static void
+rgbx_bins_x86 (const gfloat *rgbx, gsize n,
+	       const GstSpectrumRgbxBinning *binning, gdouble *bins)
+{
+  const __m128 skip_lo = _mm_loadu_ps (binning->skip_lo);
+  const __m128 skip_hi = _mm_loadu_ps (binning->skip_hi);
+  const __m128 split = _mm_loadu_ps (binning->split);
+  const __m128 origin0 = _mm_loadu_ps (binning->origin[0]);
+  const __m128 origin1 = _mm_loadu_ps (binning->origin[1]);
+  const __m128 scale0 = _mm_loadu_ps (binning->scale[0]);
+  const __m128 scale1 = _mm_loadu_ps (binning->scale[1]);
+  const __m128i nb = _mm_set1_epi32 ((gint) binning->nbins);
+  const __m128i last = _mm_set1_epi32 ((gint) binning->nbins - 1);
+  const __m128i lanes = _mm_setr_epi32 (0, 2, 4, 6);
+  __m128 v, x, above;
+  __m128i bin, base;
+  gint skip, idx[4];
+  gfloat vals[4];
+  gsize i;
+  guint c;
+
+  for (i = 0; i < n; ++i)
+    {
+      v = _mm_loadu_ps (&rgbx[4*i]);
+      above = _mm_cmpgt_ps (v, split);
+
+      /* Truncation, then the top of the range, as in rgbx_bins_c;
+       * there are never 2^31 bins */
+      x = _mm_mul_ps (_mm_sub_ps (v, rgbx_select (above, origin1, origin0)),
+		      rgbx_select (above, scale1, scale0));
+      bin = _mm_min_epi32 (_mm_cvttps_epi32 (x), last);
+
+      /* Plus (2 * c + side) * nbins, where above is -1 for side 1 */
+      base = _mm_sub_epi32 (lanes, _mm_castps_si128 (above));
+      bin = _mm_add_epi32 (bin, _mm_mullo_epi32 (base, nb));
+
+      skip = _mm_movemask_ps (_mm_or_ps (_mm_or_ps (_mm_cmpeq_ps (v, skip_lo),
+						    _mm_cmpeq_ps (v, skip_hi)),
+					 _mm_cmpunord_ps (v, v)));
+
+      _mm_storeu_si128 ((__m128i *) idx, bin);
+      _mm_storeu_ps (vals, v);
+      for (c = 0; c < 3; ++c)
+	if (!(skip & (1 << c)))
+	  {
+	    bins[2*idx[c]]++;
+	    bins[2*idx[c] + 1] += vals[c];
+	  }
+    }
+}
+
+/* max and min pick their second operand for NaN, as the ?:s in
+ * rgbx_normalize_c do */
+static inline __m128
+rgbx_normalize (__m128 v, __m128 mini, __m128 delta)
+{
+  const __m128 zero = _mm_setzero_ps ();
+  __m128 x;
+
+  x = _mm_div_ps (_mm_sub_ps (v, mini), delta);
+  x = _mm_min_ps (_mm_max_ps (x, zero), _mm_set1_ps (1.f));
+  return _mm_and_ps (x, _mm_cmpeq_ps (_mm_sub_ps (v, v), zero));
+}
+
+static void
+rgbx_prefix_sums_x86 (const gfloat *rgbx, gsize n, const gfloat *mini,
+		      const gfloat *delta, const gdouble *positions,
+		      guint npositions, gdouble *sums)
+{
+  const __m128 vmini = _mm_loadu_ps (mini), vdelta = _mm_loadu_ps (delta);
+  __m128d runlo = _mm_setzero_pd (), runhi = _mm_setzero_pd ();
+  __m128d lo, hi, frac;
+  __m128 x, acc;
+  gsize i = 0, whole;
+  guint k;
+
+  for (k = 0; k < npositions; ++k)
+    {
+      /* Each stretch is summed in floats, as in rgbx_prefix_sums_c */
+      whole = MIN ((gsize) positions[k], n);
+      acc = _mm_setzero_ps ();
+      for (; i < whole; ++i)
+	acc = _mm_add_ps (acc, rgbx_normalize (_mm_loadu_ps (&rgbx[4*i]),
+					       vmini, vdelta));
+      runlo = _mm_add_pd (runlo, _mm_cvtps_pd (acc));
+      runhi = _mm_add_pd (runhi, _mm_cvtps_pd (_mm_movehl_ps (acc, acc)));
+
+      lo = runlo;
+      hi = runhi;
+      if (positions[k] > (gdouble) whole  &&  whole < n)
+	{
+	  frac = _mm_set1_pd (positions[k] - (gdouble) whole);
+	  x = rgbx_normalize (_mm_loadu_ps (&rgbx[4*whole]), vmini, vdelta);
+	  lo = _mm_add_pd (lo, _mm_mul_pd (frac, _mm_cvtps_pd (x)));
+	  hi = _mm_add_pd (hi, _mm_mul_pd (frac,
+					  _mm_cvtps_pd (_mm_movehl_ps (x, x))));
+	}
+      _mm_storeu_pd (&sums[4*k], lo);
+      _mm_storeu_pd (&sums[4*k + 2], hi);
+    }
+}
+
+#endif  /* __SPECTRUMKERNELS_X86_H__ */
@@ -0,0 +1,184 @@
+/* GStreamer moodbar plugin DSP kernels
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* The hot loops of the elements run through the kernels here, so a
+ * distribution build (for the baseline CPU) still gets vector code.
+ * Each variant lives in its own spectrumkernels-*.c file, built with
+ * its own instruction set flags (see meson.build), and the element-wise
+ * kernels are shared between them in spectrumkernels-generic.h.  The
+ * rest of the plugin is built for the baseline CPU and only calls the
+ * variants through the table picked here.
+ *
+ * The sums in the vector variants add up their values in a different
+ * order from the portable ones, so their results may differ in the
+ * last bits.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+
+#include "spectrumkernels.h"
+#include "spectrumkernels-private.h"
+
+GST_DEBUG_CATEGORY (gst_spectrum_kernels_debug);
+#define GST_CAT_DEFAULT gst_spectrum_kernels_debug
+
+static const GstSpectrumKernels *kernels = &gst_spectrum_kernels_c;
+
+
+/* Whether the CPU can run the given variant */
+static gboolean
+cpu_supports (const GstSpectrumKernels *variant)
+{
+  if (variant == &gst_spectrum_kernels_c)
+    return TRUE;
+
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init ();
+
+  if (variant == &gst_spectrum_kernels_sse41)
+    return __builtin_cpu_supports ("sse4.1");
+  if (variant == &gst_spectrum_kernels_avx2)
+    return __builtin_cpu_supports ("avx2")  &&  __builtin_cpu_supports ("fma");
+  if (variant == &gst_spectrum_kernels_avx512)
+    return __builtin_cpu_supports ("avx512f")
+      &&  __builtin_cpu_supports ("fma");
+#endif
+
+  return FALSE;
+}
+
+
+void
+gst_spectrum_kernels_init (void)
+{
+  /* Fastest first */
+  static const GstSpectrumKernels *variants[] =
+    {
+#ifdef HAVE_X86_KERNELS
+      &gst_spectrum_kernels_avx512,
+      &gst_spectrum_kernels_avx2,
+      &gst_spectrum_kernels_sse41,
+#endif
+      &gst_spectrum_kernels_c
+    };
+  const gchar *forced = g_getenv (GST_SPECTRUM_KERNELS_ENV);
+  guint i;
+
+  kernels = &gst_spectrum_kernels_c;
+
+  if (forced != NULL  &&  *forced != '\0')
+    {
+      for (i = 0; i < G_N_ELEMENTS (variants); ++i)
+	if (strcmp (forced, variants[i]->name) == 0)
+	  break;
+
+      if (i == G_N_ELEMENTS (variants))
+	GST_WARNING ("No kernel variant \"%s\" (from $"
+		     GST_SPECTRUM_KERNELS_ENV ")", forced);
+      else if (!cpu_supports (variants[i]))
+	GST_WARNING ("The CPU can't run the %s kernels (from $"
+		     GST_SPECTRUM_KERNELS_ENV ")", forced);
+      else
+	kernels = variants[i];
+    }
+  else
+    for (i = 0; i < G_N_ELEMENTS (variants); ++i)
+      if (cpu_supports (variants[i]))
+	{
+	  kernels = variants[i];
+	  break;
+	}
+
+  GST_INFO ("Using the %s kernels", kernels->name);
+}
+
+const gchar *
+gst_spectrum_kernels_name (void)
+{
+  return kernels->name;
+}
+
+
+void
+gst_spectrum_scale (gfloat *data, gsize n, gfloat factor)
+{
+  kernels->scale (data, n, factor);
+}
+
+void
+gst_spectrum_multiply (gfloat *data, const gfloat *factors, gsize n)
+{
+  kernels->multiply (data, factors, n);
+}
+
+void
+gst_spectrum_scale_to (const gfloat *in, gfloat *out, gsize n, gfloat factor)
+{
+  kernels->scale_to (in, out, n, factor);
+}
+
+void
+gst_spectrum_blend (const gfloat *in, const gfloat *in_weights,
+		    gfloat *acc, const gfloat *acc_weights, gsize n)
+{
+  kernels->blend (in, in_weights, acc, acc_weights, n);
+}
+
+void
+gst_spectrum_magnitudes (const gfloat *in, gfloat *out, gsize n,
+			 gfloat scale)
+{
+  kernels->magnitudes (in, out, n, scale);
+}
+
+void
+gst_spectrum_band_sums (const gfloat *spectrum, const guint *edges,
+			guint nbands, gfloat scale, gfloat *out)
+{
+  kernels->band_sums (spectrum, edges, nbands, scale, out);
+}
+
+void
+gst_spectrum_range_sums (const gfloat *vals, const guint *edges,
+			 guint nranges, gfloat *out)
+{
+  kernels->range_sums (vals, edges, nranges, out);
+}
+
+void
+gst_spectrum_rgbx_stats (const gfloat *rgbx, gsize n,
+			 GstSpectrumRgbxStats *stats)
+{
+  kernels->rgbx_stats (rgbx, n, stats);
+}
+
+void
+gst_spectrum_rgbx_bins (const gfloat *rgbx, gsize n,
+			const GstSpectrumRgbxBinning *binning, gdouble *bins)
+{
+  kernels->rgbx_bins (rgbx, n, binning, bins);
+}
+
+void
+gst_spectrum_rgbx_prefix_sums (const gfloat *rgbx, gsize n,
+			       const gfloat *mini, const gfloat *delta,
+			       const gdouble *positions, guint npositions,
+			       gdouble *sums)
+{
+  kernels->rgbx_prefix_sums (rgbx, n, mini, delta, positions, npositions,
+			     sums);
+}
@@ -0,0 +1,122 @@
+/* GStreamer moodbar plugin DSP kernels
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __SPECTRUMKERNELS_H__
+#define __SPECTRUMKERNELS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The inner loops of the elements, in a portable version and, on x86,
+ * versions built for SSE4.1, AVX2 and AVX-512 (see spectrumkernels.c).
+ * gst_spectrum_kernels_init picks the fastest version the CPU runs;
+ * it's called once from plugin_init, and the kernels may be called
+ * from any thread after that.
+ */
+void gst_spectrum_kernels_init (void);
+
+/* Environment variable naming the kernel variant to use instead of
+ * the fastest one ("c", "sse4.1", "avx2" or "avx512"), for testing */
+#define GST_SPECTRUM_KERNELS_ENV "MOODBAR_SIMD"
+
+/* The name of the kernel variant in use, for logging */
+const gchar *gst_spectrum_kernels_name (void);
+
+/* Multiply the n floats at data by factor */
+void gst_spectrum_scale (gfloat *data, gsize n, gfloat factor);
+
+/* Multiply each of the n floats at data by the float at the same
+ * index of factors */
+void gst_spectrum_multiply (gfloat *data, const gfloat *factors, gsize n);
+
+/* Write the n floats at in, times factor, to out */
+void gst_spectrum_scale_to (const gfloat *in, gfloat *out, gsize n,
+			    gfloat factor);
+
+/* Set acc[i] to in[i] * in_weights[i] + acc[i] * acc_weights[i], for
+ * the first n floats */
+void gst_spectrum_blend (const gfloat *in, const gfloat *in_weights,
+			 gfloat *acc, const gfloat *acc_weights, gsize n);
+
+/* Write the magnitudes of the n complex values (r, i pairs) at in,
+ * times sqrt(scale), to out */
+void gst_spectrum_magnitudes (const gfloat *in, gfloat *out, gsize n,
+			      gfloat scale);
+
+/* For each of the nbands bands given by edges (band k is made of bins
+ * edges[k] up to edges[k+1] - 1), sum the magnitudes of the complex
+ * values (r, i pairs) of spectrum in those bins, times scale, into
+ * out[k].
+ */
+void gst_spectrum_band_sums (const gfloat *spectrum, const guint *edges,
+			     guint nbands, gfloat scale, gfloat *out);
+
+/* The same for plain values: sum vals[edges[k]] up to
+ * vals[edges[k+1] - 1] into out[k], for each of the nranges ranges */
+void gst_spectrum_range_sums (const gfloat *vals, const guint *edges,
+			      guint nranges, gfloat *out);
+
+/* Per-lane statistics of frames of 4 floats, such as moodbar's
+ * (r, g, b, unused) quadruples */
+typedef struct
+{
+  gfloat  mini[4], maxi[4];
+  gfloat  nmini[4], nmaxi[4];  /* How often mini and maxi occur */
+  gdouble sum[4];              /* The sum of the finite values */
+  gfloat  nan[4];              /* How many values aren't numbers */
+} GstSpectrumRgbxStats;
+
+/* Gather the statistics of the n frames at rgbx, in one pass */
+void gst_spectrum_rgbx_stats (const gfloat *rgbx, gsize n,
+			      GstSpectrumRgbxStats *stats);
+
+/* How gst_spectrum_rgbx_bins sorts values into bins: lane c of a
+ * frame is left out if it's equal to skip_lo[c] or skip_hi[c], or
+ * isn't a number; otherwise it goes on side 1 if it's above split[c],
+ * or side 0 if not, in bin (v - origin[side][c]) * scale[side][c]
+ * (at most nbins - 1) of that side.
+ */
+typedef struct
+{
+  gfloat skip_lo[4], skip_hi[4];
+  gfloat split[4];
+  gfloat origin[2][4], scale[2][4];
+  guint  nbins;
+} GstSpectrumRgbxBinning;
+
+/* Add the values of the first three lanes of the n frames at rgbx to
+ * bins, a (count, sum) pair per bin; lane c's bins for side s start at
+ * pair (2 * c + s) * nbins.  Lane 3 is ignored.
+ */
+void gst_spectrum_rgbx_bins (const gfloat *rgbx, gsize n,
+			     const GstSpectrumRgbxBinning *binning,
+			     gdouble *bins);
+
+/* Map each value v of the n frames at rgbx to (v - mini) / delta,
+ * clamped to [0, 1] (values that aren't finite become 0), and give the
+ * running sum of each lane at each of the npositions positions, which
+ * are frame numbers from 0 to n in increasing order and may fall
+ * between frames: sums[4*k + c] is the sum of lane c over the frames
+ * before positions[k], plus the fraction of the frame at positions[k]
+ * that comes before it.  The frames between two positions are summed
+ * in floats, in frame order, and those sums added up in doubles, so
+ * every variant gives the same result.
+ */
+void gst_spectrum_rgbx_prefix_sums (const gfloat *rgbx, gsize n,
+				    const gfloat *mini, const gfloat *delta,
+				    const gdouble *positions,
+				    guint npositions, gdouble *sums);
+
+G_END_DECLS
+
+#endif  /* __SPECTRUMKERNELS_H__ */
@@ -0,0 +1,319 @@
+/* GStreamer moodbar plugin FFTW plan cache
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Planning a transform with FFTW_MEASURE times several candidate
+ * algorithms, which for the sizes we use costs far more than the
+ * transforms themselves on a short file.  So plans are kept in a
+ * process-wide cache keyed by (direction, size, batch layout, flags)
+ * and shared
+ * between elements, and the planner's wisdom is saved to disk so
+ * that later processes can skip the measuring altogether.
+ *
+ * The only thread-safe FFTW functions are the execute functions.
+ * Everything else FFTW does in this plugin -- planning, destroying
+ * plans, wisdom and its allocator -- goes through this file and is
+ * serialized by the fftw_planner lock, so any number of pipelines
+ * can set themselves up concurrently while their transforms still
+ * run in parallel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <fftw3.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spectrumplan.h"
+
+GST_DEBUG_CATEGORY (gst_spectrum_plan_debug);
+#define GST_CAT_DEFAULT gst_spectrum_plan_debug
+
+/* Plans nobody is using are kept around for the next element that
+ * wants one (e.g. the next file of a batch), up to this many. */
+#define MAX_IDLE_PLANS 8
+
+typedef struct
+{
+  GstSpectrumPlanDirection direction;
+  gint       size;
+  gint       howmany;
+  gint       dist;
+  guint      flags;
+  fftwf_plan plan;
+  guint      refcount;
+} PlanCacheEntry;
+
+/* Protects every FFTW call other than execute, and the data below */
+G_LOCK_DEFINE_STATIC (fftw_planner);
+static GList *plan_cache = NULL;
+static guint  num_idle_plans = 0;
+
+/* The wisdom files we have already loaded */
+static GList *imported_wisdom = NULL;
+
+
+/***************************************************************/
+/* Wisdom                                                      */
+/***************************************************************/
+
+/* The property wins over the environment, which wins over the
+ * per-user cache directory.  Returns NULL if wisdom is disabled.
+ */
+static gchar *
+wisdom_path (const gchar *wisdom_file)
+{
+  const gchar *env;
+
+  if (wisdom_file != NULL)
+    return *wisdom_file ? g_strdup (wisdom_file) : NULL;
+
+  env = g_getenv (GST_SPECTRUM_WISDOM_ENV);
+  if (env != NULL)
+    return *env ? g_strdup (env) : NULL;
+
+  return g_build_filename (g_get_user_cache_dir (), "moodbar",
+			   "fftw-wisdom", NULL);
+}
+
+/* Must be called with the planner lock held */
+static void
+import_wisdom (const gchar *path)
+{
+  if (g_list_find_custom (imported_wisdom, path, (GCompareFunc) strcmp))
+    return;
+
+  imported_wisdom = g_list_prepend (imported_wisdom, g_strdup (path));
+
+  if (fftwf_import_wisdom_from_filename (path))
+    GST_DEBUG ("Imported FFTW wisdom from %s", path);
+  else
+    GST_DEBUG ("No usable FFTW wisdom in %s", path);
+}
+
+/* Must be called with the planner lock held.  The wisdom is
+ * written to a temporary file first so that concurrent processes
+ * never see a half-written file.
+ */
+static void
+export_wisdom (const gchar *path)
+{
+  gchar *dir, *tmp;
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  tmp = g_strdup_printf ("%s.%d.tmp", path, (gint) getpid ());
+  if (fftwf_export_wisdom_to_filename (tmp)  &&  g_rename (tmp, path) == 0)
+    GST_DEBUG ("Exported FFTW wisdom to %s", path);
+  else
+    {
+      GST_WARNING ("Could not write FFTW wisdom to %s", path);
+      g_unlink (tmp);
+    }
+  g_free (tmp);
+}
+
+
+/***************************************************************/
+/* Plan cache                                                  */
+/***************************************************************/
+
+/* Must be called with the planner lock held */
+static fftwf_plan
+create_plan (GstSpectrumPlanDirection direction, gint size, gint howmany,
+	     gint dist, guint flags)
+{
+  fftwf_plan plan;
+  float *real, *cplx;
+  gint nfreqs = size/2 + 1;
+
+  /* The planner may scribble over these, so they're scratch arrays;
+   * fftwf_malloc gives them the alignment the elements' arrays
+   * will have too. */
+  real = (float *) fftwf_malloc (((gsize) (howmany - 1) * dist + size)
+				 * sizeof (float));
+  cplx = (float *) fftwf_malloc ((gsize) howmany * nfreqs
+				 * sizeof (fftwf_complex));
+
+  if (direction == GST_SPECTRUM_PLAN_R2C)
+    plan = fftwf_plan_many_dft_r2c (1, &size, howmany,
+				    real, NULL, 1, dist,
+				    (fftwf_complex *) cplx, NULL, 1, nfreqs,
+				    flags);
+  else
+    plan = fftwf_plan_many_dft_c2r (1, &size, howmany,
+				    (fftwf_complex *) cplx, NULL, 1, nfreqs,
+				    real, NULL, 1, dist,
+				    flags);
+
+  fftwf_free (real);
+  fftwf_free (cplx);
+
+  return plan;
+}
+
+fftwf_plan
+gst_spectrum_plan_acquire (GstSpectrumPlanDirection direction,
+			   gint size, gboolean hi_q,
+			   const gchar *wisdom_file)
+{
+  return gst_spectrum_plan_acquire_many (direction, size, 1, size, hi_q,
+					 wisdom_file);
+}
+
+fftwf_plan
+gst_spectrum_plan_acquire_many (GstSpectrumPlanDirection direction,
+				gint size, gint howmany, gint dist,
+				gboolean hi_q, const gchar *wisdom_file)
+{
+  PlanCacheEntry *entry;
+  GList *l;
+  gchar *path;
+  guint flags = hi_q ? FFTW_MEASURE : FFTW_ESTIMATE;
+  gint64 start;
+
+  g_return_val_if_fail (size > 0  &&  howmany > 0  &&  dist > 0, NULL);
+
+  /* Forward transforms may read overlapping windows */
+  if (direction == GST_SPECTRUM_PLAN_R2C)
+    flags |= FFTW_PRESERVE_INPUT;
+
+  G_LOCK (fftw_planner);
+
+  for (l = plan_cache; l != NULL; l = l->next)
+    {
+      entry = (PlanCacheEntry *) l->data;
+      if (entry->direction == direction  &&  entry->size == size
+	  &&  entry->howmany == howmany  &&  entry->dist == dist
+	  &&  entry->flags == flags)
+	{
+	  if (entry->refcount++ == 0)
+	    num_idle_plans--;
+	  G_UNLOCK (fftw_planner);
+
+	  GST_LOG ("Reusing cached plan for %d x size %d", howmany, size);
+	  return entry->plan;
+	}
+    }
+
+  path = hi_q ? wisdom_path (wisdom_file) : NULL;
+  if (path != NULL)
+    import_wisdom (path);
+
+  start = g_get_monotonic_time ();
+  entry = g_new0 (PlanCacheEntry, 1);
+  entry->direction = direction;
+  entry->size      = size;
+  entry->howmany   = howmany;
+  entry->dist      = dist;
+  entry->flags     = flags;
+  entry->plan      = create_plan (direction, size, howmany, dist, flags);
+  entry->refcount  = 1;
+
+  GST_DEBUG ("Planned %d %s transforms of size %d in %.3f ms", howmany,
+	     direction == GST_SPECTRUM_PLAN_R2C ? "forward" : "inverse",
+	     size, (g_get_monotonic_time () - start) / 1000.0);
+
+  if (entry->plan == NULL)
+    {
+      g_free (entry);
+      g_free (path);
+      G_UNLOCK (fftw_planner);
+      return NULL;
+    }
+
+  plan_cache = g_list_prepend (plan_cache, entry);
+
+  /* Wisdom only grows, so save it whenever we had to plan */
+  if (path != NULL)
+    export_wisdom (path);
+  g_free (path);
+
+  G_UNLOCK (fftw_planner);
+
+  return entry->plan;
+}
+
+void
+gst_spectrum_plan_release (fftwf_plan plan)
+{
+  PlanCacheEntry *entry;
+  GList *l;
+
+  if (plan == NULL)
+    return;
+
+  G_LOCK (fftw_planner);
+
+  for (l = plan_cache; l != NULL; l = l->next)
+    {
+      entry = (PlanCacheEntry *) l->data;
+      if (entry->plan != plan)
+	continue;
+
+      if (--entry->refcount == 0)
+	{
+	  if (num_idle_plans < MAX_IDLE_PLANS)
+	    num_idle_plans++;
+	  else
+	    {
+	      plan_cache = g_list_delete_link (plan_cache, l);
+	      fftwf_destroy_plan (entry->plan);
+	      g_free (entry);
+	    }
+	}
+      break;
+    }
+
+  G_UNLOCK (fftw_planner);
+}
+
+
+/***************************************************************/
+/* Allocation                                                  */
+/***************************************************************/
+
+/* fftwf_alignment_of only looks at the address, so it needs no lock.
+ * The plans are made on fftwf_malloc arrays, whose alignment is 0. */
+gboolean
+gst_spectrum_fftw_aligned (gconstpointer mem)
+{
+  return fftwf_alignment_of ((float *) mem) == 0;
+}
+
+gpointer
+gst_spectrum_fftw_malloc (gsize size)
+{
+  gpointer mem;
+
+  G_LOCK (fftw_planner);
+  mem = fftwf_malloc (size);
+  G_UNLOCK (fftw_planner);
+
+  return mem;
+}
+
+void
+gst_spectrum_fftw_free (gpointer mem)
+{
+  if (mem == NULL)
+    return;
+
+  G_LOCK (fftw_planner);
+  fftwf_free (mem);
+  G_UNLOCK (fftw_planner);
+}
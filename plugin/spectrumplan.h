@@ -0,0 +1,82 @@
+/* GStreamer moodbar plugin FFTW plan cache
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __SPECTRUMPLAN_H__
+#define __SPECTRUMPLAN_H__
+
+#include <gst/gst.h>
+#include <fftw3.h>
+
+G_BEGIN_DECLS
+
+/* Plans are shared between all the elements in the process, so a
+ * plan must only ever be run with the new-array execute functions
+ * (fftwf_execute_dft_r2c and fftwf_execute_dft_c2r) on out-of-place
+ * arrays allocated with gst_spectrum_fftw_malloc, or other memory for
+ * which gst_spectrum_fftw_aligned is TRUE.
+ *
+ * FFTW's execute functions are thread-safe and may be called without
+ * any locking.  No other FFTW function may be called directly by the
+ * elements: the functions below serialize them behind one lock for
+ * the whole plugin, since FFTW's planner and allocator are not
+ * thread-safe.
+ */
+typedef enum
+{
+  GST_SPECTRUM_PLAN_R2C,
+  GST_SPECTRUM_PLAN_C2R
+} GstSpectrumPlanDirection;
+
+/* Environment variable naming the FFTW wisdom file; set it to the
+ * empty string to disable wisdom entirely. */
+#define GST_SPECTRUM_WISDOM_ENV "MOODBAR_FFTW_WISDOM"
+
+/* Returns a (shared) plan for a transform of size samples, creating
+ * it if necessary.  wisdom_file overrides the default wisdom location
+ * and may be NULL.  Each plan returned must be given back with
+ * gst_spectrum_plan_release.
+ */
+fftwf_plan gst_spectrum_plan_acquire (GstSpectrumPlanDirection direction,
+				      gint size, gboolean hi_q,
+				      const gchar *wisdom_file);
+
+/* The same for howmany transforms at once.  The real arrays (the
+ * input of a forward transform, the output of an inverse one) hold
+ * one transform every dist floats, and may overlap for a forward
+ * transform; the complex arrays hold size/2+1 complex floats per
+ * transform, back to back.
+ */
+fftwf_plan gst_spectrum_plan_acquire_many (GstSpectrumPlanDirection direction,
+					   gint size, gint howmany, gint dist,
+					   gboolean hi_q,
+					   const gchar *wisdom_file);
+
+void gst_spectrum_plan_release (fftwf_plan plan);
+
+/* Alignment mask for memory the plans should be able to run on
+ * directly (32 bytes, enough for AVX); GstBuffers the elements want
+ * to transform in place are allocated with it. */
+#define GST_SPECTRUM_ALIGN 31
+
+/* Whether the plans can be executed on mem directly, i.e. whether it
+ * is aligned like the arrays the plans were made with.  Otherwise
+ * the data has to be copied to a gst_spectrum_fftw_malloc array. */
+gboolean gst_spectrum_fftw_aligned (gconstpointer mem);
+
+/* Thread-safe fftwf_malloc and fftwf_free */
+gpointer gst_spectrum_fftw_malloc (gsize size);
+
+void gst_spectrum_fftw_free (gpointer mem);
+
+G_END_DECLS
+
+#endif  /* __SPECTRUMPLAN_H__ */
@@ -0,0 +1,209 @@
+/* GStreamer moodbar plugin buffer pools
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Offline decoding pushes thousands of spectrum buffers per second of
+ * audio, all of the same size, so instead of going to the allocator
+ * for each one the elements recycle them through a GstBufferPool.
+ * The pool comes from downstream's answer to the ALLOCATION query if
+ * it has one, and is our own otherwise; the elements that take
+ * spectra in propose a pool to upstream in turn.
+ *
+ * How many buffers each element allocated is logged (category
+ * "spectrumpool") when it goes back to READY; the pools' own
+ * allocations are logged by GStreamer's "bufferpool" category.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "spectrumpool.h"
+#include "spectrumformat.h"
+#include "spectrumplan.h"
+
+GST_DEBUG_CATEGORY (gst_spectrum_pool_debug);
+#define GST_CAT_DEFAULT gst_spectrum_pool_debug
+
+/* Keep this many buffers in a pool we make, for the next element
+ * (or queue) downstream to hold on to */
+#define POOL_MIN_BUFFERS 4
+
+
+static void
+aligned_params (GstAllocationParams *params)
+{
+  gst_allocation_params_init (params);
+  params->align = GST_SPECTRUM_ALIGN;
+}
+
+
+void
+gst_spectrum_pool_init (GstSpectrumPool *pool)
+{
+  pool->pool      = NULL;
+  pool->size      = 0;
+  pool->pooled    = 0;
+  pool->allocated = 0;
+}
+
+
+void
+gst_spectrum_pool_reset (GstSpectrumPool *pool)
+{
+  if (pool->pool != NULL)
+    {
+      gst_buffer_pool_set_active (pool->pool, FALSE);
+      gst_object_unref (pool->pool);
+    }
+  pool->pool = NULL;
+  pool->size = 0;
+}
+
+
+/* Set up a pool of buffers of size bytes with downstream of srcpad */
+static void
+negotiate_pool (GstSpectrumPool *pool, GstPad *srcpad, gsize size)
+{
+  GstBufferPool *newpool = NULL;
+  GstAllocationParams params;
+  GstStructure *config;
+  GstQuery *query;
+  GstCaps *caps;
+  guint qsize, min = POOL_MIN_BUFFERS, max = 0;
+
+  /* Whether or not this works, it's only tried once per size */
+  gst_spectrum_pool_reset (pool);
+  pool->size = size;
+
+  caps = gst_pad_get_current_caps (srcpad);
+  if (caps == NULL)
+    return;
+
+  query = gst_query_new_allocation (caps, TRUE);
+  if (gst_pad_peer_query (srcpad, query)
+      &&  gst_query_get_n_allocation_pools (query) > 0)
+    {
+      gst_query_parse_nth_allocation_pool (query, 0, &newpool, &qsize,
+					   &min, &max);
+      min = MAX (min, POOL_MIN_BUFFERS);
+      if (max != 0)
+	max = MAX (max, min);
+    }
+  gst_query_unref (query);
+
+  if (newpool == NULL)
+    newpool = gst_buffer_pool_new ();
+
+  aligned_params (&params);
+  config = gst_buffer_pool_get_config (newpool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_set_allocator (config, NULL, &params);
+  gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (newpool, config)
+      ||  !gst_buffer_pool_set_active (newpool, TRUE))
+    {
+      GST_DEBUG_OBJECT (srcpad, "Could not set up a pool of %"
+			G_GSIZE_FORMAT "-byte buffers", size);
+      gst_object_unref (newpool);
+      return;
+    }
+
+  GST_DEBUG_OBJECT (srcpad, "Using a pool of %" G_GSIZE_FORMAT
+		    "-byte buffers (%u to %u)", size, min, max);
+  pool->pool = newpool;
+}
+
+
+GstBuffer *
+gst_spectrum_pool_alloc (GstSpectrumPool *pool, GstPad *srcpad, gsize size)
+{
+  GstAllocationParams params;
+  GstBuffer *buf = NULL;
+
+  /* Only the first size asked for, which is the usual one, gets a
+   * pool; odd ones (a short last batch) are allocated as they come */
+  if (pool->size == 0)
+    negotiate_pool (pool, srcpad, size);
+
+  if (pool->pool != NULL  &&  pool->size == size
+      &&  gst_buffer_pool_acquire_buffer (pool->pool, &buf, NULL)
+	  == GST_FLOW_OK)
+    {
+      pool->pooled++;
+      return buf;
+    }
+
+  aligned_params (&params);
+  pool->allocated++;
+  GST_LOG_OBJECT (srcpad, "Allocating a %" G_GSIZE_FORMAT "-byte buffer",
+		  size);
+  return gst_buffer_new_allocate (NULL, size, &params);
+}
+
+
+void
+gst_spectrum_pool_clear (GstSpectrumPool *pool, GstObject *owner)
+{
+  if (pool->pooled > 0  ||  pool->allocated > 0)
+    GST_DEBUG_OBJECT (owner, "%" G_GUINT64_FORMAT " buffers from the pool, %"
+		      G_GUINT64_FORMAT " allocated one by one",
+		      pool->pooled, pool->allocated);
+
+  gst_spectrum_pool_reset (pool);
+  pool->pooled    = 0;
+  pool->allocated = 0;
+}
+
+
+gboolean
+gst_spectrum_pool_propose_spectra (GstQuery *query)
+{
+  GstBufferPool *newpool;
+  GstAllocationParams params;
+  GstStructure *config, *s;
+  GstCaps *caps;
+  gboolean need_pool;
+  gint size, frames = 1;
+  guint bytes;
+
+  gst_query_parse_allocation (query, &caps, &need_pool);
+  if (caps == NULL  ||  gst_caps_get_size (caps) == 0)
+    return FALSE;
+
+  s = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (s, "size", &size)  ||  size <= 0)
+    return FALSE;
+  gst_structure_get_int (s, "frames", &frames);
+  bytes = gst_spectrum_format_frame_bytes (gst_spectrum_format_of (s), size)
+    * MAX (frames, 1);
+
+  aligned_params (&params);
+  gst_query_add_allocation_param (query, NULL, &params);
+
+  if (need_pool)
+    {
+      newpool = gst_buffer_pool_new ();
+      config = gst_buffer_pool_get_config (newpool);
+      gst_buffer_pool_config_set_params (config, caps, bytes,
+					 POOL_MIN_BUFFERS, 0);
+      gst_buffer_pool_config_set_allocator (config, NULL, &params);
+      if (gst_buffer_pool_set_config (newpool, config))
+	gst_query_add_allocation_pool (query, newpool, bytes,
+				       POOL_MIN_BUFFERS, 0);
+      gst_object_unref (newpool);
+    }
+
+  return TRUE;
+}
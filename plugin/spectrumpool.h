@@ -0,0 +1,57 @@
+/* GStreamer moodbar plugin buffer pools
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __SPECTRUMPOOL_H__
+#define __SPECTRUMPOOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* The output buffers of an element, taken from a buffer pool agreed
+ * on with downstream through the ALLOCATION query where possible.
+ * The pool holds buffers of one size (a full batch of frames); other
+ * sizes are allocated one by one.  All buffers are aligned to
+ * GST_SPECTRUM_ALIGN, so FFTW can work in them directly.
+ */
+typedef struct
+{
+  GstBufferPool *pool;
+  gsize          size;       /* The size of the pool's buffers */
+  guint64        pooled;     /* Buffers taken from the pool */
+  guint64        allocated;  /* Buffers allocated one by one */
+} GstSpectrumPool;
+
+void gst_spectrum_pool_init (GstSpectrumPool *pool);
+
+/* Returns a buffer of size bytes for pushing out of srcpad, whose
+ * current caps are used to set up a pool of buffers that size if
+ * there's none yet.
+ */
+GstBuffer *gst_spectrum_pool_alloc (GstSpectrumPool *pool, GstPad *srcpad,
+				    gsize size);
+
+/* Drop the pool, so the next buffer sets up a new one; for when the
+ * caps change */
+void gst_spectrum_pool_reset (GstSpectrumPool *pool);
+
+/* Drop the pool, logging how many buffers were allocated for owner */
+void gst_spectrum_pool_clear (GstSpectrumPool *pool, GstObject *owner);
+
+/* Answer an ALLOCATION query from upstream, whose caps are spectrum
+ * caps (see spectrum.h), with a pool of buffers of one batch of
+ * spectra */
+gboolean gst_spectrum_pool_propose_spectra (GstQuery *query);
+
+G_END_DECLS
+
+#endif  /* __SPECTRUMPOOL_H__ */
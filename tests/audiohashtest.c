@@ -0,0 +1,611 @@
+/***************************************************************************
+                        audiohashtest.c  -  description
+                           -------------------
+  Check the audio hashes and durations of small made-up files
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* For each container audiohash.c knows, this writes a few files that
+ * are just big enough to be parsed: the same audio with no tags and
+ * with two different sets of them, and different audio with no tags.
+ * The audio is a byte repeated, as nothing is decoded.  It checks
+ * that every file plays as long as its headers say, that the tags
+ * don't change the hash and that the audio does.  Then come the files
+ * that should get no hash or no duration.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "audiohash.h"
+
+/* What the tagged files are tagged with; 0 is no tags */
+#define NUM_TAGS 3
+
+static const gchar *tag_texts[NUM_TAGS] =
+  { NULL, "Artist", "A title that is rather longer than the artist" };
+
+/* An Ogg granule position meaning no packet ends on the page */
+#define OGG_NO_GRANULE G_GUINT64_CONSTANT (0xffffffffffffffff)
+
+static gint failures = 0;
+
+
+static void
+put (GByteArray *file, gconstpointer data, gsize len)
+{
+  g_byte_array_append (file, (const guint8 *) data, len);
+}
+
+static void
+put_fill (GByteArray *file, guchar byte, gsize len)
+{
+  gsize at = file->len;
+
+  g_byte_array_set_size (file, at + len);
+  memset (file->data + at, byte, len);
+}
+
+static void
+put_le (GByteArray *file, guint64 value, guint bytes)
+{
+  guint i;
+
+  for (i = 0; i < bytes; ++i)
+    {
+      guint8 b = (guint8) (value >> (8 * i));
+
+      g_byte_array_append (file, &b, 1);
+    }
+}
+
+static void
+put_be (GByteArray *file, guint64 value, guint bytes)
+{
+  while (bytes-- > 0)
+    {
+      guint8 b = (guint8) (value >> (8 * bytes));
+
+      g_byte_array_append (file, &b, 1);
+    }
+}
+
+/* Overwrite the 32-bit size at offset with value */
+static void
+set_be32 (GByteArray *file, guint offset, guint32 value)
+{
+  file->data[offset] = value >> 24;
+  file->data[offset + 1] = value >> 16;
+  file->data[offset + 2] = value >> 8;
+  file->data[offset + 3] = value;
+}
+
+static void
+set_le32 (GByteArray *file, guint offset, guint32 value)
+{
+  file->data[offset] = value;
+  file->data[offset + 1] = value >> 8;
+  file->data[offset + 2] = value >> 16;
+  file->data[offset + 3] = value >> 24;
+}
+
+
+/* Tags */
+
+/* An ID3v2.4 tag with a title frame */
+static void
+put_id3v2 (GByteArray *file, const gchar *text)
+{
+  guint32 frame = 1 + strlen (text), size = 10 + frame;
+
+  put (file, "ID3\004\000\000", 6);
+  put_be (file, ((size & 0x0fe00000) << 3) | ((size & 0x001fc000) << 2)
+	  | ((size & 0x00003f80) << 1) | (size & 0x7f), 4);
+  put (file, "TIT2", 4);
+  put_be (file, frame, 4);
+  put_be (file, 0, 2);
+  put (file, "\003", 1);
+  put (file, text, strlen (text));
+}
+
+/* An APEv2 tag with a footer and no header, then an ID3v1 tag */
+static void
+put_trailing_tags (GByteArray *file, const gchar *text)
+{
+  guint32 value = strlen (text);
+  guint at;
+
+  put_le (file, value, 4);
+  put_le (file, 0, 4);
+  put (file, "Title", 6);
+  put (file, text, value);
+  put (file, "APETAGEX", 8);
+  put_le (file, 2000, 4);
+  put_le (file, 4 + 4 + 6 + value + 32, 4);
+  put_le (file, 1, 4);
+  put_le (file, 0, 4);
+  put_fill (file, 0, 8);
+
+  at = file->len;
+  put (file, "TAG", 3);
+  put_fill (file, 0, 125);
+  memcpy (file->data + at + 3, text, MIN (strlen (text), 30));
+}
+
+
+/* Containers.  Each writes a file with the audio bytes all audio,
+ * tagged with tag_texts[tags], and returns how long it plays in
+ * seconds. */
+
+/* 2.5 s of 8 kHz 8-bit mono */
+static gdouble
+build_wav (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+
+  put (file, "RIFF", 4);
+  put_le (file, 0, 4);
+  put (file, "WAVE", 4);
+
+  put (file, "fmt ", 4);
+  put_le (file, 16, 4);
+  put_le (file, 1, 2);
+  put_le (file, 1, 2);
+  put_le (file, 8000, 4);
+  put_le (file, 8000, 4);
+  put_le (file, 1, 2);
+  put_le (file, 8, 2);
+
+  if (text != NULL)
+    {
+      guint32 len = strlen (text) + 1;
+
+      put (file, "LIST", 4);
+      put_le (file, 4 + 8 + len, 4);
+      put (file, "INFOINAM", 8);
+      put_le (file, len, 4);
+      put (file, text, len);
+      if (len & 1)
+	put_fill (file, 0, 1);
+    }
+
+  put (file, "data", 4);
+  put_le (file, 20000, 4);
+  put_fill (file, audio, 20000);
+
+  set_le32 (file, 4, file->len - 8);
+  return 2.5;
+}
+
+/* COMM says 3 s at 44.1 kHz, though SSND is shorter */
+static gdouble
+build_aiff (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+
+  put (file, "FORM", 4);
+  put_be (file, 0, 4);
+  put (file, "AIFF", 4);
+
+  put (file, "COMM", 4);
+  put_be (file, 18, 4);
+  put_be (file, 1, 2);
+  put_be (file, 3 * 44100, 4);
+  put_be (file, 16, 2);
+  put_be (file, 16383 + 15, 2);
+  put_be (file, G_GUINT64_CONSTANT (44100) << 48, 8);
+
+  if (text != NULL)
+    {
+      guint32 len = strlen (text);
+
+      put (file, "NAME", 4);
+      put_be (file, len, 4);
+      put (file, text, len);
+      if (len & 1)
+	put_fill (file, 0, 1);
+    }
+
+  put (file, "SSND", 4);
+  put_be (file, 8 + 4000, 4);
+  put_be (file, 0, 8);
+  put_fill (file, audio, 4000);
+
+  set_be32 (file, 4, file->len - 8);
+  return 3.;
+}
+
+/* A STREAMINFO block for 4 minutes at 44.1 kHz */
+static void
+put_streaminfo (GByteArray *file, gboolean last)
+{
+  put_be (file, (last ? 0x80000000 : 0) | 34, 4);
+  put_be (file, 4096, 2);
+  put_be (file, 4096, 2);
+  put_be (file, 0, 6);
+  put_be (file, (G_GUINT64_CONSTANT (44100) << 44)
+	  | (G_GUINT64_CONSTANT (15) << 36) | (240 * 44100), 8);
+  put_fill (file, 0, 16);
+}
+
+static gdouble
+build_flac (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+
+  if (text != NULL)
+    put_id3v2 (file, text);
+
+  put (file, "fLaC", 4);
+  put_streaminfo (file, text == NULL);
+  if (text != NULL)
+    {
+      guint32 len = strlen (text);
+
+      put_be (file, 0x84000000 | (4 + len + 4), 4);
+      put_le (file, len, 4);
+      put (file, text, len);
+      put_le (file, 0, 4);
+    }
+
+  put (file, "\377\370", 2);
+  put_fill (file, audio, 1000);
+  return 240.;
+}
+
+/* The header of an Ogg page with len bytes of payload, which the
+ * caller puts after it */
+static void
+put_ogg_page (GByteArray *file, guint64 granule, guint32 serial,
+	      guint32 sequence, guint8 flags, gsize len)
+{
+  put (file, "OggS", 4);
+  put_le (file, 0, 1);
+  put_le (file, flags, 1);
+  put_le (file, granule, 8);
+  put_le (file, serial, 4);
+  put_le (file, sequence, 4);
+  put_le (file, 0, 4);  /* Nothing checks the CRC */
+  put_le (file, len / 255 + 1, 1);
+  for (; len >= 255; len -= 255)
+    put_le (file, 255, 1);
+  put_le (file, len, 1);
+}
+
+/* The pages after the header pages: one that a packet ends on, one
+ * no packet ends on, and the last one */
+static void
+put_ogg_audio (GByteArray *file, guint32 serial, guint64 last_granule,
+	       guchar audio)
+{
+  put_ogg_page (file, last_granule / 4, serial, 2, 0, 3000);
+  put_fill (file, audio, 3000);
+  put_ogg_page (file, OGG_NO_GRANULE, serial, 3, 1, 500);
+  put_fill (file, audio, 500);
+  put_ogg_page (file, last_granule, serial, 4, 5, 200);
+  put_fill (file, audio, 200);
+}
+
+/* 10 s of 48 kHz stereo, with its tags in the comment header */
+static gdouble
+build_vorbis (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags] != NULL ? tag_texts[tags] : "";
+  GByteArray *packet = g_byte_array_new ();
+
+  put (packet, "\001vorbis", 7);
+  put_le (packet, 0, 4);
+  put_le (packet, 2, 1);
+  put_le (packet, 48000, 4);
+  put_fill (packet, 0, 14);
+  put_ogg_page (file, 0, 7, 0, 2, packet->len);
+  put (file, packet->data, packet->len);
+
+  g_byte_array_set_size (packet, 0);
+  put (packet, "\003vorbis", 7);
+  put_le (packet, strlen (text), 4);
+  put (packet, text, strlen (text));
+  put_le (packet, 0, 4);
+  put (packet, "\001", 1);
+  put_fill (packet, 0x55, 40);  /* The setup header */
+  put_ogg_page (file, 0, 7, 1, 0, packet->len);
+  put (file, packet->data, packet->len);
+  g_byte_array_free (packet, TRUE);
+
+  put_ogg_audio (file, 7, 480000, audio);
+  return 10.;
+}
+
+/* 5 s, after a pre-skip of 312 samples */
+static gdouble
+build_opus (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags] != NULL ? tag_texts[tags] : "";
+  GByteArray *packet = g_byte_array_new ();
+
+  put (packet, "OpusHead\001\002", 10);
+  put_le (packet, 312, 2);
+  put_le (packet, 44100, 4);
+  put_le (packet, 0, 3);
+  put_ogg_page (file, 0, 9, 0, 2, packet->len);
+  put (file, packet->data, packet->len);
+
+  g_byte_array_set_size (packet, 0);
+  put (packet, "OpusTags", 8);
+  put_le (packet, strlen (text), 4);
+  put (packet, text, strlen (text));
+  put_le (packet, 0, 4);
+  put_ogg_page (file, 0, 9, 1, 0, packet->len);
+  put (file, packet->data, packet->len);
+  g_byte_array_free (packet, TRUE);
+
+  put_ogg_audio (file, 9, 5 * 48000 + 312, audio);
+  return 5.;
+}
+
+/* moov/mvhd says 200.5 s; the tags go in moov/udta */
+static gdouble
+build_mp4 (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+  guint moov;
+
+  put_be (file, 16, 4);
+  put (file, "ftypM4A ", 8);
+  put_be (file, 0, 4);
+
+  put_be (file, 8 + 3000, 4);
+  put (file, "mdat", 4);
+  put_fill (file, audio, 3000);
+
+  moov = file->len;
+  put_be (file, 0, 4);
+  put (file, "moov", 4);
+  put_be (file, 8 + 100, 4);
+  put (file, "mvhd", 4);
+  put_fill (file, 0, 12);
+  put_be (file, 600, 4);
+  put_be (file, 600 * 200 + 300, 4);
+  put_fill (file, 0, 80);
+  if (text != NULL)
+    {
+      put_be (file, 8 + 8 + strlen (text), 4);
+      put (file, "udta", 4);
+      put_be (file, 8 + strlen (text), 4);
+      put (file, "\251nam", 4);
+      put (file, text, strlen (text));
+    }
+  set_be32 (file, moov, file->len - moov);
+
+  return 200.5;
+}
+
+/* MPEG-1 layer III at 128 kbit/s, 44.1 kHz stereo: 417 bytes a frame */
+static void
+put_mp3_frame (GByteArray *file, guchar audio)
+{
+  put (file, "\377\373\220\000", 4);
+  put_fill (file, audio, 417 - 4);
+}
+
+/* 100 frames, taken at their bitrate */
+static gdouble
+build_mp3_cbr (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+  guint i;
+
+  if (text != NULL)
+    put_id3v2 (file, text);
+  for (i = 0; i < 100; ++i)
+    put_mp3_frame (file, audio);
+  if (text != NULL)
+    put_trailing_tags (file, text);
+
+  return 100 * 417 * 8 / 128000.;
+}
+
+/* A Xing header saying 5000 frames, though only 10 follow */
+static gdouble
+build_mp3_xing (GByteArray *file, guint tags, guchar audio)
+{
+  const gchar *text = tag_texts[tags];
+  guint i, xing;
+
+  if (text != NULL)
+    put_id3v2 (file, text);
+
+  xing = file->len + 4 + 32;
+  put_mp3_frame (file, 0);
+  memcpy (file->data + xing, "Xing", 4);
+  set_be32 (file, xing + 4, 1);
+  set_be32 (file, xing + 8, 5000);
+
+  for (i = 0; i < 10; ++i)
+    put_mp3_frame (file, audio);
+  if (text != NULL)
+    put_trailing_tags (file, text);
+
+  return 5000 * 1152 / 44100.;
+}
+
+static const struct
+{
+  const gchar *name;
+  gdouble (*build) (GByteArray *file, guint tags, guchar audio);
+} formats[] =
+  {
+    { "wav", build_wav },
+    { "aiff", build_aiff },
+    { "flac", build_flac },
+    { "ogg", build_vorbis },
+    { "opus", build_opus },
+    { "m4a", build_mp4 },
+    { "mp3", build_mp3_cbr },
+    { "xing.mp3", build_mp3_xing }
+  };
+
+
+/* Write file to a file named name in dir, and return its path */
+static gchar *
+write_file (const gchar *dir, const gchar *name, const GByteArray *file)
+{
+  gchar *path = g_build_filename (dir, name, NULL);
+  GError *err = NULL;
+
+  if (!g_file_set_contents (path, (const gchar *) file->data, file->len,
+			    &err))
+    g_error ("Could not write %s: %s", path, err->message);
+
+  return path;
+}
+
+static void
+fail (const gchar *name, const gchar *problem)
+{
+  g_printerr ("%s: %s\n", name, problem);
+  failures++;
+}
+
+/* Make a file of format f and return its hash, checking its duration */
+static gchar *
+check_file (const gchar *dir, guint f, guint tags, guchar audio)
+{
+  GByteArray *file = g_byte_array_new ();
+  gdouble expected = formats[f].build (file, tags, audio);
+  gchar *name, *path, *hash;
+  gint64 duration;
+
+  name = g_strdup_printf ("%u-%u.%s", tags, audio, formats[f].name);
+  path = write_file (dir, name, file);
+  g_byte_array_free (file, TRUE);
+
+  duration = audio_duration_file (path);
+  hash = audio_hash_file (path);
+  g_print ("%-18s %10.4f s  %s\n", name, duration / 1e9,
+	   hash != NULL ? hash : "(none)");
+
+  if (duration < 0  ||  ABS (duration / 1e9 - expected) > 1e-3)
+    fail (name, "wrong duration");
+  if (hash == NULL)
+    fail (name, "no hash");
+
+  g_remove (path);
+  g_free (path);
+  g_free (name);
+  return hash;
+}
+
+static void
+check_format (const gchar *dir, guint f)
+{
+  gchar *hashes[NUM_TAGS], *other;
+  guint tags;
+
+  for (tags = 0; tags < NUM_TAGS; ++tags)
+    hashes[tags] = check_file (dir, f, tags, 1);
+  other = check_file (dir, f, 0, 2);
+
+  for (tags = 1; tags < NUM_TAGS; ++tags)
+    if (g_strcmp0 (hashes[tags], hashes[0]) != 0)
+      fail (formats[f].name, "the tags change the hash");
+  if (hashes[0] != NULL  &&  g_strcmp0 (other, hashes[0]) == 0)
+    fail (formats[f].name, "different audio has the same hash");
+
+  for (tags = 0; tags < NUM_TAGS; ++tags)
+    g_free (hashes[tags]);
+  g_free (other);
+}
+
+/* A file that should get neither a duration nor a hash */
+static void
+check_nothing (const gchar *dir, const gchar *name, const GByteArray *file)
+{
+  gchar *path = write_file (dir, name, file);
+  gchar *hash = audio_hash_file (path);
+
+  if (hash != NULL)
+    fail (name, "has a hash");
+  if (audio_duration_file (path) != -1)
+    fail (name, "has a duration");
+
+  g_remove (path);
+  g_free (path);
+  g_free (hash);
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  GByteArray *file;
+  GError *err = NULL;
+  gchar *dir, *path, *hash;
+  guint f;
+
+  dir = g_dir_make_tmp ("audiohashtest-XXXXXX", &err);
+  if (dir == NULL)
+    g_error ("Could not make a directory: %s", err->message);
+
+  for (f = 0; f < G_N_ELEMENTS (formats); ++f)
+    check_format (dir, f);
+
+  /* Something we don't know is hashed whole, and has no duration */
+  file = g_byte_array_new ();
+  for (f = 0; f < 256 * 20; ++f)
+    put_le (file, f, 1);
+  path = write_file (dir, "junk.bin", file);
+  hash = audio_hash_file (path);
+  if (hash == NULL)
+    fail ("junk.bin", "no hash");
+  if (audio_duration_file (path) != -1)
+    fail ("junk.bin", "has a duration");
+  g_remove (path);
+  g_free (path);
+  g_free (hash);
+
+  /* Files with no audio: they'd all hash the same */
+  g_byte_array_set_size (file, 0);
+  check_nothing (dir, "empty", file);
+  put_id3v2 (file, tag_texts[1]);
+  check_nothing (dir, "tags.mp3", file);
+
+  /* That goes for a FLAC file with no frames, though it says how long
+   * it plays */
+  g_byte_array_set_size (file, 0);
+  put (file, "fLaC", 4);
+  put_streaminfo (file, TRUE);
+  path = write_file (dir, "noframes.flac", file);
+  hash = audio_hash_file (path);
+  if (hash != NULL)
+    fail ("noframes.flac", "has a hash");
+  g_remove (path);
+  g_free (path);
+  g_free (hash);
+  g_byte_array_free (file, TRUE);
+
+  /* Nor does a file that isn't there */
+  path = g_build_filename (dir, "missing", NULL);
+  if (audio_hash_file (path) != NULL  ||  audio_duration_file (path) != -1)
+    fail ("missing", "has a hash or a duration");
+  g_free (path);
+
+  g_rmdir (dir);
+  g_free (dir);
+
+  g_print ("%d failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
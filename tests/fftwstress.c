@@ -0,0 +1,299 @@
+/***************************************************************************
+                        fftwstress.c  -  description
+                           -------------------
+  Run dozens of fftwspectrum ! fftwunspectrum chains at once
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* FFTW's planner isn't thread-safe, so everything but executing a
+ * plan goes through the plugin-wide lock in spectrumplan.c.  This
+ * test takes the elements through their state changes, and so through
+ * planning, allocation and plan release, from many threads at once,
+ * starting with nothing in the plan cache, so the threads plan every
+ * size themselves.  Only then is each size run on its own, and every
+ * chain has to have put out what that run does.
+ *
+ *   fftwstress PLUGIN
+ *
+ * where PLUGIN is the built plugin library.  Only GStreamer core is
+ * needed: the chains are fed and drained through pads of our own.
+ */
+
+#include <gst/gst.h>
+#include <string.h>
+#include <math.h>
+
+#define NUM_THREADS   32
+#define NUM_ROUNDS    8
+#define RATE          44100
+#define NUM_SAMPLES   (RATE / 2)
+#define CHUNK_SAMPLES 1000
+
+/* Sizes that are and aren't powers of two, batched and not */
+static const struct
+{
+  gint size, step, frames;
+} configs[] =
+  {
+    { 256, 128, 1 },
+    { 512, 256, 4 },
+    { 1024, 512, 8 },
+    { 2048, 1024, 1 },
+    { 480, 240, 4 },
+    { 1000, 500, 2 },
+    { 1536, 384, 16 },
+    { 4096, 2048, 4 }
+  };
+
+#define NUM_CONFIGS G_N_ELEMENTS (configs)
+
+static gfloat samples[NUM_SAMPLES];
+
+/* Every config's output when run alone */
+static GByteArray *reference[NUM_CONFIGS];
+
+/* What each thread's chains put out, pass by pass */
+static GByteArray *outputs[NUM_THREADS][NUM_ROUNDS];
+
+static gint failures = 0;
+
+
+static GstFlowReturn
+collect_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
+{
+  GByteArray *out = (GByteArray *) gst_pad_get_element_private (pad);
+  GstMapInfo info;
+
+  gst_buffer_map (buf, &info, GST_MAP_READ);
+  g_byte_array_append (out, info.data, info.size);
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+collect_event (GstPad *pad, GstObject *parent, GstEvent *event)
+{
+  gst_event_unref (event);
+  return TRUE;
+}
+
+
+static GstElement *
+make_element (const gchar *factory, gint config)
+{
+  GstElement *element = gst_element_factory_make (factory, NULL);
+
+  if (element == NULL)
+    g_error ("Could not make a %s", factory);
+
+  /* Plan quickly, and keep the user's wisdom out of it */
+  g_object_set (G_OBJECT (element), "hiquality", FALSE,
+		"wisdom-file", "", NULL);
+  if (strcmp (factory, "fftwspectrum") == 0)
+    g_object_set (G_OBJECT (element), "def-size", configs[config].size,
+		  "def-step", configs[config].step,
+		  "def-frames", configs[config].frames, NULL);
+
+  return element;
+}
+
+/* Push the samples through a new fftwspectrum ! fftwunspectrum chain,
+ * and return what comes out */
+static GByteArray *
+run_chain (gint config)
+{
+  GstElement *spectrum, *unspectrum;
+  GstPad *src, *sink, *pad;
+  GstSegment segment;
+  GstCaps *caps;
+  GByteArray *out = g_byte_array_new ();
+  GstFlowReturn res = GST_FLOW_OK;
+  gint i;
+
+  spectrum = make_element ("fftwspectrum", config);
+  unspectrum = make_element ("fftwunspectrum", config);
+  gst_object_ref_sink (spectrum);
+  gst_object_ref_sink (unspectrum);
+  if (!gst_element_link (spectrum, unspectrum))
+    g_error ("Could not link fftwspectrum to fftwunspectrum");
+
+  src = gst_pad_new ("src", GST_PAD_SRC);
+  pad = gst_element_get_static_pad (spectrum, "sink");
+  gst_pad_link (src, pad);
+  gst_object_unref (pad);
+
+  sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_element_private (sink, out);
+  gst_pad_set_chain_function (sink, collect_chain);
+  gst_pad_set_event_function (sink, collect_event);
+  pad = gst_element_get_static_pad (unspectrum, "src");
+  gst_pad_link (pad, sink);
+  gst_object_unref (pad);
+
+  gst_pad_set_active (src, TRUE);
+  gst_pad_set_active (sink, TRUE);
+  gst_element_set_state (unspectrum, GST_STATE_PLAYING);
+  gst_element_set_state (spectrum, GST_STATE_PLAYING);
+
+  gst_pad_push_event (src, gst_event_new_stream_start ("fftwstress"));
+  caps = gst_caps_new_simple ("audio/x-raw",
+			      "format", G_TYPE_STRING, "F32LE",
+			      "rate", G_TYPE_INT, RATE,
+			      "channels", G_TYPE_INT, 1, NULL);
+  gst_pad_push_event (src, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (src, gst_event_new_segment (&segment));
+
+  for (i = 0; i < NUM_SAMPLES  &&  res == GST_FLOW_OK; i += CHUNK_SAMPLES)
+    {
+      gsize n = MIN (CHUNK_SAMPLES, NUM_SAMPLES - i) * sizeof (gfloat);
+      GstBuffer *buf = gst_buffer_new_allocate (NULL, n, NULL);
+
+      gst_buffer_fill (buf, 0, &samples[i], n);
+      res = gst_pad_push (src, buf);
+    }
+  gst_pad_push_event (src, gst_event_new_eos ());
+
+  if (res != GST_FLOW_OK)
+    {
+      g_printerr ("Size %d: pushing failed: %s\n", configs[config].size,
+		  gst_flow_get_name (res));
+      g_atomic_int_inc (&failures);
+    }
+
+  gst_element_set_state (spectrum, GST_STATE_NULL);
+  gst_element_set_state (unspectrum, GST_STATE_NULL);
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+  gst_object_unref (spectrum);
+  gst_object_unref (unspectrum);
+
+  return out;
+}
+
+
+/* Whether out is what config puts out on its own.  The plans are
+ * shared, so it should be exactly that, but leave FFTW some room. */
+static gboolean
+check_output (gint config, const GByteArray *out)
+{
+  const GByteArray *ref = reference[config];
+  const gfloat *a = (const gfloat *) ref->data;
+  const gfloat *b = (const gfloat *) out->data;
+  guint i;
+
+  if (out->len != ref->len)
+    {
+      g_printerr ("Size %d: %u bytes out, %u alone\n",
+		  configs[config].size, out->len, ref->len);
+      return FALSE;
+    }
+
+  for (i = 0; i < ref->len / sizeof (gfloat); ++i)
+    if (fabsf (a[i] - b[i]) > 1e-4f * (1.f + fabsf (a[i])))
+      {
+	g_printerr ("Size %d: sample %u is %g, %g alone\n",
+		    configs[config].size, i, b[i], a[i]);
+	return FALSE;
+      }
+
+  return TRUE;
+}
+
+/* The config a thread runs on a pass; in the first pass, every size
+ * is planned by several threads at once */
+static gint
+thread_config (gint thread, gint pass)
+{
+  return (thread + pass) % NUM_CONFIGS;
+}
+
+static gpointer
+stress_thread (gpointer data)
+{
+  gint thread = GPOINTER_TO_INT (data), pass;
+
+  for (pass = 0; pass < NUM_ROUNDS; ++pass)
+    outputs[thread][pass] = run_chain (thread_config (thread, pass));
+
+  return NULL;
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  GThread *threads[NUM_THREADS];
+  GstPlugin *plugin;
+  GError *err = NULL;
+  gint64 start, elapsed;
+  guint i, pass;
+
+  gst_init (&argc, &argv);
+
+  if (argc != 2)
+    {
+      g_printerr ("Usage: fftwstress PLUGIN\n");
+      return 2;
+    }
+
+  plugin = gst_plugin_load_file (argv[1], &err);
+  if (plugin == NULL)
+    {
+      g_printerr ("Could not load %s: %s\n", argv[1], err->message);
+      return 1;
+    }
+  gst_object_unref (plugin);
+
+  for (i = 0; i < NUM_SAMPLES; ++i)
+    samples[i] = 0.5f * sinf (i * 0.031f) + 0.25f * sinf (i * 0.47f)
+      + 0.125f * sinf (i * 1.9f);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < NUM_THREADS; ++i)
+    threads[i] = g_thread_new ("stress", stress_thread, GINT_TO_POINTER (i));
+  for (i = 0; i < NUM_THREADS; ++i)
+    g_thread_join (threads[i]);
+  elapsed = g_get_monotonic_time () - start;
+
+  for (i = 0; i < NUM_CONFIGS; ++i)
+    {
+      reference[i] = run_chain (i);
+      if (reference[i]->len == 0)
+	{
+	  g_printerr ("Size %d: no output\n", configs[i].size);
+	  return 1;
+	}
+    }
+
+  for (i = 0; i < NUM_THREADS; ++i)
+    for (pass = 0; pass < NUM_ROUNDS; ++pass)
+      {
+	if (!check_output (thread_config (i, pass), outputs[i][pass]))
+	  g_atomic_int_inc (&failures);
+	g_byte_array_free (outputs[i][pass], TRUE);
+      }
+
+  g_print ("%d chains on %d threads in %.2f s, %d failed\n",
+	   NUM_THREADS * NUM_ROUNDS, NUM_THREADS,
+	   elapsed / 1e6,
+	   g_atomic_int_get (&failures));
+
+  for (i = 0; i < NUM_CONFIGS; ++i)
+    g_byte_array_free (reference[i], TRUE);
+
+  return g_atomic_int_get (&failures) == 0 ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+/***************************************************************************
+                        normalizetest.c  -  description
+                           -------------------
+  Check the two-pass moodbar normalization against the five-pass one
+***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* gst_moodbar_normalize takes the outer averages of each channel from
+ * bins, where Exscalibar's normalization (which moodbar used to run,
+ * five passes over each channel) takes them exactly; see
+ * moodbarrender.c.  This draws synthetic tracks both ways, with box
+ * resampling like the old code, in every kernel variant the CPU runs,
+ * and checks that no pixel differs by more than MAX_DIFF and that at
+ * most MAX_DIFF_SHARE of them differ at all.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+#include <math.h>
+
+#include "moodbarrender.h"
+#include "spectrumkernels.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_spectrum_kernels_debug);
+
+#define MAX_DIFF       1
+#define MAX_DIFF_SHARE 0.002
+
+/* Number of frames and image width of each track; a width of 0 means
+ * one column per frame, as the element draws short tracks */
+static const struct
+{
+  guint numframes, width;
+} tracks[] =
+  {
+    { 2000, 0 },
+    { 30000, 1000 },
+    { 100000, 2000 },
+    { 300000, 1000 }
+  };
+
+static const gchar *variants[] = { "c", "sse4.1", "avx2", "avx512" };
+
+
+/* Exscalibar's normalise.cpp, as moodbar had it: map the nvals values
+ * at vals, one channel, to [0, 1] in place */
+static void
+normalize_five_pass (gfloat *vals, guint numvals)
+{
+  gfloat mini, maxi, tu = 0.f, tb = 0.f;
+  gfloat avgu = 0.f, avgb = 0.f, delta, avg = 0.f;
+  gfloat avguu = 0.f, avgbb = 0.f, x;
+  guint i, z = 0;
+
+  do
+    mini = maxi = vals[0] = vals[z];
+  while (isnan (vals[z++])  &&  z < numvals);
+
+  for (i = 1; i < numvals; i++)
+    {
+      if (vals[i] > maxi)
+	maxi = vals[i];
+      else if (vals[i] < mini)
+	mini = vals[i];
+    }
+
+  for (i = 0; i < numvals; i++)
+    if (vals[i] != mini  &&  vals[i] != maxi)
+      avg += vals[i] / ((gfloat) numvals);
+
+  for (i = 0; i < numvals; i++)
+    if (vals[i] != mini  &&  vals[i] != maxi)
+      {
+	if (vals[i] > avg)
+	  {
+	    avgu += vals[i];
+	    tu++;
+	  }
+	else
+	  {
+	    avgb += vals[i];
+	    tb++;
+	  }
+      }
+
+  avgu /= tu;
+  avgb /= tb;
+
+  tu = 0.f;
+  tb = 0.f;
+  for (i = 0; i < numvals; i++)
+    if (vals[i] != mini  &&  vals[i] != maxi)
+      {
+	if (vals[i] > avgu)
+	  {
+	    avguu += vals[i];
+	    tu++;
+	  }
+	else if (vals[i] < avgb)
+	  {
+	    avgbb += vals[i];
+	    tb++;
+	  }
+      }
+
+  avguu /= tu;
+  avgbb /= tb;
+
+  mini = MAX (avg + (avgb - avg) * 2.f, avgbb);
+  maxi = MIN (avg + (avgu - avg) * 2.f, avguu);
+  delta = maxi - mini;
+  if (delta == 0.f)
+    delta = 1.f;
+
+  for (i = 0; i < numvals; i++)
+    {
+      x = CLAMP ((vals[i] - mini) / delta, 0.f, 1.f);
+      vals[i] = vals[i] - vals[i] == 0.f ? x : 0.f;
+    }
+}
+
+/* The old column averaging: column i averages frames edges[i] up to
+ * edges[i+1] - 1 */
+static void
+render_five_pass (gfloat **channels, guint numframes, guint width,
+		  guchar *row)
+{
+  guint i, c, f, from, to;
+  gfloat sum;
+
+  for (i = 0; i < width; ++i)
+    {
+      from = (guint64) i * numframes / width;
+      to = (guint64) (i + 1) * numframes / width;
+      for (c = 0; c < 3; ++c)
+	{
+	  sum = 0.f;
+	  for (f = from; f < to; ++f)
+	    sum += channels[c][f];
+	  *(row++) = (guchar) (sum * 255.f / ((gfloat) (to - from)));
+	}
+    }
+}
+
+
+/* Something like the r, g and b of music: skewed positive energies
+ * that drift over the track, with loud and quiet passages.  Frame 0
+ * is left 0, as the element leaves it. */
+static void
+make_track (gfloat *rgbx, guint numframes, guint32 seed)
+{
+  GRand *rand = g_rand_new_with_seed (seed);
+  guint i, c;
+
+  memset (rgbx, 0, GST_MOODBAR_FRAME_FLOATS * sizeof (gfloat));
+  for (i = 1; i < numframes; ++i)
+    for (c = 0; c < GST_MOODBAR_FRAME_FLOATS; ++c)
+      {
+	gdouble level = 1. + 0.5 * sin (i * (0.0003 + 0.0001 * c) + c)
+	  + 0.3 * sin (i * 0.01);
+
+	rgbx[GST_MOODBAR_FRAME_FLOATS * i + c] = c == 3 ? 0.f
+	  : (gfloat) (level * (c + 1)
+		      * -log (g_rand_double_range (rand, 1e-9, 1.)));
+      }
+
+  g_rand_free (rand);
+}
+
+/* Draw one track both ways and compare; returns whether they agree */
+static gboolean
+check_track (guint numframes, guint width, guint32 seed)
+{
+  gfloat *rgbx = g_new (gfloat, GST_MOODBAR_FRAME_FLOATS * numframes);
+  gfloat *channels[3];
+  guchar *expected, *row;
+  GstMoodbarNormalization norm;
+  guint i, c, maxdiff = 0, ndiff = 0, diff;
+
+  if (width == 0)
+    width = numframes - 1;
+  expected = g_new (guchar, 3 * width);
+  row = g_new (guchar, 3 * width);
+
+  make_track (rgbx, numframes, seed);
+
+  for (c = 0; c < 3; ++c)
+    {
+      channels[c] = g_new (gfloat, numframes);
+      for (i = 0; i < numframes; ++i)
+	channels[c][i] = rgbx[GST_MOODBAR_FRAME_FLOATS * i + c];
+      normalize_five_pass (channels[c], numframes);
+    }
+  render_five_pass (channels, numframes, width, expected);
+
+  gst_moodbar_normalize (rgbx, numframes, &norm);
+  gst_moodbar_render_row (rgbx, numframes, &norm, GST_MOODBAR_RESAMPLE_BOX,
+			  width, row);
+
+  for (i = 0; i < 3 * width; ++i)
+    {
+      diff = ABS ((gint) row[i] - (gint) expected[i]);
+      maxdiff = MAX (maxdiff, diff);
+      if (diff > 0)
+	++ndiff;
+    }
+
+  g_print ("%-7s %8u frames, %5u columns: %5u pixels differ, "
+	   "by at most %u\n", gst_spectrum_kernels_name (), numframes,
+	   width, ndiff, maxdiff);
+
+  for (c = 0; c < 3; ++c)
+    g_free (channels[c]);
+  g_free (rgbx);
+  g_free (expected);
+  g_free (row);
+
+  return maxdiff <= MAX_DIFF  &&  ndiff <= MAX_DIFF_SHARE * 3 * width;
+}
+
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gboolean res = TRUE;
+  guint i, t;
+
+  gst_init (&argc, &argv);
+  GST_DEBUG_CATEGORY_INIT (gst_spectrum_kernels_debug, "spectrumkernels",
+			   0, "moodbar DSP kernels");
+
+  for (i = 0; i < G_N_ELEMENTS (variants); ++i)
+    {
+      g_setenv (GST_SPECTRUM_KERNELS_ENV, variants[i], TRUE);
+      gst_spectrum_kernels_init ();
+      if (strcmp (gst_spectrum_kernels_name (), variants[i]) != 0)
+	continue;
+
+      for (t = 0; t < G_N_ELEMENTS (tracks); ++t)
+	if (!check_track (tracks[t].numframes, tracks[t].width, t + 1))
+	  res = FALSE;
+    }
+
+  g_unsetenv (GST_SPECTRUM_KERNELS_ENV);
+
+  return res ? 0 : 1;
+}